@@ -0,0 +1,38 @@
+#ifndef DATA_PARSE_BENCHMARK_H
+#define DATA_PARSE_BENCHMARK_H
+
+#include <stdint.h>
+
+// --- Benchmark Settings ---
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 50 // Encodes / decodes averaged per table row
+#endif
+#ifndef BENCH_BUFFER_SIZE
+#define BENCH_BUFFER_SIZE 32768 // Encoded payload buffer; the largest report is ~20 KB as JSON
+#endif
+
+// --- Platform ---
+// The same benchmark runs on the ESP32 envs and in the native env.
+#ifdef ARDUINO
+#include <Arduino.h>
+#define BENCH_PLATFORM "esp32 (" CONFIG_IDF_TARGET ")"
+#define benchPrintf(...) Serial.printf(__VA_ARGS__)
+inline uint32_t benchMicros() { return micros(); }
+#else
+#include <chrono>
+#include <stdio.h>
+#define BENCH_PLATFORM "native"
+#define benchPrintf(...) printf(__VA_ARGS__)
+inline uint32_t benchMicros()
+{
+  using namespace std::chrono;
+  return (uint32_t)duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+// Encodes and decodes every payload size with every codec and prints one
+// table row each: encoded size, mean encode / decode time and the peak
+// ArduinoJson heap. Returns false if any round trip lost data.
+bool runBenchmarks();
+
+#endif // DATA_PARSE_BENCHMARK_H
@@ -0,0 +1,32 @@
+#ifndef DATA_PARSE_CODECS_H
+#define DATA_PARSE_CODECS_H
+
+#include "Payloads.h"
+
+// --- Codec Settings ---
+#ifndef BENCH_TIMES_AS_STRINGS
+#define BENCH_TIMES_AS_STRINGS 1 // Text formats carry offsets as strings, like the app does today
+#endif
+
+// One wire format for all three payloads.
+//
+// encode() returns the encoded size, or 0 if out is too small or the
+// document ran out of memory. decode() fills out and returns false on
+// malformed input. The ArduinoJson codecs allocate through benchAllocator.
+//
+// "json" and "msgpack" build the same ArduinoJson document, so they differ
+// only in the format. "binary" is a fixed schema, little endian:
+//   upload  medCount u8, per med: idLen u8, id, timeCount u16, timeCount * offset u32
+//   report  receiveTime u32, then as upload with a state u8 after each offset
+//   status  the firmware's 17-byte DeviceStatus record
+struct Codec
+{
+  const char *name;
+  size_t (*encode)(PayloadKind kind, const Payload &in, uint8_t *out, size_t capacity);
+  bool (*decode)(PayloadKind kind, const uint8_t *in, size_t len, Payload &out);
+};
+
+extern const Codec codecs[];
+extern const size_t codecCount;
+
+#endif // DATA_PARSE_CODECS_H
@@ -0,0 +1,34 @@
+#ifndef DATA_PARSE_COUNTING_ALLOCATOR_H
+#define DATA_PARSE_COUNTING_ALLOCATOR_H
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+
+// ArduinoJson allocator that tracks the bytes it holds and their peak.
+//
+// Every JsonDocument in the benchmark allocates through benchAllocator, so
+// its peak is exactly the heap a codec needed, on the ESP32 and natively
+// alike. Blocks carry a small header with their size; it is not counted.
+class CountingAllocator : public ArduinoJson::Allocator
+{
+public:
+  void *allocate(size_t size) override;
+  void deallocate(void *ptr) override;
+  void *reallocate(void *ptr, size_t newSize) override;
+
+  // Starts a new measurement from what is held right now
+  void resetPeak() { _peak = _current; }
+
+  size_t current() const { return _current; }
+  size_t peak() const { return _peak; }
+  size_t allocations() const { return _allocations; }
+
+private:
+  size_t _current = 0;
+  size_t _peak = 0;
+  size_t _allocations = 0;
+};
+
+extern CountingAllocator benchAllocator;
+
+#endif // DATA_PARSE_COUNTING_ALLOCATOR_H
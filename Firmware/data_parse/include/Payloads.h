@@ -0,0 +1,76 @@
+#ifndef DATA_PARSE_PAYLOADS_H
+#define DATA_PARSE_PAYLOADS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Payload Limits ---
+#define BENCH_MAX_MEDS 8
+#define BENCH_MAX_TIMES 64  // Per med
+#define BENCH_MED_ID_LEN 24 // Including the terminator, as in the firmware's ScheduleStore
+
+// Same values as the firmware's SlotState
+#define RESPONSE_MISSED 0
+#define RESPONSE_TAKEN 1
+#define RESPONSE_PENDING 0xFF
+
+// The three payloads the device exchanges with the app:
+//   PAYLOAD_UPLOAD  schedule sent to the device:   [{"med_id":"x","times":["3600",...]},...]
+//   PAYLOAD_REPORT  schedule with responses back:  {"schedule":[{"med_id":"x","times":
+//                   [{"time":"3600","responded":true|false|null},...]},...],"originalReceiveTime":N}
+//   PAYLOAD_STATUS  the 17-byte status record, as a flat object in the text formats
+enum PayloadKind : uint8_t
+{
+  PAYLOAD_UPLOAD,
+  PAYLOAD_REPORT,
+  PAYLOAD_STATUS,
+};
+
+struct Med
+{
+  char id[BENCH_MED_ID_LEN];
+  uint16_t timeCount;
+  uint32_t times[BENCH_MAX_TIMES]; // Offsets in seconds from the receive time
+  uint8_t states[BENCH_MAX_TIMES]; // RESPONSE_*, report only
+};
+
+struct Schedule
+{
+  uint32_t receiveTime; // Report only
+  uint8_t medCount;
+  Med meds[BENCH_MAX_MEDS];
+};
+
+struct Status
+{
+  uint8_t version;
+  uint8_t state;
+  uint8_t flags;
+  uint8_t battery;
+  uint16_t pending;
+  uint32_t nextDue;
+  uint16_t lastSlot;
+  uint8_t lastState;
+  uint32_t lastAge;
+};
+
+// What a codec encodes from and decodes into; kind selects the member used
+struct Payload
+{
+  Schedule schedule;
+  Status status;
+};
+
+// Fills out with a realistic schedule: a few doses a day spread over as
+// many days as timesPerMed needs, the first third answered (mostly taken).
+void makeSchedule(Payload &out, uint8_t meds, uint16_t timesPerMed);
+
+// Fills out with a status record for a device midway through a schedule
+void makeStatus(Payload &out);
+
+// True if a and b carry the same kind payload
+bool payloadsEqual(PayloadKind kind, const Payload &a, const Payload &b);
+
+const char *payloadName(PayloadKind kind);
+
+#endif // DATA_PARSE_PAYLOADS_H
@@ -0,0 +1,104 @@
+#include "Benchmark.h"
+#include "Codecs.h"
+#include "CountingAllocator.h"
+#include "Payloads.h"
+
+#include <initializer_list>
+#include <stdio.h>
+
+// Schedules of increasing size: meds x times per med
+struct ScheduleSize
+{
+  uint8_t meds;
+  uint16_t timesPerMed;
+};
+
+static const ScheduleSize scheduleSizes[] = {
+    {1, 4}, {2, 14}, {4, 28}, {6, 42}, {8, 64},
+};
+
+// Large enough that they belong in static storage, not on the loop stack
+static Payload source;
+static Payload decoded;
+static uint8_t buffer[BENCH_BUFFER_SIZE];
+
+struct Result
+{
+  size_t bytes;
+  float encodeUs;
+  float decodeUs;
+  size_t encodeHeap;
+  size_t decodeHeap;
+  bool ok;
+};
+
+static Result measure(const Codec &codec, PayloadKind kind)
+{
+  Result result = {};
+
+  benchAllocator.resetPeak();
+  size_t baseline = benchAllocator.current();
+  uint32_t start = benchMicros();
+  for (int i = 0; i < BENCH_ITERATIONS; ++i)
+  {
+    result.bytes = codec.encode(kind, source, buffer, sizeof(buffer));
+  }
+  result.encodeUs = (float)(benchMicros() - start) / BENCH_ITERATIONS;
+  result.encodeHeap = benchAllocator.peak() - baseline;
+  if (result.bytes == 0)
+  {
+    return result;
+  }
+
+  benchAllocator.resetPeak();
+  bool decodedOk = true;
+  start = benchMicros();
+  for (int i = 0; i < BENCH_ITERATIONS; ++i)
+  {
+    decodedOk = codec.decode(kind, buffer, result.bytes, decoded) && decodedOk;
+  }
+  result.decodeUs = (float)(benchMicros() - start) / BENCH_ITERATIONS;
+  result.decodeHeap = benchAllocator.peak() - baseline;
+  result.ok = decodedOk && payloadsEqual(kind, source, decoded);
+  return result;
+}
+
+static bool benchAllCodecs(PayloadKind kind, const char *label, size_t slots)
+{
+  bool allOk = true;
+  for (size_t c = 0; c < codecCount; ++c)
+  {
+    Result r = measure(codecs[c], kind);
+    benchPrintf("%-6s %-8s %5u %-8s %7u %10.1f %10.1f %9u %9u  %s\n", payloadName(kind), label, (unsigned)slots,
+                codecs[c].name, (unsigned)r.bytes, r.encodeUs, r.decodeUs, (unsigned)r.encodeHeap,
+                (unsigned)r.decodeHeap, r.ok ? "ok" : "FAIL");
+    allOk = allOk && r.ok;
+  }
+  return allOk;
+}
+
+bool runBenchmarks()
+{
+  benchPrintf("\n--- Codec benchmark: %s, %d iterations, times as %s ---\n", BENCH_PLATFORM, BENCH_ITERATIONS,
+              BENCH_TIMES_AS_STRINGS ? "strings" : "numbers");
+  benchPrintf("%-6s %-8s %5s %-8s %7s %10s %10s %9s %9s  %s\n", "kind", "size", "slots", "codec", "bytes",
+              "enc_us", "dec_us", "enc_heap", "dec_heap", "check");
+
+  bool allOk = true;
+  for (PayloadKind kind : {PAYLOAD_UPLOAD, PAYLOAD_REPORT})
+  {
+    for (const ScheduleSize &size : scheduleSizes)
+    {
+      char label[12];
+      snprintf(label, sizeof(label), "%ux%u", size.meds, size.timesPerMed);
+      makeSchedule(source, size.meds, size.timesPerMed);
+      allOk = benchAllCodecs(kind, label, (size_t)size.meds * size.timesPerMed) && allOk;
+    }
+  }
+  makeStatus(source);
+  allOk = benchAllCodecs(PAYLOAD_STATUS, "record", 0) && allOk;
+
+  benchPrintf("--- %s: %u ArduinoJson allocations ---\n", allOk ? "All round trips ok" : "Round trip FAILED",
+              (unsigned)benchAllocator.allocations());
+  return allOk;
+}
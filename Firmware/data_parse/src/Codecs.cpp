@@ -0,0 +1,335 @@
+#include "Codecs.h"
+#include "CountingAllocator.h"
+
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --- ArduinoJson document <-> payload ---
+
+static void addTime(JsonVariant slot, uint32_t offset)
+{
+#if BENCH_TIMES_AS_STRINGS
+  char text[11];
+  snprintf(text, sizeof(text), "%lu", (unsigned long)offset);
+  slot.set(text);
+#else
+  slot.set(offset);
+#endif
+}
+
+static uint32_t readTime(JsonVariant value)
+{
+  if (value.is<const char *>())
+  {
+    return strtoul(value.as<const char *>(), nullptr, 10);
+  }
+  return value.as<uint32_t>();
+}
+
+static void buildMeds(JsonArray meds, const Schedule &schedule, bool report)
+{
+  for (uint8_t m = 0; m < schedule.medCount; ++m)
+  {
+    const Med &med = schedule.meds[m];
+    JsonObject entry = meds.add<JsonObject>();
+    entry["med_id"] = med.id;
+    JsonArray times = entry["times"].to<JsonArray>();
+    for (uint16_t t = 0; t < med.timeCount; ++t)
+    {
+      if (!report)
+      {
+        addTime(times.add<JsonVariant>(), med.times[t]);
+        continue;
+      }
+      JsonObject slot = times.add<JsonObject>();
+      addTime(slot["time"], med.times[t]);
+      if (med.states[t] == RESPONSE_PENDING)
+      {
+        slot["responded"] = nullptr;
+      }
+      else
+      {
+        slot["responded"] = med.states[t] == RESPONSE_TAKEN;
+      }
+    }
+  }
+}
+
+static void buildDocument(JsonDocument &doc, PayloadKind kind, const Payload &in)
+{
+  if (kind == PAYLOAD_UPLOAD)
+  {
+    buildMeds(doc.to<JsonArray>(), in.schedule, false);
+  }
+  else if (kind == PAYLOAD_REPORT)
+  {
+    buildMeds(doc["schedule"].to<JsonArray>(), in.schedule, true);
+    doc["originalReceiveTime"] = in.schedule.receiveTime;
+  }
+  else
+  {
+    const Status &status = in.status;
+    doc["version"] = status.version;
+    doc["state"] = status.state;
+    doc["flags"] = status.flags;
+    doc["battery"] = status.battery;
+    doc["pending"] = status.pending;
+    doc["next_due"] = status.nextDue;
+    doc["last_slot"] = status.lastSlot;
+    doc["last_state"] = status.lastState;
+    doc["last_age"] = status.lastAge;
+  }
+}
+
+static bool readMeds(JsonArray meds, Schedule &schedule, bool report)
+{
+  schedule.medCount = 0;
+  for (JsonObject entry : meds)
+  {
+    if (schedule.medCount == BENCH_MAX_MEDS)
+    {
+      return false;
+    }
+    Med &med = schedule.meds[schedule.medCount++];
+    strncpy(med.id, entry["med_id"] | "", BENCH_MED_ID_LEN - 1);
+    med.id[BENCH_MED_ID_LEN - 1] = '\0';
+    med.timeCount = 0;
+    for (JsonVariant slot : entry["times"].as<JsonArray>())
+    {
+      if (med.timeCount == BENCH_MAX_TIMES)
+      {
+        return false;
+      }
+      if (report)
+      {
+        JsonVariant responded = slot["responded"];
+        med.times[med.timeCount] = readTime(slot["time"]);
+        med.states[med.timeCount] = responded.isNull() ? RESPONSE_PENDING
+                                    : responded.as<bool>() ? RESPONSE_TAKEN
+                                                           : RESPONSE_MISSED;
+      }
+      else
+      {
+        med.times[med.timeCount] = readTime(slot);
+      }
+      med.timeCount++;
+    }
+  }
+  return true;
+}
+
+static bool readDocument(JsonDocument &doc, PayloadKind kind, Payload &out)
+{
+  if (kind == PAYLOAD_UPLOAD)
+  {
+    return doc.is<JsonArray>() && readMeds(doc.as<JsonArray>(), out.schedule, false);
+  }
+  if (kind == PAYLOAD_REPORT)
+  {
+    out.schedule.receiveTime = doc["originalReceiveTime"] | 0UL;
+    return doc["schedule"].is<JsonArray>() && readMeds(doc["schedule"].as<JsonArray>(), out.schedule, true);
+  }
+  Status &status = out.status;
+  status.version = doc["version"] | 0;
+  status.state = doc["state"] | 0;
+  status.flags = doc["flags"] | 0;
+  status.battery = doc["battery"] | 0;
+  status.pending = doc["pending"] | 0;
+  status.nextDue = doc["next_due"] | 0UL;
+  status.lastSlot = doc["last_slot"] | 0;
+  status.lastState = doc["last_state"] | 0;
+  status.lastAge = doc["last_age"] | 0UL;
+  return true;
+}
+
+// --- JSON ---
+
+static size_t encodeJson(PayloadKind kind, const Payload &in, uint8_t *out, size_t capacity)
+{
+  JsonDocument doc(&benchAllocator);
+  buildDocument(doc, kind, in);
+  if (doc.overflowed())
+  {
+    return 0;
+  }
+  size_t length = serializeJson(doc, (char *)out, capacity);
+  return length < capacity ? length : 0; // A full buffer means truncated output
+}
+
+static bool decodeJson(PayloadKind kind, const uint8_t *in, size_t len, Payload &out)
+{
+  JsonDocument doc(&benchAllocator);
+  return !deserializeJson(doc, (const char *)in, len) && readDocument(doc, kind, out);
+}
+
+// --- MessagePack ---
+
+static size_t encodeMsgPack(PayloadKind kind, const Payload &in, uint8_t *out, size_t capacity)
+{
+  JsonDocument doc(&benchAllocator);
+  buildDocument(doc, kind, in);
+  if (doc.overflowed())
+  {
+    return 0;
+  }
+  size_t length = serializeMsgPack(doc, out, capacity);
+  return length < capacity ? length : 0;
+}
+
+static bool decodeMsgPack(PayloadKind kind, const uint8_t *in, size_t len, Payload &out)
+{
+  JsonDocument doc(&benchAllocator);
+  return !deserializeMsgPack(doc, in, len) && readDocument(doc, kind, out);
+}
+
+// --- Fixed binary schema ---
+
+struct Writer
+{
+  uint8_t *out;
+  size_t capacity;
+  size_t length;
+
+  bool put(const void *data, size_t n)
+  {
+    if (length + n > capacity)
+    {
+      return false;
+    }
+    memcpy(out + length, data, n);
+    length += n;
+    return true;
+  }
+  bool u8(uint8_t v) { return put(&v, 1); }
+  bool u16(uint16_t v)
+  {
+    uint8_t b[2] = {(uint8_t)v, (uint8_t)(v >> 8)};
+    return put(b, 2);
+  }
+  bool u32(uint32_t v)
+  {
+    uint8_t b[4] = {(uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24)};
+    return put(b, 4);
+  }
+};
+
+struct Reader
+{
+  const uint8_t *in;
+  size_t len;
+  size_t pos;
+
+  bool get(void *data, size_t n)
+  {
+    if (pos + n > len)
+    {
+      return false;
+    }
+    memcpy(data, in + pos, n);
+    pos += n;
+    return true;
+  }
+  bool u8(uint8_t &v) { return get(&v, 1); }
+  bool u16(uint16_t &v)
+  {
+    uint8_t b[2];
+    if (!get(b, 2))
+    {
+      return false;
+    }
+    v = b[0] | (b[1] << 8);
+    return true;
+  }
+  bool u32(uint32_t &v)
+  {
+    uint8_t b[4];
+    if (!get(b, 4))
+    {
+      return false;
+    }
+    v = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+  }
+};
+
+static size_t encodeBinary(PayloadKind kind, const Payload &in, uint8_t *out, size_t capacity)
+{
+  Writer w = {out, capacity, 0};
+  bool ok = true;
+  if (kind == PAYLOAD_STATUS)
+  {
+    const Status &s = in.status;
+    ok = w.u8(s.version) && w.u8(s.state) && w.u8(s.flags) && w.u8(s.battery) && w.u16(s.pending) &&
+         w.u32(s.nextDue) && w.u16(s.lastSlot) && w.u8(s.lastState) && w.u32(s.lastAge);
+    return ok ? w.length : 0;
+  }
+
+  const Schedule &schedule = in.schedule;
+  if (kind == PAYLOAD_REPORT)
+  {
+    ok = w.u32(schedule.receiveTime);
+  }
+  ok = ok && w.u8(schedule.medCount);
+  for (uint8_t m = 0; ok && m < schedule.medCount; ++m)
+  {
+    const Med &med = schedule.meds[m];
+    uint8_t idLength = strlen(med.id);
+    ok = w.u8(idLength) && w.put(med.id, idLength) && w.u16(med.timeCount);
+    for (uint16_t t = 0; ok && t < med.timeCount; ++t)
+    {
+      ok = w.u32(med.times[t]) && (kind != PAYLOAD_REPORT || w.u8(med.states[t]));
+    }
+  }
+  return ok ? w.length : 0;
+}
+
+static bool decodeBinary(PayloadKind kind, const uint8_t *in, size_t len, Payload &out)
+{
+  Reader r = {in, len, 0};
+  if (kind == PAYLOAD_STATUS)
+  {
+    Status &s = out.status;
+    return r.u8(s.version) && r.u8(s.state) && r.u8(s.flags) && r.u8(s.battery) && r.u16(s.pending) &&
+           r.u32(s.nextDue) && r.u16(s.lastSlot) && r.u8(s.lastState) && r.u32(s.lastAge);
+  }
+
+  Schedule &schedule = out.schedule;
+  if (kind == PAYLOAD_REPORT && !r.u32(schedule.receiveTime))
+  {
+    return false;
+  }
+  if (!r.u8(schedule.medCount) || schedule.medCount > BENCH_MAX_MEDS)
+  {
+    return false;
+  }
+  for (uint8_t m = 0; m < schedule.medCount; ++m)
+  {
+    Med &med = schedule.meds[m];
+    uint8_t idLength;
+    if (!r.u8(idLength) || idLength >= BENCH_MED_ID_LEN || !r.get(med.id, idLength) || !r.u16(med.timeCount) ||
+        med.timeCount > BENCH_MAX_TIMES)
+    {
+      return false;
+    }
+    med.id[idLength] = '\0';
+    for (uint16_t t = 0; t < med.timeCount; ++t)
+    {
+      if (!r.u32(med.times[t]) || (kind == PAYLOAD_REPORT && !r.u8(med.states[t])))
+      {
+        return false;
+      }
+    }
+  }
+  return r.pos == len;
+}
+
+// --- Table ---
+
+const Codec codecs[] = {
+    {"json", encodeJson, decodeJson},
+    {"msgpack", encodeMsgPack, decodeMsgPack},
+    {"binary", encodeBinary, decodeBinary},
+};
+const size_t codecCount = sizeof(codecs) / sizeof(codecs[0]);
@@ -0,0 +1,63 @@
+#include "CountingAllocator.h"
+
+#include <stdlib.h>
+
+CountingAllocator benchAllocator;
+
+// Keeps the block size in front of the block, padded so the block stays aligned
+union BlockHeader
+{
+  size_t size;
+  max_align_t align;
+};
+
+void *CountingAllocator::allocate(size_t size)
+{
+  BlockHeader *header = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+  if (header == nullptr)
+  {
+    return nullptr;
+  }
+  header->size = size;
+  _current += size;
+  _allocations++;
+  if (_current > _peak)
+  {
+    _peak = _current;
+  }
+  return header + 1;
+}
+
+void CountingAllocator::deallocate(void *ptr)
+{
+  if (ptr == nullptr)
+  {
+    return;
+  }
+  BlockHeader *header = (BlockHeader *)ptr - 1;
+  _current -= header->size;
+  free(header);
+}
+
+void *CountingAllocator::reallocate(void *ptr, size_t newSize)
+{
+  if (ptr == nullptr)
+  {
+    return allocate(newSize);
+  }
+  BlockHeader *header = (BlockHeader *)ptr - 1;
+  size_t oldSize = header->size;
+  BlockHeader *moved = (BlockHeader *)realloc(header, sizeof(BlockHeader) + newSize);
+  if (moved == nullptr)
+  {
+    return nullptr;
+  }
+  moved->size = newSize;
+  _current = _current - oldSize + newSize;
+  _allocations++;
+  if (_current > _peak)
+  {
+    _peak = _current;
+  }
+  return moved + 1;
+}
@@ -0,0 +1,104 @@
+#include "Payloads.h"
+
+#include <string.h>
+
+static const char *const medNames[BENCH_MAX_MEDS] = {
+    "amoxicillin-500mg", "metformin-850mg", "lisinopril-10mg", "atorvastatin-20mg",
+    "levothyroxine-50ug", "omeprazole-20mg", "amlodipine-5mg", "paracetamol-1g",
+};
+
+// Dose hours for one, two or three doses a day
+static const uint8_t doseHours[3][3] = {{9, 0, 0}, {8, 20, 0}, {8, 14, 21}};
+
+// --- Generators ---
+
+void makeSchedule(Payload &out, uint8_t meds, uint16_t timesPerMed)
+{
+  memset(&out.schedule, 0, sizeof(out.schedule));
+  Schedule &schedule = out.schedule;
+  schedule.receiveTime = 1718000000;
+  schedule.medCount = meds > BENCH_MAX_MEDS ? BENCH_MAX_MEDS : meds;
+  if (timesPerMed > BENCH_MAX_TIMES)
+  {
+    timesPerMed = BENCH_MAX_TIMES;
+  }
+
+  uint32_t seed = 12345; // Same payload on every run and platform
+  for (uint8_t m = 0; m < schedule.medCount; ++m)
+  {
+    Med &med = schedule.meds[m];
+    strncpy(med.id, medNames[m], BENCH_MED_ID_LEN - 1);
+    med.timeCount = timesPerMed;
+    uint8_t dosesPerDay = m % 3 + 1;
+    for (uint16_t t = 0; t < timesPerMed; ++t)
+    {
+      seed = seed * 1103515245 + 12345;
+      uint32_t day = t / dosesPerDay;
+      uint32_t jitter = (seed >> 16) % 900; // Up to 15 minutes, as set by a person
+      med.times[t] = day * 86400 + doseHours[dosesPerDay - 1][t % dosesPerDay] * 3600 + jitter;
+      if (t < timesPerMed / 3)
+      {
+        med.states[t] = (seed >> 8) % 5 == 0 ? RESPONSE_MISSED : RESPONSE_TAKEN;
+      }
+      else
+      {
+        med.states[t] = RESPONSE_PENDING;
+      }
+    }
+  }
+}
+
+void makeStatus(Payload &out)
+{
+  out.status = {1, 1, 0x01, 87, 42, 5400, 17, RESPONSE_TAKEN, 3125};
+}
+
+// --- Comparison ---
+
+bool payloadsEqual(PayloadKind kind, const Payload &a, const Payload &b)
+{
+  if (kind == PAYLOAD_STATUS)
+  {
+    const Status &x = a.status;
+    const Status &y = b.status;
+    return x.version == y.version && x.state == y.state && x.flags == y.flags && x.battery == y.battery &&
+           x.pending == y.pending && x.nextDue == y.nextDue && x.lastSlot == y.lastSlot &&
+           x.lastState == y.lastState && x.lastAge == y.lastAge;
+  }
+
+  const Schedule &x = a.schedule;
+  const Schedule &y = b.schedule;
+  if (x.medCount != y.medCount || (kind == PAYLOAD_REPORT && x.receiveTime != y.receiveTime))
+  {
+    return false;
+  }
+  for (uint8_t m = 0; m < x.medCount; ++m)
+  {
+    const Med &p = x.meds[m];
+    const Med &q = y.meds[m];
+    if (strcmp(p.id, q.id) != 0 || p.timeCount != q.timeCount ||
+        memcmp(p.times, q.times, p.timeCount * sizeof(p.times[0])) != 0)
+    {
+      return false;
+    }
+    if (kind == PAYLOAD_REPORT && memcmp(p.states, q.states, p.timeCount) != 0)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+const char *payloadName(PayloadKind kind)
+{
+  switch (kind)
+  {
+  case PAYLOAD_UPLOAD:
+    return "upload";
+  case PAYLOAD_REPORT:
+    return "report";
+  case PAYLOAD_STATUS:
+    return "status";
+  }
+  return "?";
+}
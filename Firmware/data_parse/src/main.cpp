@@ -1,45 +1,33 @@
-#include <Arduino.h>
-#include <ArduinoJson.h>
+// Codec benchmark: Pipli schedule and status payloads as ArduinoJson JSON,
+// ArduinoJson MessagePack and a fixed binary schema. Runs once at boot on
+// the ESP32 envs, or as a program in the native env (`make native`).
+#include "Benchmark.h"
+
+#ifdef ARDUINO
 
 void setup()
 {
   // Initialize serial port
   Serial.begin(115200);
+  delay(1000); // Give the monitor time to attach
+
+  runBenchmarks();
 
-  // Allocate the JSON document
-  JsonDocument doc;
-
-  // JSON input string.
-  const char *json = "{\"sensor\":\"gps\",\"time\":1351824120,\"data\":[48.756080,2.302038]}";
-
-  // Deserialize the JSON document
-  DeserializationError error = deserializeJson(doc, json);
-
-  // Test if parsing succeeds.
-  if (error)
-  {
-    Serial.print(F("deserializeJson() failed: "));
-    Serial.println(error.f_str());
-    return;
-  }
-
-  // Fetch values.
-  //
-  // Most of the time, you can rely on the implicit casts.
-  // In other case, you can do doc["time"].as<long>();
-  const char *sensor = doc["sensor"];
-  long time = doc["time"];
-  double latitude = doc["data"][0];
-  double longitude = doc["data"][1];
-
-  // Print values.
-  Serial.println(sensor);
-  Serial.println(time);
-  Serial.println(latitude, 6);
-  Serial.println(longitude, 6);
+  // Whole-system view next to the per-codec numbers
+  Serial.printf("Free heap %u, minimum since boot %u, largest block %u\n", (unsigned)ESP.getFreeHeap(),
+                (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
 }
 
 void loop()
 {
   // not used in this example
-}
\ No newline at end of file
+}
+
+#else
+
+int main()
+{
+  return runBenchmarks() ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DATA_STORE_STORAGE_BENCH_H
+#define DATA_STORE_STORAGE_BENCH_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include <LittleFS.h>
+
+// --- Benchmark Settings ---
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES 100 // Timed operations per table row
+#endif
+#ifndef BENCH_JOURNAL_RECORD
+#define BENCH_JOURNAL_RECORD 16 // Bytes per appended journal record
+#endif
+#ifndef BENCH_JOURNAL_MAX
+#define BENCH_JOURNAL_MAX 16384 // The journal is deleted and restarted at this size
+#endif
+#define BENCH_RING_PARTITION "bench" // Raw data partition, see partitions_bench.csv
+#define BENCH_RING_SUBTYPE 0x40
+#define BENCH_SEQUENTIAL_BYTES (2048 * 512) // The original testFileIO: 1 MB in 512-byte blocks
+
+// Flash sectors erased since boot, by anyone (LittleFS, NVS, the raw ring).
+// Counted by wrapping esp_flash_erase_region at link time (see FlashCounters.cpp).
+uint32_t flashSectorsErased();
+
+// Latency summary of one scenario
+struct BenchStats
+{
+  uint32_t ops;
+  uint32_t failures;
+  uint32_t p50Us;
+  uint32_t p90Us;
+  uint32_t p99Us;
+  uint32_t maxUs;
+  uint32_t meanUs;
+  uint32_t erases; // Flash sectors erased during the scenario
+};
+
+// Storage benchmark for the access patterns the firmware uses.
+//
+// File scenarios run against LittleFS at each fill level: a filler file takes the
+// filesystem to that share of its capacity first, since LittleFS slows
+// down and erases more as free blocks run out. Every row reports latency
+// percentiles over BENCH_SAMPLES operations and the sectors erased.
+class StorageBench
+{
+public:
+  explicit StorageBench(fs::LittleFSFS &fs) : _fs(fs) {}
+
+  void run();
+
+  // --- Scenarios (one timed operation per sample) ---
+  BenchStats fullRewrite(size_t fileSize);  // saveSchedule(): replace the whole file
+  BenchStats tinyOverwrite();               // saveMillisCounter(): 4 bytes, whole file
+  BenchStats appendJournal();               // One record appended per operation
+  BenchStats nvsPut(size_t valueSize);      // Preferences key update
+  BenchStats ringWrite(size_t recordSize);  // Raw partition ring, erasing sectors as it wraps
+  void sequential();                        // Throughput of 512-byte block writes / reads
+
+private:
+  bool fillTo(uint8_t percent);
+  void clearFill();
+  BenchStats summarize(uint32_t failures, uint32_t erasesBefore);
+  void printRow(const char *scenario, size_t size, int fill, const BenchStats &stats);
+
+  fs::LittleFSFS &_fs;
+  uint32_t _samples[BENCH_SAMPLES];
+  uint32_t _count = 0;
+};
+
+#endif // DATA_STORE_STORAGE_BENCH_H
@@ -0,0 +1,25 @@
+#include "StorageBench.h"
+
+#include <esp_flash.h>
+
+// Every flash erase (LittleFS, NVS, esp_partition_erase_range) ends up in
+// esp_flash_erase_region. The build links with
+// -Wl,--wrap=esp_flash_erase_region, so calls land here first and the real
+// function is reached as __real_esp_flash_erase_region.
+
+#define FLASH_SECTOR_SIZE 4096
+
+static volatile uint32_t sectorsErased = 0;
+
+extern "C" esp_err_t __real_esp_flash_erase_region(esp_flash_t *chip, uint32_t start, uint32_t len);
+
+extern "C" esp_err_t IRAM_ATTR __wrap_esp_flash_erase_region(esp_flash_t *chip, uint32_t start, uint32_t len)
+{
+  sectorsErased += (len + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE;
+  return __real_esp_flash_erase_region(chip, start, len);
+}
+
+uint32_t flashSectorsErased()
+{
+  return sectorsErased;
+}
@@ -0,0 +1,311 @@
+#include "StorageBench.h"
+
+#include <Preferences.h>
+#include <esp_partition.h>
+#include <algorithm>
+
+#define FILL_PATH "/bench_fill.bin"
+#define REWRITE_PATH "/bench_schedule.json"
+#define MILLIS_PATH "/bench_millis.dat"
+#define JOURNAL_PATH "/bench_journal.bin"
+#define SEQUENTIAL_PATH "/bench_sequential.bin"
+#define BLOCK_SIZE 512
+#define RING_SECTOR_SIZE 4096
+
+static const size_t rewriteSizes[] = {1024, 4096, 16384};
+static const uint8_t fillLevels[] = {0, 50, 90};
+
+static uint8_t block[BLOCK_SIZE];
+
+// --- Helpers ---
+
+bool StorageBench::fillTo(uint8_t percent)
+{
+  clearFill();
+  size_t target = _fs.totalBytes() / 100 * percent;
+  if (percent == 0 || _fs.usedBytes() >= target)
+  {
+    return true;
+  }
+  File file = _fs.open(FILL_PATH, FILE_WRITE);
+  if (!file)
+  {
+    Serial.println("- failed to open fill file");
+    return false;
+  }
+  memset(block, 0xA5, sizeof(block));
+  // usedBytes() only moves as blocks are committed, so flush every 8 KB
+  for (size_t written = 0; _fs.usedBytes() < target; written += sizeof(block))
+  {
+    if (file.write(block, sizeof(block)) != sizeof(block))
+    {
+      Serial.println("- filesystem full before the fill level");
+      break;
+    }
+    if ((written & 0x1FFF) == 0)
+    {
+      file.flush();
+    }
+  }
+  file.close();
+  return true;
+}
+
+void StorageBench::clearFill()
+{
+  _fs.remove(FILL_PATH);
+}
+
+BenchStats StorageBench::summarize(uint32_t failures, uint32_t erasesBefore)
+{
+  BenchStats stats = {};
+  stats.ops = _count;
+  stats.failures = failures;
+  stats.erases = flashSectorsErased() - erasesBefore;
+  if (_count == 0)
+  {
+    return stats;
+  }
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < _count; ++i)
+  {
+    total += _samples[i];
+  }
+  std::sort(_samples, _samples + _count);
+  // Nearest rank
+  stats.p50Us = _samples[(_count * 50 + 99) / 100 - 1];
+  stats.p90Us = _samples[(_count * 90 + 99) / 100 - 1];
+  stats.p99Us = _samples[(_count * 99 + 99) / 100 - 1];
+  stats.maxUs = _samples[_count - 1];
+  stats.meanUs = total / _count;
+  return stats;
+}
+
+void StorageBench::printRow(const char *scenario, size_t size, int fill, const BenchStats &stats)
+{
+  char fillText[8];
+  if (fill < 0)
+  {
+    snprintf(fillText, sizeof(fillText), "-");
+  }
+  else
+  {
+    snprintf(fillText, sizeof(fillText), "%d%%", fill);
+  }
+  Serial.printf("%-10s %6u %5s %4lu %8lu %8lu %8lu %8lu %8lu %6lu %7.2f%s\r\n", scenario, (unsigned)size, fillText,
+                (unsigned long)stats.ops, (unsigned long)stats.meanUs, (unsigned long)stats.p50Us,
+                (unsigned long)stats.p90Us, (unsigned long)stats.p99Us, (unsigned long)stats.maxUs,
+                (unsigned long)stats.erases, stats.ops ? (float)stats.erases / stats.ops : 0.0f,
+                stats.failures ? "  FAILURES" : "");
+}
+
+// --- File scenarios ---
+
+BenchStats StorageBench::fullRewrite(size_t fileSize)
+{
+  uint32_t failures = 0;
+  uint32_t erasesBefore = flashSectorsErased();
+  memset(block, '7', sizeof(block));
+  _count = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i)
+  {
+    uint32_t start = micros();
+    File file = _fs.open(REWRITE_PATH, FILE_WRITE);
+    size_t written = 0;
+    while (file && written < fileSize)
+    {
+      size_t n = std::min(fileSize - written, sizeof(block));
+      if (file.write(block, n) != n)
+      {
+        break;
+      }
+      written += n;
+    }
+    file.close();
+    _samples[_count++] = micros() - start;
+    failures += written != fileSize;
+  }
+  _fs.remove(REWRITE_PATH);
+  return summarize(failures, erasesBefore);
+}
+
+BenchStats StorageBench::tinyOverwrite()
+{
+  uint32_t failures = 0;
+  uint32_t erasesBefore = flashSectorsErased();
+  _count = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i)
+  {
+    unsigned long value = millis();
+    uint32_t start = micros();
+    File file = _fs.open(MILLIS_PATH, FILE_WRITE);
+    bool ok = file && file.write((uint8_t *)&value, sizeof(value)) == sizeof(value);
+    file.close();
+    _samples[_count++] = micros() - start;
+    failures += !ok;
+  }
+  _fs.remove(MILLIS_PATH);
+  return summarize(failures, erasesBefore);
+}
+
+BenchStats StorageBench::appendJournal()
+{
+  uint32_t failures = 0;
+  uint32_t erasesBefore = flashSectorsErased();
+  uint8_t record[BENCH_JOURNAL_RECORD];
+  size_t journalSize = 0;
+  _fs.remove(JOURNAL_PATH);
+  _count = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i)
+  {
+    memset(record, i & 0xFF, sizeof(record));
+    uint32_t start = micros();
+    if (journalSize + sizeof(record) > BENCH_JOURNAL_MAX)
+    {
+      _fs.remove(JOURNAL_PATH); // Compaction, charged to the append that triggers it
+      journalSize = 0;
+    }
+    File file = _fs.open(JOURNAL_PATH, FILE_APPEND);
+    bool ok = file && file.write(record, sizeof(record)) == sizeof(record);
+    file.close();
+    _samples[_count++] = micros() - start;
+    failures += !ok;
+    journalSize += ok ? sizeof(record) : 0;
+  }
+  _fs.remove(JOURNAL_PATH);
+  return summarize(failures, erasesBefore);
+}
+
+// --- NVS ---
+
+BenchStats StorageBench::nvsPut(size_t valueSize)
+{
+  Preferences prefs;
+  uint32_t failures = 0;
+  if (!prefs.begin("bench", false))
+  {
+    Serial.println("- failed to open NVS namespace");
+    return BenchStats();
+  }
+  prefs.clear();
+  uint32_t erasesBefore = flashSectorsErased();
+  _count = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i)
+  {
+    memset(block, i & 0xFF, valueSize);
+    uint32_t start = micros();
+    size_t written = valueSize == sizeof(uint32_t) ? prefs.putUInt("millis", millis()) : prefs.putBytes("blob", block, valueSize);
+    _samples[_count++] = micros() - start;
+    failures += written != valueSize;
+  }
+  BenchStats stats = summarize(failures, erasesBefore);
+  prefs.clear();
+  prefs.end();
+  return stats;
+}
+
+// --- Raw partition ring ---
+
+BenchStats StorageBench::ringWrite(size_t recordSize)
+{
+  const esp_partition_t *partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)BENCH_RING_SUBTYPE, BENCH_RING_PARTITION);
+  if (partition == nullptr)
+  {
+    Serial.println("- no '" BENCH_RING_PARTITION "' partition, check board_build.partitions");
+    return BenchStats();
+  }
+  uint32_t failures = 0;
+  uint32_t erasesBefore = flashSectorsErased();
+  size_t position = 0;
+  memset(block, 0x5A, sizeof(block));
+  _count = 0;
+  for (int i = 0; i < BENCH_SAMPLES; ++i)
+  {
+    uint32_t start = micros();
+    if (position + recordSize > partition->size)
+    {
+      position = 0;
+    }
+    bool ok = true;
+    if (position % RING_SECTOR_SIZE == 0)
+    {
+      ok = esp_partition_erase_range(partition, position, RING_SECTOR_SIZE) == ESP_OK;
+    }
+    ok = ok && esp_partition_write(partition, position, block, recordSize) == ESP_OK;
+    _samples[_count++] = micros() - start;
+    failures += !ok;
+    position += recordSize;
+  }
+  return summarize(failures, erasesBefore);
+}
+
+// --- Sequential throughput (the original testFileIO) ---
+
+void StorageBench::sequential()
+{
+  memset(block, 0, sizeof(block));
+  File file = _fs.open(SEQUENTIAL_PATH, FILE_WRITE);
+  if (!file)
+  {
+    Serial.println("- failed to open file for writing");
+    return;
+  }
+  uint32_t erasesBefore = flashSectorsErased();
+  uint32_t start = millis();
+  for (size_t i = 0; i < BENCH_SEQUENTIAL_BYTES / BLOCK_SIZE; i++)
+  {
+    file.write(block, BLOCK_SIZE);
+  }
+  file.close();
+  uint32_t writeMs = millis() - start;
+  uint32_t erases = flashSectorsErased() - erasesBefore;
+
+  file = _fs.open(SEQUENTIAL_PATH);
+  start = millis();
+  size_t read = 0;
+  while (file && file.available())
+  {
+    read += file.read(block, BLOCK_SIZE);
+  }
+  file.close();
+  uint32_t readMs = millis() - start;
+  _fs.remove(SEQUENTIAL_PATH);
+
+  Serial.printf("sequential: %u bytes written in %lu ms (%lu KB/s, %lu erases), %u read in %lu ms (%lu KB/s)\r\n",
+                BENCH_SEQUENTIAL_BYTES, (unsigned long)writeMs,
+                (unsigned long)(writeMs ? BENCH_SEQUENTIAL_BYTES / writeMs * 1000 / 1024 : 0), (unsigned long)erases,
+                (unsigned)read, (unsigned long)readMs, (unsigned long)(readMs ? read / readMs * 1000 / 1024 : 0));
+}
+
+// --- Suite ---
+
+void StorageBench::run()
+{
+  Serial.printf("\r\n--- Storage benchmark: %s, LittleFS %u KB, %d samples per row ---\r\n", CONFIG_IDF_TARGET,
+                (unsigned)(_fs.totalBytes() / 1024), BENCH_SAMPLES);
+  sequential();
+  Serial.printf("%-10s %6s %5s %4s %8s %8s %8s %8s %8s %6s %7s\r\n", "scenario", "bytes", "fill", "ops", "mean_us",
+                "p50_us", "p90_us", "p99_us", "max_us", "erases", "per_op");
+
+  for (uint8_t fill : fillLevels)
+  {
+    if (!fillTo(fill))
+    {
+      continue;
+    }
+    for (size_t size : rewriteSizes)
+    {
+      printRow("rewrite", size, fill, fullRewrite(size));
+    }
+    printRow("overwrite", sizeof(unsigned long), fill, tinyOverwrite());
+    printRow("append", BENCH_JOURNAL_RECORD, fill, appendJournal());
+  }
+  clearFill();
+
+  printRow("nvs", sizeof(uint32_t), -1, nvsPut(sizeof(uint32_t)));
+  printRow("nvs", 32, -1, nvsPut(32));
+  printRow("ring", 32, -1, ringWrite(32));
+  printRow("ring", 256, -1, ringWrite(256));
+  Serial.println("--- Done ---");
+}
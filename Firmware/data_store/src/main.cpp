@@ -2,8 +2,7 @@
 #include "FS.h"
 #include <LittleFS.h>
 
-// JSON data library
-#include <ArduinoJson.h>
+#include "StorageBench.h"
 
 #define FORMAT_LITTLEFS_IF_FAILED true
 
@@ -46,196 +45,6 @@ void listDir(fs::FS &fs, const char *dirname, uint8_t levels)
   }
 }
 
-void createDir(fs::FS &fs, const char *path)
-{
-  Serial.printf("Creating Dir: %s\n", path);
-  if (fs.mkdir(path))
-  {
-    Serial.println("Dir created");
-  }
-  else
-  {
-    Serial.println("mkdir failed");
-  }
-}
-
-void removeDir(fs::FS &fs, const char *path)
-{
-  Serial.printf("Removing Dir: %s\n", path);
-  if (fs.rmdir(path))
-  {
-    Serial.println("Dir removed");
-  }
-  else
-  {
-    Serial.println("rmdir failed");
-  }
-}
-
-void readFile(fs::FS &fs, const char *path)
-{
-  Serial.printf("Reading file: %s\r\n", path);
-
-  File file = fs.open(path);
-  if (!file || file.isDirectory())
-  {
-    Serial.println("- failed to open file for reading");
-    return;
-  }
-
-  JsonDocument doc;
-  deserializeJson(doc, file);
-  const char *sensor = doc["sensor"];
-  long time = doc["time"];
-  double latitude = doc["data"][0];
-  double longitude = doc["data"][1];
-
-  Serial.println(sensor);
-  Serial.println(time);
-  Serial.println(latitude, 6);
-  Serial.println(longitude, 6);
-  Serial.println("Json parse working");
-
-  Serial.println("- read from file:");
-  while (file.available())
-  {
-    Serial.write(file.read());
-  }
-  file.close();
-}
-
-void writeFile(fs::FS &fs, const char *path, const char *message)
-{
-  Serial.printf("Writing file: %s\r\n", path);
-
-  File file = fs.open(path, FILE_WRITE);
-  if (!file)
-  {
-    Serial.println("- failed to open file for writing");
-    return;
-  }
-  if (file.print(message))
-  {
-    Serial.println("- file written");
-  }
-  else
-  {
-    Serial.println("- write failed");
-  }
-  file.close();
-}
-
-void appendFile(fs::FS &fs, const char *path, const char *message)
-{
-  Serial.printf("Appending to file: %s\r\n", path);
-
-  File file = fs.open(path, FILE_APPEND);
-  if (!file)
-  {
-    Serial.println("- failed to open file for appending");
-    return;
-  }
-  if (file.print(message))
-  {
-    Serial.println("- message appended");
-  }
-  else
-  {
-    Serial.println("- append failed");
-  }
-  file.close();
-}
-
-void renameFile(fs::FS &fs, const char *path1, const char *path2)
-{
-  Serial.printf("Renaming file %s to %s\r\n", path1, path2);
-  if (fs.rename(path1, path2))
-  {
-    Serial.println("- file renamed");
-  }
-  else
-  {
-    Serial.println("- rename failed");
-  }
-}
-
-void deleteFile(fs::FS &fs, const char *path)
-{
-  Serial.printf("Deleting file: %s\r\n", path);
-  if (fs.remove(path))
-  {
-    Serial.println("- file deleted");
-  }
-  else
-  {
-    Serial.println("- delete failed");
-  }
-}
-
-void testFileIO(fs::FS &fs, const char *path)
-{
-  Serial.printf("Testing file I/O with %s\r\n", path);
-
-  static uint8_t buf[512];
-  size_t len = 0;
-  File file = fs.open(path, FILE_WRITE);
-  if (!file)
-  {
-    Serial.println("- failed to open file for writing");
-    return;
-  }
-
-  size_t i;
-  Serial.print("- writing");
-  uint32_t start = millis();
-  for (i = 0; i < 2048; i++)
-  {
-    if ((i & 0x001F) == 0x001F)
-    {
-      Serial.print(".");
-    }
-    file.write(buf, 512);
-  }
-  Serial.println("");
-  uint32_t end = millis() - start;
-  Serial.printf(" - %u bytes written in %lu ms\r\n", 2048 * 512, end);
-  file.close();
-
-  file = fs.open(path);
-  start = millis();
-  end = start;
-  i = 0;
-  if (file && !file.isDirectory())
-  {
-    len = file.size();
-    size_t flen = len;
-    start = millis();
-    Serial.print("- reading");
-    while (len)
-    {
-      size_t toRead = len;
-      if (toRead > 512)
-      {
-        toRead = 512;
-      }
-      file.read(buf, toRead);
-      if ((i++ & 0x001F) == 0x001F)
-      {
-        Serial.print(".");
-      }
-      len -= toRead;
-    }
-    Serial.println("");
-    end = millis() - start;
-    Serial.printf("- %u bytes read in %lu ms\r\n", flen, end);
-    file.close();
-  }
-  else
-  {
-    Serial.println("- failed to open file for reading");
-  }
-}
-
 void setup()
 {
   Serial.begin(115200);
@@ -246,14 +55,14 @@ void setup()
     return;
   }
 
-  // JSON input string.
-  const char *json = "{\"sensor\":\"gps\",\"time\":1351824120,\"data\":[48.756080,2.302038]}";
   delay(3000);
   listDir(LittleFS, "/", 3);
-  createDir(LittleFS, "/mydir");
-  writeFile(LittleFS, "/mydir/hello.txt", json);
-  listDir(LittleFS, "/", 1);
-  readFile(LittleFS, "/mydir/hello.txt");
+
+  StorageBench bench(LittleFS);
+  bench.run();
+
+  // Anything left behind here is a scenario that failed to clean up
+  listDir(LittleFS, "/", 3);
 }
 
-void loop() {}
\ No newline at end of file
+void loop() {}
@@ -0,0 +1,69 @@
+#ifndef PIPLI_BATTERY_MONITOR_H
+#define PIPLI_BATTERY_MONITOR_H
+
+#include <Arduino.h>
+
+// --- Battery Settings ---
+// The cell is read through a resistor divider on an ADC1 pin (ADC2 is
+// shared with the radio). Boards without one leave BATTERY_PIN at -1: the
+// level then reads as unknown and the device stays in the normal tier.
+#ifndef BATTERY_PIN
+#define BATTERY_PIN -1
+#endif
+#ifndef BATTERY_DIVIDER_X100
+#define BATTERY_DIVIDER_X100 200 // Cell voltage / pin voltage x 100 (two equal resistors)
+#endif
+#ifndef BATTERY_SAMPLE_INTERVAL_MS
+#define BATTERY_SAMPLE_INTERVAL_MS 60000 // The cell drains over days; a reading a minute is plenty
+#endif
+#define BATTERY_READS_PER_SAMPLE 4 // ADC reads averaged per sample
+#define BATTERY_EMA_SHIFT 3        // Each sample moves the filter 1/8 of the way
+#define BATTERY_LOW_PERCENT 30
+#define BATTERY_CRITICAL_PERCENT 10
+#define BATTERY_HYSTERESIS_PERCENT 5 // A tier is left upwards only this far above its threshold
+#define BATTERY_UNKNOWN_PERCENT 0xFF
+
+enum BatteryTier : uint8_t
+{
+    BATTERY_NORMAL,
+    BATTERY_LOW,
+    BATTERY_CRITICAL,
+};
+
+// Cell voltage through the ADC, smoothed and mapped to a charge tier.
+//
+// sample() averages a few calibrated reads and feeds an exponential moving
+// average, so motor current, radio bursts and ADC noise do not flip the tier.
+// The first sample seeds the filter. Tiers change with hysteresis: a cell
+// that recovers a little once the load stops stays in the lower tier until
+// it is clearly above the threshold again.
+//
+// Loop-only. Skip sampling while the motor runs; the cell sags under it.
+class BatteryMonitor
+{
+public:
+    // False (and no sampling) when pin is negative
+    bool begin(int pin);
+    bool present() const { return _pin >= 0; }
+
+    // Takes one filtered sample. True when the tier changed.
+    bool sample();
+
+    uint16_t millivolts() const { return (uint16_t)(_filtered >> BATTERY_EMA_SHIFT); }
+    uint8_t percent() const { return _percent; }
+    BatteryTier tier() const { return _tier; }
+
+    // Charge of a single Li-ion/LiPo cell at light load
+    static uint8_t percentFor(uint16_t millivolts);
+
+private:
+    BatteryTier tierFor(uint8_t percent) const;
+
+    int _pin = -1;
+    uint32_t _filtered = 0; // Millivolts << BATTERY_EMA_SHIFT
+    bool _seeded = false;
+    uint8_t _percent = BATTERY_UNKNOWN_PERCENT;
+    BatteryTier _tier = BATTERY_NORMAL;
+};
+
+#endif // PIPLI_BATTERY_MONITOR_H
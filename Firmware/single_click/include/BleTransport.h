@@ -0,0 +1,125 @@
+#ifndef PIPLI_BLE_TRANSPORT_H
+#define PIPLI_BLE_TRANSPORT_H
+
+#include <Arduino.h>
+#include <string>
+
+// --- Stack Selection ---
+// Bluedroid (the Arduino BLE library) is the default. Build with
+// -D PIPLI_BLE_NIMBLE=1 and the NimBLE-Arduino library to use NimBLE, which
+// needs far less RAM and flash. Exactly one of BluedroidTransport.cpp and
+// NimbleTransport.cpp compiles into the image.
+#ifndef PIPLI_BLE_NIMBLE
+#define PIPLI_BLE_NIMBLE 0
+#endif
+
+// --- Bond Filter ---
+// 1 restricts connections to bonded peers outside a pairing window (see
+// setPairing()). Phones connect from rotating private addresses, so begin()
+// turns on local privacy, which puts the bonded IRKs in the resolving list:
+// bonded peers are resolved to their identity addresses before the
+// whitelist is matched.
+#ifndef BLE_BOND_FILTER
+#define BLE_BOND_FILTER 1
+#endif
+
+// Characteristic properties
+#define BLE_PROP_READ 0x01
+#define BLE_PROP_WRITE 0x02
+#define BLE_PROP_WRITE_NR 0x04
+#define BLE_PROP_NOTIFY 0x08
+#define BLE_PROP_INDICATE 0x10
+
+#define BLE_DEFAULT_MTU 23
+
+// Every characteristic of the Pipli service
+enum BleChannel : uint8_t
+{
+    BLE_CHANNEL_LEGACY,  // Original all-in-one characteristic
+    BLE_CHANNEL_INFO,    // Schedule hash / generation
+    BLE_CHANNEL_CONTROL, // Command control point
+    BLE_CHANNEL_BULK,    // Uploads, transfer frames and acks
+    BLE_CHANNEL_STATUS,  // DeviceStatus record
+    BLE_CHANNEL_EVENTS,  // EventOutbox frames and acks
+    BLE_CHANNEL_COUNT
+};
+
+// Stack events. All of them run in the BLE task; keep them short and hand
+// real work to the loop.
+struct BleTransportHandlers
+{
+    void (*onConnect)();
+    void (*onDisconnect)();
+    void (*onMtuChanged)(uint16_t mtu);
+    void (*onWrite)(BleChannel channel, const std::string &value);
+    void (*onRead)(BleChannel channel); // May setValue() the channel before the read completes
+    void (*onSubscribe)(BleChannel channel, bool notifications);
+    void (*onSecured)(bool bonded); // Link encrypted; bonded = with keys kept for the next connection
+};
+
+// One GATT service with one characteristic per BleChannel, a single peer,
+// and advertising, on whichever BLE stack the build selected.
+//
+// Every connection is asked to encrypt. A new peer bonds with Just Works
+// (LE Secure Connections; there is no display or keypad) and the stack keeps
+// the keys in NVS, so a bonded peer re-encrypts without pairing again.
+//
+// begin()/addChannel()/start() are called once from setup(); setValue(),
+// notify() and startAdvertising() may be called from any task;
+// setAdvertisingInterval(), setManufacturerData(), setPairing(),
+// clearBonds() and requestConnectionParams() from the loop.
+class BleTransport
+{
+public:
+    bool begin(const char *deviceName, const char *serviceUuid, uint16_t preferredMtu,
+               const BleTransportHandlers &handlers);
+    bool addChannel(BleChannel channel, const char *uuid, uint8_t properties);
+
+    // Starts the service and advertising
+    void start();
+
+    // Sets the value returned to reads. Ignored for channels never added.
+    void setValue(BleChannel channel, const uint8_t *data, size_t len);
+
+    // Sets the value and notifies the peer. False if nobody is connected.
+    bool notify(BleChannel channel, const uint8_t *data, size_t len);
+
+    // True while the peer has notifications enabled on channel
+    bool subscribed(BleChannel channel) const;
+
+    void startAdvertising();
+    bool advertising() const;
+
+    // Puts manufacturer-specific data (company id first) into the scan
+    // response, after the device name. Takes effect at once, also while
+    // advertising; name and data must fit the 31 byte scan response.
+    void setManufacturerData(const uint8_t *data, size_t len);
+
+    // Advertising interval in 0.625 ms units. Takes effect at once if
+    // advertising is running, otherwise the next time it starts.
+    void setAdvertisingInterval(uint16_t minUnits, uint16_t maxUnits);
+
+    // Asks the central for new connection parameters: interval in 1.25 ms
+    // units, peripheral latency in skipped intervals, supervision timeout in
+    // 10 ms units. The central has the last word. False if nobody is connected.
+    bool requestConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout);
+
+    // --- Bonding ---
+    // With BLE_BOND_FILTER, closed pairing lets only bonded peers connect:
+    // advertising filters connection requests through the controller
+    // whitelist, loaded with the bonded identity addresses. Scan requests stay
+    // open, so anyone can read the scan response. Without any bond, or with
+    // the filter off, pairing is always open; bonds are kept either way.
+    void setPairing(bool open);
+    uint8_t bondCount() const;
+    void clearBonds();
+    bool peerBonded() const;
+
+    bool connected() const;
+    uint16_t mtu() const;
+
+    // "Bluedroid" or "NimBLE", for logs
+    const char *stackName() const;
+};
+
+#endif // PIPLI_BLE_TRANSPORT_H
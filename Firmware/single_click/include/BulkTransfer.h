@@ -0,0 +1,141 @@
+#ifndef PIPLI_BULK_TRANSFER_H
+#define PIPLI_BULK_TRANSFER_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include <freertos/FreeRTOS.h>
+#include "Lzss.h"
+
+// --- Bulk Transfer Settings ---
+#ifndef XFER_WINDOW
+#define XFER_WINDOW 8 // Chunks in flight before an ack is required (max 32)
+#endif
+#ifndef XFER_MAX_CHUNK
+#define XFER_MAX_CHUNK 240 // Payload bytes per data frame at the largest MTU
+#endif
+#ifndef XFER_ACK_TIMEOUT_MS
+#define XFER_ACK_TIMEOUT_MS 1500 // No ack progress for this long resends the window
+#endif
+#ifndef XFER_MAX_RETRIES
+#define XFER_MAX_RETRIES 5 // Consecutive timeouts before the session pauses
+#endif
+
+#define XFER_SNAPSHOT_FILENAME "/xfer.bin"
+#define XFER_META_FILENAME "/xfer.meta"
+
+// --- Wire format (all integers little endian) ---
+// Device -> app, notifications:
+//   0xD0 header: id u16, total u32, crc32 u32, chunk u16, window u8, start u32, codec u8
+//                total and crc32 describe the bytes on the wire (after compression)
+//   0xD1 data:   id u16, offset u32, payload
+// App -> device, writes:
+//   0xA1 ack:    id u16, cumulative u32, sack u32
+//     cumulative = every byte before it has arrived
+//     sack bit i = the chunk at cumulative + (i + 1) * chunk has arrived
+#define XFER_OP_HEADER 0xD0
+#define XFER_OP_DATA 0xD1
+#define XFER_OP_ACK 0xA1
+#define XFER_HEADER_LEN 19
+#define XFER_DATA_OVERHEAD 7
+#define XFER_ACK_LEN 11
+
+// Sends one frame to the peer. Returns false if it could not be queued.
+typedef bool (*FrameSender)(const uint8_t *data, size_t len, void *ctx);
+
+// Produces the payload of a new transfer
+typedef size_t (*SnapshotWriter)(Print &out, void *ctx);
+
+// Resumable, windowed transfer of one payload to the app.
+//
+// The payload is written to a flash snapshot when the transfer starts, so a
+// resumed transfer sends exactly the same bytes even if the schedule changed
+// in between, and a transfer survives disconnects and reboots. Each transfer
+// has an id; the app resumes it with the id and the offset it already has.
+// Up to XFER_WINDOW chunks are in flight; acks carry a cumulative offset plus
+// a selective bitmap so only missing chunks are resent.
+//
+// start()/resume()/pause()/service() must be called from the main loop.
+// onAck() may be called from the BLE task.
+class BulkTransfer
+{
+public:
+    explicit BulkTransfer(fs::FS &fs) : _fs(fs) {}
+
+    void setSender(FrameSender sender, void *ctx);
+
+    // Snapshots a new payload (compressed with codec) and starts sending it from offset 0
+    bool start(SnapshotWriter writer, void *ctx, uint16_t chunkSize, uint8_t codec = CODEC_NONE);
+
+    // Continues transfer id from offset. False if that snapshot is gone.
+    bool resume(uint16_t id, uint32_t offset, uint16_t chunkSize);
+
+    // Stops sending (e.g. on disconnect); the snapshot is kept for resume()
+    void pause();
+
+    // Handles a 0xA1 frame. Safe from any task.
+    bool onAck(const uint8_t *data, size_t len);
+
+    // Applies pending acks and sends at most one frame. Call every few ms while active().
+    void service(uint32_t nowMs);
+
+    bool active() const { return _active; }
+    uint16_t id() const { return _meta.id; }
+    uint32_t total() const { return _meta.total; }
+    uint32_t acked() const { return _base; }
+
+    // True once after the app acknowledged the last byte
+    bool takeCompleted();
+
+    uint32_t framesSent() const { return _framesSent; }
+    uint32_t framesResent() const { return _framesResent; }
+
+private:
+    struct Meta
+    {
+        uint32_t magic;
+        uint16_t id;
+        uint8_t complete;
+        uint8_t codec; // PayloadCodec of the snapshot
+        uint32_t total;
+        uint32_t crc32;
+    };
+
+    bool loadMeta();
+    bool saveMeta();
+    bool openSession(uint32_t offset, uint16_t chunkSize, uint32_t nowMs);
+    bool sendHeader();
+    bool sendChunk(uint32_t offset);
+    bool nextResend(uint32_t &offset);
+    void finish();
+
+    fs::FS &_fs;
+    FrameSender _sender = nullptr;
+    void *_senderCtx = nullptr;
+
+    Meta _meta = {};
+    File _file;
+    bool _active = false;
+    bool _completed = false;
+    uint16_t _chunk = 0;
+    uint32_t _base = 0;        // Cumulative ack
+    uint32_t _next = 0;        // Next never-sent offset
+    uint32_t _sack = 0;        // Latest selective ack, relative to _base
+    bool _resending = false;    // A resend pass is running
+    uint32_t _resendCursor = 0; // Next offset the pass looks at
+    uint32_t _resendLimit = 0;  // Pass ends here
+    uint32_t _lastProgressMs = 0;
+    uint8_t _retries = 0;
+    uint32_t _sessionStartMs = 0; // Throughput of the current session
+    uint32_t _sessionStartOffset = 0;
+
+    // Latest ack from the BLE task, applied by service()
+    portMUX_TYPE _ackLock = portMUX_INITIALIZER_UNLOCKED;
+    bool _ackPending = false;
+    uint32_t _ackCumulative = 0;
+    uint32_t _ackSack = 0;
+
+    uint32_t _framesSent = 0;
+    uint32_t _framesResent = 0;
+};
+
+#endif // PIPLI_BULK_TRANSFER_H
@@ -0,0 +1,119 @@
+#ifndef PIPLI_BUTTONS_H
+#define PIPLI_BUTTONS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+#include <freertos/semphr.h>
+#include "StaticQueue.h"
+
+// --- Button Settings ---
+#ifndef BUTTON_DEBOUNCE_MS
+#define BUTTON_DEBOUNCE_MS 20 // Pin must be quiet this long before a level counts
+#endif
+#ifndef BUTTON_LONG_PRESS_MS
+#define BUTTON_LONG_PRESS_MS 1500 // Hold time for a long press
+#endif
+#ifndef BUTTON_DOUBLE_PRESS_MS
+#define BUTTON_DOUBLE_PRESS_MS 400 // Max gap between release and the next press
+#endif
+#ifndef BUTTON_QUEUE_LEN
+#define BUTTON_QUEUE_LEN 8
+#endif
+#define BUTTON_ACTIVE_LEVEL HIGH // Both buttons pull the pin up when pressed
+
+enum ButtonId : uint8_t
+{
+    BUTTON_USER = 0, // Reminder response
+    BUTTON_PAIR = 1, // Pairing / advertising
+    BUTTON_COUNT,
+};
+
+enum ButtonGesture : uint8_t
+{
+    BUTTON_PRESS,        // Debounced press, sent as soon as it is seen
+    BUTTON_LONG_PRESS,   // Still held after BUTTON_LONG_PRESS_MS (follows a PRESS)
+    BUTTON_DOUBLE_PRESS, // Second press within BUTTON_DOUBLE_PRESS_MS (follows its PRESS)
+};
+
+struct ButtonEvent
+{
+    uint8_t button;  // ButtonId
+    uint8_t gesture; // ButtonGesture
+    uint32_t timeMs; // millis() of the debounced edge
+};
+
+// Turns debounced edges of one button into gestures. No hardware access,
+// so it can be driven from a host build as well.
+class ButtonDecoder
+{
+public:
+    // Feeds a debounced level change. Writes up to two gestures to out and
+    // returns how many were produced.
+    uint8_t onEdge(bool pressed, uint32_t nowMs, ButtonGesture out[2]);
+
+    // Called when the hold timer expires. True if this is a long press.
+    bool onHold(uint32_t nowMs);
+
+    bool pressed() const { return _pressed; }
+
+private:
+    bool _pressed = false;
+    bool _longSent = false;
+    bool _releaseValid = false; // _releaseMs can start a double press
+    uint32_t _pressMs = 0;
+    uint32_t _releaseMs = 0;
+};
+
+// Interrupt-driven input for the USER and PAIR buttons.
+//
+// A CHANGE interrupt only records the edge time and arms a debounce timer.
+// Once the pin has been quiet for BUTTON_DEBOUNCE_MS the level is sampled and
+// fed to the decoder from the esp_timer task, and the resulting gestures are
+// queued for the main loop. The loop can therefore block in waitEvent() until
+// the next timer deadline and still see a press one debounce window after it
+// settles, however briefly the button was held.
+class Buttons
+{
+public:
+    bool begin(uint8_t userPin, uint8_t pairPin);
+
+    // Blocks up to timeoutMs (UINT32_MAX = forever) for the next event
+    bool waitEvent(ButtonEvent &out, uint32_t timeoutMs);
+
+    // Ends a pending waitEvent() without a button event. Safe from any task.
+    // It only gives the wake signal, so a burst of wakes never takes a queue
+    // slot a press needs.
+    void wake();
+
+    uint32_t droppedCount() const { return _dropped; }
+
+private:
+    struct Channel
+    {
+        Buttons *owner;
+        uint8_t id;
+        uint8_t pin;
+        esp_timer_handle_t debounceTimer;
+        esp_timer_handle_t holdTimer;
+        volatile uint32_t lastEdgeUs;
+        std::atomic<bool> debouncing;
+        bool stablePressed;
+        ButtonDecoder decoder;
+    };
+
+    bool beginChannel(Channel &channel, uint8_t id, uint8_t pin);
+    void post(uint8_t button, uint8_t gesture, uint32_t timeMs);
+
+    static void IRAM_ATTR onEdgeIsr(void *arg);
+    static void onDebounce(void *arg);
+    static void onHold(void *arg);
+
+    Channel _channels[BUTTON_COUNT] = {};
+    StaticQueue<ButtonEvent, BUTTON_QUEUE_LEN> _queue;
+    SemaphoreHandle_t _wakeSignal = nullptr; // Given on every post() and wake(); waitEvent() blocks on it
+    StaticSemaphore_t _wakeSignalBuffer;
+    std::atomic<uint32_t> _dropped{0};
+};
+
+#endif // PIPLI_BUTTONS_H
@@ -0,0 +1,60 @@
+#ifndef PIPLI_CONNECTION_STATS_H
+#define PIPLI_CONNECTION_STATS_H
+
+#include <Arduino.h>
+
+// Reconnect timing, to show what bonding and GATT caching buy.
+//
+// Time to first byte runs from the connection to the peer's first write:
+// by then the app has found the service (from its cache or by discovery)
+// and acts. It is kept apart for bonded links (encrypted with stored keys
+// before that write) and for links without a bond. secure_ms is connection
+// to encryption, offline_ms the gap since the previous disconnect.
+//
+// The stack callbacks feed it from the BLE task; format() may run in any
+// task and only reads whole words.
+class ConnectionStats
+{
+public:
+    void onConnect(uint32_t nowMs);
+    void onSecured(uint32_t nowMs, bool bonded);
+    // True for the first write of the connection
+    bool onWrite(uint32_t nowMs);
+    void onDisconnect(uint32_t nowMs);
+
+    bool bonded() const { return _bonded; }
+    uint32_t lastFirstWriteMs() const { return _lastFirstWriteMs; }
+
+    // {"bonds":N,"connects":N,"bonded":0|1,"offline_ms":N,"secure_ms":N,"ttfb_ms":N,
+    //  "bonded_n":N,"bonded_avg_ms":N,"new_n":N,"new_avg_ms":N}
+    size_t format(char *out, size_t size, uint8_t bonds) const;
+
+private:
+    struct Timing
+    {
+        uint32_t count;
+        uint32_t totalMs;
+
+        void add(uint32_t ms)
+        {
+            count++;
+            totalMs += ms;
+        }
+        uint32_t averageMs() const { return count > 0 ? totalMs / count : 0; }
+    };
+
+    volatile bool _connected = false;
+    volatile bool _wrote = false;
+    volatile bool _bonded = false;
+    uint32_t _connectedAtMs = 0;
+    uint32_t _disconnectedAtMs = 0;
+    bool _everDisconnected = false;
+    uint32_t _connects = 0;
+    uint32_t _offlineMs = 0;
+    uint32_t _secureMs = 0;
+    uint32_t _lastFirstWriteMs = 0;
+    Timing _bondedFirstWrite = {};
+    Timing _newFirstWrite = {};
+};
+
+#endif // PIPLI_CONNECTION_STATS_H
@@ -0,0 +1,72 @@
+#ifndef PIPLI_DEVICE_STATUS_H
+#define PIPLI_DEVICE_STATUS_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+// --- Status record (all integers little endian) ---
+//   0  version u8              DEVICE_STATUS_VERSION
+//   1  state u8                main loop State
+//   2  flags u8                DEVICE_STATUS_FLAG_*
+//   3  battery u8              percent, DEVICE_STATUS_UNKNOWN_U8 if not measured
+//   4  pending u16             reminders not yet answered
+//   6  next due u32            seconds until the next reminder, 0xFFFFFFFF = none
+//  10  last response slot u16  0xFFFF = none since boot
+//  12  last response state u8  SLOT_TAKEN / SLOT_MISSED
+//  13  last response age u32   seconds since that response
+// 17 bytes fit one ATT read at the default MTU.
+#define DEVICE_STATUS_VERSION 1
+#define DEVICE_STATUS_LEN 17
+#define DEVICE_STATUS_UNKNOWN_U8 0xFF
+#define DEVICE_STATUS_NONE_U16 0xFFFF
+#define DEVICE_STATUS_NONE_U32 0xFFFFFFFF
+
+#define DEVICE_STATUS_FLAG_SCHEDULE 0x01 // A schedule is loaded
+#define DEVICE_STATUS_FLAG_ALERT 0x02    // A reminder is being alerted or awaits a response
+#define DEVICE_STATUS_FLAG_TRANSFER 0x04 // A bulk transfer or an OTA update is running
+
+// Pre-serialized status summary behind the status characteristic.
+//
+// Each setter rewrites only its own bytes, and only when the value changed,
+// so the loop can call them every pass. The two "seconds" fields are kept as
+// millis() stamps and rendered by refresh() right before a read, so a read
+// never sees stale times and never costs more than two subtractions.
+//
+// Setters and takeChanged() are loop-only; refresh()/copy() may run in the
+// BLE task.
+class DeviceStatus
+{
+public:
+    DeviceStatus();
+
+    void setState(uint8_t state);
+    void setFlags(uint8_t flags);
+    void setBattery(uint8_t percent);
+    void setPending(uint16_t pending);
+    void setNextDue(bool armed, uint32_t dueMs);
+    void setLastResponse(uint16_t slot, uint8_t state, uint32_t atMs);
+
+    // Renders the time fields for nowMs
+    void refresh(uint32_t nowMs);
+
+    // Copies the record (DEVICE_STATUS_LEN bytes) into out
+    void copy(uint8_t *out);
+
+    // True once after any field other than the rendered times changed
+    bool takeChanged();
+
+private:
+    void putU16(size_t offset, uint16_t value);
+    void putU32(size_t offset, uint32_t value);
+
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    uint8_t _packed[DEVICE_STATUS_LEN];
+    bool _changed = true;
+
+    bool _nextDueArmed = false;
+    uint32_t _nextDueMs = 0;
+    bool _hasResponse = false;
+    uint32_t _responseMs = 0;
+};
+
+#endif // PIPLI_DEVICE_STATUS_H
@@ -0,0 +1,47 @@
+#ifndef PIPLI_ESP_OTA_TARGET_H
+#define PIPLI_ESP_OTA_TARGET_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include <esp_ota_ops.h>
+#include "OtaReceiver.h"
+
+#define OTA_PROGRESS_FILENAME "/ota.meta"
+
+// The inactive app partition of the OTA partition table, written raw with
+// esp_partition_*; the session checkpoint lives in a small file.
+//
+// Rollback: the Arduino core marks a freshly booted image valid at once
+// unless verifyRollbackLater() says otherwise, and main.cpp says otherwise.
+// A new image therefore boots as "pending verify" and must confirm() itself
+// once it is healthy. If it resets first, the bootloader goes back to the
+// previous image.
+class EspOtaTarget : public OtaTarget
+{
+public:
+    explicit EspOtaTarget(fs::FS &fs) : _fs(fs) {}
+
+    bool open() override;
+    uint32_t capacity() override;
+    bool erase(uint32_t offset, uint32_t len) override;
+    bool write(uint32_t offset, const uint8_t *data, size_t len) override;
+    bool read(uint32_t offset, uint8_t *data, size_t len) override;
+    bool activate(uint32_t size) override;
+
+    bool loadProgress(OtaProgress &progress) override;
+    bool saveProgress(const OtaProgress &progress) override;
+    void clearProgress() override;
+
+    // --- Running image ---
+    bool pendingVerify() const; // Booted from a new image that has not confirmed itself
+    void confirm();             // Keep the running image; cancels the rollback
+    // Boots the other image next time: rejects a pending image, or goes back
+    // to the previous valid one. False if there is none.
+    bool rollback();
+
+private:
+    fs::FS &_fs;
+    const esp_partition_t *_partition = nullptr;
+};
+
+#endif // PIPLI_ESP_OTA_TARGET_H
@@ -0,0 +1,137 @@
+#ifndef PIPLI_EVENT_OUTBOX_H
+#define PIPLI_EVENT_OUTBOX_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include <freertos/FreeRTOS.h>
+#include "BulkTransfer.h" // FrameSender
+
+// --- Event Outbox Settings ---
+#ifndef OUTBOX_CAPACITY
+#define OUTBOX_CAPACITY 64 // Unsent events kept; the oldest is dropped when full
+#endif
+#ifndef OUTBOX_WINDOW
+#define OUTBOX_WINDOW 4 // Events in flight before an ack is required
+#endif
+#ifndef OUTBOX_ACK_TIMEOUT_MS
+#define OUTBOX_ACK_TIMEOUT_MS 1000 // No ack progress for this long resends from the oldest
+#endif
+#ifndef OUTBOX_MAX_RETRIES
+#define OUTBOX_MAX_RETRIES 5 // Consecutive timeouts before draining stops until the next connection
+#endif
+
+#define OUTBOX_FILENAME "/outbox.bin"
+
+// --- Wire format (all integers little endian) ---
+// Device -> app, notification:
+//   0xE0 event: seq u32, type u8, state u8, slot u16, offset u32, at u32
+//     offset = the reminder's schedule offset in seconds
+//     at     = seconds since the schedule origin when the event happened
+// App -> device, write:
+//   0xE1 ack:   seq u32 = every event up to and including seq has arrived
+#define OUTBOX_OP_EVENT 0xE0
+#define OUTBOX_OP_ACK 0xE1
+#define OUTBOX_EVENT_LEN 17
+#define OUTBOX_ACK_LEN 5
+
+enum OutboxEventType : uint8_t
+{
+    EVENT_RESPONSE = 1,      // A reminder was answered (state SLOT_TAKEN)
+    EVENT_MISSED = 2,        // A reminder went unanswered (state SLOT_MISSED)
+    EVENT_LOW_BATTERY = 3,   // state = battery percent
+    EVENT_SCHEDULE_DONE = 4, // Every reminder of the schedule has been handled
+};
+
+struct OutboxEvent
+{
+    uint32_t seq;
+    uint8_t type;
+    uint8_t state;
+    uint16_t slot;
+    uint32_t offsetSec;
+    uint32_t atSec;
+};
+
+// Persistent queue of events the app has not acknowledged yet.
+//
+// Events are queued in RAM and written to flash by the write-back cache
+// (the caller marks its region dirty after push() and after acks). While a
+// subscribed peer is connected, service() sends up to OUTBOX_WINDOW events
+// ahead of the last ack, one frame per call, and resends from the oldest
+// unacked event when acks stall. A host on the serial link reads the queue
+// with copyEvents() and acks it with acknowledge() instead. Sequence numbers
+// keep counting across reboots so the app can drop duplicates.
+//
+// Everything but onAck() is loop-only; onAck() may be called from the BLE task.
+class EventOutbox
+{
+public:
+    explicit EventOutbox(fs::FS &fs) : _fs(fs) {}
+
+    bool load();
+    bool save();
+
+    void setSender(FrameSender sender, void *ctx);
+
+    // Queues an event; returns its sequence number
+    uint32_t push(uint8_t type, uint8_t state, uint16_t slot, uint32_t offsetSec, uint32_t atSec);
+
+    void startDrain(uint32_t nowMs);
+    void stopDrain();
+
+    // Handles a 0xE1 frame. Safe from any task.
+    bool onAck(const uint8_t *data, size_t len);
+
+    // Renders up to max events, oldest first, as OUTBOX_EVENT_LEN frames
+    // back to back into out. Returns how many.
+    uint16_t copyEvents(uint8_t *out, uint16_t max) const;
+
+    // Applies a 0xE1 frame right away. Returns true when the queue changed
+    // and should be persisted.
+    bool acknowledge(const uint8_t *data, size_t len, uint32_t nowMs);
+
+    // Applies the latest ack and sends at most one event. Returns true when
+    // the queue changed and should be persisted.
+    bool service(uint32_t nowMs);
+
+    bool draining() const { return _draining; }
+    uint16_t count() const { return _count; }
+    uint32_t dropped() const { return _dropped; }
+
+private:
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t nextSeq;
+        uint16_t count;
+        uint16_t reserved;
+    };
+
+    const OutboxEvent &at(uint16_t index) const { return _events[(_head + index) % OUTBOX_CAPACITY]; }
+    static void encodeEvent(const OutboxEvent &event, uint8_t *frame);
+    static bool parseAck(const uint8_t *data, size_t len, uint32_t &seq);
+    bool sendEvent(const OutboxEvent &event);
+    bool applyAck(uint32_t seq, uint32_t nowMs);
+
+    fs::FS &_fs;
+    FrameSender _sender = nullptr;
+    void *_senderCtx = nullptr;
+
+    OutboxEvent _events[OUTBOX_CAPACITY];
+    uint16_t _head = 0;
+    uint16_t _count = 0;
+    uint32_t _nextSeq = 1;
+    uint32_t _dropped = 0;
+
+    bool _draining = false;
+    uint16_t _inFlight = 0; // Events from the head already sent this pass
+    uint32_t _lastProgressMs = 0;
+    uint8_t _retries = 0;
+
+    // Latest ack from the BLE task, applied by service()
+    portMUX_TYPE _ackLock = portMUX_INITIALIZER_UNLOCKED;
+    bool _ackPending = false;
+    uint32_t _ackSeq = 0;
+};
+
+#endif // PIPLI_EVENT_OUTBOX_H
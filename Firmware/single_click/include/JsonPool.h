@@ -0,0 +1,115 @@
+#ifndef PIPLI_JSON_POOL_H
+#define PIPLI_JSON_POOL_H
+
+#include <ArduinoJson.h>
+#include <string.h>
+
+// ArduinoJson allocator over a fixed buffer of Capacity bytes.
+//
+// Blocks are handed out from the bottom like a stack. Freeing or resizing the
+// newest block works in place; an older block that grows is moved up. Once
+// every block is freed (the document is gone) the whole buffer is free again.
+// A document that does not fit fails with DeserializationError::NoMemory and
+// counts in failures(), so the largest document a build accepts is known when
+// it is built.
+//
+// Not thread safe: one task parses at a time.
+template <size_t Capacity>
+class JsonPool : public ArduinoJson::Allocator
+{
+public:
+    void *allocate(size_t size) override
+    {
+        size_t need = sizeof(Header) + align(size);
+        if (need > Capacity - _top)
+        {
+            ++_failures;
+            return nullptr;
+        }
+        Header *header = (Header *)(_buffer + _top);
+        header->size = align(size);
+        header->previous = _last;
+        _last = _top;
+        _top += need;
+        ++_live;
+        _peak = _top > _peak ? _top : _peak;
+        return header + 1;
+    }
+
+    void deallocate(void *ptr) override
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+        Header *header = (Header *)ptr - 1;
+        if (--_live == 0)
+        {
+            _top = 0;
+            _last = NO_BLOCK;
+        }
+        else if (isLast(header))
+        {
+            _top = _last;
+            _last = header->previous;
+        }
+    }
+
+    void *reallocate(void *ptr, size_t newSize) override
+    {
+        if (ptr == nullptr)
+        {
+            return allocate(newSize);
+        }
+        Header *header = (Header *)ptr - 1;
+        if (isLast(header))
+        {
+            if (align(newSize) > Capacity - _last - sizeof(Header))
+            {
+                ++_failures;
+                return nullptr;
+            }
+            header->size = align(newSize);
+            _top = _last + sizeof(Header) + header->size;
+            _peak = _top > _peak ? _top : _peak;
+            return ptr;
+        }
+        if (newSize <= header->size)
+        {
+            return ptr; // Shrinking an older block keeps its space until the reset
+        }
+        void *moved = allocate(newSize);
+        if (moved != nullptr)
+        {
+            memcpy(moved, ptr, header->size);
+            deallocate(ptr);
+        }
+        return moved;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+    size_t used() const { return _top; }
+    size_t peak() const { return _peak; } // Most bytes ever in use, headers included
+    uint32_t failures() const { return _failures; }
+
+private:
+    static constexpr uint32_t NO_BLOCK = UINT32_MAX;
+
+    struct Header
+    {
+        uint32_t size;     // Payload bytes, aligned
+        uint32_t previous; // Offset of the block below, or NO_BLOCK
+    };
+
+    static size_t align(size_t size) { return (size + 7) & ~(size_t)7; }
+    bool isLast(const Header *header) const { return _last != NO_BLOCK && (const uint8_t *)header == _buffer + _last; }
+
+    alignas(8) uint8_t _buffer[Capacity];
+    size_t _top = 0;           // First free byte
+    uint32_t _last = NO_BLOCK; // Offset of the newest block's header
+    size_t _live = 0;
+    size_t _peak = 0;
+    uint32_t _failures = 0;
+};
+
+#endif // PIPLI_JSON_POOL_H
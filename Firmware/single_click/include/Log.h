@@ -0,0 +1,170 @@
+#ifndef PIPLI_LOG_H
+#define PIPLI_LOG_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// --- Log Levels ---
+// Messages above LOG_LEVEL compile to dead code: their arguments are still
+// type checked (and count as used) but never evaluated, and the optimizer
+// drops the call and its format string.
+#define LOG_LEVEL_NONE 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3
+#define LOG_LEVEL_DEBUG 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+#ifndef LOG_BINARY
+#define LOG_BINARY 1 // Keep binary diagnostic records for BLE retrieval
+#endif
+
+// --- Logger Settings ---
+#ifndef LOG_QUEUE_SLOTS
+#define LOG_QUEUE_SLOTS 32 // Records waiting for the drain task (power of two)
+#endif
+#ifndef LOG_LINE_MAX
+#define LOG_LINE_MAX 96 // Longer text lines are truncated
+#endif
+#ifndef LOG_HISTORY_RECORDS
+#define LOG_HISTORY_RECORDS 64 // Binary records kept for LOG_FETCH
+#endif
+#ifndef LOG_DRAIN_INTERVAL_MS
+#define LOG_DRAIN_INTERVAL_MS 10
+#endif
+#ifndef LOG_SERIAL_BAUD
+#define LOG_SERIAL_BAUD 115200
+#endif
+
+#define LOG_DISCARD(level, ...) do { if (0) logger.write(level, __VA_ARGS__); } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.write(LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) LOG_DISCARD(LOG_LEVEL_ERROR, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.write(LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...) LOG_DISCARD(LOG_LEVEL_WARN, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...) LOG_DISCARD(LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) LOG_DISCARD(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+#if LOG_BINARY
+#define LOG_EVENT(code, arg16, arg32) logger.record((code), (arg16), (arg32))
+#else
+#define LOG_EVENT(code, arg16, arg32) do { if (0) logger.record((code), (arg16), (arg32)); } while (0)
+#endif
+
+// --- Binary Records ---
+// 12 bytes each, little endian on the wire: ms u32, code u16, arg16 u16, arg32 u32
+enum LogCode : uint16_t
+{
+    LOG_CODE_BOOT = 1,            // arg16 = esp_reset_reason()
+    LOG_CODE_FS_FAILED = 2,       //
+    LOG_CODE_SCHEDULE_LOADED = 3, // arg16 = slots, arg32 = content hash
+    LOG_CODE_SCHEDULE_UPLOAD = 4, // arg16 = slots, arg32 = content hash
+    LOG_CODE_REMINDER_DUE = 5,    // arg16 = slot, arg32 = offset seconds
+    LOG_CODE_RESPONSE = 6,        // arg16 = slot, arg32 = SLOT_TAKEN / SLOT_MISSED
+    LOG_CODE_FLUSH_FAILED = 7,    // arg16 = region mask
+    LOG_CODE_CONNECT = 8,         //
+    LOG_CODE_DISCONNECT = 9,      //
+    LOG_CODE_XFER_DONE = 10,      // arg16 = transfer id, arg32 = bytes
+    LOG_CODE_LOG_DROPPED = 11,    // arg32 = records dropped so far
+    LOG_CODE_BATTERY_TIER = 12,   // arg16 = BatteryTier, arg32 = millivolts
+    LOG_CODE_FIRST_WRITE = 13,    // arg16 = bonded, arg32 = ms from connect to the first write
+};
+
+struct LogRecord
+{
+    uint32_t ms;
+    uint16_t code;
+    uint16_t arg16;
+    uint32_t arg32;
+};
+
+#define LOG_RECORD_LEN 12
+
+// Deferred logger.
+//
+// write() and record() format into a slot of a lock-free bounded queue
+// (multi-producer, single-consumer) and return at once; a low-priority task
+// prints the queue to Serial, so no caller ever waits on the UART. When the
+// queue is full the record is dropped and counted. Binary records are also
+// kept in a small history that copyRecords() hands to the BLE fetch.
+//
+// Anything else that writes to Serial (the provisioning link) brackets its
+// output with lockOutput()/unlockOutput() so it never interleaves with a line.
+//
+// write()/record() are safe from any task; not from ISRs (they format text).
+class Logger
+{
+public:
+    Logger();
+
+    // Opens Serial and starts the drain task
+    void begin(unsigned long baud = LOG_SERIAL_BAUD);
+
+    // Exclusive use of Serial between whole lines
+    void lockOutput();
+    void unlockOutput();
+
+    void write(uint8_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    void record(uint16_t code, uint16_t arg16, uint32_t arg32);
+
+    // Copies up to maxCount binary records, oldest first
+    size_t copyRecords(LogRecord *out, size_t maxCount);
+
+    uint32_t dropped() const { return _dropped.load(); }
+
+private:
+    enum Kind : uint8_t
+    {
+        KIND_TEXT,
+        KIND_RECORD,
+    };
+
+    struct Slot
+    {
+        std::atomic<uint32_t> sequence;
+        uint32_t ms;
+        uint8_t kind;
+        uint8_t level;
+        uint8_t length;
+        char text[LOG_LINE_MAX]; // KIND_RECORD keeps its LogRecord here
+    };
+
+    Slot *reserve();
+    void drain();
+    static void drainTask(void *ctx);
+
+    Slot _slots[LOG_QUEUE_SLOTS];
+    std::atomic<uint32_t> _enqueue{0};
+    uint32_t _dequeue = 0; // Drain task only
+    std::atomic<uint32_t> _dropped{0};
+    uint32_t _droppedReported = 0;
+
+    SemaphoreHandle_t _outputLock = nullptr;
+    StaticSemaphore_t _outputLockBuffer;
+
+    portMUX_TYPE _historyLock = portMUX_INITIALIZER_UNLOCKED;
+    LogRecord _history[LOG_HISTORY_RECORDS];
+    uint16_t _historyHead = 0;
+    uint16_t _historyCount = 0;
+};
+
+extern Logger logger;
+
+#endif // PIPLI_LOG_H
@@ -0,0 +1,90 @@
+#ifndef PIPLI_LZSS_H
+#define PIPLI_LZSS_H
+
+#include <Arduino.h>
+
+// --- Compression Settings ---
+// Both ends must agree on these; the device announces them when a session
+// negotiates compression.
+#ifndef LZSS_WINDOW_BITS
+#define LZSS_WINDOW_BITS 8 // 256 byte history
+#endif
+#ifndef LZSS_LOOKAHEAD_BITS
+#define LZSS_LOOKAHEAD_BITS 4 // Matches of 2..17 bytes
+#endif
+
+#define LZSS_WINDOW_SIZE (1 << LZSS_WINDOW_BITS)
+#define LZSS_MIN_MATCH 2
+#define LZSS_MAX_MATCH (LZSS_MIN_MATCH + (1 << LZSS_LOOKAHEAD_BITS) - 1)
+
+// Payload encodings a BLE session can negotiate
+enum PayloadCodec : uint8_t
+{
+    CODEC_NONE = 0,
+    CODEC_LZSS = 1,
+};
+
+// Bit stream (MSB first), in the style of heatshrink:
+//   1 + 8 bits                       literal byte
+//   0 + WINDOW_BITS + LOOKAHEAD_BITS copy (distance - 1, length - MIN_MATCH)
+// The last byte is zero padded; a decoder ignores a trailing partial token.
+
+// Compresses everything written to it into out. Call finish() at the end.
+// Uses LZSS_WINDOW_SIZE + LZSS_MAX_MATCH bytes of RAM and no heap.
+class LzssEncoder : public Print
+{
+public:
+    explicit LzssEncoder(Print &out) : _out(out) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    // Emits the pending bytes and the final partial byte
+    void finish();
+
+    uint32_t bytesIn() const { return _bytesIn; }
+    uint32_t bytesOut() const { return _bytesOut; }
+
+private:
+    void emitToken();
+    void putBits(uint32_t value, uint8_t count);
+
+    Print &_out;
+    uint8_t _history[LZSS_WINDOW_SIZE];
+    uint16_t _historyPos = 0;
+    uint16_t _historyLen = 0;
+    uint8_t _lookahead[LZSS_MAX_MATCH];
+    uint8_t _lookaheadLen = 0;
+    uint32_t _bitBuffer = 0;
+    uint8_t _bitCount = 0;
+    uint32_t _bytesIn = 0;
+    uint32_t _bytesOut = 0;
+};
+
+// Expands an LzssEncoder stream written to it into out
+class LzssDecoder : public Print
+{
+public:
+    explicit LzssDecoder(Print &out) : _out(out) {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    // Set when the stream referenced history it never produced
+    bool failed() const { return _failed; }
+    uint32_t bytesOut() const { return _bytesOut; }
+
+private:
+    void emit(uint8_t c);
+
+    Print &_out;
+    uint8_t _history[LZSS_WINDOW_SIZE];
+    uint16_t _historyPos = 0;
+    uint16_t _historyLen = 0;
+    uint32_t _bitBuffer = 0;
+    uint8_t _bitCount = 0;
+    bool _failed = false;
+    uint32_t _bytesOut = 0;
+};
+
+#endif // PIPLI_LZSS_H
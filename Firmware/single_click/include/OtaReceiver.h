@@ -0,0 +1,148 @@
+#ifndef PIPLI_OTA_RECEIVER_H
+#define PIPLI_OTA_RECEIVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Sha256.h"
+
+// --- OTA Settings ---
+#ifndef OTA_WINDOW
+#define OTA_WINDOW 16 // Blocks in flight before the sender waits for an ack
+#endif
+#ifndef OTA_MAX_BLOCK
+#define OTA_MAX_BLOCK 235 // One ATT write at MTU 247, less the data header
+#endif
+#ifndef OTA_CHECKPOINT_BYTES
+#define OTA_CHECKPOINT_BYTES 32768 // Progress saved this often; a reboot resumes from the last one
+#endif
+#define OTA_ACK_EVERY (OTA_WINDOW / 2) // Blocks per ack, so the sender never runs dry
+#define OTA_SECTOR_SIZE 4096
+
+// --- Wire format (all integers little endian) ---
+// App -> device, writes:
+//   0x90 begin:  size u32, block u16, sha256[32]  starts, or resumes the same image
+//   0x91 data:   offset u32, crc32 u32, payload   crc32 (IEEE) of the payload
+//   0x92 finish: -                                 verify the hash and activate
+//   0x93 abort:  -
+// Device -> app, notifications:
+//   0x98 status: code u8, offset u32, block u16, window u8
+//     offset: every byte before it is on flash; the sender continues there
+//     block:  the block size in effect (the app's, capped by the link)
+// Blocks are written in order. A block past the expected offset or with a
+// bad CRC is dropped and answered with one OTA_NAK; the sender rewinds to its
+// offset. A sender that hears nothing for a while rewinds to the last ack.
+#define OTA_OP_BEGIN 0x90
+#define OTA_OP_DATA 0x91
+#define OTA_OP_FINISH 0x92
+#define OTA_OP_ABORT 0x93
+#define OTA_OP_STATUS 0x98
+#define OTA_BEGIN_LEN (7 + SHA256_LEN)
+#define OTA_DATA_OVERHEAD 9
+#define OTA_STATUS_LEN 9
+
+enum OtaStatus : uint8_t
+{
+    OTA_OK = 0,           // Session ready / progress ack
+    OTA_DONE = 1,         // Image verified and activated; the device reboots into it
+    OTA_NAK = 2,          // Resend from offset
+    OTA_ABORTED = 3,      //
+    OTA_ERR_FRAME = 4,    // Malformed frame (begin needs an MTU of at least 42)
+    OTA_ERR_SIZE = 5,     // Image larger than the partition
+    OTA_ERR_STATE = 6,    // No session, or updates are not possible right now
+    OTA_ERR_FLASH = 7,    // Erase or write failed; the session ends
+    OTA_ERR_HASH = 8,     // SHA-256 mismatch; the session ends
+    OTA_ERR_ACTIVATE = 9, // The image was rejected as a boot image
+};
+
+// Where a resumable session stands, kept by the target across reboots
+struct OtaProgress
+{
+    uint32_t magic;
+    uint32_t size;
+    uint8_t sha256[SHA256_LEN];
+    uint32_t offset; // Sector aligned; everything before it is on flash
+};
+
+// The inactive app partition and a place for the session checkpoint.
+// EspOtaTarget is the real one; the native env simulates it in a file.
+class OtaTarget
+{
+public:
+    virtual ~OtaTarget() {}
+
+    // Prepares the partition for a new session; false if updates are not possible now
+    virtual bool open() = 0;
+    virtual uint32_t capacity() = 0; // Bytes, a multiple of OTA_SECTOR_SIZE
+    virtual bool erase(uint32_t offset, uint32_t len) = 0;
+    virtual bool write(uint32_t offset, const uint8_t *data, size_t len) = 0;
+    virtual bool read(uint32_t offset, uint8_t *data, size_t len) = 0;
+    // Boots the image of this size next time
+    virtual bool activate(uint32_t size) = 0;
+
+    virtual bool loadProgress(OtaProgress &progress) = 0;
+    virtual bool saveProgress(const OtaProgress &progress) = 0;
+    virtual void clearProgress() = 0;
+};
+
+// Sends one status frame to the app. Returns false if it could not be queued.
+typedef bool (*OtaFrameSender)(const uint8_t *data, size_t len, void *ctx);
+
+// Receives a firmware image into the target, block by block.
+//
+// Each block is checked against its CRC and written straight to flash,
+// erasing sectors just ahead of it. A session survives disconnects (the app
+// sends begin again and continues at the acked offset) and reboots (the
+// target's checkpoint, at most OTA_CHECKPOINT_BYTES behind). Finish reads
+// the image back, checks its SHA-256 against the one from begin and only
+// then activates it.
+//
+// Loop-only; the caller queues frames from the BLE task.
+class OtaReceiver
+{
+public:
+    explicit OtaReceiver(OtaTarget &target) : _target(target) {}
+
+    void setSender(OtaFrameSender sender, void *ctx);
+
+    // Largest block the link carries (the ATT payload less the data header)
+    void setMaxBlock(uint16_t bytes) { _maxBlock = bytes; }
+
+    void handle(const uint8_t *frame, size_t len);
+
+    bool active() const { return _active; }
+    bool done() const { return _done; } // Activated: reboot into the new image
+    uint32_t received() const { return _written; }
+    uint32_t size() const { return _size; }
+
+private:
+    void onBegin(const uint8_t *frame, size_t len);
+    void onData(const uint8_t *frame, size_t len);
+    void onFinish();
+    void onAbort();
+
+    bool writeBlock(uint32_t offset, const uint8_t *data, size_t len);
+    void checkpoint();
+    bool verify();
+    void end(OtaStatus status);
+    void nak();
+    void sendStatus(OtaStatus status, uint32_t offset);
+
+    OtaTarget &_target;
+    OtaFrameSender _sender = nullptr;
+    void *_senderCtx = nullptr;
+    uint16_t _maxBlock = OTA_MAX_BLOCK;
+
+    bool _active = false;
+    bool _done = false;
+    bool _stateErrorSent = false; // One OTA_ERR_STATE per stray burst of data
+    uint32_t _size = 0;
+    uint8_t _sha256[SHA256_LEN];
+    uint16_t _block = 0;
+    uint32_t _written = 0;      // Contiguous bytes on flash
+    uint32_t _erasedUntil = 0;  // Sectors before this are erased for the session
+    uint32_t _checkpointed = 0; // Offset of the saved progress
+    uint32_t _nakOffset = UINT32_MAX;
+    uint8_t _sinceAck = 0;
+};
+
+#endif // PIPLI_OTA_RECEIVER_H
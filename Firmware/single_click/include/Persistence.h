@@ -0,0 +1,97 @@
+#ifndef PIPLI_PERSISTENCE_H
+#define PIPLI_PERSISTENCE_H
+
+#include <stdint.h>
+#include <atomic>
+
+// --- Persistence Regions ---
+// Each region is one bit of the dirty mask. State changes only mark their
+// region dirty; the flush policy decides when all dirty regions are written
+// together in a single pass.
+enum PersistRegion : uint8_t
+{
+    PERSIST_SCHEDULE = 1 << 0, // Schedule document (responses, new uploads)
+    PERSIST_MILLIS = 1 << 1,   // Uptime checkpoint used to recover time after reboot
+    PERSIST_OUTBOX = 1 << 2,   // Events not yet acknowledged by the app
+};
+
+#define PERSIST_MAX_REGIONS 8
+
+// --- Flush Policy Settings ---
+// State changes only mark regions dirty; everything dirty is written in one
+// flush once the oldest mark is FLUSH_MAX_LATENCY_MS old or FLUSH_MAX_DIRTY_COUNT
+// marks have piled up. Override per env with build_flags if needed.
+#ifndef FLUSH_MAX_LATENCY_MS
+#define FLUSH_MAX_LATENCY_MS 5000
+#endif
+#ifndef FLUSH_MAX_DIRTY_COUNT
+#define FLUSH_MAX_DIRTY_COUNT 8
+#endif
+
+// --- Flush Policy ---
+struct FlushPolicy
+{
+    uint32_t maxLatencyMs;    // Oldest dirty mark is written after at most this long
+    uint16_t maxDirtyCount;   // Flush early once this many marks have piled up (0 = no limit)
+    bool flushOnPowerWarning; // Flush immediately on low battery / brown-out warning
+};
+
+// Writes one region to flash. Returns false if the write failed, in which
+// case the region stays dirty and is retried on the next deadline.
+typedef bool (*RegionWriter)(void *ctx);
+
+// Write-back cache for everything the firmware keeps on flash.
+// markDirty() may be called from any task (BLE callbacks included);
+// flushIfDue()/flush() must only be called from the main loop.
+class Persistence
+{
+public:
+    void begin(const FlushPolicy &policy);
+    void setPolicy(const FlushPolicy &policy) { _policy = policy; }
+    const FlushPolicy &policy() const { return _policy; }
+
+    void registerRegion(uint8_t region, RegionWriter writer, void *ctx = nullptr);
+
+    void markDirty(uint8_t regions, uint32_t nowMs);
+    bool isDirty() const { return _dirtyMask.load() != 0; }
+    uint8_t dirtyMask() const { return _dirtyMask.load(); }
+    // nowMs of the latest markDirty() that named the region, so a writer can
+    // store the state as of its mark rather than as of the flush
+    uint32_t markedAt(uint8_t region) const;
+
+    // Milliseconds until the policy wants a flush (0 = due now, UINT32_MAX = clean)
+    uint32_t msUntilFlush(uint32_t nowMs) const;
+
+    bool flushIfDue(uint32_t nowMs);
+    bool flush(uint32_t nowMs);
+
+    // Called by power monitoring code when the supply is about to go away.
+    // Requests a flush on the next flushIfDue() when the policy allows it.
+    void onPowerWarning();
+
+    uint32_t flushCount() const { return _flushCount; }
+    uint32_t markCount() const { return _markCount; }
+
+private:
+    struct Region
+    {
+        uint8_t bit;
+        RegionWriter writer;
+        void *ctx;
+    };
+
+    FlushPolicy _policy = {5000, 8, true};
+    Region _regions[PERSIST_MAX_REGIONS] = {};
+    uint8_t _regionCount = 0;
+
+    std::atomic<uint8_t> _dirtyMask{0};
+    std::atomic<uint16_t> _dirtyCount{0};
+    std::atomic<uint32_t> _firstDirtyMs{0};
+    std::atomic<bool> _powerWarning{false};
+    std::atomic<uint32_t> _markedAtMs[PERSIST_MAX_REGIONS] = {};
+
+    uint32_t _flushCount = 0;
+    uint32_t _markCount = 0;
+};
+
+#endif // PIPLI_PERSISTENCE_H
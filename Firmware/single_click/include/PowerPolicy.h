@@ -0,0 +1,58 @@
+#ifndef PIPLI_POWER_POLICY_H
+#define PIPLI_POWER_POLICY_H
+
+#include <Arduino.h>
+#include "BatteryMonitor.h"
+#include "Persistence.h"
+#include "RadioPolicy.h"
+
+// --- Power Policy Settings ---
+// What each battery tier gives up. The normal tier runs on the base values
+// passed to begin(); the lower tiers buzz shorter and softer, advertise
+// less often when idle and batch more changes per flash write.
+#define POWER_FULL_DUTY 255
+#define POWER_LOW_VIBRATION_MS 3000
+#define POWER_LOW_VIBRATION_DUTY 200
+#define POWER_LOW_ADV_MIN 3200 // 2 s
+#define POWER_LOW_ADV_MAX 3300 // 2.06 s
+#define POWER_LOW_FLUSH_SCALE 4
+#define POWER_CRITICAL_VIBRATION_MS 2000
+#define POWER_CRITICAL_VIBRATION_DUTY 160
+#define POWER_CRITICAL_ADV_MIN 6400 // 4 s
+#define POWER_CRITICAL_ADV_MAX 6560 // 4.1 s
+#define POWER_CRITICAL_FLUSH_SCALE 12
+
+struct PowerProfile
+{
+    uint32_t vibrationMs;  // Motor on-time per alert
+    uint8_t vibrationDuty; // Motor PWM duty, POWER_FULL_DUTY = always on
+    bool blink;            // LED blinks on BLE traffic
+};
+
+// Maps the battery tier onto the knobs that cost charge.
+//
+// apply() pushes the slow advertising interval to the RadioPolicy and the
+// flush thresholds to Persistence; the vibration and LED settings are read
+// from profile() by whoever drives them. A write-through base flush policy
+// (maxDirtyCount 1, as after a brown-out) is kept in every tier. Loop-only.
+class PowerPolicy
+{
+public:
+    PowerPolicy(RadioPolicy &radio, Persistence &persistence) : _radio(radio), _persistence(persistence) {}
+
+    void begin(uint32_t vibrationMs, const FlushPolicy &flush);
+    void apply(BatteryTier tier);
+
+    BatteryTier tier() const { return _tier; }
+    const PowerProfile &profile() const { return _profile; }
+
+private:
+    RadioPolicy &_radio;
+    Persistence &_persistence;
+    uint32_t _baseVibrationMs = 0;
+    FlushPolicy _baseFlush = {};
+    BatteryTier _tier = BATTERY_NORMAL;
+    PowerProfile _profile = {0, POWER_FULL_DUTY, true};
+};
+
+#endif // PIPLI_POWER_POLICY_H
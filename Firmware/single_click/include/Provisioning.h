@@ -0,0 +1,212 @@
+#ifndef PIPLI_PROVISIONING_H
+#define PIPLI_PROVISIONING_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <string>
+#include "DeviceStatus.h"
+#include "EventOutbox.h"
+#include "Persistence.h"
+#include "ReminderEngine.h"
+#include "ScheduleIngest.h"
+#include "ScheduleStore.h"
+#include "SerialLink.h"
+
+// --- Upload Settings ---
+#ifndef MAX_UPLOAD_BYTES
+#define MAX_UPLOAD_BYTES 16384 // Largest schedule a compressed or serial upload may carry
+#endif
+#define COMPRESSED_UPLOAD_MARKER 0xC1 // First byte of an LZSS upload (see "CODEC" in main.cpp)
+
+// --- Serial Provisioning Settings ---
+// The command / upload / status protocol also runs over the USB-serial UART
+// (see SerialLink.h), so a bench tool can provision many devices at once.
+// Log text shares the UART, which then runs at SERIAL_LINK_BAUD. Every host
+// frame gets exactly one response frame.
+#ifndef SERIAL_LINK_ENABLED
+#define SERIAL_LINK_ENABLED 1
+#endif
+#ifndef SERIAL_LINK_BAUD
+#define SERIAL_LINK_BAUD 921600
+#endif
+#define SERIAL_LINK_RX_BUFFER 2048 // Holds a whole frame while the loop is busy
+#define SERIAL_STREAM_CHUNK 512    // SEND_UPDATE bytes per LINK_STREAM frame
+
+#define UPDATE_REQUEST_CMD "SEND_UPDATE"
+#define SCHEDULE_INFO_CMD "SCHEDULE_INFO" // Notifies the same JSON as the info characteristic
+// "EVENTS" drains the event outbox over the link: it answers LINK_EVENTS
+// with the oldest events, and every LINK_EVENTS_ACK answers with the ones
+// after it, until an empty LINK_EVENTS says the outbox is empty.
+#define EVENTS_CMD "EVENTS"
+
+// Where a request came from, so its reply goes back the same way
+enum ReplyRoute : uint8_t
+{
+    ROUTE_BLE,
+    ROUTE_SERIAL,
+};
+
+// Upload bytes collected in a fixed buffer: a Print for the LZSS decoder,
+// appends for serial upload parts
+template <size_t Capacity>
+class UploadBuffer : public Print
+{
+public:
+    size_t write(uint8_t c) override { return append(&c, 1) ? 1 : 0; }
+
+    // False (and nothing appended) if the bytes do not fit
+    bool append(const uint8_t *data, size_t len)
+    {
+        if (len > Capacity - _length)
+        {
+            _overflowed = true;
+            return false;
+        }
+        memcpy(_data + _length, data, len);
+        _length += len;
+        return true;
+    }
+
+    void clear()
+    {
+        _length = 0;
+        _overflowed = false;
+    }
+
+    const char *data() const { return _data; }
+    size_t size() const { return _length; }
+    bool overflowed() const { return _overflowed; }
+
+private:
+    char _data[Capacity];
+    size_t _length = 0;
+    bool _overflowed = false;
+};
+
+typedef UploadBuffer<MAX_UPLOAD_BYTES> UploadInbox;
+
+// What became of the uploads handed to the loop, for diagnostics
+struct UploadCounts
+{
+    uint32_t committed = 0;
+    uint32_t unchanged = 0; // Same content as the active schedule
+    uint32_t failed = 0;
+    uint32_t refused = 0; // Serial uploads answered BUSY, TOO_LARGE or UNSUPPORTED
+    uint32_t patches = 0; // Handed to the patch hook, or dropped without one
+};
+
+// What the device adds around the shared glue. Every hook gets ctx.
+struct ProvisioningHooks
+{
+    bool (*command)(const std::string &command, void *ctx); // A serial command not handled here; false = unknown
+    void (*patch)(const char *data, size_t len, void *ctx); // A {"patch":[...]} upload (may be null: dropped)
+    void (*submitted)(ReplyRoute route, void *ctx);         // An upload waits for the loop (any task)
+    void (*committed)(void *ctx);                           // An upload has been swapped in
+    void (*streamed)(uint32_t bytes, void *ctx);            // SEND_UPDATE went out over the link (may be null)
+    void *ctx;
+};
+
+// The schedule side of the app and host protocols, shared by the firmware
+// and the fleet simulator: the upload inbox and its ingest, the schedule
+// identity, the status record and the serial link (event drain included).
+//
+// Every upload (BLE write, LZSS upload, serial parts) is copied into the
+// inbox and ingested by the loop a slice at a time (serviceIngest()). One
+// upload at a time: another one arriving before the inbox is free again is
+// rejected, and the app sends it again. claimInbox(), inbox() and
+// submitInbox() may be used from the BLE task; everything else is loop-only.
+class Provisioning
+{
+public:
+    Provisioning(ScheduleStore &store, ScheduleIngest &ingest, ReminderEngine &reminders, DeviceStatus &status,
+                 EventOutbox &outbox, Persistence &persistence)
+        : _store(store), _ingest(ingest), _reminders(reminders), _status(status), _outbox(outbox),
+          _persistence(persistence)
+    {
+    }
+
+    void begin(const ProvisioningHooks &hooks) { _hooks = hooks; }
+
+    // --- Upload Inbox ---
+    // Claims the inbox for a new upload; false while another one is in it
+    bool claimInbox();
+    UploadInbox &inbox() { return _inbox; }
+    void releaseInbox();
+    // Hands the filled inbox to the loop
+    void submitInbox(ReplyRoute route);
+    bool inboxReady() const { return _inboxState == INBOX_READY; }
+
+    // One bounded step of the upload in the inbox per loop pass: a slice of
+    // tokens, one index pass or the final swap. Timers and buttons run in
+    // between, so a reminder due mid-upload still fires and takes its press.
+    void serviceIngest();
+
+    const UploadCounts &counts() const { return _counts; }
+
+    // --- Schedule Identity ---
+    // Lets the app skip uploads the device already has: it reads the hash
+    // once after connecting and only sends a schedule whose hash differs.
+    size_t formatScheduleInfo(char *out, size_t size) const;
+
+    // --- Status ---
+    // Feeds the reminder engine's view into the status record; extraFlags
+    // are the DEVICE_STATUS_FLAG_* only the device knows. Returns the flags.
+    uint8_t updateStatus(uint8_t extraFlags);
+
+#if SERIAL_LINK_ENABLED
+    // --- Serial Link ---
+    void beginSerial(Stream &port) { _link.begin(port, onSerialFrame, this); }
+    void pollSerial() { _link.poll(); }
+    SerialLink &link() { return _link; }
+    const SerialLink &link() const { return _link; }
+    void reply(const char *text) { _link.send(LINK_REPLY, (const uint8_t *)text, strlen(text)); }
+
+    // SEND_UPDATE over the link: the store streamed in SERIAL_STREAM_CHUNK
+    // frames, then LINK_STREAM_END with the total
+    void sendSerialUpdate();
+
+    // Loop-only scratch of SERIAL_STREAM_CHUNK bytes for other streams over the link
+    uint8_t *streamBuffer() { return _streamChunk; }
+#endif
+
+private:
+    enum InboxState : uint8_t
+    {
+        INBOX_FREE,
+        INBOX_FILLING,   // Claimed by the BLE task or the serial link
+        INBOX_READY,     // Waiting for the loop
+        INBOX_INGESTING, // Loop only from here until free
+    };
+
+    void finishIngest();
+
+#if SERIAL_LINK_ENABLED
+    static void onSerialFrame(uint8_t type, const uint8_t *payload, size_t len, void *ctx);
+    void handleSerialCommand(const std::string &command);
+    void handleSerialUpload(bool last, const uint8_t *payload, size_t len);
+    void sendSerialStreamEnd(uint32_t total);
+    void sendSerialEvents();
+#endif
+
+    ScheduleStore &_store;
+    ScheduleIngest &_ingest;
+    ReminderEngine &_reminders;
+    DeviceStatus &_status;
+    EventOutbox &_outbox;
+    Persistence &_persistence;
+    ProvisioningHooks _hooks = {};
+
+    UploadInbox _inbox;
+    std::atomic<uint8_t> _inboxState{INBOX_FREE};
+    uint32_t _inboxReceivedAt = 0;     // millis() at submit, the new schedule's time origin
+    ReplyRoute _inboxRoute = ROUTE_BLE; // Serial uploads are answered once applied
+    UploadCounts _counts;
+
+#if SERIAL_LINK_ENABLED
+    SerialLink _link;
+    bool _serialUploadOpen = false;           // The inbox holds the parts so far
+    uint8_t _streamChunk[SERIAL_STREAM_CHUNK]; // SEND_UPDATE and EVENTS buffer for the link
+#endif
+};
+
+#endif // PIPLI_PROVISIONING_H
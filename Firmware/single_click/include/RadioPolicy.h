@@ -0,0 +1,93 @@
+#ifndef PIPLI_RADIO_POLICY_H
+#define PIPLI_RADIO_POLICY_H
+
+#include <Arduino.h>
+#include "BleTransport.h"
+
+// --- Radio Policy Settings ---
+// Advertising intervals are in 0.625 ms units, connection intervals in
+// 1.25 ms units, supervision timeouts in 10 ms units. The defaults follow
+// Apple's accessory guidelines, which Android centrals accept as well.
+#ifndef RADIO_FAST_WINDOW_MS
+#define RADIO_FAST_WINDOW_MS 30000 // Fast advertising after a trigger
+#endif
+#ifndef RADIO_BULK_LINGER_MS
+#define RADIO_BULK_LINGER_MS 3000 // Short interval kept after the last bulk traffic
+#endif
+#ifndef RADIO_CONNECT_SETTLE_MS
+#define RADIO_CONNECT_SETTLE_MS 5000 // Central's own parameters kept during discovery
+#endif
+#define RADIO_ADV_FAST_MIN 32   // 20 ms
+#define RADIO_ADV_FAST_MAX 48   // 30 ms
+#define RADIO_ADV_SLOW_MIN 1636 // 1022.5 ms
+#define RADIO_ADV_SLOW_MAX 1700 // 1062.5 ms
+#define RADIO_CONN_BULK_MIN 12      // 15 ms
+#define RADIO_CONN_BULK_MAX 24      // 30 ms
+#define RADIO_CONN_BULK_LATENCY 0   //
+#define RADIO_CONN_BULK_TIMEOUT 400 // 4 s
+#define RADIO_CONN_IDLE_MIN 144     // 180 ms
+#define RADIO_CONN_IDLE_MAX 160     // 200 ms
+#define RADIO_CONN_IDLE_LATENCY 4   // Skip up to 4 intervals: ~1 s between answers
+#define RADIO_CONN_IDLE_TIMEOUT 600 // 6 s, over 3 x (max interval x (latency + 1))
+
+#define RADIO_NO_DEADLINE UINT32_MAX
+
+enum AdvertisingSpeed : uint8_t
+{
+    ADV_UNSET, // Stack default until the first update()
+    ADV_FAST,
+    ADV_SLOW,
+};
+
+enum LinkProfile : uint8_t
+{
+    LINK_CENTRAL, // Whatever the central chose at connect
+    LINK_BULK,    // Short interval, no latency
+    LINK_IDLE,    // Long interval with peripheral latency
+};
+
+// Advertising and connection parameters by what the device is doing.
+//
+// Advertising is fast for RADIO_FAST_WINDOW_MS after boost() (a button
+// press, a reminder, a queued event, a disconnect) so the phone finds the
+// device quickly, and slow otherwise. While connected, bulk traffic asks for
+// a short connection interval; once it has been quiet for
+// RADIO_BULK_LINGER_MS the link drops to a long interval with latency.
+//
+// update() applies whatever changed and returns when the policy will change
+// on its own, so the loop can sleep until then. Everything is loop-only
+// except noteBulk(), which the BLE task may call.
+class RadioPolicy
+{
+public:
+    explicit RadioPolicy(BleTransport &ble) : _ble(ble) {}
+
+    void boost(uint32_t nowMs);
+
+    // Interval used when not boosted (RADIO_ADV_SLOW_* until changed).
+    // Applied at once if advertising slowly.
+    void setSlowAdvertising(uint16_t minUnits, uint16_t maxUnits);
+    void noteBulk(uint32_t nowMs) { _bulkUntil = nowMs + RADIO_BULK_LINGER_MS; }
+
+    // Milliseconds until the next change without new input, or RADIO_NO_DEADLINE
+    uint32_t update(uint32_t nowMs, bool connected);
+
+    AdvertisingSpeed advertisingSpeed() const { return _advertising; }
+    LinkProfile linkProfile() const { return _link; }
+
+private:
+    void applyAdvertising(AdvertisingSpeed speed);
+    void applyLink(LinkProfile profile);
+
+    BleTransport &_ble;
+    uint32_t _boostUntil = 0;
+    volatile uint32_t _bulkUntil = 0;
+    uint32_t _settleUntil = 0;
+    bool _wasConnected = false;
+    AdvertisingSpeed _advertising = ADV_UNSET;
+    uint16_t _slowMin = RADIO_ADV_SLOW_MIN;
+    uint16_t _slowMax = RADIO_ADV_SLOW_MAX;
+    LinkProfile _link = LINK_CENTRAL;
+};
+
+#endif // PIPLI_RADIO_POLICY_H
@@ -0,0 +1,181 @@
+#ifndef PIPLI_REMINDER_ENGINE_H
+#define PIPLI_REMINDER_ENGINE_H
+
+#include <Arduino.h>
+#include "FS.h"
+#include "EventOutbox.h"
+#include "Persistence.h"
+#include "ScheduleIngest.h"
+#include "ScheduleStore.h"
+#include "TimerWheel.h"
+
+// --- Reminder System Settings ---
+#define VIBRATION_DURATION_MS 5000 // How long to vibrate for a reminder (lower battery tiers shorten it)
+#define RESPONSE_TIMEOUT_MS 15000  // How long to wait for user input after vibration
+#ifndef REMINDER_MAX_ATTEMPTS
+#define REMINDER_MAX_ATTEMPTS 3 // Vibrations per reminder before it is recorded as missed
+#endif
+#ifndef REREMIND_INTERVAL_MS
+#define REREMIND_INTERVAL_MS 300000 // Snooze between unanswered attempts (5 min)
+#endif
+#ifndef COALESCE_WINDOW_MS
+#define COALESCE_WINDOW_MS 300000 // Reminders due this soon after the first one share its alert (0 = off)
+#endif
+#ifndef REMINDER_GROUP_MAX
+#define REMINDER_GROUP_MAX SCHEDULE_WINDOW_SIZE // Reminders per coalesced alert
+#endif
+
+// --- Uptime Checkpoint Settings ---
+// millis() is saved every MILLIS_SAVE_INTERVAL_MS (through the write-back
+// cache) together with the schedule origin on the same clock, so a reboot
+// can tell how far into the schedule the device was.
+#define MILLIS_COUNTER_FILENAME "/millis_counter.dat"
+#ifndef MILLIS_SAVE_INTERVAL_MS
+#define MILLIS_SAVE_INTERVAL_MS 5000 // How often the uptime checkpoint is refreshed
+#endif
+
+#define REMINDER_TIMERS 3 // TimerIds the engine keeps armed (count them into the pool)
+
+// --- State Machine ---
+// DeviceStatus reports it, so the values are part of the status record
+enum ReminderState : uint8_t
+{
+    STATE_IDLE,                // Waiting for a schedule or connection
+    STATE_PROCESSING_SCHEDULE, // Actively checking reminder times
+    STATE_VIBRATING,           // Currently vibrating for a reminder
+    STATE_WAITING_RESPONSE,    // Waiting for user button press after vibration
+    STATE_SNOOZED,             // Unanswered, waiting to re-remind (a press still counts)
+    STATE_SENDING_UPDATE       // Preparing/sending updated schedule
+};
+
+// Where an upload being ingested stands after stepUpload()
+enum UploadResult : uint8_t
+{
+    UPLOAD_BUSY,      // More steps to go
+    UPLOAD_UNCHANGED, // Same content as the active schedule; it keeps its responses
+    UPLOAD_COMMITTED, // Swapped in; the active reminder is dropped and the schedule rescanned
+    UPLOAD_FAILED,    // Dropped; the old schedule is untouched
+};
+
+// What the engine needs from the device around it. Every hook gets ctx.
+struct ReminderHooks
+{
+    uint32_t (*alert)(bool first, void *ctx);  // Motor on (first = not a re-remind); returns its on-time in ms
+    void (*silence)(void *ctx);                // Motor off
+    void (*due)(const ScheduleSlot *group, uint8_t count, void *ctx);                  // A group starts alerting
+    void (*answered)(const ScheduleSlot &last, uint8_t count, bool taken, void *ctx); // Its responses are recorded
+    void (*queued)(void *ctx);                 // An event went into the outbox
+    bool (*connected)(void *ctx);              // A peer to send the finished schedule to
+    void *ctx;
+};
+
+// The reminder state machine between the schedule store and the motor.
+//
+// processSchedule() arms a timer for the head of the store's due-time
+// window; when it fires, everything due within COALESCE_WINDOW_MS joins
+// one alert: vibrate, wait RESPONSE_TIMEOUT_MS for a press, snooze
+// REREMIND_INTERVAL_MS and try again up to REMINDER_MAX_ATTEMPTS times,
+// then record the group as missed. Responses go to the store and the
+// outbox and are written by the write-back cache together with the uptime
+// checkpoint, whose regions begin() registers. restore() recovers the
+// schedule clock after a boot.
+//
+// Both the firmware and the fleet simulator run this; the motor, the LED,
+// the radio and the status record stay behind ReminderHooks. Loop-only.
+class ReminderEngine
+{
+public:
+    ReminderEngine(fs::FS &fs, ScheduleStore &store, ScheduleIngest &ingest, TimerWheel &timers,
+                   Persistence &persistence, EventOutbox &outbox)
+        : _fs(fs), _store(store), _ingest(ingest), _timers(timers), _persistence(persistence), _outbox(outbox)
+    {
+    }
+
+    // Registers PERSIST_SCHEDULE and PERSIST_MILLIS and starts the checkpoint
+    void begin(const ReminderHooks &hooks);
+
+    // Takes over a schedule loaded from flash (loaded = false: there is none)
+    // and moves its origin onto this boot's millis()
+    void restore(bool loaded);
+
+    // One loop pass: drops a replaced schedule's alert, looks for the next reminder
+    void service();
+    bool pending() const { return _rescan || _replaced; } // service() has work right away
+
+    // A user press; false unless a group is waiting for one
+    bool press();
+
+    // One step of the upload begun on the ingest
+    UploadResult stepUpload();
+    // The active reminder may have moved or gone (patched in place): rescan
+    void reschedule() { _replaced = true; }
+    // The store lost its schedule (a failed patch reload)
+    void unload();
+
+    // Queues an event stamped with the schedule clock; the caller marks PERSIST_OUTBOX dirty
+    void queueEvent(uint8_t type, uint8_t state, uint16_t slot, uint32_t offsetSec);
+
+    // Logs the countdown to the next reminder; rescans if it has no timer
+    void countdown();
+    // Marks the uptime checkpoint dirty now, so a flush before a clean
+    // restart loses no schedule time
+    void checkpoint();
+
+    ReminderState state() const { return _state; }
+    void setState(ReminderState state) { _state = state; }
+    bool loaded() const { return _loaded && _store.isLoaded(); }
+    uint32_t receiveTime() const { return _receiveTime; }
+    bool alerting() const { return _groupCount > 0; }
+
+private:
+    // MILLIS_COUNTER_FILENAME. Older firmware wrote the millis field alone.
+    struct Checkpoint
+    {
+        uint32_t millis;      // millis() when it was taken
+        uint32_t origin;      // Schedule origin on the same clock (rebased at every boot)
+        uint32_t storeOrigin; // The store's originalReceiveTime, which ties it to that schedule
+    };
+
+    void processSchedule();
+    void startAlert();
+    bool armPhase(uint32_t delayMs, TimerCallback callback);
+    void recordResponse(bool taken);
+    void cancelAlert();
+
+    bool saveMillisCounter(uint32_t currentMillis);
+    bool loadMillisCounter(Checkpoint &out);
+
+    static void onReminderDue(void *ctx);
+    static void onVibrationDone(void *ctx);
+    static void onReRemind(void *ctx);
+    static void onResponseTimeout(void *ctx);
+    static void onMillisCheckpoint(void *ctx);
+    static bool writeScheduleRegion(void *ctx);
+    static bool writeMillisRegion(void *ctx);
+
+    fs::FS &_fs;
+    ScheduleStore &_store;
+    ScheduleIngest &_ingest;
+    TimerWheel &_timers;
+    Persistence &_persistence;
+    EventOutbox &_outbox;
+    ReminderHooks _hooks = {};
+
+    ReminderState _state = STATE_IDLE;
+    bool _loaded = false;
+    uint32_t _receiveTime = 0; // millis() at the schedule origin, this boot
+
+    // Reminders being vibrated / waiting for a response
+    ScheduleSlot _group[REMINDER_GROUP_MAX];
+    uint8_t _groupCount = 0;
+    uint8_t _attempt = 0; // Vibrations so far for _group
+
+    bool _rescan = false;   // Look for the next due reminder
+    bool _replaced = false; // A new schedule was committed
+
+    TimerId _reminderTimer = TIMER_NONE;   // Next reminder due
+    TimerId _phaseTimer = TIMER_NONE;      // Vibration end / response timeout / re-remind
+    TimerId _checkpointTimer = TIMER_NONE; // Uptime checkpoint
+};
+
+#endif // PIPLI_REMINDER_ENGINE_H
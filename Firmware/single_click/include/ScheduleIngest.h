@@ -0,0 +1,132 @@
+#ifndef PIPLI_SCHEDULE_INGEST_H
+#define PIPLI_SCHEDULE_INGEST_H
+
+#include <Arduino.h>
+#include "ScheduleStore.h"
+
+// --- Ingest Settings ---
+#ifndef INGEST_SLICE_TOKENS
+#define INGEST_SLICE_TOKENS 48 // JSON tokens parsed (and slots written) per step
+#endif
+
+enum IngestStatus : uint8_t
+{
+    INGEST_IDLE,
+    INGEST_PARSING,   // Upload being parsed into the store's build
+    INGEST_PARSED,    // Whole upload in the build; commit() or abort() next
+    INGEST_INDEXING,  // Build sealed, due-time index being sorted
+    INGEST_COMMITTED, // New schedule swapped in and loaded
+    INGEST_FAILED,    // Build dropped; the old schedule is untouched
+};
+
+// Turns a full schedule upload into a store build a slice at a time.
+//
+// The upload is [{"med_id":"X","times":["3600",7200,...]},...]; other keys
+// are skipped, and a "times" array ahead of its "med_id" is read again once
+// the entry ends. Offsets are parsed like jsonOffset() in main.cpp. Each
+// step() handles at most INGEST_SLICE_TOKENS tokens or one index pass, so
+// the loop keeps running timers and buttons in between; the store only swaps
+// in the new schedule when the last step commits it.
+//
+// The upload must stay untouched until the ingest ends. Loop-only.
+class ScheduleIngest
+{
+public:
+    explicit ScheduleIngest(ScheduleStore &store) : _store(store) {}
+
+    bool begin(const char *data, size_t len, uint32_t receiveTime);
+    IngestStatus step();
+    // After INGEST_PARSED: seal the build; the following steps index and commit it
+    void commit();
+    void abort();
+
+    IngestStatus status() const { return _status; }
+    bool active() const { return _status == INGEST_PARSING || _status == INGEST_PARSED || _status == INGEST_INDEXING; }
+    uint32_t receiveTime() const { return _receiveTime; }
+    // ScheduleStore::contentHash() of the upload, complete once parsed
+    uint32_t hash() const { return _hash; }
+
+private:
+    enum TokenType : uint8_t
+    {
+        TOKEN_END, // Out of data
+        TOKEN_ERROR,
+        TOKEN_BEGIN_ARRAY,
+        TOKEN_END_ARRAY,
+        TOKEN_BEGIN_OBJECT,
+        TOKEN_END_OBJECT,
+        TOKEN_COLON,
+        TOKEN_COMMA,
+        TOKEN_STRING, // start/len cover the raw text between the quotes
+        TOKEN_NUMBER,
+        TOKEN_LITERAL, // true, false or null
+    };
+
+    struct Token
+    {
+        TokenType type;
+        size_t start;
+        size_t len;
+    };
+
+    enum ParseState : uint8_t
+    {
+        PARSE_SCHEDULE,     // '['
+        PARSE_MED_OR_END,   // '{' or ']'
+        PARSE_MED,          // '{'
+        PARSE_AFTER_MED,    // ',' or ']'
+        PARSE_KEY_OR_END,   // key or '}'
+        PARSE_KEY,          //
+        PARSE_COLON,        //
+        PARSE_VALUE,        // Value of _key
+        PARSE_AFTER_VALUE,  // ',' or '}'
+        PARSE_TIME_OR_END,  // offset or ']'
+        PARSE_TIME,         //
+        PARSE_AFTER_TIME,   // ',' or ']'
+        PARSE_SKIP,         // Inside an array or object nobody reads
+    };
+
+    enum Key : uint8_t
+    {
+        KEY_OTHER,
+        KEY_MED_ID,
+        KEY_TIMES,
+    };
+
+    void nextToken(Token &token);
+    size_t decodeString(const Token &token, char *out, size_t size) const;
+    bool consume(const Token &token);
+    bool onValue(const Token &token);
+    bool skipValue(const Token &token, ParseState next);
+    void startMed();
+    bool ensureMed();
+    bool endMed();
+    bool addTime(const Token &token);
+    void endTimes();
+    void fail();
+
+    ScheduleStore &_store;
+    IngestStatus _status = INGEST_IDLE;
+    uint32_t _receiveTime = 0;
+    uint32_t _hash = 0;
+
+    const char *_data = nullptr;
+    size_t _len = 0;
+    size_t _pos = 0;
+    ParseState _state = PARSE_SCHEDULE;
+    ParseState _skipNext = PARSE_SCHEDULE; // Where PARSE_SKIP returns to
+    uint16_t _skipDepth = 0;
+    Key _key = KEY_OTHER;
+
+    // Current med entry
+    char _medId[SCHEDULE_MED_ID_LEN + 1] = {}; // One extra byte so the store sees (and logs) truncation
+    char _keptId[SCHEDULE_MED_ID_LEN] = {};    // What the store keeps, for the hash
+    bool _hasMedId = false;
+    bool _hasTimes = false;
+    int _med = -1;
+    size_t _timesAt = SIZE_MAX; // '[' of a "times" read before "med_id"
+    size_t _resumeAt = 0;       // Where parsing continues after reading it
+    bool _replaying = false;
+};
+
+#endif // PIPLI_SCHEDULE_INGEST_H
@@ -0,0 +1,221 @@
+#ifndef PIPLI_SCHEDULE_STORE_H
+#define PIPLI_SCHEDULE_STORE_H
+
+#include <Arduino.h>
+#include "FS.h"
+
+// --- Schedule Store Settings ---
+// Capacities can be overridden per env through build_flags.
+#ifndef SCHEDULE_MAX_MEDS
+#define SCHEDULE_MAX_MEDS 32 // Medications held in the (RAM resident) med table
+#endif
+#ifndef SCHEDULE_MED_ID_LEN
+#define SCHEDULE_MED_ID_LEN 24 // Bytes per med_id including the terminator
+#endif
+#ifndef SCHEDULE_WINDOW_SIZE
+#define SCHEDULE_WINDOW_SIZE 8 // Upcoming reminders kept in RAM
+#endif
+#ifndef SCHEDULE_INDEX_BATCH
+#define SCHEDULE_INDEX_BATCH 64 // Keys sorted per pass when (re)building the due-time index
+#endif
+#ifndef SCHEDULE_DIRTY_MAX
+#define SCHEDULE_DIRTY_MAX 16 // Unflushed slot state changes before a forced write
+#endif
+
+#define SCHEDULE_STORE_FILENAME "/schedule.bin"
+#define SCHEDULE_INDEX_FILENAME "/schedule.idx"
+#define SCHEDULE_TMP_SUFFIX ".tmp"
+
+// Response state of one reminder slot, stored as a single byte on flash
+enum SlotState : uint8_t
+{
+    SLOT_MISSED = 0,     // "responded": false
+    SLOT_TAKEN = 1,      // "responded": true
+    SLOT_PENDING = 0xFF, // "responded": null
+};
+
+// Slot record flags
+#define SLOT_FLAG_REMOVED 0x0001 // Tombstone left by a patch; skipped everywhere
+
+// One reminder as seen by the scheduler
+struct ScheduleSlot
+{
+    uint16_t slot;      // Record number in the store file
+    uint32_t offsetSec; // Due offset relative to originalReceiveTime
+    uint8_t med;        // Index into the med table
+    uint8_t state;      // SlotState
+};
+
+// Flash-backed schedule.
+//
+// The schedule lives in SCHEDULE_STORE_FILENAME as a header, a fixed-size
+// med table and one 8-byte record per reminder slot in upload order.
+// SCHEDULE_INDEX_FILENAME holds the slot numbers sorted by due time. Only the
+// med table and a window of the next SCHEDULE_WINDOW_SIZE pending reminders
+// are kept in RAM; the window is refilled by streaming the index forward as
+// reminders are consumed, so schedule size is bounded by flash, not heap.
+//
+// Patches edit a copy of the store: added slots are appended, removed slots
+// and meds become tombstones, and changed offsets are rewritten where they
+// are. The copy gets its header last and replaces the store like a build, so
+// losing power mid-patch leaves the old schedule whole. The index is only
+// rebuilt when the due order changed, and every slot keeps its response state.
+class ScheduleStore
+{
+public:
+    explicit ScheduleStore(fs::FS &fs) : _fs(fs) {}
+
+    // --- Loading ---
+    bool load();
+    void unload();
+    bool isLoaded() const { return _loaded; }
+    void remove();
+
+    // --- Building a new schedule (replaces the current one on commit) ---
+    // commitBuild() seals the build, sorts its index and swaps it in at once.
+    // To spread the sort over several calls, sealBuild() and then indexStep()
+    // (one SCHEDULE_INDEX_BATCH per call) until indexDone() before committing.
+    bool beginBuild(uint32_t originalReceiveTime);
+    int addMed(const char *medId);
+    bool addSlot(uint8_t med, uint32_t offsetSec, uint8_t state = SLOT_PENDING);
+    bool sealBuild();
+    bool indexStep();
+    bool indexDone() const { return _sealed && _indexBuild.done; }
+    bool commitBuild();
+    void abortBuild();
+
+    // --- Runtime access ---
+    bool peekNext(ScheduleSlot &out);
+    // Copies the earliest pending reminders due at or before untilOffsetSec
+    // (at most maxCount, never more than SCHEDULE_WINDOW_SIZE). Returns the count.
+    uint8_t peekDue(ScheduleSlot *out, uint8_t maxCount, uint32_t untilOffsetSec);
+    bool setState(uint16_t slot, uint8_t state);
+    bool flushDirty();
+    bool hasDirty() const { return _dirtyCount > 0; }
+
+    uint16_t medCount() const { return _header.medCount; }
+    uint16_t slotCount() const { return _header.slotCount; }
+    uint16_t pendingCount() const { return _pendingCount; }
+    uint16_t missedCount() const { return _missedCount; }
+    uint32_t originalReceiveTime() const { return _header.originalReceiveTime; }
+    const char *medId(uint8_t med) const;
+
+    // --- Content identity ---
+    // The hash covers what the app uploads (med_ids and their times), not
+    // responses, and ignores order: it is the sum of hashMed() over live meds
+    // and hashSlot() over live slots, so patches and uploads of the same
+    // content agree. The generation counts committed uploads and patches.
+    static uint32_t hashMed(const char *medId);
+    static uint32_t hashSlot(const char *medId, uint32_t offsetSec);
+    uint32_t contentHash() const { return _contentHash; }
+    uint32_t generation() const { return _header.generation; }
+
+    // --- Patching the loaded schedule ---
+    bool beginPatch();
+    int findMed(const char *medId) const;
+    int findSlot(uint8_t med, uint32_t offsetSec);
+    int patchAddMed(const char *medId);
+    bool patchRemoveMed(uint8_t med);
+    bool patchAddSlot(uint8_t med, uint32_t offsetSec);
+    bool patchRemoveSlot(uint16_t slot);
+    bool patchSetOffset(uint16_t slot, uint32_t offsetSec);
+    bool commitPatch();
+
+    // Streams the schedule as {"schedule":[...],"originalReceiveTime":N}
+    size_t writeJson(Print &out);
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t medCount;
+        uint16_t slotCount;
+        uint16_t medCapacity; // Size of the med table region on flash
+        uint32_t originalReceiveTime;
+        uint32_t buildId; // Ties the index file to this store file
+        uint32_t generation;
+    };
+
+    struct SlotRecord
+    {
+        uint32_t offsetSec;
+        uint8_t med;
+        uint8_t state;
+        uint16_t flags;
+    };
+
+    struct IndexHeader
+    {
+        uint32_t magic;
+        uint16_t slotCount;
+        uint16_t reserved;
+        uint32_t buildId;
+    };
+
+    // An index being written, one pass of the store per indexPass()
+    struct IndexBuild
+    {
+        File store;
+        File index;
+        Header header = {};
+        uint64_t lastKey = 0;
+        uint32_t written = 0;
+        bool first = true;
+        bool done = false;
+    };
+
+    struct DirtySlot
+    {
+        uint16_t slot;
+        uint8_t state;
+    };
+
+    static size_t slotPosition(const Header &header, uint16_t slot);
+
+    bool readSlot(File &file, uint16_t slot, SlotRecord &out);
+    bool rebuildIndex(const char *storePath, const char *indexPath, const Header &header);
+    bool openIndex(IndexBuild &build, const char *storePath, const char *indexPath, const Header &header);
+    bool indexPass(IndexBuild &build);
+    static void closeIndex(IndexBuild &build);
+    bool indexMatches(const Header &header);
+    void refillWindow();
+    uint8_t overlayState(uint16_t slot, uint8_t state) const;
+    bool copyFile(const char *fromPath, const char *toPath);
+    bool commitFile(const char *tmpPath, const char *path);
+    void recoverFile(const char *tmpPath, const char *path);
+    bool patchWrite(size_t position, const void *data, size_t len);
+
+    fs::FS &_fs;
+    bool _loaded = false;
+    Header _header = {};
+    char _medIds[SCHEDULE_MAX_MEDS][SCHEDULE_MED_ID_LEN] = {};
+
+    // Window of upcoming pending reminders, ascending by due time.
+    // Every pending slot before _cursor in the index is in the window.
+    ScheduleSlot _window[SCHEDULE_WINDOW_SIZE] = {};
+    uint8_t _windowCount = 0;
+    uint16_t _cursor = 0;
+    uint16_t _pendingCount = 0;
+    uint16_t _missedCount = 0;
+    uint32_t _contentHash = 0;
+
+    DirtySlot _dirty[SCHEDULE_DIRTY_MAX] = {};
+    uint8_t _dirtyCount = 0;
+
+    // Patch state
+    File _patchFile;
+    bool _patching = false;
+    bool _patchReorder = false; // Index order changed, rebuild on commit
+    uint16_t _patchWrites = 0;
+
+    // Build state
+    File _buildFile;
+    bool _building = false;
+    bool _sealed = false; // Header written, index in progress
+    Header _buildHeader = {};
+    char _buildMedIds[SCHEDULE_MAX_MEDS][SCHEDULE_MED_ID_LEN] = {};
+    IndexBuild _indexBuild;
+};
+
+#endif // PIPLI_SCHEDULE_STORE_H
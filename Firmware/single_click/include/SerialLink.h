@@ -0,0 +1,76 @@
+#ifndef PIPLI_SERIAL_LINK_H
+#define PIPLI_SERIAL_LINK_H
+
+#include <Arduino.h>
+
+// --- Serial Link Settings ---
+#ifndef SERIAL_LINK_MAX_PAYLOAD
+#define SERIAL_LINK_MAX_PAYLOAD 1024 // Largest frame payload in either direction
+#endif
+
+// --- Wire format ---
+// Each frame is COBS(type u8, payload, crc16 u16 little endian) between two
+// 0x00 delimiters. The CRC is CRC-16/CCITT-FALSE over type and payload. Log
+// text shares the UART but never contains 0x00, so a host splits the stream
+// on 0x00 and keeps whatever decodes with a valid CRC; the leading delimiter
+// cuts off a log line printed just before the frame. Every host frame gets
+// exactly one response frame, except the SEND_UPDATE and TRACE_DUMP
+// commands, whose frames run until their end marker.
+//
+// Host -> device
+#define LINK_CMD 0x01         // Text command, same strings as over BLE
+#define LINK_UPLOAD_PART 0x02 // Part of a schedule / patch upload, more follow
+#define LINK_UPLOAD_END 0x03  // Last part; the whole upload is handled like a BLE write
+#define LINK_STATUS_READ 0x04 // Asks for a LINK_STATUS frame
+#define LINK_EVENTS_ACK 0x05  // Outbox ack (the 0xE1 frame of EventOutbox.h), answered with LINK_EVENTS
+// Device -> host
+#define LINK_REPLY 0x81       // Text reply to a command
+#define LINK_STREAM 0x82      // Part of a SEND_UPDATE stream
+#define LINK_STREAM_END 0x83  // End of the stream: total bytes u32
+#define LINK_STATUS 0x84      // DeviceStatus record
+#define LINK_LOG_RECORDS 0x85 // LOG_FETCH: count * LogRecord
+#define LINK_TRACE 0x86       // TRACE_DUMP: one tasks / events frame (see Trace.h)
+#define LINK_EVENTS 0x87      // EVENTS: count * 0xE0 event frame, oldest unacknowledged first (0 = none left)
+
+#define SERIAL_LINK_OVERHEAD 3 // Type and CRC
+
+// Handles one received frame (in the caller of poll())
+typedef void (*LinkFrameHandler)(uint8_t type, const uint8_t *payload, size_t len, void *ctx);
+
+// Framed request/response link over a UART, for provisioning at high baud.
+//
+// poll() decodes whatever bytes have arrived and calls the handler once per
+// valid frame; it never blocks. send() writes a whole frame while holding
+// the logger's output lock so log lines never land inside a frame.
+// Both are loop-only.
+class SerialLink
+{
+public:
+    void begin(Stream &port, LinkFrameHandler handler, void *ctx = nullptr);
+
+    void poll();
+    bool send(uint8_t type, const uint8_t *payload, size_t len);
+
+    uint32_t framesReceived() const { return _framesReceived; }
+    uint32_t badFrames() const { return _badFrames; }
+
+private:
+    void onDelimiter();
+
+    Stream *_port = nullptr;
+    LinkFrameHandler _handler = nullptr;
+    void *_handlerCtx = nullptr;
+
+    // One encoded frame: COBS adds a byte per 254 plus one, then two delimiters
+    static constexpr size_t MAX_ENCODED = SERIAL_LINK_MAX_PAYLOAD + SERIAL_LINK_OVERHEAD +
+                                          (SERIAL_LINK_MAX_PAYLOAD + SERIAL_LINK_OVERHEAD) / 254 + 3;
+    uint8_t _rx[MAX_ENCODED];
+    size_t _rxLength = 0;
+    bool _rxOverflow = false;
+    uint8_t _tx[MAX_ENCODED];
+
+    uint32_t _framesReceived = 0;
+    uint32_t _badFrames = 0;
+};
+
+#endif // PIPLI_SERIAL_LINK_H
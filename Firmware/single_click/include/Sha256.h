@@ -0,0 +1,28 @@
+#ifndef PIPLI_SHA256_H
+#define PIPLI_SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+// SHA-256 (FIPS 180-4). Plain C++ without Arduino headers, so the OTA
+// receiver that uses it also builds in the native env.
+class Sha256
+{
+public:
+    Sha256();
+
+    void update(const uint8_t *data, size_t len);
+    void finish(uint8_t out[SHA256_LEN]);
+
+private:
+    void compress(const uint8_t *block);
+
+    uint32_t _state[8];
+    uint64_t _length = 0; // Bytes hashed so far
+    uint8_t _buffer[64];
+    size_t _used = 0;
+};
+
+#endif // PIPLI_SHA256_H
@@ -0,0 +1,36 @@
+#ifndef PIPLI_STATIC_QUEUE_H
+#define PIPLI_STATIC_QUEUE_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+
+// FreeRTOS queue of Length items of T whose storage is part of the object,
+// so a global queue is sized by the linker instead of the heap.
+// send() never blocks and is safe from any task; receive() may wait.
+template <typename T, size_t Length>
+class StaticQueue
+{
+public:
+    bool begin()
+    {
+        _handle = xQueueCreateStatic(Length, sizeof(T), _storage, &_control);
+        return _handle != nullptr;
+    }
+
+    bool send(const T &item) { return _handle != nullptr && xQueueSend(_handle, &item, 0) == pdPASS; }
+
+    bool receive(T &out, TickType_t ticks)
+    {
+        return _handle != nullptr && xQueueReceive(_handle, &out, ticks) == pdTRUE;
+    }
+
+    bool ready() const { return _handle != nullptr; }
+
+private:
+    StaticQueue_t _control;
+    uint8_t _storage[Length * sizeof(T)];
+    QueueHandle_t _handle = nullptr;
+};
+
+#endif // PIPLI_STATIC_QUEUE_H
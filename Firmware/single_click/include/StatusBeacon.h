@@ -0,0 +1,62 @@
+#ifndef PIPLI_STATUS_BEACON_H
+#define PIPLI_STATUS_BEACON_H
+
+#include <Arduino.h>
+
+// --- Beacon Settings ---
+// Bluetooth SIG company identifier that opens the manufacturer data.
+// 0xFFFF is reserved for testing; a shipped product uses its own.
+#ifndef STATUS_BEACON_COMPANY_ID
+#define STATUS_BEACON_COMPANY_ID 0xFFFF
+#endif
+
+// --- Beacon record (manufacturer-specific data, all integers little endian) ---
+//   0  company id u16           STATUS_BEACON_COMPANY_ID
+//   2  version u8               STATUS_BEACON_VERSION
+//   3  sequence u8              advances with every change of the fields below
+//   4  generation u16           low 16 bits of the schedule generation, 0 = none
+//   6  pending u16              reminders not yet answered
+//   8  missed u16               reminders recorded as missed
+//  10  last response slot u16   0xFFFF = none since boot
+//  12  last response state u8   SLOT_TAKEN / SLOT_MISSED
+//  13  battery u8               percent, 0xFF if not measured
+//  14  flags u8                 DEVICE_STATUS_FLAG_*
+// 15 bytes: with the "Pipli" name it fills 24 of the 31 scan response bytes.
+#define STATUS_BEACON_VERSION 1
+#define STATUS_BEACON_LEN 15
+
+// Connectionless summary for caregiver phones, sent as manufacturer data in
+// the scan response so a scan answers "was the morning dose taken?" without
+// connecting.
+//
+// Setters rewrite only their own bytes, and only when the value changed.
+// The sequence byte moves on with each change, so scanners that drop
+// repeated advertisements still see a new record. The loop calls the setters
+// every pass and hands data() to the transport when takeChanged() says so.
+// Everything is loop-only.
+class StatusBeacon
+{
+public:
+    StatusBeacon();
+
+    void setGeneration(uint32_t generation);
+    void setPending(uint16_t pending);
+    void setMissed(uint16_t missed);
+    void setLastResponse(uint16_t slot, uint8_t state);
+    void setBattery(uint8_t percent);
+    void setFlags(uint8_t flags);
+
+    // True once after any field changed
+    bool takeChanged();
+
+    const uint8_t *data() const { return _packed; }
+
+private:
+    void putU8(size_t offset, uint8_t value);
+    void putU16(size_t offset, uint16_t value);
+
+    uint8_t _packed[STATUS_BEACON_LEN];
+    bool _changed = true;
+};
+
+#endif // PIPLI_STATUS_BEACON_H
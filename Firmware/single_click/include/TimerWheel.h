@@ -0,0 +1,92 @@
+#ifndef PIPLI_TIMER_WHEEL_H
+#define PIPLI_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+// --- Timer Service Settings ---
+#ifndef TIMER_TICK_MS
+#define TIMER_TICK_MS 10 // Resolution of every deadline in the firmware
+#endif
+#ifndef TIMER_POOL_SIZE
+#define TIMER_POOL_SIZE 32 // Timers that can be armed at the same time
+#endif
+static_assert(TIMER_POOL_SIZE <= 127, "Pool indices are int8_t");
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS) // 64 slots per level
+
+// Handle to an armed timer. 0 is never a valid id, so it can be used as
+// "not armed". Ids carry a generation, so cancelling a timer that already
+// fired (and whose pool entry was reused) is harmless.
+typedef uint16_t TimerId;
+#define TIMER_NONE 0
+
+typedef void (*TimerCallback)(void *ctx);
+
+// Hierarchical timing wheel.
+//
+// Four levels of 64 slots cover 64^4 ticks (about 46 hours at 10 ms).
+// Longer delays park in the last level and are re-placed when they cascade.
+// schedule() and cancel() are O(1); advance() only visits ticks where a
+// slot is occupied or a higher level has to cascade, so catching up after a
+// long sleep is cheap. All calls must come from the same task (the main loop).
+class TimerWheel
+{
+public:
+    void begin(uint32_t nowMs);
+
+    // Arms a one-shot timer (periodMs = 0) or a periodic timer.
+    // TIMER_NONE (and an error log) if every pool entry is armed.
+    TimerId schedule(uint32_t delayMs, TimerCallback callback, void *ctx, uint32_t nowMs, uint32_t periodMs = 0);
+    bool cancel(TimerId id);
+    bool isArmed(TimerId id) const;
+
+    // Re-arms id if it is armed, otherwise schedules a new timer. Returns the id to keep.
+    TimerId reschedule(TimerId id, uint32_t delayMs, TimerCallback callback, void *ctx, uint32_t nowMs);
+
+    // Runs every timer that expired up to nowMs. Returns the number fired.
+    uint16_t advance(uint32_t nowMs);
+
+    // Milliseconds until the earliest armed timer (UINT32_MAX if none)
+    uint32_t msUntilNextDeadline(uint32_t nowMs) const;
+
+    // Milliseconds until one timer fires (UINT32_MAX if it is not armed)
+    uint32_t msUntil(TimerId id, uint32_t nowMs) const;
+
+    uint8_t armedCount() const { return _armed; }
+
+private:
+    struct Timer
+    {
+        uint32_t expires; // Absolute tick
+        uint32_t periodTicks;
+        TimerCallback callback;
+        void *ctx;
+        int8_t prev;
+        int8_t next;
+        uint8_t level;
+        uint8_t slot;
+        uint8_t generation;
+        bool active;
+    };
+
+    static uint32_t ticksFor(uint32_t ms) { return (ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS; }
+    static TimerId makeId(uint8_t index, uint8_t generation) { return ((TimerId)generation << 8) | index; }
+    int indexOf(TimerId id) const;
+    uint32_t ticksToMs(uint32_t ticks, uint32_t nowMs) const;
+
+    void place(int index);
+    void unlink(int index);
+    void cascade(uint8_t level);
+    uint16_t runTick();
+
+    Timer _timers[TIMER_POOL_SIZE] = {};
+    int8_t _heads[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t _occupied[TIMER_WHEEL_LEVELS] = {};
+    uint32_t _tick = 0;     // Current tick
+    uint32_t _tickMs = 0;   // millis() value that corresponds to _tick
+    uint8_t _armed = 0;
+};
+
+#endif // PIPLI_TIMER_WHEEL_H
@@ -0,0 +1,143 @@
+#ifndef PIPLI_TRACE_H
+#define PIPLI_TRACE_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// --- Trace Settings ---
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1 // 0 compiles every TRACE_SPAN out
+#endif
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS 512 // Begin/end events kept in RAM (8 bytes each)
+#endif
+#if !TRACE_ENABLED
+#undef TRACE_EVENTS
+#define TRACE_EVENTS 1 // Nothing is recorded, so keep the ring out of RAM
+#endif
+#define TRACE_MAX_TASKS 8 // Tasks that get their own track; later ones share TRACE_TASK_OTHER
+#define TRACE_TASK_NAME_LEN 16
+#define TRACE_TASK_OTHER 0xFF
+
+// --- Wire format (all integers little endian) ---
+// "TRACE_DUMP" answers with frames of the same layout over BLE notifications
+// and over the serial link (LINK_TRACE):
+//   0xB2 tasks:  op u8, count u8, count * (id u8, name char[16], NUL padded)
+//   0xB1 events: op u8, count u8, count * TraceEvent
+// All task frames come first. An events frame with count 0 ends the dump.
+// tools/trace2chrome.py turns a dump into Chrome trace JSON for Perfetto.
+#define TRACE_OP_EVENTS 0xB1
+#define TRACE_OP_TASKS 0xB2
+#define TRACE_EVENT_LEN 8
+#define TRACE_TASK_LEN (1 + TRACE_TASK_NAME_LEN)
+
+// Span names; tools/trace2chrome.py keeps the same table
+enum TraceName : uint8_t
+{
+    TRACE_LOOP_WAIT = 1,        // Loop asleep until a deadline or event
+    TRACE_TIMERS = 2,           // Expired timer callbacks
+    TRACE_PROCESS_SCHEDULE = 3, //
+    TRACE_HANDLE_RECEIVED = 4,  // One ingest step of an upload, arg = IngestStatus
+    TRACE_SAVE_SCHEDULE = 5,    // Dirty response states written
+    TRACE_SAVE_MILLIS = 6,      // Uptime checkpoint written
+    TRACE_FLUSH = 7,            // Persistence flush, arg = region mask
+    TRACE_STORE_COMMIT = 8,     // New schedule written by the store, arg = 1 for a patch
+    TRACE_SEND_UPDATE = 9,      // arg = ReplyRoute
+    TRACE_SEND_CHUNK = 10,      // One notification or link frame of SEND_UPDATE
+    TRACE_BLE_CONNECT = 11,     //
+    TRACE_BLE_DISCONNECT = 12,  //
+    TRACE_BLE_WRITE = 13,       // arg = BleChannel
+    TRACE_BLE_READ = 14,        // arg = BleChannel
+    TRACE_BLE_SUBSCRIBE = 15,   // arg = BleChannel
+    TRACE_BLE_MTU = 16,         //
+    TRACE_SERIAL_FRAME = 17,    // arg = link frame type
+    TRACE_OUTBOX_SAVE = 18,     // Event outbox written
+    TRACE_OTA = 19,             // One OTA frame handled, arg = op
+};
+
+enum TracePhase : uint8_t
+{
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+};
+
+struct TraceEvent
+{
+    uint32_t us; // esp_timer_get_time(), wraps after ~71 minutes
+    uint8_t name;
+    uint8_t phase;
+    uint8_t task; // Index into the task table, or TRACE_TASK_OTHER
+    uint8_t arg;
+};
+
+// Span recorder.
+//
+// begin()/end() append an event to a ring of TRACE_EVENTS, overwriting the
+// oldest, and cost a critical section and a timer read each. The timestamp is
+// taken inside the lock, so the ring is in time order across tasks and cores.
+// Each recording task gets a track in the task table the first time it records.
+//
+// startDump() freezes the ring; readFrame() then hands out the wire frames
+// one by one and recording resumes after the last one. Events arriving while
+// a dump runs are not recorded.
+//
+// begin()/end() are safe from any task; not from ISRs. The dump calls must
+// come from one task.
+class Tracer
+{
+public:
+    void begin(uint8_t name, uint8_t arg = 0) { record(name, TRACE_PHASE_BEGIN, arg); }
+    void end(uint8_t name, uint8_t arg = 0) { record(name, TRACE_PHASE_END, arg); }
+
+    // Returns false if a dump is already running
+    bool startDump();
+    void cancelDump(); // Peer gone: drop the rest and record again
+    bool dumping() const { return _dumping; }
+
+    // Writes the next frame of the dump into out (at most room bytes) and
+    // returns its length, or 0 once the end marker has been handed out.
+    size_t readFrame(uint8_t *out, size_t room);
+
+    uint32_t dropped() const { return _dropped; } // Events overwritten before a dump
+
+private:
+    void record(uint8_t name, uint8_t phase, uint8_t arg);
+    uint8_t taskIndex(TaskHandle_t task);
+
+    portMUX_TYPE _lock = portMUX_INITIALIZER_UNLOCKED;
+    TraceEvent _events[TRACE_EVENTS];
+    uint16_t _head = 0; // Oldest event
+    uint16_t _count = 0;
+    uint32_t _dropped = 0;
+    TaskHandle_t _tasks[TRACE_MAX_TASKS] = {};
+    uint8_t _taskCount = 0;
+
+    volatile bool _dumping = false;
+    uint8_t _tasksSent = 0;
+    uint16_t _eventsSent = 0;
+};
+
+extern Tracer tracer;
+
+#if TRACE_ENABLED
+// Records a span from here to the end of the enclosing scope
+class TraceSpan
+{
+public:
+    explicit TraceSpan(uint8_t name, uint8_t arg = 0) : _name(name), _arg(arg) { tracer.begin(name, arg); }
+    ~TraceSpan() { tracer.end(_name, _arg); }
+
+private:
+    uint8_t _name;
+    uint8_t _arg;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SPAN(...) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...) do { } while (0)
+#endif
+
+#endif // PIPLI_TRACE_H
@@ -0,0 +1,281 @@
+#ifndef PIPLI_SIM_FS_H
+#define PIPLI_SIM_FS_H
+
+// In-memory flash file system, one per simulated device.
+//
+// Behaves like LittleFS where the firmware depends on it: what a file holds
+// changes only when a writer closes (or flushes) it, readers see the last
+// committed contents, and a power cut drops everything still open. Writes
+// fail once the files would outgrow the partition. Every byte written and
+// every file committed is counted for the fleet report.
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode
+{
+    SeekSet,
+    SeekCur,
+    SeekEnd,
+};
+
+struct FlashStats
+{
+    uint64_t bytesWritten = 0; // Bytes passed to write() that were accepted
+    uint32_t commits = 0;      // Files closed with new contents
+    uint32_t removes = 0;
+    uint32_t renames = 0;
+    uint32_t failedWrites = 0; // Writes refused because the partition was full
+};
+
+typedef std::shared_ptr<const std::vector<uint8_t>> Contents;
+
+class FS;
+
+struct FileHandle
+{
+    FS *fs = nullptr;
+    std::string path;
+    uint32_t powerEpoch = 0; // A power cut since open() orphans the handle
+    Contents committed;      // What readers see
+    std::vector<uint8_t> pending;
+    bool writable = false;
+    bool changed = false;
+    size_t pos = 0;
+
+    const std::vector<uint8_t> &data() const { return writable ? pending : *committed; }
+    void commit();
+    ~FileHandle() { commit(); }
+};
+
+class File : public Stream
+{
+public:
+    File() {}
+    explicit File(std::shared_ptr<FileHandle> handle) : _handle(std::move(handle)) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+
+    int available() override { return _handle ? (int)(_handle->data().size() - std::min(_handle->pos, _handle->data().size())) : 0; }
+    int read() override
+    {
+        uint8_t c;
+        return read(&c, 1) == 1 ? c : -1;
+    }
+    int peek() override
+    {
+        return available() > 0 ? _handle->data()[_handle->pos] : -1;
+    }
+    size_t read(uint8_t *buffer, size_t size)
+    {
+        size_t n = std::min<size_t>(size, available());
+        if (n > 0)
+        {
+            memcpy(buffer, _handle->data().data() + _handle->pos, n);
+            _handle->pos += n;
+        }
+        return n;
+    }
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet)
+    {
+        if (!_handle)
+        {
+            return false;
+        }
+        size_t base = mode == SeekSet ? 0 : (mode == SeekCur ? _handle->pos : _handle->data().size());
+        if (base + pos > _handle->data().size())
+        {
+            return false;
+        }
+        _handle->pos = base + pos;
+        return true;
+    }
+    size_t position() const { return _handle ? _handle->pos : 0; }
+    size_t size() const { return _handle ? _handle->data().size() : 0; }
+
+    void flush() override
+    {
+        if (_handle)
+        {
+            _handle->commit();
+        }
+    }
+    void close() { _handle.reset(); }
+    operator bool() const { return (bool)_handle; }
+
+private:
+    std::shared_ptr<FileHandle> _handle; // Copies share it, like Arduino's File
+};
+
+class FS
+{
+public:
+    explicit FS(size_t capacity) : _capacity(capacity) {}
+
+    File open(const char *path, const char *mode = FILE_READ, bool create = false)
+    {
+        (void)create;
+        auto handle = std::make_shared<FileHandle>();
+        handle->fs = this;
+        handle->path = path;
+        handle->powerEpoch = _powerEpoch;
+        auto it = _files.find(path);
+        bool found = it != _files.end();
+        handle->committed = found ? it->second : std::make_shared<std::vector<uint8_t>>();
+        if (strcmp(mode, "r") == 0 || strcmp(mode, "r+") == 0)
+        {
+            if (!found)
+            {
+                return File();
+            }
+            handle->writable = mode[1] == '+';
+        }
+        else if (strcmp(mode, "w") == 0 || strcmp(mode, "a") == 0)
+        {
+            handle->writable = true;
+            if (!found)
+            {
+                _files[path] = handle->committed; // The entry exists from open() on
+            }
+        }
+        else
+        {
+            return File();
+        }
+        if (handle->writable)
+        {
+            if (mode[0] != 'w')
+            {
+                handle->pending = *handle->committed;
+            }
+            handle->changed = mode[0] == 'w' && !handle->committed->empty();
+            handle->pos = mode[0] == 'a' ? handle->pending.size() : 0;
+        }
+        return File(handle);
+    }
+
+    bool exists(const char *path) const { return _files.count(path) > 0; }
+
+    bool remove(const char *path)
+    {
+        if (_files.erase(path) == 0)
+        {
+            return false;
+        }
+        _stats.removes++;
+        return true;
+    }
+
+    bool rename(const char *from, const char *to)
+    {
+        auto it = _files.find(from);
+        if (it == _files.end())
+        {
+            return false;
+        }
+        Contents contents = it->second;
+        _files.erase(it);
+        _files[to] = contents;
+        _stats.renames++;
+        return true;
+    }
+
+    size_t usedBytes() const
+    {
+        size_t used = 0;
+        for (const auto &file : _files)
+        {
+            used += file.second->size();
+        }
+        return used;
+    }
+    size_t capacity() const { return _capacity; }
+    void setCapacity(size_t capacity) { _capacity = capacity; }
+
+    // Drops every write still open, as losing power mid-write would
+    void cutPower() { _powerEpoch++; }
+
+    const FlashStats &stats() const { return _stats; }
+    const std::map<std::string, Contents> &files() const { return _files; }
+    void restore(const std::string &path, const std::vector<uint8_t> &contents)
+    {
+        _files[path] = std::make_shared<std::vector<uint8_t>>(contents);
+    }
+
+private:
+    friend struct FileHandle;
+    friend class File;
+
+    // Bytes the other files leave for this one
+    size_t roomFor(const std::string &path) const
+    {
+        size_t used = usedBytes();
+        auto it = _files.find(path);
+        if (it != _files.end())
+        {
+            used -= it->second->size();
+        }
+        return used < _capacity ? _capacity - used : 0;
+    }
+
+    std::map<std::string, Contents> _files;
+    size_t _capacity;
+    uint32_t _powerEpoch = 0;
+    FlashStats _stats;
+};
+
+inline void FileHandle::commit()
+{
+    if (fs == nullptr || !writable || !changed || powerEpoch != fs->_powerEpoch)
+    {
+        return;
+    }
+    committed = std::make_shared<std::vector<uint8_t>>(pending);
+    fs->_files[path] = committed;
+    fs->_stats.commits++;
+    changed = false;
+}
+
+inline size_t File::write(const uint8_t *buffer, size_t size)
+{
+    if (!_handle || !_handle->writable || size == 0)
+    {
+        return 0;
+    }
+    FileHandle &h = *_handle;
+    size_t end = h.pos + size;
+    if (end > h.pending.size() && end > h.fs->roomFor(h.path))
+    {
+        h.fs->_stats.failedWrites++;
+        return 0;
+    }
+    if (end > h.pending.size())
+    {
+        h.pending.resize(end);
+    }
+    memcpy(h.pending.data() + h.pos, buffer, size);
+    h.pos = end;
+    h.changed = true;
+    h.fs->_stats.bytesWritten += size;
+    return size;
+}
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif // PIPLI_SIM_FS_H
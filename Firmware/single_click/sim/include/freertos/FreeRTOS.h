@@ -0,0 +1,40 @@
+#ifndef PIPLI_SIM_FREERTOS_H
+#define PIPLI_SIM_FREERTOS_H
+
+// The simulator runs every device on one thread: critical sections and
+// mutexes have nothing to guard, and tasks are never started.
+
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+
+typedef struct
+{
+    uint8_t unused[4];
+} portMUX_TYPE;
+
+typedef struct
+{
+    uint8_t unused[4];
+} StaticSemaphore_t;
+
+typedef struct
+{
+    uint8_t unused[4];
+} StaticTask_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define portMAX_DELAY 0xFFFFFFFFu
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define portMUX_INITIALIZER_UNLOCKED {}
+
+inline void portENTER_CRITICAL(portMUX_TYPE *) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE *) {}
+
+#endif // PIPLI_SIM_FREERTOS_H
@@ -0,0 +1,16 @@
+#ifndef PIPLI_SIM_TASK_H
+#define PIPLI_SIM_TASK_H
+
+#include "FreeRTOS.h"
+
+#define tskIDLE_PRIORITY 0
+
+inline TaskHandle_t xTaskCreateStatic(void (*)(void *), const char *, uint32_t, void *, UBaseType_t, StackType_t *,
+                                      StaticTask_t *)
+{
+    return nullptr;
+}
+
+inline void vTaskDelay(TickType_t) {}
+
+#endif // PIPLI_SIM_TASK_H
@@ -0,0 +1,104 @@
+#include "BatteryMonitor.h"
+#include "Log.h"
+
+// --- Discharge curve ---
+// Resting voltage of a Li-ion/LiPo cell against remaining charge; straight
+// lines in between.
+struct CurvePoint
+{
+    uint16_t millivolts;
+    uint8_t percent;
+};
+
+static const CurvePoint DISCHARGE_CURVE[] = {
+    {4200, 100}, {4100, 90}, {4000, 78}, {3900, 65}, {3800, 50}, {3750, 40},
+    {3700, 30},  {3650, 20}, {3600, 12}, {3500, 5},  {3300, 0},
+};
+static const size_t DISCHARGE_POINTS = sizeof(DISCHARGE_CURVE) / sizeof(DISCHARGE_CURVE[0]);
+
+uint8_t BatteryMonitor::percentFor(uint16_t millivolts)
+{
+    if (millivolts >= DISCHARGE_CURVE[0].millivolts)
+    {
+        return 100;
+    }
+    for (size_t i = 1; i < DISCHARGE_POINTS; ++i)
+    {
+        const CurvePoint &hi = DISCHARGE_CURVE[i - 1];
+        const CurvePoint &lo = DISCHARGE_CURVE[i];
+        if (millivolts >= lo.millivolts)
+        {
+            return lo.percent + (uint32_t)(millivolts - lo.millivolts) * (hi.percent - lo.percent) /
+                                    (hi.millivolts - lo.millivolts);
+        }
+    }
+    return 0;
+}
+
+// --- Sampling ---
+
+bool BatteryMonitor::begin(int pin)
+{
+    _pin = pin;
+    if (pin < 0)
+    {
+        LOG_INFO("No battery pin; battery level unknown.");
+        return false;
+    }
+    analogSetPinAttenuation(pin, ADC_11db); // Full scale up to about 3.1 V at the pin
+    return true;
+}
+
+bool BatteryMonitor::sample()
+{
+    if (_pin < 0)
+    {
+        return false;
+    }
+    uint32_t sum = 0;
+    for (int i = 0; i < BATTERY_READS_PER_SAMPLE; ++i)
+    {
+        sum += analogReadMilliVolts(_pin); // Calibrated with the chip's eFuse values
+    }
+    uint32_t millivolts = sum / BATTERY_READS_PER_SAMPLE * BATTERY_DIVIDER_X100 / 100;
+
+    if (!_seeded)
+    {
+        _filtered = millivolts << BATTERY_EMA_SHIFT;
+        _seeded = true;
+    }
+    else
+    {
+        _filtered += millivolts - (_filtered >> BATTERY_EMA_SHIFT);
+    }
+    _percent = percentFor(this->millivolts());
+
+    BatteryTier tier = tierFor(_percent);
+    if (tier == _tier)
+    {
+        return false;
+    }
+    LOG_INFO("Battery %u mV (%u%%): tier %u -> %u", this->millivolts(), _percent, _tier, tier);
+    _tier = tier;
+    return true;
+}
+
+BatteryTier BatteryMonitor::tierFor(uint8_t percent) const
+{
+    if (percent <= BATTERY_CRITICAL_PERCENT)
+    {
+        return BATTERY_CRITICAL;
+    }
+    if (percent <= BATTERY_LOW_PERCENT)
+    {
+        // Climbing out of critical takes the hysteresis margin too
+        return _tier == BATTERY_CRITICAL && percent < BATTERY_CRITICAL_PERCENT + BATTERY_HYSTERESIS_PERCENT
+                   ? BATTERY_CRITICAL
+                   : BATTERY_LOW;
+    }
+    if (_tier != BATTERY_NORMAL && percent < BATTERY_LOW_PERCENT + BATTERY_HYSTERESIS_PERCENT)
+    {
+        return BATTERY_LOW;
+    }
+    return BATTERY_NORMAL;
+}
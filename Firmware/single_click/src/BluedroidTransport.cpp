@@ -0,0 +1,373 @@
+#include "BleTransport.h"
+
+#if !PIPLI_BLE_NIMBLE
+
+#include <BLEDevice.h>
+#include <BLEServer.h>
+#include <BLEUtils.h>
+#include <BLE2902.h>
+#include <BLESecurity.h>
+
+// --- Stack state ---
+// There is one transport per firmware, so its stack objects live here
+// rather than in the header; the NimBLE build never sees Bluedroid types.
+static BleTransportHandlers handlers = {};
+static BLEServer *server = NULL;
+static BLEService *service = NULL;
+static const char *advertisedUuid = NULL;
+static const char *advertisedName = NULL;
+static BLECharacteristic *characteristics[BLE_CHANNEL_COUNT] = {};
+static BLE2902 *cccds[BLE_CHANNEL_COUNT] = {};
+static volatile bool peerConnected = false;
+static volatile uint16_t peerMtu = BLE_DEFAULT_MTU;
+static volatile bool advertisingActive = false; // Bluedroid has no query for it
+static esp_bd_addr_t peerAddress = {};          // Connection parameter updates name the peer
+static volatile bool peerBondedFlag = false;
+
+static const int MAX_BONDS = 8; // CONFIG_BT_SMP_MAX_BONDS in the Arduino build
+
+// --- Callbacks ---
+
+class ServerCallbacks : public BLEServerCallbacks
+{
+    void onConnect(BLEServer *pServer)
+    {
+        peerConnected = true;
+        advertisingActive = false; // A connection ends advertising
+        if (handlers.onConnect)
+        {
+            handlers.onConnect();
+        }
+    }
+
+    // Bluedroid calls both onConnect overloads; this one carries the address
+    void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
+    {
+        memcpy(peerAddress, param->connect.remote_bda, sizeof(peerAddress));
+    }
+
+    void onDisconnect(BLEServer *pServer)
+    {
+        peerConnected = false;
+        peerBondedFlag = false;
+        peerMtu = BLE_DEFAULT_MTU;
+        // Bluedroid keeps CCCD values across connections; the next peer subscribes for itself
+        for (BLE2902 *cccd : cccds)
+        {
+            if (cccd != NULL)
+            {
+                cccd->setNotifications(false);
+            }
+        }
+        if (handlers.onDisconnect)
+        {
+            handlers.onDisconnect();
+        }
+    }
+
+    void onMtuChanged(BLEServer *pServer, esp_ble_gatts_cb_param_t *param)
+    {
+        peerMtu = param->mtu.mtu;
+        if (handlers.onMtuChanged)
+        {
+            handlers.onMtuChanged(peerMtu);
+        }
+    }
+};
+
+class ChannelCallbacks : public BLECharacteristicCallbacks
+{
+public:
+    void bind(BleChannel channel) { _channel = channel; }
+
+    void onWrite(BLECharacteristic *pCharacteristic)
+    {
+        if (handlers.onWrite)
+        {
+            handlers.onWrite(_channel, pCharacteristic->getValue());
+        }
+    }
+
+    void onRead(BLECharacteristic *pCharacteristic)
+    {
+        if (handlers.onRead)
+        {
+            handlers.onRead(_channel);
+        }
+    }
+
+private:
+    BleChannel _channel = BLE_CHANNEL_COUNT;
+};
+
+class CccdCallbacks : public BLEDescriptorCallbacks
+{
+public:
+    void bind(BleChannel channel) { _channel = channel; }
+
+    void onWrite(BLEDescriptor *pDescriptor)
+    {
+        if (handlers.onSubscribe)
+        {
+            handlers.onSubscribe(_channel, cccds[_channel]->getNotifications());
+        }
+    }
+
+private:
+    BleChannel _channel = BLE_CHANNEL_COUNT;
+};
+
+// Just Works: nothing to show or confirm, the link is encrypted and bonded
+class SecurityCallbacks : public BLESecurityCallbacks
+{
+    uint32_t onPassKeyRequest() { return 0; }
+    void onPassKeyNotify(uint32_t passKey) {}
+    bool onSecurityRequest() { return true; }
+    bool onConfirmPIN(uint32_t passKey) { return true; }
+
+    void onAuthenticationComplete(esp_ble_auth_cmpl_t result)
+    {
+        if (!result.success)
+        {
+            return;
+        }
+        peerBondedFlag = (result.auth_mode & ESP_LE_AUTH_BOND) != 0;
+        if (handlers.onSecured)
+        {
+            handlers.onSecured(peerBondedFlag);
+        }
+    }
+};
+
+// Static rather than new'd; the stack only keeps pointers to them
+static ServerCallbacks serverCallbacks;
+static SecurityCallbacks securityCallbacks;
+static ChannelCallbacks channelCallbacks[BLE_CHANNEL_COUNT];
+static CccdCallbacks cccdCallbacks[BLE_CHANNEL_COUNT];
+
+// --- Transport ---
+
+bool BleTransport::begin(const char *deviceName, const char *serviceUuid, uint16_t preferredMtu,
+                         const BleTransportHandlers &callbacks)
+{
+    handlers = callbacks;
+    BLEDevice::init(deviceName);
+    BLEDevice::setMTU(preferredMtu);
+    // Puts the bonded IRKs in the controller's resolving list, so the bond
+    // filter matches phones whose private address has rotated since bonding
+    esp_ble_gap_config_local_privacy(true);
+    BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT); // Every connection is asked to encrypt
+    BLEDevice::setSecurityCallbacks(&securityCallbacks);
+    BLESecurity security;
+    security.setAuthenticationMode(ESP_LE_AUTH_REQ_SC_BOND);
+    security.setCapability(ESP_IO_CAP_NONE);
+    security.setInitEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+    security.setRespEncryptionKey(ESP_BLE_ENC_KEY_MASK | ESP_BLE_ID_KEY_MASK);
+    server = BLEDevice::createServer();
+    server->setCallbacks(&serverCallbacks);
+    service = server->createService(serviceUuid);
+    advertisedUuid = serviceUuid;
+    advertisedName = deviceName;
+    return service != NULL;
+}
+
+bool BleTransport::addChannel(BleChannel channel, const char *uuid, uint8_t properties)
+{
+    if (service == NULL || channel >= BLE_CHANNEL_COUNT)
+    {
+        return false;
+    }
+    uint32_t bluedroidProperties = 0;
+    if (properties & BLE_PROP_READ)
+    {
+        bluedroidProperties |= BLECharacteristic::PROPERTY_READ;
+    }
+    if (properties & BLE_PROP_WRITE)
+    {
+        bluedroidProperties |= BLECharacteristic::PROPERTY_WRITE;
+    }
+    if (properties & BLE_PROP_WRITE_NR)
+    {
+        bluedroidProperties |= BLECharacteristic::PROPERTY_WRITE_NR;
+    }
+    if (properties & BLE_PROP_NOTIFY)
+    {
+        bluedroidProperties |= BLECharacteristic::PROPERTY_NOTIFY;
+    }
+    if (properties & BLE_PROP_INDICATE)
+    {
+        bluedroidProperties |= BLECharacteristic::PROPERTY_INDICATE;
+    }
+
+    BLECharacteristic *characteristic = service->createCharacteristic(uuid, bluedroidProperties);
+    channelCallbacks[channel].bind(channel);
+    characteristic->setCallbacks(&channelCallbacks[channel]);
+    if (properties & (BLE_PROP_NOTIFY | BLE_PROP_INDICATE))
+    {
+        BLE2902 *cccd = new BLE2902(); // Needed for notifications; owned by the characteristic like the rest of the GATT table
+        cccdCallbacks[channel].bind(channel);
+        cccd->setCallbacks(&cccdCallbacks[channel]);
+        characteristic->addDescriptor(cccd);
+        cccds[channel] = cccd;
+    }
+    characteristics[channel] = characteristic;
+    return true;
+}
+
+void BleTransport::start()
+{
+    service->start();
+    BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+    pAdvertising->addServiceUUID(advertisedUuid);
+    pAdvertising->setScanResponse(true);
+    pAdvertising->setMinPreferred(0x06);
+    pAdvertising->setMaxPreferred(0x12);
+    BLEDevice::startAdvertising();
+    advertisingActive = true;
+}
+
+void BleTransport::setValue(BleChannel channel, const uint8_t *data, size_t len)
+{
+    if (channel < BLE_CHANNEL_COUNT && characteristics[channel] != NULL)
+    {
+        characteristics[channel]->setValue((uint8_t *)data, len);
+    }
+}
+
+bool BleTransport::notify(BleChannel channel, const uint8_t *data, size_t len)
+{
+    if (!peerConnected || channel >= BLE_CHANNEL_COUNT || characteristics[channel] == NULL)
+    {
+        return false;
+    }
+    characteristics[channel]->setValue((uint8_t *)data, len);
+    characteristics[channel]->notify();
+    return true;
+}
+
+bool BleTransport::subscribed(BleChannel channel) const
+{
+    return peerConnected && channel < BLE_CHANNEL_COUNT && cccds[channel] != NULL &&
+           cccds[channel]->getNotifications();
+}
+
+void BleTransport::startAdvertising()
+{
+    if (server != NULL)
+    {
+        server->startAdvertising();
+        advertisingActive = true;
+    }
+}
+
+bool BleTransport::advertising() const
+{
+    return advertisingActive;
+}
+
+void BleTransport::setManufacturerData(const uint8_t *data, size_t len)
+{
+    // A custom scan response replaces the stack's own, so it carries the name too
+    BLEAdvertisementData scanResponse;
+    scanResponse.setName(advertisedName != NULL ? advertisedName : "");
+    scanResponse.setManufacturerData(std::string((const char *)data, len));
+    BLEDevice::getAdvertising()->setScanResponseData(scanResponse);
+}
+
+void BleTransport::setAdvertisingInterval(uint16_t minUnits, uint16_t maxUnits)
+{
+    BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+    pAdvertising->setMinInterval(minUnits);
+    pAdvertising->setMaxInterval(maxUnits);
+    if (advertisingActive && !peerConnected)
+    {
+        // The interval is part of the advertising parameters, applied on start
+        pAdvertising->stop();
+        pAdvertising->start();
+    }
+}
+
+bool BleTransport::requestConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout)
+{
+    if (!peerConnected || server == NULL)
+    {
+        return false;
+    }
+    server->updateConnParams(peerAddress, minInterval, maxInterval, latency, timeout);
+    return true;
+}
+
+void BleTransport::setPairing(bool open)
+{
+    bool filter = BLE_BOND_FILTER && !open && bondCount() > 0;
+    BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
+    bool restart = advertisingActive && !peerConnected;
+    if (restart)
+    {
+        // The controller refuses whitelist changes while it advertises
+        pAdvertising->stop();
+    }
+    esp_ble_gap_clear_whitelist();
+    if (filter)
+    {
+        esp_ble_bond_dev_t bonds[MAX_BONDS];
+        int count = MAX_BONDS;
+        if (esp_ble_get_bond_device_list(&count, bonds) == ESP_OK)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                esp_ble_wl_addr_type_t type =
+                    (bonds[i].bond_key.pid_key.addr_type & 1) ? BLE_WL_ADDR_TYPE_RANDOM : BLE_WL_ADDR_TYPE_PUBLIC;
+                // The identity address the type belongs to, not the address the bond was made from
+                esp_ble_gap_update_whitelist(true, bonds[i].bond_key.pid_key.static_addr, type);
+            }
+        }
+    }
+    pAdvertising->setScanFilter(false, filter);
+    if (restart)
+    {
+        pAdvertising->start();
+    }
+}
+
+uint8_t BleTransport::bondCount() const
+{
+    int count = esp_ble_get_bond_device_num();
+    return count > 0 ? (uint8_t)count : 0;
+}
+
+void BleTransport::clearBonds()
+{
+    esp_ble_bond_dev_t bonds[MAX_BONDS];
+    int count = MAX_BONDS;
+    if (esp_ble_get_bond_device_list(&count, bonds) != ESP_OK)
+    {
+        return;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        esp_ble_remove_bond_device(bonds[i].bd_addr);
+    }
+}
+
+bool BleTransport::peerBonded() const
+{
+    return peerBondedFlag;
+}
+
+bool BleTransport::connected() const
+{
+    return peerConnected;
+}
+
+uint16_t BleTransport::mtu() const
+{
+    return peerMtu;
+}
+
+const char *BleTransport::stackName() const
+{
+    return "Bluedroid";
+}
+
+#endif // !PIPLI_BLE_NIMBLE
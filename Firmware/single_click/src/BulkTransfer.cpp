@@ -0,0 +1,379 @@
+#include "BulkTransfer.h"
+#include "Log.h"
+
+#include <algorithm> // std::min
+
+#define META_MAGIC 0x52465850 // "PXFR"
+
+static_assert(XFER_WINDOW >= 1 && XFER_WINDOW <= 32, "Selective acks cover 32 chunks");
+
+// --- Helpers ---
+
+static void putU16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Print adapter that writes the snapshot while computing its CRC-32
+class SnapshotPrint : public Print
+{
+public:
+    explicit SnapshotPrint(File &file) : _file(file) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        size_t written = _file.write(buffer, size);
+        for (size_t i = 0; i < written; ++i)
+        {
+            _crc ^= buffer[i];
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                _crc = (_crc >> 1) ^ (0xEDB88320 & (0 - (_crc & 1)));
+            }
+        }
+        _length += written;
+        return written;
+    }
+
+    uint32_t crc32() const { return ~_crc; }
+    uint32_t length() const { return _length; }
+
+private:
+    File &_file;
+    uint32_t _crc = 0xFFFFFFFF;
+    uint32_t _length = 0;
+};
+
+// --- Meta file ---
+
+bool BulkTransfer::loadMeta()
+{
+    File file = _fs.open(XFER_META_FILENAME, FILE_READ);
+    Meta meta;
+    if (!file || file.read((uint8_t *)&meta, sizeof(meta)) != sizeof(meta) || meta.magic != META_MAGIC)
+    {
+        return false;
+    }
+    _meta = meta;
+    return true;
+}
+
+bool BulkTransfer::saveMeta()
+{
+    File file = _fs.open(XFER_META_FILENAME, FILE_WRITE);
+    if (!file || file.write((const uint8_t *)&_meta, sizeof(_meta)) != sizeof(_meta))
+    {
+        LOG_ERROR("Failed to write transfer meta file.");
+        return false;
+    }
+    return true;
+}
+
+// --- Session control ---
+
+void BulkTransfer::setSender(FrameSender sender, void *ctx)
+{
+    _sender = sender;
+    _senderCtx = ctx;
+}
+
+bool BulkTransfer::start(SnapshotWriter writer, void *ctx, uint16_t chunkSize, uint8_t codec)
+{
+    pause();
+
+    // Ids keep counting across transfers (and reboots) so a stale resume never matches
+    uint16_t id = loadMeta() ? _meta.id + 1 : (uint16_t)millis();
+    if (id == 0)
+    {
+        id = 1;
+    }
+
+    File file = _fs.open(XFER_SNAPSHOT_FILENAME, FILE_WRITE);
+    if (!file)
+    {
+        LOG_ERROR("Failed to create transfer snapshot.");
+        return false;
+    }
+    SnapshotPrint snapshot(file);
+    uint32_t startUs = micros();
+    size_t rawLength;
+    if (codec == CODEC_LZSS)
+    {
+        LzssEncoder encoder(snapshot);
+        writer(encoder, ctx);
+        encoder.finish();
+        rawLength = encoder.bytesIn();
+    }
+    else
+    {
+        codec = CODEC_NONE;
+        rawLength = writer(snapshot, ctx);
+    }
+    file.close();
+
+    _meta = {META_MAGIC, id, 0, codec, snapshot.length(), snapshot.crc32()};
+    _framesSent = _framesResent = 0;
+    if (!saveMeta())
+    {
+        return false;
+    }
+    LOG_INFO("Transfer %u: %u -> %lu byte snapshot ready in %lu us.", id, (unsigned)rawLength,
+             (unsigned long)_meta.total, (unsigned long)(micros() - startUs));
+    return openSession(0, chunkSize, millis());
+}
+
+bool BulkTransfer::resume(uint16_t id, uint32_t offset, uint16_t chunkSize)
+{
+    pause();
+    if (!loadMeta() || _meta.id != id || _meta.complete || offset > _meta.total)
+    {
+        return false;
+    }
+    LOG_INFO("Transfer %u: resuming at %lu of %lu.", id, (unsigned long)offset, (unsigned long)_meta.total);
+    return openSession(offset, chunkSize, millis());
+}
+
+bool BulkTransfer::openSession(uint32_t offset, uint16_t chunkSize, uint32_t nowMs)
+{
+    _file = _fs.open(XFER_SNAPSHOT_FILENAME, FILE_READ);
+    if (!_file || _file.size() != _meta.total)
+    {
+        LOG_ERROR("Transfer snapshot missing or truncated.");
+        _file.close();
+        return false;
+    }
+
+    _chunk = std::max<uint16_t>(1, std::min<uint16_t>(chunkSize, XFER_MAX_CHUNK));
+    _base = _next = offset;
+    _sack = 0;
+    _resending = false;
+    _retries = 0;
+    _lastProgressMs = nowMs;
+    _sessionStartMs = nowMs;
+    _sessionStartOffset = offset;
+    portENTER_CRITICAL(&_ackLock);
+    _ackPending = false;
+    portEXIT_CRITICAL(&_ackLock);
+
+    _active = true;
+    sendHeader();
+    return true;
+}
+
+void BulkTransfer::pause()
+{
+    if (!_active)
+    {
+        return;
+    }
+    LOG_INFO("Transfer %u: paused at %lu of %lu.", _meta.id, (unsigned long)_base, (unsigned long)_meta.total);
+    _file.close();
+    _active = false;
+}
+
+void BulkTransfer::finish()
+{
+    _file.close();
+    _active = false;
+    _completed = true;
+    _meta.complete = 1;
+    saveMeta(); // Keeps the id counter
+    _fs.remove(XFER_SNAPSHOT_FILENAME);
+    // Throughput of the last session, from its first header to the final ack
+    uint32_t elapsedMs = millis() - _sessionStartMs;
+    uint32_t bytes = _meta.total - _sessionStartOffset;
+    LOG_INFO("Transfer %u complete (%lu frames, %lu resent): %lu bytes in %lu ms, %lu B/s at chunk %u.",
+             _meta.id, (unsigned long)_framesSent, (unsigned long)_framesResent, (unsigned long)bytes,
+             (unsigned long)elapsedMs, elapsedMs > 0 ? (unsigned long)((uint64_t)bytes * 1000 / elapsedMs) : 0UL,
+             _chunk);
+    LOG_EVENT(LOG_CODE_XFER_DONE, _meta.id, _meta.total);
+}
+
+bool BulkTransfer::takeCompleted()
+{
+    bool completed = _completed;
+    _completed = false;
+    return completed;
+}
+
+// --- Frames ---
+
+bool BulkTransfer::sendHeader()
+{
+    uint8_t frame[XFER_HEADER_LEN];
+    frame[0] = XFER_OP_HEADER;
+    putU16(frame + 1, _meta.id);
+    putU32(frame + 3, _meta.total);
+    putU32(frame + 7, _meta.crc32);
+    putU16(frame + 11, _chunk);
+    frame[13] = XFER_WINDOW;
+    putU32(frame + 14, _base);
+    frame[18] = _meta.codec;
+    return _sender != nullptr && _sender(frame, sizeof(frame), _senderCtx);
+}
+
+bool BulkTransfer::sendChunk(uint32_t offset)
+{
+    uint8_t frame[XFER_DATA_OVERHEAD + XFER_MAX_CHUNK];
+    size_t len = std::min<uint32_t>(_chunk, _meta.total - offset);
+    frame[0] = XFER_OP_DATA;
+    putU16(frame + 1, _meta.id);
+    putU32(frame + 3, offset);
+    if (!_file.seek(offset) || _file.read(frame + XFER_DATA_OVERHEAD, len) != len)
+    {
+        LOG_ERROR("Transfer snapshot read failed.");
+        return false;
+    }
+    if (_sender == nullptr || !_sender(frame, XFER_DATA_OVERHEAD + len, _senderCtx))
+    {
+        return false;
+    }
+    _framesSent++;
+    return true;
+}
+
+bool BulkTransfer::onAck(const uint8_t *data, size_t len)
+{
+    if (len < XFER_ACK_LEN || data[0] != XFER_OP_ACK)
+    {
+        return false;
+    }
+    uint16_t id = data[1] | (data[2] << 8);
+    if (id != _meta.id)
+    {
+        return false; // Ack for an older transfer
+    }
+    uint32_t cumulative = getU32(data + 3);
+    uint32_t sack = getU32(data + 7);
+
+    portENTER_CRITICAL(&_ackLock);
+    if (!_ackPending || cumulative >= _ackCumulative)
+    {
+        _ackCumulative = cumulative;
+        _ackSack = sack;
+        _ackPending = true;
+    }
+    portEXIT_CRITICAL(&_ackLock);
+    return true;
+}
+
+// Next chunk of the running resend pass that the app has not confirmed
+bool BulkTransfer::nextResend(uint32_t &offset)
+{
+    while (_resendCursor < _resendLimit)
+    {
+        uint32_t candidate = _resendCursor;
+        _resendCursor += _chunk;
+        uint32_t index = (candidate - _base) / _chunk;
+        if (index == 0 || index > 32 || (_sack & (1UL << (index - 1))) == 0)
+        {
+            offset = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BulkTransfer::service(uint32_t nowMs)
+{
+    if (!_active)
+    {
+        return;
+    }
+
+    // --- Apply the latest ack ---
+    bool ackPending;
+    uint32_t cumulative, sack;
+    portENTER_CRITICAL(&_ackLock);
+    ackPending = _ackPending;
+    cumulative = _ackCumulative;
+    sack = _ackSack;
+    _ackPending = false;
+    portEXIT_CRITICAL(&_ackLock);
+
+    if (ackPending && cumulative >= _base && cumulative <= _meta.total)
+    {
+        if (cumulative > _base)
+        {
+            _base = cumulative;
+            _next = std::max(_next, _base);
+            _lastProgressMs = nowMs;
+            _retries = 0;
+        }
+        _sack = sack;
+        if (_resending && _resendCursor < _base)
+        {
+            _resendCursor = _base;
+        }
+        if (sack != 0 && !_resending)
+        {
+            // Notifications arrive in order, so a hole below a selectively
+            // acked chunk was lost: resend up to the highest acked chunk now
+            _resending = true;
+            _resendCursor = _base;
+            _resendLimit = _base + (uint32_t)(32 - __builtin_clz(sack)) * _chunk;
+        }
+    }
+
+    if (_base >= _meta.total)
+    {
+        finish();
+        return;
+    }
+
+    // --- Nothing acknowledged for a while: resend the window ---
+    if (nowMs - _lastProgressMs >= XFER_ACK_TIMEOUT_MS)
+    {
+        if (++_retries > XFER_MAX_RETRIES)
+        {
+            LOG_WARN("Transfer %u: no acks, giving up for now.", _meta.id);
+            pause();
+            return;
+        }
+        _resending = true;
+        _resendCursor = _base;
+        _resendLimit = _next;
+        _lastProgressMs = nowMs;
+        sendHeader(); // In case the app never saw it
+    }
+
+    // --- One frame per call keeps the BLE stack queue short ---
+    uint32_t offset;
+    if (_resending)
+    {
+        if (nextResend(offset))
+        {
+            if (sendChunk(offset))
+            {
+                _framesResent++;
+            }
+            else
+            {
+                _resendCursor = offset; // Try the same chunk next time
+            }
+            return;
+        }
+        _resending = false;
+    }
+
+    uint32_t windowEnd = _base + (uint32_t)XFER_WINDOW * _chunk;
+    if (_next < _meta.total && _next < windowEnd && sendChunk(_next))
+    {
+        _next = std::min<uint32_t>(_next + _chunk, _meta.total);
+    }
+}
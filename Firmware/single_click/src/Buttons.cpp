@@ -0,0 +1,195 @@
+#include "Buttons.h"
+#include "Log.h"
+
+#define DEBOUNCE_US ((uint32_t)BUTTON_DEBOUNCE_MS * 1000UL)
+
+// --- Gesture decoding ---
+
+uint8_t ButtonDecoder::onEdge(bool pressed, uint32_t nowMs, ButtonGesture out[2])
+{
+    if (pressed == _pressed)
+    {
+        return 0;
+    }
+    _pressed = pressed;
+
+    if (!pressed)
+    {
+        _releaseMs = nowMs;
+        _releaseValid = true;
+        return 0;
+    }
+
+    uint8_t count = 0;
+    out[count++] = BUTTON_PRESS;
+    if (_releaseValid && nowMs - _releaseMs <= BUTTON_DOUBLE_PRESS_MS)
+    {
+        out[count++] = BUTTON_DOUBLE_PRESS;
+        _releaseValid = false; // A third press starts a new pair
+    }
+    _pressMs = nowMs;
+    _longSent = false;
+    return count;
+}
+
+bool ButtonDecoder::onHold(uint32_t nowMs)
+{
+    if (!_pressed || _longSent || nowMs - _pressMs < BUTTON_LONG_PRESS_MS)
+    {
+        return false;
+    }
+    _longSent = true;
+    _releaseValid = false; // Releasing a long press never starts a double press
+    return true;
+}
+
+// --- Hardware ---
+
+bool Buttons::begin(uint8_t userPin, uint8_t pairPin)
+{
+    _wakeSignal = xSemaphoreCreateBinaryStatic(&_wakeSignalBuffer);
+    if (!_queue.begin() || _wakeSignal == nullptr)
+    {
+        LOG_ERROR("Failed to create button queue.");
+        return false;
+    }
+    return beginChannel(_channels[BUTTON_USER], BUTTON_USER, userPin) &&
+           beginChannel(_channels[BUTTON_PAIR], BUTTON_PAIR, pairPin);
+}
+
+bool Buttons::beginChannel(Channel &channel, uint8_t id, uint8_t pin)
+{
+    channel.owner = this;
+    channel.id = id;
+    channel.pin = pin;
+    channel.lastEdgeUs = 0;
+    channel.debouncing = false;
+    channel.stablePressed = digitalRead(pin) == BUTTON_ACTIVE_LEVEL;
+    channel.decoder = ButtonDecoder();
+    if (channel.stablePressed)
+    {
+        // Held at boot: sync the decoder without reporting a press
+        ButtonGesture ignored[2];
+        channel.decoder.onEdge(true, millis(), ignored);
+    }
+
+    esp_timer_create_args_t args = {};
+    args.callback = onDebounce;
+    args.arg = &channel;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "btn_debounce";
+    if (esp_timer_create(&args, &channel.debounceTimer) != ESP_OK)
+    {
+        LOG_ERROR("Failed to create debounce timer for pin %u.", pin);
+        return false;
+    }
+
+    args.callback = onHold;
+    args.name = "btn_hold";
+    if (esp_timer_create(&args, &channel.holdTimer) != ESP_OK)
+    {
+        LOG_ERROR("Failed to create hold timer for pin %u.", pin);
+        return false;
+    }
+
+    attachInterruptArg(pin, onEdgeIsr, &channel, CHANGE);
+    return true;
+}
+
+// Runs on every edge, bounces included, so it only records the time and
+// makes sure one debounce timer is pending.
+void IRAM_ATTR Buttons::onEdgeIsr(void *arg)
+{
+    Channel *channel = (Channel *)arg;
+    channel->lastEdgeUs = (uint32_t)esp_timer_get_time();
+    if (!channel->debouncing.exchange(true))
+    {
+        esp_timer_start_once(channel->debounceTimer, DEBOUNCE_US);
+    }
+}
+
+void Buttons::onDebounce(void *arg)
+{
+    Channel *channel = (Channel *)arg;
+
+    // Edges kept coming while we waited: wait out the rest of the quiet period
+    uint32_t quietUs = (uint32_t)esp_timer_get_time() - channel->lastEdgeUs;
+    if (quietUs < DEBOUNCE_US)
+    {
+        esp_timer_start_once(channel->debounceTimer, DEBOUNCE_US - quietUs);
+        return;
+    }
+    // Clear before sampling so an edge from here on arms a new pass
+    channel->debouncing = false;
+
+    bool pressed = digitalRead(channel->pin) == BUTTON_ACTIVE_LEVEL;
+    if (pressed == channel->stablePressed)
+    {
+        return; // Bounced back to where it was
+    }
+    channel->stablePressed = pressed;
+
+    uint32_t nowMs = millis();
+    ButtonGesture gestures[2];
+    uint8_t count = channel->decoder.onEdge(pressed, nowMs, gestures);
+    if (pressed)
+    {
+        esp_timer_start_once(channel->holdTimer, (uint64_t)BUTTON_LONG_PRESS_MS * 1000ULL);
+    }
+    else
+    {
+        esp_timer_stop(channel->holdTimer);
+    }
+    for (uint8_t i = 0; i < count; ++i)
+    {
+        channel->owner->post(channel->id, gestures[i], nowMs);
+    }
+}
+
+void Buttons::onHold(void *arg)
+{
+    Channel *channel = (Channel *)arg;
+    uint32_t nowMs = millis();
+    if (channel->decoder.onHold(nowMs))
+    {
+        channel->owner->post(channel->id, BUTTON_LONG_PRESS, nowMs);
+    }
+}
+
+void Buttons::post(uint8_t button, uint8_t gesture, uint32_t timeMs)
+{
+    ButtonEvent event = {button, gesture, timeMs};
+    if (!_queue.send(event))
+    {
+        _dropped++;
+        return;
+    }
+    xSemaphoreGive(_wakeSignal);
+}
+
+void Buttons::wake()
+{
+    if (_wakeSignal != nullptr)
+    {
+        xSemaphoreGive(_wakeSignal); // Already given: the loop is woken once either way
+    }
+}
+
+bool Buttons::waitEvent(ButtonEvent &out, uint32_t timeoutMs)
+{
+    if (!_queue.ready())
+    {
+        delay(timeoutMs == UINT32_MAX ? 10 : timeoutMs);
+        return false;
+    }
+    if (_queue.receive(out, 0))
+    {
+        return true;
+    }
+    // Events are queued before the signal is given, so one left over from an
+    // event already received only costs an early return. A zero wait clears
+    // it: the loop pass that follows sees whatever the wake was for.
+    TickType_t ticks = (timeoutMs == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(timeoutMs);
+    xSemaphoreTake(_wakeSignal, ticks);
+    return _queue.receive(out, 0);
+}
@@ -0,0 +1,55 @@
+#include "ConnectionStats.h"
+
+#include <stdio.h>
+
+void ConnectionStats::onConnect(uint32_t nowMs)
+{
+    _connected = true;
+    _wrote = false;
+    _bonded = false;
+    _connectedAtMs = nowMs;
+    _connects++;
+    _secureMs = 0;
+    _offlineMs = _everDisconnected ? nowMs - _disconnectedAtMs : 0;
+}
+
+void ConnectionStats::onSecured(uint32_t nowMs, bool bonded)
+{
+    if (!_connected)
+    {
+        return;
+    }
+    _bonded = bonded;
+    _secureMs = nowMs - _connectedAtMs;
+}
+
+bool ConnectionStats::onWrite(uint32_t nowMs)
+{
+    if (!_connected || _wrote)
+    {
+        return false;
+    }
+    _wrote = true;
+    _lastFirstWriteMs = nowMs - _connectedAtMs;
+    (_bonded ? _bondedFirstWrite : _newFirstWrite).add(_lastFirstWriteMs);
+    return true;
+}
+
+void ConnectionStats::onDisconnect(uint32_t nowMs)
+{
+    _connected = false;
+    _disconnectedAtMs = nowMs;
+    _everDisconnected = true;
+}
+
+size_t ConnectionStats::format(char *out, size_t size, uint8_t bonds) const
+{
+    int n = snprintf(out, size,
+                     "{\"bonds\":%u,\"connects\":%lu,\"bonded\":%u,\"offline_ms\":%lu,\"secure_ms\":%lu,"
+                     "\"ttfb_ms\":%lu,\"bonded_n\":%lu,\"bonded_avg_ms\":%lu,\"new_n\":%lu,\"new_avg_ms\":%lu}",
+                     bonds, (unsigned long)_connects, _bonded ? 1 : 0, (unsigned long)_offlineMs,
+                     (unsigned long)_secureMs, (unsigned long)_lastFirstWriteMs,
+                     (unsigned long)_bondedFirstWrite.count, (unsigned long)_bondedFirstWrite.averageMs(),
+                     (unsigned long)_newFirstWrite.count, (unsigned long)_newFirstWrite.averageMs());
+    return n > 0 ? (size_t)n : 0;
+}
@@ -0,0 +1,143 @@
+#include "DeviceStatus.h"
+
+#include <string.h>
+
+#define OFFSET_VERSION 0
+#define OFFSET_STATE 1
+#define OFFSET_FLAGS 2
+#define OFFSET_BATTERY 3
+#define OFFSET_PENDING 4
+#define OFFSET_NEXT_DUE 6
+#define OFFSET_RESPONSE_SLOT 10
+#define OFFSET_RESPONSE_STATE 12
+#define OFFSET_RESPONSE_AGE 13
+
+static_assert(OFFSET_RESPONSE_AGE + 4 == DEVICE_STATUS_LEN, "Status layout and length disagree");
+
+DeviceStatus::DeviceStatus()
+{
+    memset(_packed, 0, sizeof(_packed));
+    _packed[OFFSET_VERSION] = DEVICE_STATUS_VERSION;
+    _packed[OFFSET_BATTERY] = DEVICE_STATUS_UNKNOWN_U8;
+    putU32(OFFSET_NEXT_DUE, DEVICE_STATUS_NONE_U32);
+    putU16(OFFSET_RESPONSE_SLOT, DEVICE_STATUS_NONE_U16);
+    putU32(OFFSET_RESPONSE_AGE, DEVICE_STATUS_NONE_U32);
+}
+
+// --- Helpers (caller holds _lock) ---
+
+void DeviceStatus::putU16(size_t offset, uint16_t value)
+{
+    _packed[offset] = value & 0xFF;
+    _packed[offset + 1] = value >> 8;
+}
+
+void DeviceStatus::putU32(size_t offset, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        _packed[offset + i] = (value >> (8 * i)) & 0xFF;
+    }
+}
+
+// --- Setters ---
+
+void DeviceStatus::setState(uint8_t state)
+{
+    portENTER_CRITICAL(&_lock);
+    if (_packed[OFFSET_STATE] != state)
+    {
+        _packed[OFFSET_STATE] = state;
+        _changed = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::setFlags(uint8_t flags)
+{
+    portENTER_CRITICAL(&_lock);
+    if (_packed[OFFSET_FLAGS] != flags)
+    {
+        _packed[OFFSET_FLAGS] = flags;
+        _changed = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::setBattery(uint8_t percent)
+{
+    portENTER_CRITICAL(&_lock);
+    if (_packed[OFFSET_BATTERY] != percent)
+    {
+        _packed[OFFSET_BATTERY] = percent;
+        _changed = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::setPending(uint16_t pending)
+{
+    portENTER_CRITICAL(&_lock);
+    if ((_packed[OFFSET_PENDING] | (_packed[OFFSET_PENDING + 1] << 8)) != pending)
+    {
+        putU16(OFFSET_PENDING, pending);
+        _changed = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::setNextDue(bool armed, uint32_t dueMs)
+{
+    portENTER_CRITICAL(&_lock);
+    if (armed != _nextDueArmed || (armed && dueMs != _nextDueMs))
+    {
+        _nextDueArmed = armed;
+        _nextDueMs = dueMs;
+        _changed = true;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::setLastResponse(uint16_t slot, uint8_t state, uint32_t atMs)
+{
+    portENTER_CRITICAL(&_lock);
+    putU16(OFFSET_RESPONSE_SLOT, slot);
+    _packed[OFFSET_RESPONSE_STATE] = state;
+    _hasResponse = true;
+    _responseMs = atMs;
+    _changed = true;
+    portEXIT_CRITICAL(&_lock);
+}
+
+// --- Readers ---
+
+void DeviceStatus::refresh(uint32_t nowMs)
+{
+    portENTER_CRITICAL(&_lock);
+    uint32_t dueSec = DEVICE_STATUS_NONE_U32;
+    if (_nextDueArmed)
+    {
+        // A deadline already behind us reads as due now
+        int32_t remaining = (int32_t)(_nextDueMs - nowMs);
+        dueSec = remaining > 0 ? (uint32_t)remaining / 1000 : 0;
+    }
+    putU32(OFFSET_NEXT_DUE, dueSec);
+    putU32(OFFSET_RESPONSE_AGE, _hasResponse ? (nowMs - _responseMs) / 1000 : DEVICE_STATUS_NONE_U32);
+    portEXIT_CRITICAL(&_lock);
+}
+
+void DeviceStatus::copy(uint8_t *out)
+{
+    portENTER_CRITICAL(&_lock);
+    memcpy(out, _packed, DEVICE_STATUS_LEN);
+    portEXIT_CRITICAL(&_lock);
+}
+
+bool DeviceStatus::takeChanged()
+{
+    portENTER_CRITICAL(&_lock);
+    bool changed = _changed;
+    _changed = false;
+    portEXIT_CRITICAL(&_lock);
+    return changed;
+}
@@ -0,0 +1,112 @@
+#include "EspOtaTarget.h"
+#include "Log.h"
+
+// --- Partition ---
+
+bool EspOtaTarget::open()
+{
+    if (pendingVerify())
+    {
+        // The other partition holds the image a rollback returns to
+        LOG_WARN("OTA refused until the running image is confirmed.");
+        return false;
+    }
+    _partition = esp_ota_get_next_update_partition(NULL);
+    if (_partition == NULL)
+    {
+        LOG_ERROR("No OTA partition, check the partition table.");
+        return false;
+    }
+    LOG_INFO("OTA into '%s' (%lu KB)", _partition->label, (unsigned long)(_partition->size / 1024));
+    return true;
+}
+
+uint32_t EspOtaTarget::capacity()
+{
+    return _partition != NULL ? _partition->size : 0;
+}
+
+bool EspOtaTarget::erase(uint32_t offset, uint32_t len)
+{
+    return _partition != NULL && esp_partition_erase_range(_partition, offset, len) == ESP_OK;
+}
+
+bool EspOtaTarget::write(uint32_t offset, const uint8_t *data, size_t len)
+{
+    return _partition != NULL && esp_partition_write(_partition, offset, data, len) == ESP_OK;
+}
+
+bool EspOtaTarget::read(uint32_t offset, uint8_t *data, size_t len)
+{
+    return _partition != NULL && esp_partition_read(_partition, offset, data, len) == ESP_OK;
+}
+
+// esp_ota_set_boot_partition() checks the image headers and the app's own
+// appended hash before it switches
+bool EspOtaTarget::activate(uint32_t size)
+{
+    if (_partition == NULL)
+    {
+        return false;
+    }
+    esp_err_t err = esp_ota_set_boot_partition(_partition);
+    if (err != ESP_OK)
+    {
+        LOG_ERROR("New image rejected (%d).", err);
+        return false;
+    }
+    LOG_INFO("Next boot from '%s' (%lu bytes).", _partition->label, (unsigned long)size);
+    return true;
+}
+
+// --- Progress file ---
+
+bool EspOtaTarget::loadProgress(OtaProgress &progress)
+{
+    File file = _fs.open(OTA_PROGRESS_FILENAME, FILE_READ);
+    return file && file.read((uint8_t *)&progress, sizeof(progress)) == sizeof(progress);
+}
+
+bool EspOtaTarget::saveProgress(const OtaProgress &progress)
+{
+    File file = _fs.open(OTA_PROGRESS_FILENAME, FILE_WRITE);
+    return file && file.write((const uint8_t *)&progress, sizeof(progress)) == sizeof(progress);
+}
+
+void EspOtaTarget::clearProgress()
+{
+    if (_fs.exists(OTA_PROGRESS_FILENAME))
+    {
+        _fs.remove(OTA_PROGRESS_FILENAME);
+    }
+}
+
+// --- Running image ---
+
+bool EspOtaTarget::pendingVerify() const
+{
+    esp_ota_img_states_t state;
+    return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+           state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void EspOtaTarget::confirm()
+{
+    if (esp_ota_mark_app_valid_cancel_rollback() == ESP_OK)
+    {
+        LOG_INFO("Running image confirmed.");
+    }
+}
+
+bool EspOtaTarget::rollback()
+{
+    const esp_partition_t *other = esp_ota_get_next_update_partition(NULL);
+    esp_app_desc_t description;
+    if (other == NULL || esp_ota_get_partition_description(other, &description) != ESP_OK ||
+        esp_ota_set_boot_partition(other) != ESP_OK)
+    {
+        return false;
+    }
+    LOG_INFO("Next boot from '%s' (%s).", other->label, description.version);
+    return true;
+}
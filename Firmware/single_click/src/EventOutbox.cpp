@@ -0,0 +1,247 @@
+#include "EventOutbox.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+#define OUTBOX_MAGIC 0x5842544F // "OTBX"
+
+static_assert(OUTBOX_WINDOW >= 1 && OUTBOX_WINDOW <= OUTBOX_CAPACITY, "Window must fit the queue");
+
+static void putU32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+// --- Flash ---
+
+bool EventOutbox::load()
+{
+    File file = _fs.open(OUTBOX_FILENAME, FILE_READ);
+    FileHeader header;
+    if (!file || file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != OUTBOX_MAGIC || header.count > OUTBOX_CAPACITY)
+    {
+        return false;
+    }
+    size_t bytes = header.count * sizeof(OutboxEvent);
+    if (file.read((uint8_t *)_events, bytes) != bytes)
+    {
+        LOG_ERROR("Event outbox file truncated.");
+        return false;
+    }
+    _head = 0;
+    _count = header.count;
+    _nextSeq = header.nextSeq;
+    LOG_INFO("Event outbox: %u unsent events.", _count);
+    return true;
+}
+
+// Writes the queue oldest first, so the file never needs the ring position
+bool EventOutbox::save()
+{
+    TRACE_SPAN(TRACE_OUTBOX_SAVE);
+    File file = _fs.open(OUTBOX_FILENAME, FILE_WRITE);
+    FileHeader header = {OUTBOX_MAGIC, _nextSeq, _count, 0};
+    if (!file || file.write((const uint8_t *)&header, sizeof(header)) != sizeof(header))
+    {
+        LOG_ERROR("Failed to write event outbox.");
+        return false;
+    }
+    for (uint16_t i = 0; i < _count; ++i)
+    {
+        if (file.write((const uint8_t *)&at(i), sizeof(OutboxEvent)) != sizeof(OutboxEvent))
+        {
+            LOG_ERROR("Failed to write event outbox.");
+            return false;
+        }
+    }
+    return true;
+}
+
+// --- Queue ---
+
+void EventOutbox::setSender(FrameSender sender, void *ctx)
+{
+    _sender = sender;
+    _senderCtx = ctx;
+}
+
+uint32_t EventOutbox::push(uint8_t type, uint8_t state, uint16_t slot, uint32_t offsetSec, uint32_t atSec)
+{
+    if (_count == OUTBOX_CAPACITY)
+    {
+        // Full: the oldest event is the least useful one
+        _head = (_head + 1) % OUTBOX_CAPACITY;
+        _count--;
+        _dropped++;
+        if (_inFlight > 0)
+        {
+            _inFlight--;
+        }
+    }
+    OutboxEvent &event = _events[(_head + _count) % OUTBOX_CAPACITY];
+    event = {_nextSeq++, type, state, slot, offsetSec, atSec};
+    _count++;
+    return event.seq;
+}
+
+// --- Draining ---
+
+void EventOutbox::startDrain(uint32_t nowMs)
+{
+    _draining = true;
+    _inFlight = 0;
+    _retries = 0;
+    _lastProgressMs = nowMs;
+    portENTER_CRITICAL(&_ackLock);
+    _ackPending = false;
+    portEXIT_CRITICAL(&_ackLock);
+    if (_count > 0)
+    {
+        LOG_INFO("Event outbox: draining %u events.", _count);
+    }
+}
+
+void EventOutbox::stopDrain()
+{
+    _draining = false;
+    _inFlight = 0;
+}
+
+bool EventOutbox::parseAck(const uint8_t *data, size_t len, uint32_t &seq)
+{
+    if (len < OUTBOX_ACK_LEN || data[0] != OUTBOX_OP_ACK)
+    {
+        return false;
+    }
+    seq = (uint32_t)data[1] | ((uint32_t)data[2] << 8) | ((uint32_t)data[3] << 16) | ((uint32_t)data[4] << 24);
+    return true;
+}
+
+bool EventOutbox::onAck(const uint8_t *data, size_t len)
+{
+    uint32_t seq;
+    if (!parseAck(data, len, seq))
+    {
+        return false;
+    }
+    portENTER_CRITICAL(&_ackLock);
+    if (!_ackPending || seq > _ackSeq)
+    {
+        _ackSeq = seq;
+        _ackPending = true;
+    }
+    portEXIT_CRITICAL(&_ackLock);
+    return true;
+}
+
+void EventOutbox::encodeEvent(const OutboxEvent &event, uint8_t *frame)
+{
+    frame[0] = OUTBOX_OP_EVENT;
+    putU32(frame + 1, event.seq);
+    frame[5] = event.type;
+    frame[6] = event.state;
+    frame[7] = event.slot & 0xFF;
+    frame[8] = event.slot >> 8;
+    putU32(frame + 9, event.offsetSec);
+    putU32(frame + 13, event.atSec);
+}
+
+bool EventOutbox::sendEvent(const OutboxEvent &event)
+{
+    uint8_t frame[OUTBOX_EVENT_LEN];
+    encodeEvent(event, frame);
+    return _sender != nullptr && _sender(frame, sizeof(frame), _senderCtx);
+}
+
+// Drops everything up to and including seq
+bool EventOutbox::applyAck(uint32_t seq, uint32_t nowMs)
+{
+    bool changed = false;
+    while (_count > 0 && at(0).seq <= seq)
+    {
+        _head = (_head + 1) % OUTBOX_CAPACITY;
+        _count--;
+        if (_inFlight > 0)
+        {
+            _inFlight--;
+        }
+        changed = true;
+    }
+    if (changed)
+    {
+        _lastProgressMs = nowMs;
+        _retries = 0;
+    }
+    return changed;
+}
+
+uint16_t EventOutbox::copyEvents(uint8_t *out, uint16_t max) const
+{
+    uint16_t count = std::min(max, _count);
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        encodeEvent(at(i), out + i * OUTBOX_EVENT_LEN);
+    }
+    return count;
+}
+
+bool EventOutbox::acknowledge(const uint8_t *data, size_t len, uint32_t nowMs)
+{
+    uint32_t seq;
+    return parseAck(data, len, seq) && applyAck(seq, nowMs);
+}
+
+bool EventOutbox::service(uint32_t nowMs)
+{
+    if (!_draining)
+    {
+        return false;
+    }
+
+    // --- Drop everything the app confirmed ---
+    bool ackPending;
+    uint32_t ackSeq;
+    portENTER_CRITICAL(&_ackLock);
+    ackPending = _ackPending;
+    ackSeq = _ackSeq;
+    _ackPending = false;
+    portEXIT_CRITICAL(&_ackLock);
+
+    bool changed = ackPending && applyAck(ackSeq, nowMs);
+
+    if (_count == 0)
+    {
+        _inFlight = 0;
+        _lastProgressMs = nowMs;
+        return changed;
+    }
+
+    // --- Acks stalled: start over from the oldest unacked event ---
+    if (_inFlight > 0 && nowMs - _lastProgressMs >= OUTBOX_ACK_TIMEOUT_MS)
+    {
+        if (++_retries > OUTBOX_MAX_RETRIES)
+        {
+            LOG_WARN("Event outbox: no acks, holding events until the next connection.");
+            stopDrain();
+            return changed;
+        }
+        _inFlight = 0;
+        _lastProgressMs = nowMs;
+    }
+
+    // --- One event per call, at most OUTBOX_WINDOW ahead of the last ack ---
+    if (_inFlight < OUTBOX_WINDOW && _inFlight < _count && sendEvent(at(_inFlight)))
+    {
+        if (_inFlight == 0)
+        {
+            _lastProgressMs = nowMs; // The ack timeout runs from the first unacked send
+        }
+        _inFlight++;
+    }
+    return changed;
+}
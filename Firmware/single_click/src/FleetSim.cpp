@@ -0,0 +1,1683 @@
+// Native fleet simulator: hundreds of virtual Pipli devices in one process.
+//
+// Each device runs the firmware's own ReminderEngine, Provisioning,
+// ScheduleStore, ScheduleIngest, EventOutbox, Persistence, TimerWheel,
+// DeviceStatus and SerialLink against its own clock (with crystal drift), its
+// own in-memory flash (sim/include/FS.h) and its own serial link. Reminder
+// alerts, responses, the uptime checkpoint, time recovery after a reboot,
+// the upload inbox and the serial protocol are the firmware's modules with
+// the firmware's settings, so they behave as on the device; only the hooks
+// (motor, user model, statistics) are the simulator's.
+//
+// Time is simulated: the run jumps from one device deadline to the next, so a
+// week of a few hundred devices takes seconds. A user model answers alerts
+// with the device's adherence; a press that lands while the motor still runs
+// is ignored, as the firmware ignores it.
+//
+// Each device runs a script (--script, "%d" becomes the device number):
+//
+//   # comment
+//   at 0 sync schedule.json     SCHEDULE_INFO, upload, SEND_UPDATE, status read, EVENTS drain
+//   every 6h sync               same without the upload (drains responses)
+//   at 2d3h reboot 30s          clean restart (flushes first), 30 s down
+//   at 3d powerloss 5m          power cut: everything not yet flushed is lost
+//   at 4d flashfull on          writes fail from now on ("off" ends it)
+//   at 5d drift -40             crystal error in ppm
+//   at 5d adherence 0.5         chance the user answers an alert
+//   at 6d link off              host bytes are lost until "link on"
+//
+// Durations take ms, s, m, h and d and may be combined (1d12h); plain
+// numbers are seconds. Without --pty every device is driven by a built-in
+// host that speaks the serial link at SERIAL_LINK_BAUD. With --pty each
+// device gets a pseudo terminal linked as <dir>/devNNN and the run follows
+// the wall clock (--speed), so tools/provision.py can provision the fleet:
+//
+//   pio run -e fleet && .pio/build/fleet/program --devices 300 --duration 7d --sync-every 12h
+//   .pio/build/fleet/program --devices 50 --pty fleet --duration 1h &
+//   python3 tools/provision.py --schedule schedule.json --download fleet/dev*
+//
+// The report covers reminder timing (when each alert fired against origin +
+// offset in true time), flash bytes and files written, link bytes and frames,
+// syncs, uploads, and events queued, drained and left unacknowledged. Serial commands
+// beyond SEND_UPDATE and SCHEDULE_INFO answer "UNSUPPORTED": the logger and
+// tracer are process-wide, and there is no BLE, codec or OTA. Patch uploads
+// are dropped: the simulator has no JSON DOM for them.
+//
+// Only built by the fleet env; the firmware build skips the whole file.
+#ifndef ARDUINO
+
+#include <Arduino.h>
+#include <FS.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "DeviceStatus.h"
+#include "EventOutbox.h"
+#include "Persistence.h"
+#include "Provisioning.h"
+#include "ReminderEngine.h"
+#include "ScheduleIngest.h"
+#include "ScheduleStore.h"
+#include "SerialLink.h"
+#include "TimerWheel.h"
+
+// --- Simulator Settings ---
+#define SIM_FLASH_BYTES 0x160000     // LittleFS partition of the default partition table
+#define SIM_BOOT_MS 350              // millis() when setup() runs
+#define SIM_PRESS_MIN_MS 2000        // An answering user presses this long after the alert starts...
+#define SIM_PRESS_MAX_MS 40000       // ...at the latest
+#define SIM_HOST_TIMEOUT_MS 5000     // Same as tools/provision.py
+#define SIM_HOST_PART 1024           // Upload part size, same as tools/provision.py
+#define SIM_INITIAL_SYNC_SPREAD_MS 60000 // Initial uploads are spread over the first minute
+#define SIM_NEVER UINT64_MAX
+
+class SimDevice;
+class SimFirmware;
+
+static uint64_t simNow = 0;                   // True time in ms since the start of the run
+static SimDevice *currentDevice = nullptr; // Whose millis() the firmware sees
+
+static bool parseDuration(const std::string &text, uint64_t &ms);
+static bool readText(const std::string &path, std::string &out);
+
+HardwareSerial Serial;
+
+// --- Statistics ---
+
+struct DeviceStats
+{
+    uint32_t alerts = 0;     // Alerts started by processSchedule (not re-reminds)
+    uint32_t reminders = 0;  // Slots those alerts covered
+    uint32_t reReminds = 0;
+    uint32_t answered = 0;   // Slots
+    uint32_t missed = 0;     // Slots
+    uint32_t ignoredPresses = 0; // Pressed while the motor ran
+    uint32_t cleanReboots = 0;
+    uint32_t powerLosses = 0;
+    uint32_t uploadsCommitted = 0;
+    uint32_t uploadsUnchanged = 0;
+    uint32_t uploadsFailed = 0;
+    uint32_t uploadsRefused = 0; // BUSY, TOO_LARGE, UNSUPPORTED
+    uint32_t patchesSkipped = 0; // No patch hook: the simulator has no JSON DOM for them
+    uint32_t downloads = 0;
+    uint64_t downloadBytes = 0;
+    uint32_t syncs = 0;
+    uint32_t syncsOk = 0;
+    uint32_t syncsFailed = 0;
+    uint32_t syncsSkipped = 0; // Started while the last one still ran
+    uint32_t eventsQueued = 0;
+    uint32_t eventsDrained = 0; // Acked by the host over the link
+    uint32_t framesIn = 0;  // Valid frames the device received
+    uint32_t badFrames = 0;
+    uint32_t flushes = 0;
+    uint64_t linkRx = 0; // Bytes the device received
+    uint64_t linkTx = 0; // Bytes the device sent
+    uint64_t linkDropped = 0;
+};
+
+static std::vector<int64_t> timingErrors; // True fire time minus origin + offset, ms
+static std::vector<uint64_t> syncDurations;
+
+// --- Clock ---
+// millis() of one device: runs at (1 + ppm / 1e6) of true time from boot.
+struct SimClock
+{
+    uint64_t baseTrue = 0;
+    uint64_t baseMs = SIM_BOOT_MS;
+    double rate = 1.0;
+
+    void boot(uint64_t now)
+    {
+        baseTrue = now;
+        baseMs = SIM_BOOT_MS;
+    }
+
+    uint64_t msAt(uint64_t now) const { return baseMs + (uint64_t)((double)(now - baseTrue) * rate); }
+
+    void setDrift(uint64_t now, double ppm)
+    {
+        baseMs = msAt(now);
+        baseTrue = now;
+        rate = 1.0 + ppm * 1e-6;
+    }
+
+    // True time at which waitMs of device time have passed
+    uint64_t trueAfter(uint64_t now, uint32_t waitMs) const { return now + (uint64_t)ceil((double)waitMs / rate); }
+};
+
+// --- Link ---
+// Device end of a serial link: bytes from a pseudo terminal or from the
+// built-in host. Built-in traffic takes its wire time at SERIAL_LINK_BAUD.
+class SimPort : public Stream
+{
+public:
+    bool openPty(const std::string &linkPath)
+    {
+        _fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (_fd < 0 || grantpt(_fd) != 0 || unlockpt(_fd) != 0)
+        {
+            return false;
+        }
+        const char *slave = ptsname(_fd);
+        // Kept open so the terminal stays raw and reads never see a hangup
+        _slaveFd = slave != nullptr ? open(slave, O_RDWR | O_NOCTTY) : -1;
+        if (_slaveFd < 0)
+        {
+            return false;
+        }
+        struct termios tio;
+        tcgetattr(_slaveFd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(_slaveFd, TCSANOW, &tio);
+        unlink(linkPath.c_str());
+        return symlink(slave, linkPath.c_str()) == 0;
+    }
+
+    int fd() const { return _fd; }
+    void setUp(bool up) { _up = up; }
+    bool up() const { return _up; }
+
+    // A reset loses whatever the UART had buffered
+    void reset()
+    {
+        _rx.clear();
+        _toDevice.clear();
+        pump(SIM_NEVER, true);
+    }
+
+    // Moves arrived bytes into the receive buffer (or drops them while down)
+    void pump(uint64_t now, bool discard = false)
+    {
+        if (_fd >= 0)
+        {
+            uint8_t buffer[1024];
+            ssize_t n;
+            while ((n = ::read(_fd, buffer, sizeof(buffer))) > 0)
+            {
+                if (!discard && _up)
+                {
+                    _rx.insert(_rx.end(), buffer, buffer + n);
+                    rxBytes += n;
+                }
+            }
+            return;
+        }
+        while (!_toDevice.empty() && _toDevice.front().at <= now)
+        {
+            if (!discard)
+            {
+                _rx.insert(_rx.end(), _toDevice.front().bytes.begin(), _toDevice.front().bytes.end());
+                rxBytes += _toDevice.front().bytes.size();
+            }
+            _toDevice.pop_front();
+        }
+    }
+
+    int available() override { return (int)_rx.size(); }
+    int read() override
+    {
+        if (_rx.empty())
+        {
+            return -1;
+        }
+        uint8_t c = _rx.front();
+        _rx.pop_front();
+        return c;
+    }
+    int peek() override { return _rx.empty() ? -1 : _rx.front(); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        txBytes += size;
+        if (!_up)
+        {
+            dropped += size;
+            return size; // A UART with nothing attached still sends
+        }
+        if (_fd >= 0)
+        {
+            ssize_t n = ::write(_fd, buffer, size);
+            if (n < (ssize_t)size)
+            {
+                dropped += size - (n > 0 ? n : 0); // Nobody reads the terminal
+            }
+            return size;
+        }
+        _toHost.push_back({wireTime(_toHostFree, size), std::vector<uint8_t>(buffer, buffer + size)});
+        return size;
+    }
+    using Print::write;
+
+    // Built-in host side
+    void hostSend(const std::vector<uint8_t> &bytes)
+    {
+        if (!_up)
+        {
+            return;
+        }
+        _toDevice.push_back({wireTime(_toDeviceFree, bytes.size()), bytes});
+    }
+
+    bool hostReceive(uint64_t now, std::vector<uint8_t> &out)
+    {
+        bool any = false;
+        while (!_toHost.empty() && _toHost.front().at <= now)
+        {
+            out.insert(out.end(), _toHost.front().bytes.begin(), _toHost.front().bytes.end());
+            _toHost.pop_front();
+            any = true;
+        }
+        return any;
+    }
+
+    uint64_t nextToDevice() const { return _toDevice.empty() ? SIM_NEVER : _toDevice.front().at; }
+    uint64_t nextToHost() const { return _toHost.empty() ? SIM_NEVER : _toHost.front().at; }
+
+    uint64_t rxBytes = 0;
+    uint64_t txBytes = 0;
+    uint64_t dropped = 0;
+
+private:
+    struct Chunk
+    {
+        uint64_t at; // True time the last byte arrives
+        std::vector<uint8_t> bytes;
+    };
+
+    // Bytes on one direction of the wire go out back to back
+    static uint64_t wireTime(double &freeAt, size_t bytes)
+    {
+        double start = std::max(freeAt, (double)simNow);
+        freeAt = start + (double)bytes * 10.0 * 1000.0 / SERIAL_LINK_BAUD;
+        return (uint64_t)ceil(freeAt);
+    }
+
+    int _fd = -1;
+    int _slaveFd = -1;
+    bool _up = true;
+    std::deque<uint8_t> _rx;
+    std::deque<Chunk> _toDevice;
+    std::deque<Chunk> _toHost;
+    double _toDeviceFree = 0;
+    double _toHostFree = 0;
+};
+
+// --- Built-in host ---
+// The host end of tools/provision.py for one device: COBS frames with a
+// CRC-16/CCITT-FALSE, one request at a time.
+
+static uint16_t hostCrc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static std::vector<uint8_t> hostEncode(uint8_t type, const uint8_t *payload, size_t len)
+{
+    std::vector<uint8_t> raw;
+    raw.push_back(type);
+    raw.insert(raw.end(), payload, payload + len);
+    uint16_t crc = hostCrc16(0xFFFF, raw.data(), raw.size());
+    raw.push_back(crc & 0xFF);
+    raw.push_back(crc >> 8);
+
+    std::vector<uint8_t> out(1, 0);
+    size_t codeAt = out.size();
+    out.push_back(1);
+    for (uint8_t b : raw)
+    {
+        if (b != 0)
+        {
+            out.push_back(b);
+            out[codeAt]++;
+        }
+        if (b == 0 || out[codeAt] == 0xFF)
+        {
+            codeAt = out.size();
+            out.push_back(1);
+        }
+    }
+    out.push_back(0);
+    return out;
+}
+
+static bool hostDecode(const std::vector<uint8_t> &encoded, std::vector<uint8_t> &frame)
+{
+    frame.clear();
+    size_t in = 0;
+    while (in < encoded.size())
+    {
+        uint8_t code = encoded[in++];
+        if (code == 0 || in + code - 1 > encoded.size())
+        {
+            return false;
+        }
+        frame.insert(frame.end(), encoded.begin() + in, encoded.begin() + in + code - 1);
+        in += code - 1;
+        if (code != 0xFF && in < encoded.size())
+        {
+            frame.push_back(0);
+        }
+    }
+    return frame.size() >= SERIAL_LINK_OVERHEAD &&
+           hostCrc16(0xFFFF, frame.data(), frame.size() - 2) ==
+               (uint16_t)(frame[frame.size() - 2] | (frame[frame.size() - 1] << 8));
+}
+
+class SimHost
+{
+public:
+    SimHost(SimPort &port, DeviceStats &stats) : _port(port), _stats(stats) {}
+
+    bool busy() const { return _step != STEP_NONE; }
+
+    // SCHEDULE_INFO, the upload if any, SEND_UPDATE, a status read and the event drain
+    void startSync(std::shared_ptr<const std::string> upload)
+    {
+        if (busy())
+        {
+            _stats.syncsSkipped++;
+            return;
+        }
+        _stats.syncs++;
+        _upload = upload;
+        _uploaded = 0;
+        _started = simNow;
+        _step = STEP_INFO;
+        request(LINK_CMD, "SCHEDULE_INFO");
+    }
+
+    void service()
+    {
+        std::vector<uint8_t> bytes;
+        if (_port.hostReceive(simNow, bytes))
+        {
+            for (uint8_t b : bytes)
+            {
+                if (b != 0)
+                {
+                    _rx.push_back(b);
+                    continue;
+                }
+                std::vector<uint8_t> frame;
+                if (!_rx.empty() && hostDecode(_rx, frame))
+                {
+                    onFrame(frame[0], frame.data() + 1, frame.size() - SERIAL_LINK_OVERHEAD);
+                }
+                _rx.clear();
+            }
+        }
+        if (busy() && simNow >= _deadline)
+        {
+            finish(false);
+        }
+    }
+
+    uint64_t nextWake() const
+    {
+        uint64_t wake = _port.nextToHost();
+        return busy() ? std::min(wake, _deadline) : wake;
+    }
+
+private:
+    enum Step : uint8_t
+    {
+        STEP_NONE,
+        STEP_INFO,
+        STEP_UPLOAD,
+        STEP_DOWNLOAD,
+        STEP_STATUS,
+        STEP_EVENTS,
+    };
+
+    void request(uint8_t type, const uint8_t *payload, size_t len)
+    {
+        _port.hostSend(hostEncode(type, payload, len));
+        _deadline = simNow + SIM_HOST_TIMEOUT_MS;
+    }
+    void request(uint8_t type, const char *text) { request(type, (const uint8_t *)text, strlen(text)); }
+
+    void sendPart()
+    {
+        size_t len = std::min<size_t>(SIM_HOST_PART, _upload->size() - _uploaded);
+        bool last = _uploaded + len == _upload->size();
+        request(last ? LINK_UPLOAD_END : LINK_UPLOAD_PART, (const uint8_t *)_upload->data() + _uploaded, len);
+        _uploaded += len;
+    }
+
+    void startDownload()
+    {
+        _step = STEP_DOWNLOAD;
+        _streamed = 0;
+        request(LINK_CMD, "SEND_UPDATE");
+    }
+
+    void onFrame(uint8_t type, const uint8_t *payload, size_t len)
+    {
+        std::string text(type == LINK_REPLY ? std::string((const char *)payload, len) : std::string());
+        switch (_step)
+        {
+        case STEP_INFO:
+            if (type != LINK_REPLY)
+            {
+                return finish(false);
+            }
+            if (_upload && !_upload->empty())
+            {
+                _step = STEP_UPLOAD;
+                sendPart();
+                return;
+            }
+            return startDownload();
+        case STEP_UPLOAD:
+            if (type != LINK_REPLY || text != "UPLOAD " + std::to_string(_uploaded))
+            {
+                return finish(false);
+            }
+            if (_uploaded < _upload->size())
+            {
+                sendPart();
+                return;
+            }
+            return startDownload();
+        case STEP_DOWNLOAD:
+            if (type == LINK_STREAM)
+            {
+                _streamed += len;
+                _deadline = simNow + SIM_HOST_TIMEOUT_MS;
+                return;
+            }
+            if (type != LINK_STREAM_END || len != 4 ||
+                (payload[0] | (payload[1] << 8) | (payload[2] << 16) | ((uint32_t)payload[3] << 24)) != _streamed)
+            {
+                return finish(false);
+            }
+            _stats.downloads++;
+            _stats.downloadBytes += _streamed;
+            _step = STEP_STATUS;
+            request(LINK_STATUS_READ, nullptr, 0);
+            return;
+        case STEP_STATUS:
+            if (type != LINK_STATUS || len != DEVICE_STATUS_LEN)
+            {
+                return finish(false);
+            }
+            _step = STEP_EVENTS;
+            request(LINK_CMD, EVENTS_CMD);
+            return;
+        case STEP_EVENTS:
+        {
+            if (type != LINK_EVENTS || len % OUTBOX_EVENT_LEN != 0)
+            {
+                return finish(false);
+            }
+            if (len == 0)
+            {
+                return finish(true);
+            }
+            // Ack the newest event of the frame; the reply holds the ones after it
+            _stats.eventsDrained += len / OUTBOX_EVENT_LEN;
+            uint8_t ack[OUTBOX_ACK_LEN] = {OUTBOX_OP_ACK};
+            memcpy(ack + 1, payload + len - OUTBOX_EVENT_LEN + 1, 4);
+            request(LINK_EVENTS_ACK, ack, sizeof(ack));
+            return;
+        }
+        case STEP_NONE:
+            return;
+        }
+    }
+
+    void finish(bool ok)
+    {
+        if (ok)
+        {
+            _stats.syncsOk++;
+            syncDurations.push_back(simNow - _started);
+        }
+        else
+        {
+            _stats.syncsFailed++;
+        }
+        _step = STEP_NONE;
+        _upload.reset();
+    }
+
+    SimPort &_port;
+    DeviceStats &_stats;
+    Step _step = STEP_NONE;
+    std::vector<uint8_t> _rx;
+    std::shared_ptr<const std::string> _upload;
+    size_t _uploaded = 0;
+    uint32_t _streamed = 0;
+    uint64_t _started = 0;
+    uint64_t _deadline = SIM_NEVER;
+};
+
+// --- Firmware ---
+// One boot of the firmware: main.cpp's globals and their handlers. A reboot
+// throws it away; the flash survives in the SimDevice.
+class SimFirmware
+{
+public:
+    SimFirmware(SimDevice &device, fs::FS &flash, SimPort &port);
+
+    void setup();
+    void loopPass();
+    void press();
+    bool busy() const; // Wants another pass right away
+    uint32_t msUntilNextDeadline() { return _timers.msUntilNextDeadline(millis()); }
+    void flushAll()
+    {
+        _reminders.checkpoint(); // As onOtaReboot() does before a restart
+        _persistence.flush(millis());
+    }
+    void collectStats(DeviceStats &stats) const;
+    bool alerting() const { return _reminders.alerting(); }
+    uint16_t outboxCount() const { return _outbox.count(); }
+    uint32_t outboxDropped() const { return _outbox.dropped(); }
+
+private:
+    // Persistence
+    static bool writeOutboxRegion(void *ctx);
+    void armFlushTimer();
+    static void onFlushDue(void *ctx);
+
+    // Reminder hooks: no motor, the user model and the statistics instead
+    static uint32_t onAlert(bool first, void *ctx);
+    static void onSilence(void *ctx) { (void)ctx; }
+    static void onDue(const ScheduleSlot *group, uint8_t count, void *ctx);
+    static void onAnswered(const ScheduleSlot &last, uint8_t count, bool taken, void *ctx);
+    static void onQueued(void *ctx);
+    static bool isConnected(void *ctx) { (void)ctx; return false; } // No BLE peer to send the update to
+
+    // Provisioning hooks
+    static bool onCommand(const std::string &command, void *ctx);
+    static void onSubmitted(ReplyRoute route, void *ctx);
+    static void onCommitted(void *ctx);
+
+    SimDevice &_device;
+    fs::FS &_flash;
+    SimPort &_port;
+
+    ScheduleStore _store;
+    ScheduleIngest _ingest;
+    EventOutbox _outbox;
+    TimerWheel _timers;
+    Persistence _persistence;
+    DeviceStatus _status;
+    ReminderEngine _reminders;
+    Provisioning _provisioning;
+
+    TimerId _flushTimer = TIMER_NONE;
+};
+
+// --- Device ---
+
+struct ScriptEvent
+{
+    uint64_t at;
+    uint64_t period; // 0 = once
+    std::string action;
+    std::string arg;
+};
+
+class SimDevice
+{
+public:
+    SimDevice(int index, uint64_t seed, double driftPpm, double adherence)
+        : index(index), flash(SIM_FLASH_BYTES), host(port, stats), _rng(seed), _adherence(adherence)
+    {
+        clock.setDrift(0, driftPpm);
+        _drift = driftPpm;
+    }
+
+    void addEvent(const ScriptEvent &event) { _script.push_back(event); }
+
+    // One pass: due script actions, the host, a due press, then the loop
+    void step();
+    uint64_t nextWake();
+    void finish();
+
+    // From the firmware
+    void onAlert(bool first)
+    {
+        if (first)
+        {
+            stats.alerts++;
+        }
+        else
+        {
+            stats.reReminds++;
+        }
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        std::uniform_int_distribution<uint32_t> delay(SIM_PRESS_MIN_MS, SIM_PRESS_MAX_MS);
+        _pressAt = chance(_rng) < _adherence ? simNow + delay(_rng) : SIM_NEVER;
+    }
+    void onReminderFired(uint32_t offsetSec, uint8_t groupCount)
+    {
+        stats.reminders += groupCount;
+        if (_originKnown)
+        {
+            timingErrors.push_back((int64_t)simNow - (int64_t)(_originTrue + (uint64_t)offsetSec * 1000));
+        }
+    }
+    void onSubmit() { _submittedTrue = simNow; }
+    void onCommitted()
+    {
+        _originTrue = _submittedTrue;
+        _originKnown = true;
+    }
+
+    int index;
+    fs::FS flash;
+    SimPort port;
+    SimClock clock;
+    DeviceStats stats;
+    SimHost host;
+    std::map<std::string, std::shared_ptr<const std::string>> *uploads = nullptr; // Shared cache by path
+
+    uint16_t outboxCount = 0;
+    uint32_t outboxDropped = 0;
+
+private:
+    void runScript();
+    void run(const ScriptEvent &event);
+    void shutdown();
+
+    std::unique_ptr<SimFirmware> _firmware;
+    uint64_t _bootAt = 0; // While down, when power comes back
+    std::vector<ScriptEvent> _script;
+    std::mt19937_64 _rng;
+    double _adherence;
+    double _drift;
+    uint64_t _pressAt = SIM_NEVER;
+    uint64_t _submittedTrue = 0;
+    uint64_t _originTrue = 0;
+    bool _originKnown = false; // False for a schedule from a loaded flash image
+};
+
+unsigned long millis()
+{
+    return currentDevice != nullptr ? (unsigned long)(uint32_t)currentDevice->clock.msAt(simNow)
+                                    : (unsigned long)simNow;
+}
+
+unsigned long micros()
+{
+    return millis() * 1000UL;
+}
+
+// Only reached by code paths the simulator does not mirror (BLE pacing)
+void delay(unsigned long ms)
+{
+    (void)ms;
+}
+
+// --- SimFirmware: setup ---
+
+SimFirmware::SimFirmware(SimDevice &device, fs::FS &flash, SimPort &port)
+    : _device(device), _flash(flash), _port(port), _store(flash), _ingest(_store), _outbox(flash),
+      _reminders(flash, _store, _ingest, _timers, _persistence, _outbox),
+      _provisioning(_store, _ingest, _reminders, _status, _outbox, _persistence)
+{
+}
+
+void SimFirmware::setup()
+{
+    ProvisioningHooks provisioningHooks = {onCommand, nullptr, onSubmitted, onCommitted, nullptr, this};
+    _provisioning.begin(provisioningHooks);
+    _provisioning.beginSerial(_port);
+    _timers.begin(millis());
+
+    FlushPolicy policy = {FLUSH_MAX_LATENCY_MS, FLUSH_MAX_DIRTY_COUNT, true};
+    _persistence.begin(policy);
+    _persistence.registerRegion(PERSIST_OUTBOX, writeOutboxRegion, this);
+    _outbox.load();
+
+    ReminderHooks hooks = {onAlert, onSilence, onDue, onAnswered, onQueued, isConnected, this};
+    _reminders.begin(hooks);
+    _reminders.restore(_store.load());
+}
+
+void SimFirmware::collectStats(DeviceStats &stats) const
+{
+    const UploadCounts &uploads = _provisioning.counts();
+    stats.uploadsCommitted += uploads.committed;
+    stats.uploadsUnchanged += uploads.unchanged;
+    stats.uploadsFailed += uploads.failed;
+    stats.uploadsRefused += uploads.refused;
+    stats.patchesSkipped += uploads.patches;
+    stats.framesIn += _provisioning.link().framesReceived();
+    stats.badFrames += _provisioning.link().badFrames();
+    stats.flushes += _persistence.flushCount();
+}
+
+// --- SimFirmware: persistence ---
+
+bool SimFirmware::writeOutboxRegion(void *ctx)
+{
+    return ((SimFirmware *)ctx)->_outbox.save();
+}
+
+void SimFirmware::onFlushDue(void *ctx)
+{
+    ((SimFirmware *)ctx)->_persistence.flushIfDue(millis());
+}
+
+void SimFirmware::armFlushTimer()
+{
+    unsigned long now = millis();
+    uint32_t wait = _persistence.msUntilFlush(now);
+    if (wait == UINT32_MAX)
+    {
+        return;
+    }
+    if (!_timers.isArmed(_flushTimer) || _timers.msUntil(_flushTimer, now) > wait)
+    {
+        _flushTimer = _timers.reschedule(_flushTimer, wait, onFlushDue, this, now);
+    }
+}
+
+// --- SimFirmware: reminder hooks ---
+
+uint32_t SimFirmware::onAlert(bool first, void *ctx)
+{
+    ((SimFirmware *)ctx)->_device.onAlert(first);
+    return VIBRATION_DURATION_MS;
+}
+
+void SimFirmware::onDue(const ScheduleSlot *group, uint8_t count, void *ctx)
+{
+    ((SimFirmware *)ctx)->_device.onReminderFired(group[0].offsetSec, count);
+}
+
+void SimFirmware::onAnswered(const ScheduleSlot &last, uint8_t count, bool taken, void *ctx)
+{
+    SimFirmware *fw = (SimFirmware *)ctx;
+    (taken ? fw->_device.stats.answered : fw->_device.stats.missed) += count;
+    fw->_status.setLastResponse(last.slot, taken ? SLOT_TAKEN : SLOT_MISSED, millis());
+}
+
+void SimFirmware::onQueued(void *ctx)
+{
+    ((SimFirmware *)ctx)->_device.stats.eventsQueued++;
+}
+
+// A press only counts while waiting for an answer, as in handleButtonEvent()
+void SimFirmware::press()
+{
+    if (_reminders.state() == STATE_VIBRATING)
+    {
+        _device.stats.ignoredPresses++;
+        return;
+    }
+    _reminders.press();
+}
+
+// --- SimFirmware: provisioning hooks ---
+
+// LOG_FETCH, TRACE_DUMP, CODEC, XFER, OTA and the BLE-only commands
+bool SimFirmware::onCommand(const std::string &command, void *ctx)
+{
+    (void)command;
+    ((SimFirmware *)ctx)->_provisioning.reply("UNSUPPORTED");
+    return true;
+}
+
+void SimFirmware::onSubmitted(ReplyRoute route, void *ctx)
+{
+    (void)route;
+    ((SimFirmware *)ctx)->_device.onSubmit();
+}
+
+void SimFirmware::onCommitted(void *ctx)
+{
+    ((SimFirmware *)ctx)->_device.onCommitted();
+}
+
+// --- SimFirmware: loop ---
+
+bool SimFirmware::busy() const
+{
+    return _reminders.pending() || _provisioning.inboxReady() || _ingest.active();
+}
+
+// The body of loop() in main.cpp, without BLE and the LED
+void SimFirmware::loopPass()
+{
+    _provisioning.pollSerial();
+    _provisioning.serviceIngest();
+    _timers.advance(millis());
+    armFlushTimer();
+    _reminders.service();
+    _provisioning.updateStatus(0);
+    _status.takeChanged(); // Nobody subscribes over the link
+}
+
+// --- SimDevice ---
+
+void SimDevice::shutdown()
+{
+    if (_firmware)
+    {
+        _firmware->collectStats(stats);
+        outboxCount = _firmware->outboxCount();
+        outboxDropped = _firmware->outboxDropped();
+        _firmware.reset();
+    }
+    _pressAt = SIM_NEVER;
+}
+
+void SimDevice::run(const ScriptEvent &event)
+{
+    uint64_t down = 0;
+    if (event.action == "reboot" || event.action == "powerloss")
+    {
+        if (!event.arg.empty())
+        {
+            parseDuration(event.arg, down);
+        }
+        if (!_firmware)
+        {
+            return; // Already down
+        }
+        if (event.action == "reboot")
+        {
+            _firmware->flushAll();
+            stats.cleanReboots++;
+        }
+        else
+        {
+            flash.cutPower();
+            stats.powerLosses++;
+        }
+        shutdown();
+        port.reset();
+        _bootAt = simNow + down;
+    }
+    else if (event.action == "sync")
+    {
+        if (port.fd() >= 0)
+        {
+            return; // The host tool on the terminal syncs
+        }
+        std::shared_ptr<const std::string> upload;
+        if (!event.arg.empty())
+        {
+            auto cached = uploads->find(event.arg);
+            if (cached == uploads->end())
+            {
+                std::string text;
+                if (!readText(event.arg, text))
+                {
+                    fprintf(stderr, "fleet_sim: cannot read schedule %s\n", event.arg.c_str());
+                }
+                cached = uploads->emplace(event.arg, std::make_shared<const std::string>(text)).first;
+            }
+            upload = cached->second;
+        }
+        host.startSync(upload);
+    }
+    else if (event.action == "flashfull")
+    {
+        flash.setCapacity(event.arg == "off" ? SIM_FLASH_BYTES : flash.usedBytes());
+    }
+    else if (event.action == "drift")
+    {
+        _drift = atof(event.arg.c_str());
+        clock.setDrift(simNow, _drift);
+    }
+    else if (event.action == "adherence")
+    {
+        _adherence = atof(event.arg.c_str());
+    }
+    else if (event.action == "link")
+    {
+        port.setUp(event.arg != "off");
+    }
+}
+
+void SimDevice::runScript()
+{
+    for (ScriptEvent &event : _script)
+    {
+        while (event.at <= simNow)
+        {
+            run(event);
+            if (event.period == 0)
+            {
+                event.at = SIM_NEVER;
+                break;
+            }
+            event.at += event.period;
+        }
+    }
+}
+
+void SimDevice::step()
+{
+    currentDevice = this;
+    runScript();
+    host.service();
+    if (!_firmware)
+    {
+        if (simNow < _bootAt)
+        {
+            port.pump(simNow, true);
+            currentDevice = nullptr;
+            return;
+        }
+        clock.boot(simNow);
+        clock.setDrift(simNow, _drift);
+        _firmware.reset(new SimFirmware(*this, flash, port));
+        _firmware->setup();
+    }
+    port.pump(simNow);
+    if (_pressAt <= simNow)
+    {
+        _pressAt = SIM_NEVER;
+        _firmware->press();
+    }
+    _firmware->loopPass();
+    host.service(); // Replies that need no wire time
+    currentDevice = nullptr;
+}
+
+uint64_t SimDevice::nextWake()
+{
+    uint64_t wake = host.nextWake();
+    for (const ScriptEvent &event : _script)
+    {
+        wake = std::min(wake, event.at);
+    }
+    if (!_firmware)
+    {
+        return std::min(wake, std::max(_bootAt, simNow));
+    }
+    wake = std::min(wake, port.nextToDevice());
+    if (_firmware->busy() || port.available() > 0)
+    {
+        return simNow;
+    }
+    currentDevice = this;
+    uint32_t waitMs = _firmware->msUntilNextDeadline();
+    currentDevice = nullptr;
+    if (waitMs != UINT32_MAX)
+    {
+        // A deadline in the current millisecond waits for the next one
+        wake = std::min(wake, std::max(clock.trueAfter(simNow, waitMs), simNow + 1));
+    }
+    if (_firmware->alerting())
+    {
+        wake = std::min(wake, _pressAt);
+    }
+    return wake;
+}
+
+void SimDevice::finish()
+{
+    if (_firmware)
+    {
+        currentDevice = this;
+        _firmware->collectStats(stats);
+        outboxCount = _firmware->outboxCount();
+        outboxDropped = _firmware->outboxDropped();
+        currentDevice = nullptr;
+    }
+    stats.linkRx = port.rxBytes;
+    stats.linkTx = port.txBytes;
+    stats.linkDropped = port.dropped;
+}
+
+// --- Scripts ---
+
+static bool parseDuration(const std::string &text, uint64_t &ms)
+{
+    const char *p = text.c_str();
+    uint64_t total = 0;
+    if (*p == '\0')
+    {
+        return false;
+    }
+    while (*p != '\0')
+    {
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p || value < 0)
+        {
+            return false;
+        }
+        p = end;
+        double unit = 1000;
+        if (strncmp(p, "ms", 2) == 0)
+        {
+            unit = 1;
+            p += 2;
+        }
+        else if (*p == 's' || *p == 'm' || *p == 'h' || *p == 'd')
+        {
+            unit = *p == 's' ? 1000 : (*p == 'm' ? 60000 : (*p == 'h' ? 3600000 : 86400000));
+            p++;
+        }
+        else if (*p != '\0')
+        {
+            return false;
+        }
+        total += (uint64_t)(value * unit);
+    }
+    ms = total;
+    return true;
+}
+
+static std::string formatPath(const std::string &pattern, int index)
+{
+    std::string path = pattern;
+    size_t at = path.find("%d");
+    if (at != std::string::npos)
+    {
+        path.replace(at, 2, std::to_string(index));
+    }
+    return path;
+}
+
+static bool readText(const std::string &path, std::string &out)
+{
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    char buffer[4096];
+    size_t n;
+    out.clear();
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        out.append(buffer, n);
+    }
+    fclose(file);
+    return true;
+}
+
+// "at <time> <action> [arg]" or "every <period> <action> [arg]", one per line
+static bool loadScript(const std::string &path, SimDevice &device)
+{
+    std::string text;
+    if (!readText(path, text))
+    {
+        fprintf(stderr, "fleet_sim: cannot read script %s\n", path.c_str());
+        return false;
+    }
+    size_t lineStart = 0;
+    int lineNumber = 0;
+    while (lineStart < text.size())
+    {
+        size_t lineEnd = text.find('\n', lineStart);
+        if (lineEnd == std::string::npos)
+        {
+            lineEnd = text.size();
+        }
+        std::string line = text.substr(lineStart, lineEnd - lineStart);
+        lineStart = lineEnd + 1;
+        lineNumber++;
+        line = line.substr(0, line.find('#'));
+
+        char kind[16], when[32], action[32], arg[256] = "";
+        int fields = sscanf(line.c_str(), "%15s %31s %31s %255s", kind, when, action, arg);
+        if (fields <= 0)
+        {
+            continue;
+        }
+        ScriptEvent event;
+        bool every = strcmp(kind, "every") == 0;
+        uint64_t time;
+        if (fields < 3 || (!every && strcmp(kind, "at") != 0) || !parseDuration(when, time) || (every && time == 0))
+        {
+            fprintf(stderr, "fleet_sim: %s:%d: expected \"at|every <time> <action> [arg]\"\n", path.c_str(), lineNumber);
+            return false;
+        }
+        event.at = time;
+        event.period = every ? time : 0;
+        event.action = action;
+        event.arg = arg;
+        device.addEvent(event);
+    }
+    return true;
+}
+
+// Enough schedule for the whole run: one med every 8 h, one every morning
+static std::string defaultSchedule(uint64_t durationMs)
+{
+    std::string json = "[{\"med_id\":\"TID\",\"times\":[";
+    uint64_t days = durationMs / 86400000 + 1;
+    for (uint64_t hour = 8; hour < days * 24; hour += 8)
+    {
+        json += (hour == 8 ? "" : ",") + std::to_string(hour * 3600);
+    }
+    json += "]},{\"med_id\":\"QD\",\"times\":[";
+    for (uint64_t day = 0; day < days; ++day)
+    {
+        json += (day == 0 ? "" : ",") + std::to_string(day * 86400 + 9 * 3600);
+    }
+    return json + "]}]";
+}
+
+// --- Flash images ---
+// <dir>/devNNN.img: per file a u16 path length, the path, a u32 size and the bytes
+
+static bool loadImage(const std::string &path, fs::FS &flash)
+{
+    std::string data;
+    if (!readText(path, data))
+    {
+        return false;
+    }
+    size_t at = 0;
+    while (at + 2 <= data.size())
+    {
+        size_t pathLen = (uint8_t)data[at] | ((uint8_t)data[at + 1] << 8);
+        at += 2;
+        if (at + pathLen + 4 > data.size())
+        {
+            return false;
+        }
+        std::string name = data.substr(at, pathLen);
+        at += pathLen;
+        size_t size = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            size |= (size_t)(uint8_t)data[at + i] << (8 * i);
+        }
+        at += 4;
+        if (at + size > data.size())
+        {
+            return false;
+        }
+        flash.restore(name, std::vector<uint8_t>(data.begin() + at, data.begin() + at + size));
+        at += size;
+    }
+    return true;
+}
+
+static bool saveImage(const std::string &path, const fs::FS &flash)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr)
+    {
+        return false;
+    }
+    for (const auto &entry : flash.files())
+    {
+        uint8_t header[2] = {(uint8_t)entry.first.size(), (uint8_t)(entry.first.size() >> 8)};
+        uint32_t size = entry.second->size();
+        uint8_t sizeBytes[4] = {(uint8_t)size, (uint8_t)(size >> 8), (uint8_t)(size >> 16), (uint8_t)(size >> 24)};
+        fwrite(header, 1, 2, file);
+        fwrite(entry.first.data(), 1, entry.first.size(), file);
+        fwrite(sizeBytes, 1, 4, file);
+        fwrite(entry.second->data(), 1, size, file);
+    }
+    return fclose(file) == 0;
+}
+
+// --- Report ---
+
+template <typename T>
+static T percentile(std::vector<T> &values, double p)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    size_t at = (size_t)(p * (values.size() - 1) + 0.5);
+    std::nth_element(values.begin(), values.begin() + at, values.end());
+    return values[at];
+}
+
+struct FleetTotals
+{
+    DeviceStats sum;
+    fs::FlashStats flash;
+    uint64_t maxFlashBytes = 0;
+    int maxFlashDevice = 0;
+    uint64_t outboxBacklog = 0;
+    uint16_t maxOutbox = 0;
+    uint64_t outboxDropped = 0;
+};
+
+static FleetTotals total(const std::vector<std::unique_ptr<SimDevice>> &devices)
+{
+    FleetTotals t;
+    for (const auto &device : devices)
+    {
+        const DeviceStats &s = device->stats;
+        DeviceStats &a = t.sum;
+        a.alerts += s.alerts;
+        a.reminders += s.reminders;
+        a.reReminds += s.reReminds;
+        a.answered += s.answered;
+        a.missed += s.missed;
+        a.ignoredPresses += s.ignoredPresses;
+        a.cleanReboots += s.cleanReboots;
+        a.powerLosses += s.powerLosses;
+        a.uploadsCommitted += s.uploadsCommitted;
+        a.uploadsUnchanged += s.uploadsUnchanged;
+        a.uploadsFailed += s.uploadsFailed;
+        a.uploadsRefused += s.uploadsRefused;
+        a.patchesSkipped += s.patchesSkipped;
+        a.downloads += s.downloads;
+        a.downloadBytes += s.downloadBytes;
+        a.syncs += s.syncs;
+        a.syncsOk += s.syncsOk;
+        a.syncsFailed += s.syncsFailed;
+        a.syncsSkipped += s.syncsSkipped;
+        a.eventsQueued += s.eventsQueued;
+        a.eventsDrained += s.eventsDrained;
+        a.framesIn += s.framesIn;
+        a.badFrames += s.badFrames;
+        a.flushes += s.flushes;
+        a.linkRx += s.linkRx;
+        a.linkTx += s.linkTx;
+        a.linkDropped += s.linkDropped;
+
+        const fs::FlashStats &f = device->flash.stats();
+        t.flash.bytesWritten += f.bytesWritten;
+        t.flash.commits += f.commits;
+        t.flash.removes += f.removes;
+        t.flash.renames += f.renames;
+        t.flash.failedWrites += f.failedWrites;
+        if (f.bytesWritten > t.maxFlashBytes)
+        {
+            t.maxFlashBytes = f.bytesWritten;
+            t.maxFlashDevice = device->index;
+        }
+        t.outboxBacklog += device->outboxCount;
+        t.maxOutbox = std::max(t.maxOutbox, device->outboxCount);
+        t.outboxDropped += device->outboxDropped;
+    }
+    return t;
+}
+
+static void printReport(const std::vector<std::unique_ptr<SimDevice>> &devices, uint64_t durationMs, double wallSec,
+                        bool json)
+{
+    FleetTotals t = total(devices);
+    const DeviceStats &s = t.sum;
+    double deviceDays = (double)devices.size() * durationMs / 86400000.0;
+    int64_t errP50 = percentile(timingErrors, 0.50);
+    int64_t errP90 = percentile(timingErrors, 0.90);
+    int64_t errP99 = percentile(timingErrors, 0.99);
+    int64_t errMax = timingErrors.empty() ? 0 : *std::max_element(timingErrors.begin(), timingErrors.end());
+    int64_t errMin = timingErrors.empty() ? 0 : *std::min_element(timingErrors.begin(), timingErrors.end());
+    uint64_t syncP50 = percentile(syncDurations, 0.50);
+    uint64_t syncP99 = percentile(syncDurations, 0.99);
+
+    if (json)
+    {
+        printf("{\"devices\":%u,\"simulated_ms\":%llu,\"wall_s\":%.3f,\n", (unsigned)devices.size(),
+               (unsigned long long)durationMs, wallSec);
+        printf(" \"reminders\":{\"alerts\":%u,\"slots\":%u,\"re_reminds\":%u,\"answered\":%u,\"missed\":%u,"
+               "\"ignored_presses\":%u},\n",
+               s.alerts, s.reminders, s.reReminds, s.answered, s.missed, s.ignoredPresses);
+        printf(" \"timing_error_ms\":{\"count\":%u,\"min\":%lld,\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"max\":%lld},\n",
+               (unsigned)timingErrors.size(), (long long)errMin, (long long)errP50, (long long)errP90,
+               (long long)errP99, (long long)errMax);
+        printf(" \"reboots\":{\"clean\":%u,\"power_loss\":%u},\n", s.cleanReboots, s.powerLosses);
+        printf(" \"flash\":{\"bytes\":%llu,\"commits\":%u,\"removes\":%u,\"renames\":%u,\"failed_writes\":%u,"
+               "\"flushes\":%u,\"bytes_per_device_day\":%.0f,\"max_device\":%d,\"max_device_bytes\":%llu},\n",
+               (unsigned long long)t.flash.bytesWritten, t.flash.commits, t.flash.removes, t.flash.renames,
+               t.flash.failedWrites, s.flushes, deviceDays > 0 ? t.flash.bytesWritten / deviceDays : 0.0,
+               t.maxFlashDevice, (unsigned long long)t.maxFlashBytes);
+        printf(" \"link\":{\"rx_bytes\":%llu,\"tx_bytes\":%llu,\"dropped_bytes\":%llu,\"frames\":%u,\"bad_frames\":%u},\n",
+               (unsigned long long)s.linkRx, (unsigned long long)s.linkTx, (unsigned long long)s.linkDropped,
+               s.framesIn, s.badFrames);
+        printf(" \"syncs\":{\"started\":%u,\"ok\":%u,\"failed\":%u,\"skipped\":%u,\"p50_ms\":%llu,\"p99_ms\":%llu},\n",
+               s.syncs, s.syncsOk, s.syncsFailed, s.syncsSkipped, (unsigned long long)syncP50,
+               (unsigned long long)syncP99);
+        printf(" \"uploads\":{\"committed\":%u,\"unchanged\":%u,\"failed\":%u,\"refused\":%u,\"patches_skipped\":%u},\n",
+               s.uploadsCommitted, s.uploadsUnchanged, s.uploadsFailed, s.uploadsRefused, s.patchesSkipped);
+        printf(" \"downloads\":{\"count\":%u,\"bytes\":%llu},\n", s.downloads, (unsigned long long)s.downloadBytes);
+        printf(" \"outbox\":{\"queued\":%u,\"drained\":%u,\"backlog\":%llu,\"max_backlog\":%u,\"dropped\":%llu}}\n",
+               s.eventsQueued, s.eventsDrained, (unsigned long long)t.outboxBacklog, t.maxOutbox, (unsigned long long)t.outboxDropped);
+        return;
+    }
+
+    printf("fleet      %u devices, %.1f days simulated in %.1f s\n", (unsigned)devices.size(), durationMs / 86400000.0,
+           wallSec);
+    printf("reminders  %u alerts for %u slots, %u re-reminds, %u answered, %u missed, %u presses during vibration\n",
+           s.alerts, s.reminders, s.reReminds, s.answered, s.missed, s.ignoredPresses);
+    printf("timing     %u alerts, error ms min %lld p50 %lld p90 %lld p99 %lld max %lld\n",
+           (unsigned)timingErrors.size(), (long long)errMin, (long long)errP50, (long long)errP90, (long long)errP99,
+           (long long)errMax);
+    printf("reboots    %u clean, %u power loss\n", s.cleanReboots, s.powerLosses);
+    printf("flash      %llu bytes in %u file writes (%u flushes), %.0f bytes/device-day, max device %d: %llu bytes, "
+           "%u failed writes\n",
+           (unsigned long long)t.flash.bytesWritten, t.flash.commits, s.flushes,
+           deviceDays > 0 ? t.flash.bytesWritten / deviceDays : 0.0, t.maxFlashDevice,
+           (unsigned long long)t.maxFlashBytes, t.flash.failedWrites);
+    printf("link       %llu bytes in, %llu bytes out, %llu dropped, %u frames, %u bad\n", (unsigned long long)s.linkRx,
+           (unsigned long long)s.linkTx, (unsigned long long)s.linkDropped, s.framesIn, s.badFrames);
+    printf("syncs      %u started, %u ok, %u failed, %u skipped, p50 %llu ms, p99 %llu ms\n", s.syncs, s.syncsOk,
+           s.syncsFailed, s.syncsSkipped, (unsigned long long)syncP50, (unsigned long long)syncP99);
+    printf("uploads    %u committed, %u unchanged, %u failed, %u refused, %u patches skipped\n", s.uploadsCommitted,
+           s.uploadsUnchanged, s.uploadsFailed, s.uploadsRefused, s.patchesSkipped);
+    printf("downloads  %u, %llu bytes\n", s.downloads, (unsigned long long)s.downloadBytes);
+    printf("outbox     %u events queued, %u drained, %llu unacknowledged at the end (max %u on one device), %llu dropped\n",
+           s.eventsQueued, s.eventsDrained, (unsigned long long)t.outboxBacklog, t.maxOutbox, (unsigned long long)t.outboxDropped);
+}
+
+static void printDevices(const std::vector<std::unique_ptr<SimDevice>> &devices)
+{
+    printf("%-6s %7s %7s %7s %7s %10s %8s %6s %6s\n", "device", "alerts", "taken", "missed", "reboots", "flash",
+           "writes", "syncs", "outbox");
+    for (const auto &device : devices)
+    {
+        const DeviceStats &s = device->stats;
+        printf("%-6d %7u %7u %7u %7u %10llu %8u %6u %6u\n", device->index, s.alerts, s.answered, s.missed,
+               s.cleanReboots + s.powerLosses, (unsigned long long)device->flash.stats().bytesWritten,
+               device->flash.stats().commits, s.syncsOk, device->outboxCount);
+    }
+}
+
+// --- Main ---
+
+static uint64_t wallMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --devices N        virtual devices (default 10)\n"
+            "  --duration T       simulated time, e.g. 7d (default 1d)\n"
+            "  --schedule FILE    uploaded by every device at start (default: a generated one)\n"
+            "  --script FILE      per-device fault and sync script\n"
+            "  --sync-every T     every device syncs this often, at a random phase\n"
+            "  --drift-ppm X      crystal error drawn from [-X, X] per device (default 20)\n"
+            "  --adherence P      chance an alert is answered (default 0.9)\n"
+            "  --seed N           random seed (default 1)\n"
+            "  --pty DIR          expose each device as DIR/devNNN for tools/provision.py\n"
+            "  --speed X          simulated seconds per wall second (default: as fast as possible,\n"
+            "                     1 with --pty)\n"
+            "  --image-dir DIR    load flash images from DIR at start, save them at the end\n"
+            "  --per-device       print a line per device\n"
+            "  --json             print the report as JSON\n"
+            "FILE arguments may contain %%d for the device number.\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    int deviceCount = 10;
+    uint64_t durationMs = 86400000;
+    uint64_t syncEvery = 0;
+    std::string schedulePattern, scriptPattern, ptyDir, imageDir;
+    double driftPpm = 20;
+    double adherence = 0.9;
+    unsigned long seed = 1;
+    double speed = -1;
+    bool perDevice = false;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--devices" && hasValue)
+        {
+            deviceCount = atoi(argv[++i]);
+        }
+        else if ((option == "--duration" || option == "--sync-every") && hasValue)
+        {
+            if (!parseDuration(argv[++i], option == "--duration" ? durationMs : syncEvery))
+            {
+                usage(argv[0]);
+                return 2;
+            }
+        }
+        else if (option == "--schedule" && hasValue)
+        {
+            schedulePattern = argv[++i];
+        }
+        else if (option == "--script" && hasValue)
+        {
+            scriptPattern = argv[++i];
+        }
+        else if (option == "--drift-ppm" && hasValue)
+        {
+            driftPpm = atof(argv[++i]);
+        }
+        else if (option == "--adherence" && hasValue)
+        {
+            adherence = atof(argv[++i]);
+        }
+        else if (option == "--seed" && hasValue)
+        {
+            seed = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (option == "--pty" && hasValue)
+        {
+            ptyDir = argv[++i];
+        }
+        else if (option == "--speed" && hasValue)
+        {
+            speed = atof(argv[++i]);
+        }
+        else if (option == "--image-dir" && hasValue)
+        {
+            imageDir = argv[++i];
+        }
+        else if (option == "--per-device")
+        {
+            perDevice = true;
+        }
+        else if (option == "--json")
+        {
+            json = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (deviceCount <= 0 || durationMs == 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if (speed < 0)
+    {
+        speed = ptyDir.empty() ? 0 : 1;
+    }
+    if (!ptyDir.empty() && speed == 0)
+    {
+        fprintf(stderr, "fleet_sim: --pty needs a --speed the host tool can follow\n");
+        return 2;
+    }
+    if (!ptyDir.empty())
+    {
+        mkdir(ptyDir.c_str(), 0755);
+    }
+
+    // Uploads are shared by path; the built-in host reads each file once
+    std::map<std::string, std::shared_ptr<const std::string>> uploads;
+    std::mt19937_64 fleetRng(seed);
+    std::uniform_real_distribution<double> drift(-driftPpm, driftPpm);
+    std::uniform_int_distribution<uint64_t> initialSync(0, SIM_INITIAL_SYNC_SPREAD_MS);
+    std::vector<std::unique_ptr<SimDevice>> devices;
+    for (int index = 0; index < deviceCount; ++index)
+    {
+        std::unique_ptr<SimDevice> device(new SimDevice(index, seed * 1000003 + index, drift(fleetRng), adherence));
+        device->uploads = &uploads;
+        char name[16];
+        snprintf(name, sizeof(name), "dev%03d", index);
+        if (!imageDir.empty())
+        {
+            loadImage(imageDir + "/" + name + ".img", device->flash);
+        }
+        if (!ptyDir.empty() && !device->port.openPty(ptyDir + "/" + name))
+        {
+            fprintf(stderr, "fleet_sim: cannot create a terminal for %s: %s\n", name, strerror(errno));
+            return 1;
+        }
+        if (ptyDir.empty())
+        {
+            // The built-in host gives every device its schedule, then syncs it periodically
+            std::string schedule = schedulePattern.empty() ? "default" : formatPath(schedulePattern, index);
+            if (!uploads.count(schedule))
+            {
+                std::string text = schedulePattern.empty() ? defaultSchedule(durationMs) : std::string();
+                if (!schedulePattern.empty() && !readText(schedule, text))
+                {
+                    fprintf(stderr, "fleet_sim: cannot read schedule %s\n", schedule.c_str());
+                    return 1;
+                }
+                uploads[schedule] = std::make_shared<const std::string>(text);
+            }
+            device->addEvent({initialSync(fleetRng), 0, "sync", schedule});
+            if (syncEvery > 0)
+            {
+                std::uniform_int_distribution<uint64_t> phase(1, syncEvery);
+                device->addEvent({phase(fleetRng), syncEvery, "sync", ""});
+            }
+        }
+        if (!scriptPattern.empty() && !loadScript(formatPath(scriptPattern, index), *device))
+        {
+            return 1;
+        }
+        devices.push_back(std::move(device));
+    }
+    // Every device sits in the queue at its next wake-up time
+    std::set<std::pair<uint64_t, int>> queue;
+    std::vector<uint64_t> wakeAt(deviceCount);
+    for (int index = 0; index < deviceCount; ++index)
+    {
+        wakeAt[index] = 0;
+        queue.insert({0, index});
+    }
+    auto requeue = [&](int index, uint64_t wake) {
+        queue.erase({wakeAt[index], index});
+        wakeAt[index] = wake;
+        queue.insert({wake, index});
+    };
+
+    uint64_t wallStart = wallMs();
+    std::vector<struct pollfd> fds;
+    if (!ptyDir.empty())
+    {
+        for (const auto &device : devices)
+        {
+            fds.push_back({device->port.fd(), POLLIN, 0});
+        }
+        printf("fleet_sim: %d devices in %s/, running for %.1f h at %gx\n", deviceCount, ptyDir.c_str(),
+               durationMs / 3600000.0, speed);
+        fflush(stdout);
+    }
+
+    while (!queue.empty())
+    {
+        uint64_t next = queue.begin()->first;
+        if (next >= durationMs)
+        {
+            if (speed == 0 || simNow >= durationMs)
+            {
+                break;
+            }
+            next = durationMs;
+        }
+        if (speed > 0)
+        {
+            // Follow the wall clock; bytes from a host tool wake their device at once
+            uint64_t wallTarget = wallStart + (uint64_t)(next / speed);
+            uint64_t nowWall = wallMs();
+            if (nowWall < wallTarget)
+            {
+                int timeout = (int)std::min<uint64_t>(wallTarget - nowWall, 1000);
+                bool woken = false;
+                if (!fds.empty() && poll(fds.data(), fds.size(), timeout) > 0)
+                {
+                    simNow = std::max(simNow, (uint64_t)((wallMs() - wallStart) * speed));
+                    for (size_t i = 0; i < fds.size(); ++i)
+                    {
+                        if (fds[i].revents & POLLIN)
+                        {
+                            requeue((int)i, simNow);
+                            woken = true;
+                        }
+                    }
+                }
+                else if (fds.empty())
+                {
+                    usleep(timeout * 1000);
+                }
+                if (woken || wallMs() < wallTarget)
+                {
+                    continue;
+                }
+            }
+        }
+        if (next >= durationMs)
+        {
+            simNow = durationMs;
+            break;
+        }
+        simNow = std::max(simNow, next);
+        int index = queue.begin()->second;
+        SimDevice &device = *devices[index];
+        device.step();
+        requeue(index, device.nextWake());
+    }
+    simNow = std::max(simNow, durationMs);
+    double wallSec = (wallMs() - wallStart) / 1000.0;
+
+    for (auto &device : devices)
+    {
+        device->finish();
+        if (!imageDir.empty())
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "dev%03d", device->index);
+            saveImage(imageDir + "/" + name + ".img", device->flash);
+        }
+    }
+    if (!ptyDir.empty())
+    {
+        for (const auto &device : devices)
+        {
+            char name[16];
+            snprintf(name, sizeof(name), "/dev%03d", device->index);
+            unlink((ptyDir + name).c_str());
+        }
+    }
+    printReport(devices, durationMs, wallSec, json);
+    if (perDevice)
+    {
+        printDevices(devices);
+    }
+    return 0;
+}
+
+#endif // ARDUINO
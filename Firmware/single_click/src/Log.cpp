@@ -0,0 +1,195 @@
+#include "Log.h"
+
+#include <stdarg.h>
+#include <freertos/task.h>
+
+#define LOG_DRAIN_TASK_STACK 3072
+#define LOG_DRAIN_TASK_PRIORITY (tskIDLE_PRIORITY + 1)
+
+static_assert((LOG_QUEUE_SLOTS & (LOG_QUEUE_SLOTS - 1)) == 0, "Queue positions wrap, so the slot count must be a power of two");
+static_assert(LOG_LINE_MAX >= sizeof(LogRecord) && LOG_LINE_MAX <= 255, "A slot holds a record and a length byte");
+static_assert(sizeof(LogRecord) == LOG_RECORD_LEN, "LogRecord is sent as is");
+
+Logger logger;
+
+// The drain task's stack is static like every other buffer
+static StackType_t drainStack[LOG_DRAIN_TASK_STACK];
+static StaticTask_t drainTaskBuffer;
+
+Logger::Logger()
+{
+    for (uint32_t i = 0; i < LOG_QUEUE_SLOTS; ++i)
+    {
+        _slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+void Logger::begin(unsigned long baud)
+{
+    Serial.begin(baud);
+    _outputLock = xSemaphoreCreateMutexStatic(&_outputLockBuffer);
+    xTaskCreateStatic(drainTask, "log", LOG_DRAIN_TASK_STACK, this, LOG_DRAIN_TASK_PRIORITY, drainStack, &drainTaskBuffer);
+}
+
+void Logger::lockOutput()
+{
+    if (_outputLock != nullptr)
+    {
+        xSemaphoreTake(_outputLock, portMAX_DELAY);
+    }
+}
+
+void Logger::unlockOutput()
+{
+    if (_outputLock != nullptr)
+    {
+        xSemaphoreGive(_outputLock);
+    }
+}
+
+// --- Producers ---
+
+// Claims the next free slot (bounded MPMC queue after Vyukov). The caller
+// fills it and publishes it by storing position + 1 in its sequence.
+Logger::Slot *Logger::reserve()
+{
+    uint32_t position = _enqueue.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        Slot &slot = _slots[position % LOG_QUEUE_SLOTS];
+        int32_t diff = (int32_t)(slot.sequence.load(std::memory_order_acquire) - position);
+        if (diff == 0)
+        {
+            if (_enqueue.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                return &slot;
+            }
+        }
+        else if (diff < 0)
+        {
+            _dropped.fetch_add(1, std::memory_order_relaxed); // Full: the drain task is behind
+            return nullptr;
+        }
+        else
+        {
+            position = _enqueue.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Logger::write(uint8_t level, const char *format, ...)
+{
+    Slot *slot = reserve();
+    if (slot == nullptr)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(slot->text, sizeof(slot->text), format, args);
+    va_end(args);
+
+    slot->ms = millis();
+    slot->kind = KIND_TEXT;
+    slot->level = level;
+    slot->length = length < 0 ? 0 : std::min<int>(length, sizeof(slot->text) - 1);
+    uint32_t position = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+void Logger::record(uint16_t code, uint16_t arg16, uint32_t arg32)
+{
+    Slot *slot = reserve();
+    if (slot == nullptr)
+    {
+        return;
+    }
+    LogRecord record = {(uint32_t)millis(), code, arg16, arg32};
+    memcpy(slot->text, &record, sizeof(record));
+    slot->ms = record.ms;
+    slot->kind = KIND_RECORD;
+    slot->length = sizeof(record);
+    uint32_t position = slot->sequence.load(std::memory_order_relaxed);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+// --- Consumer ---
+
+void Logger::drain()
+{
+    static const char levelNames[] = "-EWID";
+    for (;;)
+    {
+        Slot &slot = _slots[_dequeue % LOG_QUEUE_SLOTS];
+        if ((int32_t)(slot.sequence.load(std::memory_order_acquire) - (_dequeue + 1)) < 0)
+        {
+            break; // Empty
+        }
+
+        if (slot.kind == KIND_RECORD)
+        {
+            LogRecord record;
+            memcpy(&record, slot.text, sizeof(record));
+            portENTER_CRITICAL(&_historyLock);
+            _history[(_historyHead + _historyCount) % LOG_HISTORY_RECORDS] = record;
+            if (_historyCount < LOG_HISTORY_RECORDS)
+            {
+                _historyCount++;
+            }
+            else
+            {
+                _historyHead = (_historyHead + 1) % LOG_HISTORY_RECORDS;
+            }
+            portEXIT_CRITICAL(&_historyLock);
+            lockOutput();
+            Serial.printf("[%7lu][R] code %u %u %lu\n", (unsigned long)record.ms, record.code, record.arg16,
+                          (unsigned long)record.arg32);
+            unlockOutput();
+        }
+        else
+        {
+            lockOutput();
+            Serial.printf("[%7lu][%c] ", (unsigned long)slot.ms, levelNames[slot.level <= LOG_LEVEL_DEBUG ? slot.level : 0]);
+            Serial.write((const uint8_t *)slot.text, slot.length);
+            Serial.println();
+            unlockOutput();
+        }
+
+        // Hand the slot back to producers for the next lap
+        slot.sequence.store(_dequeue + LOG_QUEUE_SLOTS, std::memory_order_release);
+        _dequeue++;
+    }
+
+    uint32_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped != _droppedReported)
+    {
+        lockOutput();
+        Serial.printf("[log] %lu records dropped\n", (unsigned long)(dropped - _droppedReported));
+        unlockOutput();
+        _droppedReported = dropped;
+        LOG_EVENT(LOG_CODE_LOG_DROPPED, 0, dropped);
+    }
+}
+
+void Logger::drainTask(void *ctx)
+{
+    Logger *self = static_cast<Logger *>(ctx);
+    for (;;)
+    {
+        self->drain();
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+    }
+}
+
+size_t Logger::copyRecords(LogRecord *out, size_t maxCount)
+{
+    portENTER_CRITICAL(&_historyLock);
+    size_t count = std::min<size_t>(maxCount, _historyCount);
+    size_t skip = _historyCount - count; // Keep the newest when out is short
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = _history[(_historyHead + skip + i) % LOG_HISTORY_RECORDS];
+    }
+    portEXIT_CRITICAL(&_historyLock);
+    return count;
+}
@@ -0,0 +1,177 @@
+#include "Lzss.h"
+
+#include <string.h>
+
+#define WINDOW_MASK (LZSS_WINDOW_SIZE - 1)
+#define COPY_BITS (1 + LZSS_WINDOW_BITS + LZSS_LOOKAHEAD_BITS)
+#define LITERAL_BITS 9
+
+static_assert(COPY_BITS <= 24, "Token must fit the 32-bit bit buffer with a byte to spare");
+
+// --- Encoder ---
+
+size_t LzssEncoder::write(uint8_t c)
+{
+    _lookahead[_lookaheadLen++] = c;
+    _bytesIn++;
+    if (_lookaheadLen == LZSS_MAX_MATCH)
+    {
+        emitToken();
+    }
+    return 1;
+}
+
+size_t LzssEncoder::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        write(buffer[i]);
+    }
+    return size;
+}
+
+void LzssEncoder::putBits(uint32_t value, uint8_t count)
+{
+    _bitBuffer = (_bitBuffer << count) | (value & ((1UL << count) - 1));
+    _bitCount += count;
+    while (_bitCount >= 8)
+    {
+        _bitCount -= 8;
+        _out.write((uint8_t)(_bitBuffer >> _bitCount));
+        _bytesOut++;
+    }
+}
+
+// Encodes the head of the lookahead as a literal or a copy from history
+void LzssEncoder::emitToken()
+{
+    uint8_t bestLen = 0;
+    uint16_t bestDistance = 0;
+
+    for (uint16_t distance = 1; distance <= _historyLen; ++distance)
+    {
+        uint16_t start = (_historyPos - distance) & WINDOW_MASK;
+        if (_history[start] != _lookahead[0])
+        {
+            continue;
+        }
+        // Copies may run into the bytes they produce (distance < length)
+        uint8_t len = 1;
+        while (len < _lookaheadLen)
+        {
+            uint8_t source = len < distance ? _history[(start + len) & WINDOW_MASK] : _lookahead[len - distance];
+            if (source != _lookahead[len])
+            {
+                break;
+            }
+            len++;
+        }
+        if (len > bestLen)
+        {
+            bestLen = len;
+            bestDistance = distance;
+            if (len == _lookaheadLen)
+            {
+                break;
+            }
+        }
+    }
+
+    uint8_t consumed;
+    if (bestLen >= LZSS_MIN_MATCH)
+    {
+        putBits(0, 1);
+        putBits(bestDistance - 1, LZSS_WINDOW_BITS);
+        putBits(bestLen - LZSS_MIN_MATCH, LZSS_LOOKAHEAD_BITS);
+        consumed = bestLen;
+    }
+    else
+    {
+        putBits(1, 1);
+        putBits(_lookahead[0], 8);
+        consumed = 1;
+    }
+
+    for (uint8_t i = 0; i < consumed; ++i)
+    {
+        _history[_historyPos] = _lookahead[i];
+        _historyPos = (_historyPos + 1) & WINDOW_MASK;
+    }
+    if (_historyLen < LZSS_WINDOW_SIZE)
+    {
+        _historyLen = (_historyLen + consumed > LZSS_WINDOW_SIZE) ? LZSS_WINDOW_SIZE : _historyLen + consumed;
+    }
+    _lookaheadLen -= consumed;
+    memmove(_lookahead, _lookahead + consumed, _lookaheadLen);
+}
+
+void LzssEncoder::finish()
+{
+    while (_lookaheadLen > 0)
+    {
+        emitToken();
+    }
+    if (_bitCount > 0)
+    {
+        putBits(0, 8 - _bitCount);
+    }
+}
+
+// --- Decoder ---
+
+void LzssDecoder::emit(uint8_t c)
+{
+    _out.write(c);
+    _bytesOut++;
+    _history[_historyPos] = c;
+    _historyPos = (_historyPos + 1) & WINDOW_MASK;
+    if (_historyLen < LZSS_WINDOW_SIZE)
+    {
+        _historyLen++;
+    }
+}
+
+size_t LzssDecoder::write(uint8_t c)
+{
+    _bitBuffer = (_bitBuffer << 8) | c;
+    _bitCount += 8;
+
+    while (_bitCount > 0 && !_failed)
+    {
+        bool literal = (_bitBuffer >> (_bitCount - 1)) & 1;
+        uint8_t need = literal ? LITERAL_BITS : COPY_BITS;
+        if (_bitCount < need)
+        {
+            break;
+        }
+        _bitCount -= need;
+        uint32_t token = (_bitBuffer >> _bitCount) & ((1UL << (need - 1)) - 1);
+
+        if (literal)
+        {
+            emit((uint8_t)token);
+            continue;
+        }
+        uint16_t distance = (token >> LZSS_LOOKAHEAD_BITS) + 1;
+        uint8_t len = (token & ((1 << LZSS_LOOKAHEAD_BITS) - 1)) + LZSS_MIN_MATCH;
+        if (distance > _historyLen)
+        {
+            _failed = true;
+            break;
+        }
+        for (uint8_t i = 0; i < len; ++i)
+        {
+            emit(_history[(_historyPos - distance) & WINDOW_MASK]);
+        }
+    }
+    return 1;
+}
+
+size_t LzssDecoder::write(const uint8_t *buffer, size_t size)
+{
+    for (size_t i = 0; i < size; ++i)
+    {
+        write(buffer[i]);
+    }
+    return size;
+}
@@ -0,0 +1,311 @@
+#include "BleTransport.h"
+
+#if PIPLI_BLE_NIMBLE
+
+#include <NimBLEDevice.h>
+
+// --- Stack state ---
+// Written against NimBLE-Arduino 1.4. NimBLE adds the CCCD of notifying
+// characteristics itself and tracks subscriptions per connection.
+static BleTransportHandlers handlers = {};
+static NimBLEServer *server = NULL;
+static NimBLEService *service = NULL;
+static const char *advertisedUuid = NULL;
+static const char *advertisedName = NULL;
+static NimBLECharacteristic *characteristics[BLE_CHANNEL_COUNT] = {};
+static volatile bool peerConnected = false;
+static volatile uint16_t peerMtu = BLE_DEFAULT_MTU;
+static volatile uint16_t connHandle = 0; // Connection parameter updates name the connection
+static volatile bool peerBondedFlag = false;
+
+// --- Callbacks ---
+
+class ServerCallbacks : public NimBLEServerCallbacks
+{
+    void onConnect(NimBLEServer *pServer, ble_gap_conn_desc *desc)
+    {
+        connHandle = desc->conn_handle;
+        peerConnected = true;
+        if (handlers.onConnect)
+        {
+            handlers.onConnect();
+        }
+        // A bonded peer re-encrypts with its stored keys, a new one pairs
+        NimBLEDevice::startSecurity(desc->conn_handle);
+    }
+
+    void onDisconnect(NimBLEServer *pServer, ble_gap_conn_desc *desc)
+    {
+        peerConnected = false;
+        peerBondedFlag = false;
+        peerMtu = BLE_DEFAULT_MTU;
+        if (handlers.onDisconnect)
+        {
+            handlers.onDisconnect();
+        }
+    }
+
+    void onMTUChange(uint16_t MTU, ble_gap_conn_desc *desc)
+    {
+        peerMtu = MTU;
+        if (handlers.onMtuChanged)
+        {
+            handlers.onMtuChanged(MTU);
+        }
+    }
+
+    // Just Works: nothing to show or confirm, the link is encrypted and bonded
+    uint32_t onPassKeyRequest() { return 0; }
+    bool onConfirmPIN(uint32_t pass_key) { return true; }
+
+    void onAuthenticationComplete(ble_gap_conn_desc *desc)
+    {
+        if (!desc->sec_state.encrypted)
+        {
+            return;
+        }
+        peerBondedFlag = desc->sec_state.bonded;
+        if (handlers.onSecured)
+        {
+            handlers.onSecured(peerBondedFlag);
+        }
+    }
+};
+
+class ChannelCallbacks : public NimBLECharacteristicCallbacks
+{
+public:
+    void bind(BleChannel channel) { _channel = channel; }
+
+    void onWrite(NimBLECharacteristic *pCharacteristic)
+    {
+        if (handlers.onWrite)
+        {
+            handlers.onWrite(_channel, pCharacteristic->getValue());
+        }
+    }
+
+    void onRead(NimBLECharacteristic *pCharacteristic)
+    {
+        if (handlers.onRead)
+        {
+            handlers.onRead(_channel);
+        }
+    }
+
+    void onSubscribe(NimBLECharacteristic *pCharacteristic, ble_gap_conn_desc *desc, uint16_t subValue)
+    {
+        if (handlers.onSubscribe)
+        {
+            handlers.onSubscribe(_channel, (subValue & 0x0001) != 0);
+        }
+    }
+
+private:
+    BleChannel _channel = BLE_CHANNEL_COUNT;
+};
+
+// Static rather than new'd; the stack only keeps pointers to them
+static ServerCallbacks serverCallbacks;
+static ChannelCallbacks channelCallbacks[BLE_CHANNEL_COUNT];
+
+// --- Transport ---
+
+bool BleTransport::begin(const char *deviceName, const char *serviceUuid, uint16_t preferredMtu,
+                         const BleTransportHandlers &callbacks)
+{
+    handlers = callbacks;
+    NimBLEDevice::init(deviceName);
+    NimBLEDevice::setMTU(preferredMtu);
+    // Resolvable private address: the host resolves bonded peers through
+    // their IRKs, so the bond filter matches them after their address rotates
+    NimBLEDevice::setOwnAddrType(BLE_OWN_ADDR_RPA_PUBLIC_DEFAULT);
+    NimBLEDevice::setSecurityAuth(true, false, true); // Bond, no MITM, LE Secure Connections
+    NimBLEDevice::setSecurityIOCap(BLE_HS_IO_NO_INPUT_OUTPUT);
+    NimBLEDevice::setSecurityInitKey(BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID);
+    NimBLEDevice::setSecurityRespKey(BLE_SM_PAIR_KEY_DIST_ENC | BLE_SM_PAIR_KEY_DIST_ID);
+    server = NimBLEDevice::createServer();
+    server->setCallbacks(&serverCallbacks, false); // Not the server's to delete
+    server->advertiseOnDisconnect(false); // The firmware restarts advertising itself
+    service = server->createService(serviceUuid);
+    advertisedUuid = serviceUuid;
+    advertisedName = deviceName;
+    return service != NULL;
+}
+
+bool BleTransport::addChannel(BleChannel channel, const char *uuid, uint8_t properties)
+{
+    if (service == NULL || channel >= BLE_CHANNEL_COUNT)
+    {
+        return false;
+    }
+    uint32_t nimbleProperties = 0;
+    if (properties & BLE_PROP_READ)
+    {
+        nimbleProperties |= NIMBLE_PROPERTY::READ;
+    }
+    if (properties & BLE_PROP_WRITE)
+    {
+        nimbleProperties |= NIMBLE_PROPERTY::WRITE;
+    }
+    if (properties & BLE_PROP_WRITE_NR)
+    {
+        nimbleProperties |= NIMBLE_PROPERTY::WRITE_NR;
+    }
+    if (properties & BLE_PROP_NOTIFY)
+    {
+        nimbleProperties |= NIMBLE_PROPERTY::NOTIFY;
+    }
+    if (properties & BLE_PROP_INDICATE)
+    {
+        nimbleProperties |= NIMBLE_PROPERTY::INDICATE;
+    }
+
+    NimBLECharacteristic *characteristic = service->createCharacteristic(uuid, nimbleProperties);
+    channelCallbacks[channel].bind(channel);
+    characteristic->setCallbacks(&channelCallbacks[channel]);
+    characteristics[channel] = characteristic;
+    return true;
+}
+
+void BleTransport::start()
+{
+    service->start();
+    NimBLEAdvertising *pAdvertising = NimBLEDevice::getAdvertising();
+    pAdvertising->addServiceUUID(advertisedUuid);
+    pAdvertising->setScanResponse(true);
+    pAdvertising->setMinPreferred(0x06);
+    pAdvertising->setMaxPreferred(0x12);
+    pAdvertising->start();
+}
+
+void BleTransport::setValue(BleChannel channel, const uint8_t *data, size_t len)
+{
+    if (channel < BLE_CHANNEL_COUNT && characteristics[channel] != NULL)
+    {
+        characteristics[channel]->setValue(data, len);
+    }
+}
+
+bool BleTransport::notify(BleChannel channel, const uint8_t *data, size_t len)
+{
+    if (!peerConnected || channel >= BLE_CHANNEL_COUNT || characteristics[channel] == NULL)
+    {
+        return false;
+    }
+    characteristics[channel]->setValue(data, len);
+    characteristics[channel]->notify();
+    return true;
+}
+
+bool BleTransport::subscribed(BleChannel channel) const
+{
+    return peerConnected && channel < BLE_CHANNEL_COUNT && characteristics[channel] != NULL &&
+           characteristics[channel]->getSubscribedCount() > 0;
+}
+
+void BleTransport::startAdvertising()
+{
+    if (server != NULL)
+    {
+        server->startAdvertising();
+    }
+}
+
+bool BleTransport::advertising() const
+{
+    return NimBLEDevice::getAdvertising()->isAdvertising();
+}
+
+void BleTransport::setManufacturerData(const uint8_t *data, size_t len)
+{
+    // A custom scan response replaces the stack's own, so it carries the name too
+    NimBLEAdvertisementData scanResponse;
+    scanResponse.setName(advertisedName != NULL ? advertisedName : "");
+    scanResponse.setManufacturerData(std::string((const char *)data, len));
+    NimBLEDevice::getAdvertising()->setScanResponseData(scanResponse);
+}
+
+void BleTransport::setAdvertisingInterval(uint16_t minUnits, uint16_t maxUnits)
+{
+    NimBLEAdvertising *pAdvertising = NimBLEDevice::getAdvertising();
+    pAdvertising->setMinInterval(minUnits);
+    pAdvertising->setMaxInterval(maxUnits);
+    if (pAdvertising->isAdvertising())
+    {
+        // The interval is part of the advertising parameters, applied on start
+        pAdvertising->stop();
+        pAdvertising->start();
+    }
+}
+
+bool BleTransport::requestConnectionParams(uint16_t minInterval, uint16_t maxInterval, uint16_t latency, uint16_t timeout)
+{
+    if (!peerConnected || server == NULL)
+    {
+        return false;
+    }
+    server->updateConnParams(connHandle, minInterval, maxInterval, latency, timeout);
+    return true;
+}
+
+void BleTransport::setPairing(bool open)
+{
+    bool filter = BLE_BOND_FILTER && !open && bondCount() > 0;
+    NimBLEAdvertising *pAdvertising = NimBLEDevice::getAdvertising();
+    bool restart = pAdvertising->isAdvertising();
+    if (restart)
+    {
+        // The controller refuses whitelist changes while it advertises
+        pAdvertising->stop();
+    }
+    for (size_t i = NimBLEDevice::getWhiteListCount(); i > 0; i--)
+    {
+        NimBLEDevice::whiteListRemove(NimBLEDevice::getWhiteListAddress(i - 1));
+    }
+    if (filter)
+    {
+        for (int i = 0; i < NimBLEDevice::getNumBonds(); i++)
+        {
+            NimBLEDevice::whiteListAdd(NimBLEDevice::getBondedAddress(i));
+        }
+    }
+    pAdvertising->setScanFilter(false, filter);
+    if (restart)
+    {
+        pAdvertising->start();
+    }
+}
+
+uint8_t BleTransport::bondCount() const
+{
+    int count = NimBLEDevice::getNumBonds();
+    return count > 0 ? (uint8_t)count : 0;
+}
+
+void BleTransport::clearBonds()
+{
+    NimBLEDevice::deleteAllBonds();
+}
+
+bool BleTransport::peerBonded() const
+{
+    return peerBondedFlag;
+}
+
+bool BleTransport::connected() const
+{
+    return peerConnected;
+}
+
+uint16_t BleTransport::mtu() const
+{
+    return peerMtu;
+}
+
+const char *BleTransport::stackName() const
+{
+    return "NimBLE";
+}
+
+#endif // PIPLI_BLE_NIMBLE
@@ -0,0 +1,310 @@
+#include "OtaReceiver.h"
+
+#include <string.h>
+
+#define PROGRESS_MAGIC 0x41544F50 // "POTA"
+#define VERIFY_CHUNK 1024
+
+static_assert(OTA_WINDOW >= 2 && OTA_WINDOW <= 255, "The window travels as a u8 and acks come every half window");
+static_assert(OTA_CHECKPOINT_BYTES % OTA_SECTOR_SIZE == 0, "Checkpoints sit on sector boundaries");
+
+// --- Helpers ---
+
+static void putU16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void putU32(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+static uint16_t getU16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t getU32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// --- Frames ---
+
+void OtaReceiver::setSender(OtaFrameSender sender, void *ctx)
+{
+    _sender = sender;
+    _senderCtx = ctx;
+}
+
+void OtaReceiver::handle(const uint8_t *frame, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+    switch (frame[0])
+    {
+    case OTA_OP_BEGIN:
+        onBegin(frame, len);
+        break;
+    case OTA_OP_DATA:
+        onData(frame, len);
+        break;
+    case OTA_OP_FINISH:
+        onFinish();
+        break;
+    case OTA_OP_ABORT:
+        onAbort();
+        break;
+    default:
+        sendStatus(OTA_ERR_FRAME, _written);
+        break;
+    }
+}
+
+void OtaReceiver::sendStatus(OtaStatus status, uint32_t offset)
+{
+    uint8_t frame[OTA_STATUS_LEN];
+    frame[0] = OTA_OP_STATUS;
+    frame[1] = status;
+    putU32(frame + 2, offset);
+    putU16(frame + 6, _block);
+    frame[8] = OTA_WINDOW;
+    if (_sender != nullptr)
+    {
+        _sender(frame, sizeof(frame), _senderCtx);
+    }
+}
+
+// --- Session ---
+
+void OtaReceiver::onBegin(const uint8_t *frame, size_t len)
+{
+    if (len < OTA_BEGIN_LEN)
+    {
+        sendStatus(OTA_ERR_FRAME, 0);
+        return;
+    }
+    uint32_t size = getU32(frame + 1);
+    uint16_t block = getU16(frame + 5);
+    const uint8_t *sha256 = frame + 7;
+    block = block < _maxBlock ? block : _maxBlock;
+    block = block < OTA_MAX_BLOCK ? block : OTA_MAX_BLOCK;
+    if (block == 0)
+    {
+        sendStatus(OTA_ERR_FRAME, 0);
+        return;
+    }
+    _block = block;
+    _stateErrorSent = false;
+    _nakOffset = UINT32_MAX;
+    _sinceAck = 0;
+
+    // The same image again (after a disconnect): carry on where it stopped
+    if (_active && size == _size && memcmp(sha256, _sha256, SHA256_LEN) == 0)
+    {
+        sendStatus(OTA_OK, _written);
+        return;
+    }
+
+    _active = false;
+    _done = false;
+    if (!_target.open())
+    {
+        sendStatus(OTA_ERR_STATE, 0);
+        return;
+    }
+    if (size == 0 || size > _target.capacity())
+    {
+        sendStatus(OTA_ERR_SIZE, 0);
+        return;
+    }
+    _size = size;
+    memcpy(_sha256, sha256, SHA256_LEN);
+
+    // The same image as before a reboot: resume from its checkpoint
+    OtaProgress progress;
+    if (_target.loadProgress(progress) && progress.magic == PROGRESS_MAGIC && progress.size == size &&
+        memcmp(progress.sha256, sha256, SHA256_LEN) == 0 && progress.offset <= size &&
+        progress.offset % OTA_SECTOR_SIZE == 0)
+    {
+        _written = progress.offset;
+    }
+    else
+    {
+        _target.clearProgress();
+        _written = 0;
+    }
+    // The sector at the checkpoint may hold part of a block; it is erased again
+    _erasedUntil = _written;
+    _checkpointed = _written;
+    _active = true;
+    sendStatus(OTA_OK, _written);
+}
+
+void OtaReceiver::onData(const uint8_t *frame, size_t len)
+{
+    if (!_active)
+    {
+        if (!_stateErrorSent)
+        {
+            _stateErrorSent = true;
+            sendStatus(OTA_ERR_STATE, 0);
+        }
+        return;
+    }
+    if (len <= OTA_DATA_OVERHEAD)
+    {
+        nak();
+        return;
+    }
+    uint32_t offset = getU32(frame + 1);
+    uint32_t crc = getU32(frame + 5);
+    const uint8_t *payload = frame + OTA_DATA_OVERHEAD;
+    size_t payloadLen = len - OTA_DATA_OVERHEAD;
+
+    if (offset < _written)
+    {
+        return; // Resent after a rewind; already on flash
+    }
+    if (offset > _written || payloadLen > _block || payloadLen > _size - offset || crc32(payload, payloadLen) != crc)
+    {
+        nak(); // A gap (a lost block) or a damaged one
+        return;
+    }
+    if (!writeBlock(offset, payload, payloadLen))
+    {
+        end(OTA_ERR_FLASH);
+        return;
+    }
+    _written += payloadLen;
+    _nakOffset = UINT32_MAX;
+    checkpoint();
+    if (++_sinceAck >= OTA_ACK_EVERY || _written == _size)
+    {
+        _sinceAck = 0;
+        sendStatus(OTA_OK, _written);
+    }
+}
+
+void OtaReceiver::onFinish()
+{
+    if (!_active)
+    {
+        sendStatus(OTA_ERR_STATE, 0);
+        return;
+    }
+    if (_written != _size)
+    {
+        sendStatus(OTA_NAK, _written); // The tail is missing
+        return;
+    }
+    if (!verify())
+    {
+        end(OTA_ERR_HASH);
+        return;
+    }
+    if (!_target.activate(_size))
+    {
+        end(OTA_ERR_ACTIVATE);
+        return;
+    }
+    end(OTA_DONE);
+    _done = true;
+}
+
+void OtaReceiver::onAbort()
+{
+    end(OTA_ABORTED);
+}
+
+// Ends the session; a new one starts from scratch
+void OtaReceiver::end(OtaStatus status)
+{
+    _active = false;
+    _target.clearProgress();
+    sendStatus(status, status == OTA_DONE ? _size : _written);
+}
+
+// One NAK per gap: the sender rewinds once, and its own timeout covers a lost NAK
+void OtaReceiver::nak()
+{
+    if (_nakOffset != _written)
+    {
+        _nakOffset = _written;
+        sendStatus(OTA_NAK, _written);
+    }
+}
+
+// --- Flash ---
+
+bool OtaReceiver::writeBlock(uint32_t offset, const uint8_t *data, size_t len)
+{
+    while (_erasedUntil < offset + len)
+    {
+        if (!_target.erase(_erasedUntil, OTA_SECTOR_SIZE))
+        {
+            return false;
+        }
+        _erasedUntil += OTA_SECTOR_SIZE;
+    }
+    return _target.write(offset, data, len);
+}
+
+// Saves progress whenever a checkpoint boundary is crossed
+void OtaReceiver::checkpoint()
+{
+    uint32_t boundary = _written - _written % OTA_CHECKPOINT_BYTES;
+    if (boundary <= _checkpointed)
+    {
+        return;
+    }
+    OtaProgress progress;
+    progress.magic = PROGRESS_MAGIC;
+    progress.size = _size;
+    memcpy(progress.sha256, _sha256, SHA256_LEN);
+    progress.offset = boundary;
+    if (_target.saveProgress(progress))
+    {
+        _checkpointed = boundary;
+    }
+}
+
+// Hashes what is actually on flash, not what arrived
+bool OtaReceiver::verify()
+{
+    Sha256 sha;
+    uint8_t chunk[VERIFY_CHUNK];
+    for (uint32_t offset = 0; offset < _size; offset += VERIFY_CHUNK)
+    {
+        size_t n = _size - offset < VERIFY_CHUNK ? _size - offset : VERIFY_CHUNK;
+        if (!_target.read(offset, chunk, n))
+        {
+            return false;
+        }
+        sha.update(chunk, n);
+    }
+    uint8_t digest[SHA256_LEN];
+    sha.finish(digest);
+    return memcmp(digest, _sha256, SHA256_LEN) == 0;
+}
@@ -0,0 +1,234 @@
+// Native OTA receiver: the OtaReceiver from the firmware against a
+// partition simulated in a file, for tools/ota_send.py --sim.
+//
+// Frames come in on stdin and status frames go out on stdout, each as a u16
+// little endian length and the frame. The file behaves like NOR flash: erase
+// sets a sector to 0xFF and a write can only clear bits, so writing without
+// erasing fails the hash check just as it would on the device.
+//
+//   pio run -e native && .pio/build/native/program image.part
+//
+// Only built by the native env; the firmware build skips the whole file.
+#ifndef ARDUINO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "OtaReceiver.h"
+
+#define SIM_DEFAULT_CAPACITY 0x140000 // An app partition of the default partition table
+#define SIM_MAX_FRAME (OTA_DATA_OVERHEAD + OTA_MAX_BLOCK)
+
+// --- Simulated partition ---
+
+class FileOtaTarget : public OtaTarget
+{
+public:
+    FileOtaTarget(const std::string &path, uint32_t capacity)
+        : _path(path), _metaPath(path + ".meta"), _bootPath(path + ".boot"), _capacity(capacity)
+    {
+    }
+
+    bool open() override
+    {
+        if (_file == nullptr)
+        {
+            _file = fopen(_path.c_str(), "r+b");
+        }
+        if (_file == nullptr)
+        {
+            _file = fopen(_path.c_str(), "w+b");
+        }
+        return _file != nullptr;
+    }
+
+    uint32_t capacity() override { return _capacity; }
+
+    bool erase(uint32_t offset, uint32_t len) override
+    {
+        if (offset % OTA_SECTOR_SIZE != 0 || offset + len > _capacity)
+        {
+            return false;
+        }
+        std::vector<uint8_t> blank(len, 0xFF);
+        return fseek(_file, offset, SEEK_SET) == 0 && fwrite(blank.data(), 1, len, _file) == len;
+    }
+
+    bool write(uint32_t offset, const uint8_t *data, size_t len) override
+    {
+        if (offset + len > _capacity)
+        {
+            return false;
+        }
+        std::vector<uint8_t> cells(len);
+        if (!read(offset, cells.data(), len))
+        {
+            return false;
+        }
+        for (size_t i = 0; i < len; ++i)
+        {
+            cells[i] &= data[i]; // Programming only clears bits
+        }
+        return fseek(_file, offset, SEEK_SET) == 0 && fwrite(cells.data(), 1, len, _file) == len;
+    }
+
+    bool read(uint32_t offset, uint8_t *data, size_t len) override
+    {
+        if (offset + len > _capacity || fseek(_file, offset, SEEK_SET) != 0)
+        {
+            return false;
+        }
+        size_t n = fread(data, 1, len, _file);
+        memset(data + n, 0xFF, len - n); // Never written: erased
+        return true;
+    }
+
+    bool activate(uint32_t size) override
+    {
+        fflush(_file);
+        FILE *boot = fopen(_bootPath.c_str(), "w");
+        if (boot == nullptr)
+        {
+            return false;
+        }
+        fprintf(boot, "%lu\n", (unsigned long)size);
+        fclose(boot);
+        return true;
+    }
+
+    bool loadProgress(OtaProgress &progress) override
+    {
+        FILE *meta = fopen(_metaPath.c_str(), "rb");
+        if (meta == nullptr)
+        {
+            return false;
+        }
+        bool ok = fread(&progress, sizeof(progress), 1, meta) == 1;
+        fclose(meta);
+        return ok;
+    }
+
+    bool saveProgress(const OtaProgress &progress) override
+    {
+        // Flash first: the checkpoint must never be ahead of the data
+        fflush(_file);
+        FILE *meta = fopen(_metaPath.c_str(), "wb");
+        if (meta == nullptr)
+        {
+            return false;
+        }
+        bool ok = fwrite(&progress, sizeof(progress), 1, meta) == 1;
+        fclose(meta);
+        return ok;
+    }
+
+    void clearProgress() override { remove(_metaPath.c_str()); }
+
+private:
+    std::string _path;
+    std::string _metaPath;
+    std::string _bootPath;
+    uint32_t _capacity;
+    FILE *_file = nullptr;
+};
+
+// --- Framing ---
+
+static bool readFrame(uint8_t *frame, size_t &len)
+{
+    uint8_t header[2];
+    if (fread(header, 1, 2, stdin) != 2)
+    {
+        return false;
+    }
+    len = header[0] | (header[1] << 8);
+    return len <= SIM_MAX_FRAME && fread(frame, 1, len, stdin) == len;
+}
+
+static bool writeFrame(const uint8_t *data, size_t len, void *ctx)
+{
+    (void)ctx;
+    uint8_t header[2] = {(uint8_t)(len & 0xFF), (uint8_t)(len >> 8)};
+    bool ok = fwrite(header, 1, 2, stdout) == 2 && fwrite(data, 1, len, stdout) == len;
+    fflush(stdout);
+    return ok;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "usage: %s [--capacity BYTES] [--max-block BYTES] [--crash-after BYTES] PARTITION_FILE\n"
+            "  --crash-after  exit abruptly once this run has put this many bytes on flash (a reset mid-update)\n",
+            program);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t capacity = SIM_DEFAULT_CAPACITY;
+    unsigned long maxBlock = OTA_MAX_BLOCK;
+    unsigned long crashAfter = 0;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--capacity") == 0 && i + 1 < argc)
+        {
+            capacity = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--max-block") == 0 && i + 1 < argc)
+        {
+            maxBlock = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--crash-after") == 0 && i + 1 < argc)
+        {
+            crashAfter = strtoul(argv[++i], nullptr, 0);
+        }
+        else if (argv[i][0] != '-' && path == nullptr)
+        {
+            path = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (path == nullptr || capacity % OTA_SECTOR_SIZE != 0)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FileOtaTarget target(path, capacity);
+    OtaReceiver receiver(target);
+    receiver.setSender(writeFrame, nullptr);
+    receiver.setMaxBlock(maxBlock);
+
+    uint8_t frame[SIM_MAX_FRAME];
+    size_t len;
+    unsigned long writtenThisRun = 0;
+    while (readFrame(frame, len))
+    {
+        uint32_t before = receiver.received();
+        receiver.handle(frame, len);
+        if (frame[0] == OTA_OP_DATA && receiver.received() > before)
+        {
+            writtenThisRun += receiver.received() - before;
+        }
+        if (receiver.done())
+        {
+            fprintf(stderr, "ota_sim: %lu bytes verified and activated\n", (unsigned long)receiver.size());
+            return 0;
+        }
+        if (crashAfter != 0 && writtenThisRun >= crashAfter)
+        {
+            fprintf(stderr, "ota_sim: simulated reset at %lu bytes\n", (unsigned long)receiver.received());
+            _exit(3);
+        }
+    }
+    return 0;
+}
+
+#endif // ARDUINO
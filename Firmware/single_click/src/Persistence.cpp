@@ -0,0 +1,133 @@
+#include <Arduino.h>
+#include "Persistence.h"
+#include "Log.h"
+#include "Trace.h"
+
+void Persistence::begin(const FlushPolicy &policy)
+{
+    _policy = policy;
+    _dirtyMask = 0;
+    _dirtyCount = 0;
+    _firstDirtyMs = 0;
+    _powerWarning = false;
+}
+
+void Persistence::registerRegion(uint8_t region, RegionWriter writer, void *ctx)
+{
+    if (_regionCount >= PERSIST_MAX_REGIONS)
+    {
+        LOG_ERROR("Too many persistence regions registered.");
+        return;
+    }
+    _regions[_regionCount++] = {region, writer, ctx};
+}
+
+void Persistence::markDirty(uint8_t regions, uint32_t nowMs)
+{
+    uint8_t previous = _dirtyMask.fetch_or(regions);
+    if (previous == 0)
+    {
+        // First mark since the last flush starts the latency clock
+        _firstDirtyMs = nowMs;
+    }
+    _dirtyCount++;
+    _markCount++;
+    for (uint8_t bit = 0; bit < PERSIST_MAX_REGIONS; ++bit)
+    {
+        if (regions & (1 << bit))
+        {
+            _markedAtMs[bit] = nowMs;
+        }
+    }
+}
+
+uint32_t Persistence::markedAt(uint8_t region) const
+{
+    for (uint8_t bit = 0; bit < PERSIST_MAX_REGIONS; ++bit)
+    {
+        if (region & (1 << bit))
+        {
+            return _markedAtMs[bit].load();
+        }
+    }
+    return 0;
+}
+
+uint32_t Persistence::msUntilFlush(uint32_t nowMs) const
+{
+    if (_dirtyMask.load() == 0)
+    {
+        return UINT32_MAX;
+    }
+    if (_powerWarning.load() && _policy.flushOnPowerWarning)
+    {
+        return 0;
+    }
+    if (_policy.maxDirtyCount > 0 && _dirtyCount.load() >= _policy.maxDirtyCount)
+    {
+        return 0;
+    }
+
+    // Unsigned subtraction keeps this correct across millis() rollover
+    uint32_t age = nowMs - _firstDirtyMs.load();
+    if (age >= _policy.maxLatencyMs)
+    {
+        return 0;
+    }
+    return _policy.maxLatencyMs - age;
+}
+
+bool Persistence::flushIfDue(uint32_t nowMs)
+{
+    if (msUntilFlush(nowMs) != 0)
+    {
+        return true; // Nothing to do yet
+    }
+    return flush(nowMs);
+}
+
+bool Persistence::flush(uint32_t nowMs)
+{
+    // Take the dirty set first so marks made while we are writing
+    // (e.g. from the BLE task) are kept for the next flush. Only the count
+    // read before the take is subtracted: a mark landing in between is
+    // written now but still counted once more, never lost.
+    uint16_t counted = _dirtyCount.load();
+    uint8_t pending = _dirtyMask.exchange(0);
+    _dirtyCount.fetch_sub(counted);
+    _powerWarning = false;
+    if (pending == 0)
+    {
+        return true;
+    }
+
+    TRACE_SPAN(TRACE_FLUSH, pending);
+    uint8_t failed = 0;
+    for (uint8_t i = 0; i < _regionCount; ++i)
+    {
+        const Region &region = _regions[i];
+        if ((pending & region.bit) == 0)
+        {
+            continue;
+        }
+        if (!region.writer(region.ctx))
+        {
+            failed |= region.bit;
+        }
+    }
+    _flushCount++;
+
+    if (failed != 0)
+    {
+        LOG_ERROR("Persistence flush failed for regions 0x%02x, will retry.", failed);
+        LOG_EVENT(LOG_CODE_FLUSH_FAILED, failed, 0);
+        markDirty(failed, nowMs);
+        return false;
+    }
+    return true;
+}
+
+void Persistence::onPowerWarning()
+{
+    _powerWarning = true;
+}
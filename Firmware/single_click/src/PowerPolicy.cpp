@@ -0,0 +1,47 @@
+#include "PowerPolicy.h"
+#include "Log.h"
+
+#include <algorithm>
+
+void PowerPolicy::begin(uint32_t vibrationMs, const FlushPolicy &flush)
+{
+    _baseVibrationMs = vibrationMs;
+    _baseFlush = flush;
+    _tier = BATTERY_NORMAL;
+    _profile = {vibrationMs, POWER_FULL_DUTY, true};
+}
+
+void PowerPolicy::apply(BatteryTier tier)
+{
+    _tier = tier;
+    FlushPolicy flush = _baseFlush;
+    uint32_t flushScale = 1;
+    switch (tier)
+    {
+    case BATTERY_NORMAL:
+        _profile = {_baseVibrationMs, POWER_FULL_DUTY, true};
+        _radio.setSlowAdvertising(RADIO_ADV_SLOW_MIN, RADIO_ADV_SLOW_MAX);
+        break;
+    case BATTERY_LOW:
+        _profile = {std::min<uint32_t>(_baseVibrationMs, POWER_LOW_VIBRATION_MS), POWER_LOW_VIBRATION_DUTY, false};
+        _radio.setSlowAdvertising(POWER_LOW_ADV_MIN, POWER_LOW_ADV_MAX);
+        flushScale = POWER_LOW_FLUSH_SCALE;
+        break;
+    case BATTERY_CRITICAL:
+        _profile = {std::min<uint32_t>(_baseVibrationMs, POWER_CRITICAL_VIBRATION_MS), POWER_CRITICAL_VIBRATION_DUTY,
+                    false};
+        _radio.setSlowAdvertising(POWER_CRITICAL_ADV_MIN, POWER_CRITICAL_ADV_MAX);
+        flushScale = POWER_CRITICAL_FLUSH_SCALE;
+        break;
+    }
+
+    if (flush.maxDirtyCount != 1)
+    {
+        flush.maxLatencyMs *= flushScale;
+        flush.maxDirtyCount = flush.maxDirtyCount == 0 ? 0 : std::min<uint32_t>(flush.maxDirtyCount * flushScale, UINT16_MAX);
+    }
+    _persistence.setPolicy(flush);
+    LOG_INFO("Power tier %u: vibration %lu ms at duty %u, flush after %lu ms / %u changes", tier,
+             (unsigned long)_profile.vibrationMs, _profile.vibrationDuty, (unsigned long)flush.maxLatencyMs,
+             flush.maxDirtyCount);
+}
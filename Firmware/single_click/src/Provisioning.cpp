@@ -0,0 +1,348 @@
+#include "Provisioning.h"
+#include "Log.h"
+#include "Trace.h"
+
+// --- Upload Inbox ---
+
+bool Provisioning::claimInbox()
+{
+    uint8_t expected = INBOX_FREE;
+    if (!_inboxState.compare_exchange_strong(expected, INBOX_FILLING))
+    {
+        LOG_WARN("Previous upload still being applied. Ignored.");
+        return false;
+    }
+    _inbox.clear();
+    return true;
+}
+
+void Provisioning::releaseInbox()
+{
+    _inbox.clear();
+    _inboxState = INBOX_FREE;
+}
+
+void Provisioning::submitInbox(ReplyRoute route)
+{
+    _inboxRoute = route;
+    _inboxReceivedAt = millis();
+    _inboxState = INBOX_READY;
+    _hooks.submitted(route, _hooks.ctx);
+}
+
+// Done with the inbox, whatever became of the upload
+void Provisioning::finishIngest()
+{
+#if SERIAL_LINK_ENABLED
+    if (_inboxRoute == ROUTE_SERIAL)
+    {
+        // The host checks the result with SCHEDULE_INFO
+        char text[32];
+        snprintf(text, sizeof(text), "UPLOAD %u", (unsigned)_inbox.size());
+        reply(text);
+    }
+#endif
+    releaseInbox();
+}
+
+void Provisioning::serviceIngest()
+{
+    if (_inboxState == INBOX_READY)
+    {
+        _inboxState = INBOX_INGESTING;
+        const char *data = _inbox.data();
+        size_t len = _inbox.size();
+        size_t first = 0;
+        while (first < len && isspace((unsigned char)data[first]))
+        {
+            first++;
+        }
+        if (first < len && data[first] == '{')
+        {
+            TRACE_SPAN(TRACE_HANDLE_RECEIVED, INGEST_IDLE);
+            _counts.patches++;
+            if (_hooks.patch != nullptr)
+            {
+                _hooks.patch(data, len, _hooks.ctx);
+            }
+            else
+            {
+                LOG_WARN("Patch uploads are not supported here. Ignored.");
+            }
+            finishIngest();
+            return;
+        }
+        LOG_INFO("Attempting to parse NEW schedule data string...");
+        // The store writes to temporary files and only replaces the current
+        // schedule on commit, so a failed upload keeps the old one intact.
+        if (!_ingest.begin(data, len, _inboxReceivedAt))
+        {
+            _counts.failed++;
+            finishIngest();
+            return;
+        }
+    }
+    if (!_ingest.active())
+    {
+        return;
+    }
+
+    TRACE_SPAN(TRACE_HANDLE_RECEIVED, _ingest.status());
+    UploadResult result = _reminders.stepUpload();
+    switch (result)
+    {
+    case UPLOAD_BUSY:
+        return;
+    case UPLOAD_COMMITTED:
+        _counts.committed++;
+        _hooks.committed(_hooks.ctx);
+        break;
+    case UPLOAD_UNCHANGED:
+        _counts.unchanged++;
+        break;
+    case UPLOAD_FAILED:
+        _counts.failed++;
+        break;
+    }
+    finishIngest();
+}
+
+// --- Schedule Identity ---
+
+size_t Provisioning::formatScheduleInfo(char *out, size_t size) const
+{
+    bool loaded = _reminders.loaded();
+    return snprintf(out, size, "{\"hash\":\"%08lx\",\"generation\":%lu,\"slots\":%u,\"pending\":%u}",
+                    loaded ? (unsigned long)_store.contentHash() : 0UL,
+                    loaded ? (unsigned long)_store.generation() : 0UL,
+                    loaded ? _store.slotCount() : 0,
+                    loaded ? _store.pendingCount() : 0);
+}
+
+// --- Status ---
+// Setters ignore unchanged values, so this is cheap to run every pass
+
+uint8_t Provisioning::updateStatus(uint8_t extraFlags)
+{
+    bool loaded = _reminders.loaded();
+    uint8_t flags = extraFlags;
+    if (loaded)
+    {
+        flags |= DEVICE_STATUS_FLAG_SCHEDULE;
+    }
+    if (_reminders.alerting())
+    {
+        flags |= DEVICE_STATUS_FLAG_ALERT;
+    }
+
+    ScheduleSlot next;
+    bool hasNext = loaded && _store.peekNext(next);
+    _status.setState(_reminders.state());
+    _status.setFlags(flags);
+    _status.setPending(loaded ? _store.pendingCount() : 0);
+    _status.setNextDue(hasNext, hasNext ? _reminders.receiveTime() + next.offsetSec * 1000UL : 0);
+    return flags;
+}
+
+#if SERIAL_LINK_ENABLED
+// --- Serial Link ---
+// Frames are decoded and handled in the loop (pollSerial())
+
+// Print adapter that sends a LINK_STREAM frame every time its buffer fills,
+// so SEND_UPDATE over the serial link streams straight from flash. The link
+// takes frames as fast as the UART does, so this runs to the end at once.
+class ChunkWriter : public Print
+{
+public:
+    ChunkWriter(SerialLink &link, uint8_t *buffer, size_t size) : _link(link), _buffer(buffer), _size(size) {}
+
+    size_t write(uint8_t c) override
+    {
+        _buffer[_length++] = c;
+        if (_length == _size)
+        {
+            sendChunk();
+        }
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            write(buffer[i]);
+        }
+        return size;
+    }
+
+    void flush() override
+    {
+        if (_length > 0)
+        {
+            sendChunk();
+        }
+    }
+
+    size_t chunks() const { return _chunks; }
+    size_t bytes() const { return _bytes; }
+
+private:
+    void sendChunk()
+    {
+        TRACE_SPAN(TRACE_SEND_CHUNK);
+        _chunks++;
+        _bytes += _length;
+        _link.send(LINK_STREAM, _buffer, _length);
+        _length = 0;
+    }
+
+    SerialLink &_link;
+    uint8_t *_buffer;
+    size_t _size;
+    size_t _length = 0;
+    size_t _chunks = 0;
+    size_t _bytes = 0;
+};
+
+// Ends a SEND_UPDATE over the link; the host knows the stream is complete
+void Provisioning::sendSerialStreamEnd(uint32_t total)
+{
+    uint8_t payload[4] = {(uint8_t)total, (uint8_t)(total >> 8), (uint8_t)(total >> 16), (uint8_t)(total >> 24)};
+    _link.send(LINK_STREAM_END, payload, sizeof(payload));
+}
+
+void Provisioning::sendSerialUpdate()
+{
+    if (!_reminders.loaded())
+    {
+        LOG_INFO("Cannot send update: No schedule data loaded.");
+        sendSerialStreamEnd(0);
+        // If there's no data, we can safely go idle
+        _reminders.setState(STATE_IDLE);
+        return;
+    }
+
+    TRACE_SPAN(TRACE_SEND_UPDATE, ROUTE_SERIAL);
+    LOG_INFO("Sending Update:");
+    // Stream the compact JSON straight from the store into link frames
+    ChunkWriter writer(_link, _streamChunk, sizeof(_streamChunk));
+    _store.writeJson(writer);
+    writer.flush();
+    LOG_INFO("Sent %u bytes in %u chunks.", (unsigned)writer.bytes(), (unsigned)writer.chunks());
+    sendSerialStreamEnd(writer.bytes());
+    if (_hooks.streamed != nullptr)
+    {
+        _hooks.streamed(writer.bytes(), _hooks.ctx);
+    }
+}
+
+// The oldest events that fit one frame; none left ends the drain
+void Provisioning::sendSerialEvents()
+{
+    uint16_t count = _outbox.copyEvents(_streamChunk, sizeof(_streamChunk) / OUTBOX_EVENT_LEN);
+    _link.send(LINK_EVENTS, _streamChunk, count * OUTBOX_EVENT_LEN);
+}
+
+void Provisioning::handleSerialCommand(const std::string &command)
+{
+    LOG_INFO("Serial command: %s", command.c_str());
+    if (command == UPDATE_REQUEST_CMD)
+    {
+        // Already on the loop, so the store can be streamed right away
+        sendSerialUpdate();
+    }
+    else if (command == SCHEDULE_INFO_CMD)
+    {
+        char info[96];
+        formatScheduleInfo(info, sizeof(info));
+        reply(info);
+    }
+    else if (command == EVENTS_CMD)
+    {
+        sendSerialEvents();
+    }
+    else if (!_hooks.command(command, _hooks.ctx))
+    {
+        reply("UNKNOWN");
+    }
+}
+
+// Collects LINK_UPLOAD_PART frames in the inbox; LINK_UPLOAD_END hands the
+// whole upload (schedule or patch) to the loop like a BLE write. The END
+// reply waits until it has been applied.
+void Provisioning::handleSerialUpload(bool last, const uint8_t *payload, size_t len)
+{
+    if (!_serialUploadOpen)
+    {
+        if (!claimInbox())
+        {
+            _counts.refused++;
+            reply("UPLOAD BUSY");
+            return;
+        }
+        _serialUploadOpen = true;
+    }
+    if (!_inbox.append(payload, len))
+    {
+        LOG_ERROR("Serial upload larger than %u bytes. Ignored.", MAX_UPLOAD_BYTES);
+        _counts.refused++;
+        _serialUploadOpen = false;
+        releaseInbox();
+        reply("UPLOAD TOO_LARGE");
+        return;
+    }
+    if (!last)
+    {
+        char text[32];
+        snprintf(text, sizeof(text), "UPLOAD %u", (unsigned)_inbox.size());
+        reply(text);
+        return;
+    }
+
+    _serialUploadOpen = false;
+    size_t length = _inbox.size();
+    if (length == 0 || (uint8_t)_inbox.data()[0] == COMPRESSED_UPLOAD_MARKER)
+    {
+        _counts.refused++;
+        releaseInbox();
+        reply("UPLOAD UNSUPPORTED");
+        return;
+    }
+    LOG_INFO("Received schedule over serial (%u bytes)", (unsigned)length);
+    submitInbox(ROUTE_SERIAL);
+}
+
+void Provisioning::onSerialFrame(uint8_t type, const uint8_t *payload, size_t len, void *ctx)
+{
+    TRACE_SPAN(TRACE_SERIAL_FRAME, type);
+    Provisioning *self = (Provisioning *)ctx;
+    switch (type)
+    {
+    case LINK_CMD:
+        self->handleSerialCommand(std::string((const char *)payload, len));
+        break;
+    case LINK_UPLOAD_PART:
+    case LINK_UPLOAD_END:
+        self->handleSerialUpload(type == LINK_UPLOAD_END, payload, len);
+        break;
+    case LINK_EVENTS_ACK:
+        if (self->_outbox.acknowledge(payload, len, millis()))
+        {
+            self->_persistence.markDirty(PERSIST_OUTBOX, millis());
+        }
+        self->sendSerialEvents();
+        break;
+    case LINK_STATUS_READ:
+    {
+        uint8_t record[DEVICE_STATUS_LEN];
+        self->_status.refresh(millis());
+        self->_status.copy(record);
+        self->_link.send(LINK_STATUS, record, sizeof(record));
+        break;
+    }
+    default:
+        self->reply("UNKNOWN");
+        break;
+    }
+}
+#endif
@@ -0,0 +1,105 @@
+#include "RadioPolicy.h"
+#include "Log.h"
+
+// Time left until a deadline set at most span ago. Stale deadlines (from
+// before a millis() wrap) count as passed.
+static uint32_t remaining(uint32_t until, uint32_t nowMs, uint32_t span)
+{
+    uint32_t left = until - nowMs;
+    return left <= span ? left : 0;
+}
+
+void RadioPolicy::boost(uint32_t nowMs)
+{
+    _boostUntil = nowMs + RADIO_FAST_WINDOW_MS;
+}
+
+void RadioPolicy::setSlowAdvertising(uint16_t minUnits, uint16_t maxUnits)
+{
+    if (minUnits == _slowMin && maxUnits == _slowMax)
+    {
+        return;
+    }
+    _slowMin = minUnits;
+    _slowMax = maxUnits;
+    if (_advertising == ADV_SLOW)
+    {
+        _ble.setAdvertisingInterval(_slowMin, _slowMax);
+    }
+}
+
+uint32_t RadioPolicy::update(uint32_t nowMs, bool connected)
+{
+    uint32_t next = RADIO_NO_DEADLINE;
+
+    if (!connected)
+    {
+        _wasConnected = false;
+        _link = LINK_CENTRAL; // The next connection starts from the central's choice
+        uint32_t boostLeft = remaining(_boostUntil, nowMs, RADIO_FAST_WINDOW_MS);
+        applyAdvertising(boostLeft > 0 ? ADV_FAST : ADV_SLOW);
+        return boostLeft > 0 ? boostLeft : next;
+    }
+
+    if (!_wasConnected)
+    {
+        _wasConnected = true;
+        _settleUntil = nowMs + RADIO_CONNECT_SETTLE_MS;
+    }
+    uint32_t bulkLeft = remaining(_bulkUntil, nowMs, RADIO_BULK_LINGER_MS);
+    uint32_t settleLeft = remaining(_settleUntil, nowMs, RADIO_CONNECT_SETTLE_MS);
+    if (bulkLeft > 0)
+    {
+        applyLink(LINK_BULK);
+        next = bulkLeft;
+    }
+    else if (settleLeft > 0)
+    {
+        next = settleLeft; // Discovery and subscriptions run on the central's parameters
+    }
+    else
+    {
+        applyLink(LINK_IDLE);
+    }
+    return next;
+}
+
+void RadioPolicy::applyAdvertising(AdvertisingSpeed speed)
+{
+    if (speed == _advertising)
+    {
+        return;
+    }
+    _advertising = speed;
+    if (speed == ADV_FAST)
+    {
+        _ble.setAdvertisingInterval(RADIO_ADV_FAST_MIN, RADIO_ADV_FAST_MAX);
+    }
+    else
+    {
+        _ble.setAdvertisingInterval(_slowMin, _slowMax);
+    }
+    LOG_INFO("Advertising: %s", speed == ADV_FAST ? "fast" : "slow");
+}
+
+void RadioPolicy::applyLink(LinkProfile profile)
+{
+    if (profile == _link)
+    {
+        return;
+    }
+    bool requested;
+    if (profile == LINK_BULK)
+    {
+        requested = _ble.requestConnectionParams(RADIO_CONN_BULK_MIN, RADIO_CONN_BULK_MAX, RADIO_CONN_BULK_LATENCY,
+                                                 RADIO_CONN_BULK_TIMEOUT);
+    }
+    else
+    {
+        requested = _ble.requestConnectionParams(RADIO_CONN_IDLE_MIN, RADIO_CONN_IDLE_MAX, RADIO_CONN_IDLE_LATENCY,
+                                                 RADIO_CONN_IDLE_TIMEOUT);
+    }
+    // Not retried on failure: the next profile change asks again
+    _link = profile;
+    LOG_INFO("Connection parameters: %s%s", profile == LINK_BULK ? "bulk" : "idle", requested ? "" : " (not sent)");
+}
@@ -0,0 +1,501 @@
+#include "ReminderEngine.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm>
+
+void ReminderEngine::begin(const ReminderHooks &hooks)
+{
+    _hooks = hooks;
+    _persistence.registerRegion(PERSIST_SCHEDULE, writeScheduleRegion, this);
+    _persistence.registerRegion(PERSIST_MILLIS, writeMillisRegion, this);
+    _checkpointTimer = _timers.schedule(MILLIS_SAVE_INTERVAL_MS, onMillisCheckpoint, this, millis(), MILLIS_SAVE_INTERVAL_MS);
+}
+
+// --- Time Recovery ---
+// millis() starts over at every boot, so the checkpoint keeps the schedule
+// origin on the same clock as the millis() it was taken at. Their difference
+// is how far into the schedule the device got; this boot continues from
+// there and rebases the origin onto its own millis(). The pair is written in
+// one file write, so a reboot at any point (the next one included) finds a
+// matching pair rather than this boot's millis() against an older origin.
+void ReminderEngine::restore(bool loaded)
+{
+    _groupCount = 0;
+    _attempt = 0;
+    _loaded = loaded;
+    if (!loaded)
+    {
+        LOG_INFO("No existing schedule found or load failed. Waiting for BLE connection.");
+        _state = STATE_IDLE;
+        _receiveTime = 0;
+        // A counter without its schedule would be stale for the next one
+        if (_fs.exists(MILLIS_COUNTER_FILENAME))
+        {
+            LOG_INFO("Deleting potentially stale millis counter file.");
+            _fs.remove(MILLIS_COUNTER_FILENAME);
+        }
+        return;
+    }
+
+    uint32_t storeOrigin = _store.originalReceiveTime();
+    uint32_t timePassedBeforeShutdown = 0;
+    Checkpoint checkpoint;
+    LOG_INFO("Original Receive Time (from the receiving boot): %lu", (unsigned long)storeOrigin);
+
+    if (!loadMillisCounter(checkpoint))
+    {
+        LOG_INFO("Could not determine time passed before shutdown (invalid counter or schedule time).");
+    }
+    else if (checkpoint.storeOrigin != storeOrigin)
+    {
+        // Taken before this schedule was committed: it arrived just before the shutdown
+        LOG_WARN("Millis counter belongs to an earlier schedule. Resetting elapsed time.");
+    }
+    else if (checkpoint.origin == checkpoint.storeOrigin && checkpoint.millis < checkpoint.origin)
+    {
+        // Never rebased (the receiving boot, or a counter from older firmware):
+        // both values are from one boot unless the counter is stale
+        LOG_WARN("lastKnownMillis < originalScheduleReceiveTime. Assuming stale counter or recent schedule receipt. Resetting elapsed time.");
+    }
+    else
+    {
+        // Same clock: unsigned subtraction is right even when the rebased origin wrapped
+        timePassedBeforeShutdown = checkpoint.millis - checkpoint.origin;
+        LOG_INFO("Time passed before shutdown (relative to schedule): %lu ms", (unsigned long)timePassedBeforeShutdown);
+    }
+
+    _receiveTime = millis() - timePassedBeforeShutdown;
+    LOG_INFO("Adjusted scheduleReceiveTime for current session: %lu", (unsigned long)_receiveTime);
+    LOG_INFO("Existing schedule loaded. Will start processing.");
+    // Persist the rebased origin with the next flush
+    _persistence.markDirty(PERSIST_MILLIS, millis());
+    _state = STATE_PROCESSING_SCHEDULE;
+    _rescan = true;
+}
+
+void ReminderEngine::service()
+{
+    // --- New schedule: drop the active reminder and rescan ---
+    if (_replaced)
+    {
+        _replaced = false;
+        cancelAlert();
+        _state = STATE_PROCESSING_SCHEDULE;
+        _rescan = true;
+        LOG_DEBUG("State changed to STATE_PROCESSING_SCHEDULE");
+    }
+    // Look for the next reminder when something changed or its timer fired
+    if (_state == STATE_PROCESSING_SCHEDULE && _rescan)
+    {
+        _rescan = false;
+        processSchedule();
+    }
+}
+
+bool ReminderEngine::press()
+{
+    if (_state != STATE_WAITING_RESPONSE && _state != STATE_SNOOZED)
+    {
+        return false;
+    }
+    LOG_INFO("User button pressed - Responded YES");
+    recordResponse(true); // Records response, moves to next, sets state back
+    return true;
+}
+
+UploadResult ReminderEngine::stepUpload()
+{
+    IngestStatus status = _ingest.step();
+    if (status == INGEST_PARSED)
+    {
+        // --- Same content as the active schedule: nothing to do ---
+        if (loaded() && _ingest.hash() == _store.contentHash())
+        {
+            LOG_INFO("Upload matches active schedule (hash %08lx). Keeping it and its responses.",
+                     (unsigned long)_ingest.hash());
+            _ingest.abort();
+            return UPLOAD_UNCHANGED;
+        }
+        _ingest.commit(); // Indexed by the next steps
+        status = _ingest.status();
+    }
+    if (status == INGEST_COMMITTED)
+    {
+        _receiveTime = _ingest.receiveTime();
+        _loaded = true;
+        // The next pass drops any active reminder and rescans the new schedule
+        _replaced = true;
+        // The store is already on flash; refresh the uptime checkpoint with it
+        _persistence.markDirty(PERSIST_MILLIS, millis());
+        return UPLOAD_COMMITTED;
+    }
+    if (status == INGEST_FAILED)
+    {
+        LOG_ERROR("Failed to build new schedule structure. Aborting.");
+        return UPLOAD_FAILED;
+    }
+    return UPLOAD_BUSY;
+}
+
+void ReminderEngine::unload()
+{
+    _loaded = false;
+    _state = STATE_IDLE;
+}
+
+void ReminderEngine::queueEvent(uint8_t type, uint8_t state, uint16_t slot, uint32_t offsetSec)
+{
+    uint32_t atSec = (millis() - _receiveTime) / 1000;
+    _outbox.push(type, state, slot, offsetSec, atSec);
+    if (_hooks.queued != nullptr)
+    {
+        _hooks.queued(_hooks.ctx);
+    }
+}
+
+void ReminderEngine::countdown()
+{
+    if (_state != STATE_PROCESSING_SCHEDULE || !_loaded)
+    {
+        return;
+    }
+    uint32_t remainingMillis = _timers.msUntil(_reminderTimer, millis());
+    if (remainingMillis != UINT32_MAX)
+    {
+        LOG_DEBUG("Next reminder in: %lu seconds", (unsigned long)(remainingMillis / 1000));
+    }
+    else if (_store.pendingCount() == 0)
+    {
+        LOG_INFO("No pending reminders.");
+    }
+    else
+    {
+        _rescan = true; // processSchedule() found no timer for the next one; look again
+    }
+}
+
+void ReminderEngine::checkpoint()
+{
+    if (_loaded)
+    {
+        _persistence.markDirty(PERSIST_MILLIS, millis());
+    }
+}
+
+// --- Schedule Processing ---
+// The store keeps pending reminders sorted by due time, so the earliest
+// unprocessed reminder is simply the head of its in-RAM window. If it is not
+// due yet, a timer is armed for it instead of re-checking every loop. When it
+// is due, the reminders right behind it that fall inside the coalescing
+// window join the same alert.
+void ReminderEngine::processSchedule()
+{
+    TRACE_SPAN(TRACE_PROCESS_SCHEDULE);
+    if (!loaded())
+    {
+        _state = STATE_IDLE;
+        return;
+    }
+
+    ScheduleSlot next;
+    if (!_store.peekNext(next))
+    {
+        _timers.cancel(_reminderTimer);
+        _reminderTimer = TIMER_NONE;
+
+        // No unprocessed reminders were found in the entire schedule.
+        LOG_INFO("All medications processed.");
+        if (_hooks.connected(_hooks.ctx))
+        {
+            _state = STATE_SENDING_UPDATE;
+            LOG_INFO("Processing complete. State changed to STATE_SENDING_UPDATE.");
+        }
+        else
+        {
+            _state = STATE_IDLE;
+            LOG_INFO("Processing complete while disconnected. Update pending. State changed to STATE_IDLE.");
+        }
+        return;
+    }
+
+    // Elapsed time since the schedule origin; unsigned subtraction is rollover safe
+    unsigned long now = millis();
+    uint32_t elapsedMillis = now - _receiveTime;
+    uint64_t dueMillis = (uint64_t)next.offsetSec * 1000ULL;
+    if (elapsedMillis < dueMillis)
+    {
+        // Not time yet: sleep until it is
+        uint64_t waitMillis = dueMillis - elapsedMillis;
+        _reminderTimer = _timers.reschedule(_reminderTimer, (uint32_t)std::min<uint64_t>(waitMillis, UINT32_MAX - 1),
+                                            onReminderDue, this, now);
+        if (_reminderTimer == TIMER_NONE)
+        {
+            LOG_ERROR("No timer for the next reminder. Checking it every second instead.");
+        }
+        return;
+    }
+
+    // It's time! Remember which reminders are active
+    _timers.cancel(_reminderTimer);
+    _reminderTimer = TIMER_NONE;
+    uint64_t untilOffsetSec = (uint64_t)next.offsetSec + COALESCE_WINDOW_MS / 1000;
+    _groupCount = _store.peekDue(_group, REMINDER_GROUP_MAX, (uint32_t)std::min<uint64_t>(untilOffsetSec, UINT32_MAX));
+    if (_groupCount == 0)
+    {
+        _group[0] = next;
+        _groupCount = 1;
+    }
+    _attempt = 0;
+
+    for (uint8_t i = 0; i < _groupCount; ++i)
+    {
+        LOG_INFO("Reminder Due! Med ID: %s, Time Offset: %lu (Slot %u)", _store.medId(_group[i].med),
+                 (unsigned long)_group[i].offsetSec, _group[i].slot);
+        LOG_EVENT(LOG_CODE_REMINDER_DUE, _group[i].slot, _group[i].offsetSec);
+    }
+    if (_groupCount > 1)
+    {
+        LOG_INFO("Coalesced %u reminders into one alert.", _groupCount);
+    }
+    if (_hooks.due != nullptr)
+    {
+        _hooks.due(_group, _groupCount, _hooks.ctx);
+    }
+
+    startAlert();
+}
+
+// --- Alert Phases ---
+
+// Vibrates for the current group and arms the end of the vibration
+void ReminderEngine::startAlert()
+{
+    uint32_t vibrationMs = _hooks.alert(_attempt == 0, _hooks.ctx);
+    _attempt++;
+    if (!armPhase(vibrationMs, onVibrationDone))
+    {
+        return;
+    }
+    _state = STATE_VIBRATING;
+    LOG_DEBUG("State changed to STATE_VIBRATING");
+}
+
+// Arms the next phase of the active alert. Without a free timer the alert
+// could never end on its own, so the motor stops and the reminder is
+// recorded as missed instead.
+bool ReminderEngine::armPhase(uint32_t delayMs, TimerCallback callback)
+{
+    _phaseTimer = _timers.reschedule(_phaseTimer, delayMs, callback, this, millis());
+    if (_phaseTimer != TIMER_NONE)
+    {
+        return true;
+    }
+    LOG_ERROR("No timer for the reminder phase. Recording it as missed.");
+    _hooks.silence(_hooks.ctx);
+    recordResponse(false);
+    return false;
+}
+
+// Drops whatever reminder is in flight (used when the schedule is replaced)
+void ReminderEngine::cancelAlert()
+{
+    _timers.cancel(_phaseTimer);
+    _timers.cancel(_reminderTimer);
+    _phaseTimer = _reminderTimer = TIMER_NONE;
+    if (_state == STATE_VIBRATING)
+    {
+        _hooks.silence(_hooks.ctx);
+    }
+    _groupCount = 0;
+    _attempt = 0;
+}
+
+void ReminderEngine::recordResponse(bool taken)
+{
+    if (!_loaded || _groupCount == 0)
+    {
+        LOG_ERROR("Cannot record response, schedule not loaded or no active reminder.");
+        _state = STATE_IDLE;
+        return;
+    }
+
+    // One answer covers the whole group
+    uint8_t state = taken ? SLOT_TAKEN : SLOT_MISSED;
+    for (uint8_t i = 0; i < _groupCount; ++i)
+    {
+        LOG_INFO("Recording response for Med %s, Slot %u: %s", _store.medId(_group[i].med), _group[i].slot,
+                 taken ? "Yes" : "No");
+        LOG_EVENT(LOG_CODE_RESPONSE, _group[i].slot, state);
+        if (!_store.setState(_group[i].slot, state))
+        {
+            LOG_ERROR("Failed to record response in schedule store.");
+        }
+        queueEvent(taken ? EVENT_RESPONSE : EVENT_MISSED, state, _group[i].slot, _group[i].offsetSec);
+    }
+    if (_store.pendingCount() == 0)
+    {
+        queueEvent(EVENT_SCHEDULE_DONE, 0, 0, 0);
+    }
+    _hooks.answered(_group[_groupCount - 1], _groupCount, taken, _hooks.ctx);
+    _groupCount = 0;
+    _attempt = 0;
+    _timers.cancel(_phaseTimer);
+    _phaseTimer = TIMER_NONE;
+
+    // Mark the schedule, the outbox and the millis checkpoint dirty once for
+    // the whole group; the flush policy writes them together instead of
+    // blocking the response path here.
+    _persistence.markDirty(PERSIST_SCHEDULE | PERSIST_OUTBOX | PERSIST_MILLIS, millis());
+
+    // Go back to processing state to find the *next* earliest reminder
+    _state = STATE_PROCESSING_SCHEDULE;
+    _rescan = true;
+    LOG_DEBUG("State changed to STATE_PROCESSING_SCHEDULE");
+}
+
+// --- Timer Callbacks ---
+
+void ReminderEngine::onReminderDue(void *ctx)
+{
+    ((ReminderEngine *)ctx)->_rescan = true;
+}
+
+void ReminderEngine::onVibrationDone(void *ctx)
+{
+    ReminderEngine *engine = (ReminderEngine *)ctx;
+    engine->_hooks.silence(engine->_hooks.ctx);
+    if (!engine->armPhase(RESPONSE_TIMEOUT_MS, onResponseTimeout))
+    {
+        return;
+    }
+    engine->_state = STATE_WAITING_RESPONSE;
+    LOG_DEBUG("State changed to STATE_WAITING_RESPONSE");
+}
+
+void ReminderEngine::onReRemind(void *ctx)
+{
+    LOG_INFO("Re-reminding unanswered reminder.");
+    ((ReminderEngine *)ctx)->startAlert();
+}
+
+void ReminderEngine::onResponseTimeout(void *ctx)
+{
+    ReminderEngine *engine = (ReminderEngine *)ctx;
+    if (engine->_attempt < REMINDER_MAX_ATTEMPTS)
+    {
+        // Escalate: snooze, then vibrate again
+        LOG_INFO("No response (attempt %u/%u). Re-reminding in %lu s.", engine->_attempt, REMINDER_MAX_ATTEMPTS,
+                 (unsigned long)(REREMIND_INTERVAL_MS / 1000));
+        if (!engine->armPhase(REREMIND_INTERVAL_MS, onReRemind))
+        {
+            return;
+        }
+        engine->_state = STATE_SNOOZED;
+        LOG_DEBUG("State changed to STATE_SNOOZED");
+        return;
+    }
+    LOG_INFO("Response timeout - Responded NO");
+    engine->recordResponse(false);
+}
+
+void ReminderEngine::onMillisCheckpoint(void *ctx)
+{
+    // Only useful if a schedule is loaded. This just marks the region dirty;
+    // the write itself is coalesced with any other pending change.
+    ((ReminderEngine *)ctx)->checkpoint();
+}
+
+// --- Persistence Regions ---
+
+// Writes the response states changed since the last flush. New schedules
+// are written by the store itself when they are committed.
+bool ReminderEngine::writeScheduleRegion(void *ctx)
+{
+    ReminderEngine *engine = (ReminderEngine *)ctx;
+    if (!engine->loaded())
+    {
+        LOG_INFO("No valid schedule data to save.");
+        return false;
+    }
+    TRACE_SPAN(TRACE_SAVE_SCHEDULE);
+    return engine->_store.flushDirty();
+}
+
+bool ReminderEngine::writeMillisRegion(void *ctx)
+{
+    // The checkpoint taken when the region was marked, not when the flush ran
+    ReminderEngine *engine = (ReminderEngine *)ctx;
+    return engine->saveMillisCounter(engine->_persistence.markedAt(PERSIST_MILLIS));
+}
+
+bool ReminderEngine::saveMillisCounter(uint32_t currentMillis)
+{
+    TRACE_SPAN(TRACE_SAVE_MILLIS);
+    Checkpoint checkpoint = {currentMillis, _receiveTime, _store.originalReceiveTime()};
+    File file = _fs.open(MILLIS_COUNTER_FILENAME, FILE_WRITE); // Open for writing (overwrite)
+    if (!file)
+    {
+        LOG_ERROR("Failed to open millis counter file for writing");
+        return false;
+    }
+
+    size_t bytesWritten = file.write((const uint8_t *)&checkpoint, sizeof(checkpoint));
+    file.close();
+    if (bytesWritten != sizeof(checkpoint))
+    {
+        LOG_ERROR("Failed to write millis counter to file.");
+        _fs.remove(MILLIS_COUNTER_FILENAME); // Attempt to remove potentially corrupted file
+        return false;
+    }
+    return true;
+}
+
+// False when there is no usable checkpoint. A millis value alone (older
+// firmware) is taken as relative to the store's origin, as it was written.
+bool ReminderEngine::loadMillisCounter(Checkpoint &out)
+{
+    if (!_fs.exists(MILLIS_COUNTER_FILENAME))
+    {
+        LOG_INFO("Millis counter file not found.");
+        return false;
+    }
+
+    File file = _fs.open(MILLIS_COUNTER_FILENAME, FILE_READ);
+    if (!file)
+    {
+        LOG_ERROR("Failed to open millis counter file for reading");
+        return false;
+    }
+
+    size_t size = file.size();
+    bool ok = false;
+    if (size == sizeof(Checkpoint))
+    {
+        ok = file.read((uint8_t *)&out, sizeof(out)) == sizeof(out);
+    }
+    else if (size == sizeof(out.millis))
+    {
+        ok = file.read((uint8_t *)&out.millis, sizeof(out.millis)) == sizeof(out.millis);
+        out.origin = out.storeOrigin = _store.originalReceiveTime();
+    }
+    else
+    {
+        LOG_INFO("Millis counter file has incorrect size.");
+    }
+    file.close();
+
+    if (ok && out.millis == 0)
+    {
+        return false;
+    }
+    if (ok)
+    {
+        LOG_INFO("Loaded last known millis: %lu (origin %lu)", (unsigned long)out.millis, (unsigned long)out.origin);
+    }
+    else if (size == sizeof(Checkpoint) || size == sizeof(out.millis))
+    {
+        LOG_ERROR("Failed to read millis counter file.");
+    }
+    return ok;
+}
@@ -0,0 +1,576 @@
+#include "ScheduleIngest.h"
+#include "Log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Longest number or offset string that is parsed; longer ones overflow a long anyway
+#define OFFSET_TEXT_LEN 32
+
+static bool isSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int hexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F')
+    {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// --- Session ---
+
+bool ScheduleIngest::begin(const char *data, size_t len, uint32_t receiveTime)
+{
+    abort();
+    if (!_store.beginBuild(receiveTime))
+    {
+        LOG_ERROR("Failed to start building new schedule.");
+        _status = INGEST_FAILED;
+        return false;
+    }
+    _data = data;
+    _len = len;
+    _pos = 0;
+    _state = PARSE_SCHEDULE;
+    _receiveTime = receiveTime;
+    _hash = 0;
+    _status = INGEST_PARSING;
+    return true;
+}
+
+IngestStatus ScheduleIngest::step()
+{
+    if (_status == INGEST_INDEXING)
+    {
+        if (!_store.indexStep())
+        {
+            _status = INGEST_FAILED;
+        }
+        else if (_store.indexDone())
+        {
+            _status = _store.commitBuild() ? INGEST_COMMITTED : INGEST_FAILED;
+        }
+        return _status;
+    }
+
+    for (uint16_t n = 0; _status == INGEST_PARSING && n < INGEST_SLICE_TOKENS; ++n)
+    {
+        Token token;
+        nextToken(token);
+        if (!consume(token))
+        {
+            fail();
+        }
+    }
+    return _status;
+}
+
+void ScheduleIngest::commit()
+{
+    if (_status != INGEST_PARSED)
+    {
+        return;
+    }
+    _status = _store.sealBuild() ? INGEST_INDEXING : INGEST_FAILED;
+}
+
+void ScheduleIngest::abort()
+{
+    if (active())
+    {
+        _store.abortBuild();
+    }
+    _status = INGEST_IDLE;
+}
+
+void ScheduleIngest::fail()
+{
+    _store.abortBuild();
+    _status = INGEST_FAILED;
+}
+
+// --- Tokens ---
+
+void ScheduleIngest::nextToken(Token &token)
+{
+    while (_pos < _len && isSpace(_data[_pos]))
+    {
+        _pos++;
+    }
+    token.start = _pos;
+    token.len = 1;
+    if (_pos >= _len)
+    {
+        token.type = TOKEN_END;
+        return;
+    }
+
+    char c = _data[_pos];
+    switch (c)
+    {
+    case '[':
+        token.type = TOKEN_BEGIN_ARRAY;
+        break;
+    case ']':
+        token.type = TOKEN_END_ARRAY;
+        break;
+    case '{':
+        token.type = TOKEN_BEGIN_OBJECT;
+        break;
+    case '}':
+        token.type = TOKEN_END_OBJECT;
+        break;
+    case ':':
+        token.type = TOKEN_COLON;
+        break;
+    case ',':
+        token.type = TOKEN_COMMA;
+        break;
+    case '"':
+    {
+        size_t end = _pos + 1;
+        while (end < _len && _data[end] != '"')
+        {
+            end += (_data[end] == '\\') ? 2 : 1;
+        }
+        if (end >= _len)
+        {
+            token.type = TOKEN_END; // Unterminated
+            return;
+        }
+        token.type = TOKEN_STRING;
+        token.start = _pos + 1;
+        token.len = end - _pos - 1;
+        _pos = end + 1;
+        return;
+    }
+    default:
+    {
+        size_t end = _pos;
+        if (c == '-' || (c >= '0' && c <= '9'))
+        {
+            while (end < _len && strchr("0123456789+-.eE", _data[end]) != nullptr && _data[end] != '\0')
+            {
+                end++;
+            }
+            token.type = TOKEN_NUMBER;
+        }
+        else
+        {
+            while (end < _len && _data[end] >= 'a' && _data[end] <= 'z')
+            {
+                end++;
+            }
+            size_t n = end - _pos;
+            bool literal = (n == 4 && (memcmp(_data + _pos, "true", 4) == 0 || memcmp(_data + _pos, "null", 4) == 0)) ||
+                           (n == 5 && memcmp(_data + _pos, "false", 5) == 0);
+            token.type = literal ? TOKEN_LITERAL : TOKEN_ERROR;
+        }
+        token.len = end - _pos;
+        _pos = end;
+        return;
+    }
+    }
+    _pos++;
+}
+
+// Unescapes a string token into out, cutting it at size - 1 bytes.
+// Returns the bytes written, without the terminator.
+size_t ScheduleIngest::decodeString(const Token &token, char *out, size_t size) const
+{
+    const char *p = _data + token.start;
+    const char *end = p + token.len;
+    size_t n = 0;
+    while (p < end && n + 1 < size)
+    {
+        char c = *p++;
+        if (c != '\\' || p >= end)
+        {
+            out[n++] = c;
+            continue;
+        }
+        c = *p++;
+        switch (c)
+        {
+        case 'b':
+            out[n++] = '\b';
+            break;
+        case 'f':
+            out[n++] = '\f';
+            break;
+        case 'n':
+            out[n++] = '\n';
+            break;
+        case 'r':
+            out[n++] = '\r';
+            break;
+        case 't':
+            out[n++] = '\t';
+            break;
+        case 'u':
+        {
+            uint32_t code = 0;
+            for (int i = 0; i < 4 && p < end; ++i)
+            {
+                int digit = hexDigit(*p++);
+                code = (code << 4) | (digit < 0 ? 0 : digit);
+            }
+            // A surrogate pair makes one code point, as ArduinoJson decodes it
+            if (code >= 0xD800 && code < 0xDC00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+            {
+                uint32_t low = 0;
+                for (int i = 2; i < 6; ++i)
+                {
+                    int digit = hexDigit(p[i]);
+                    low = (low << 4) | (digit < 0 ? 0 : digit);
+                }
+                if (low >= 0xDC00 && low < 0xE000)
+                {
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    p += 6;
+                }
+            }
+            // As UTF-8, cut at size like any other bytes
+            uint8_t utf8[4];
+            size_t count;
+            if (code < 0x80)
+            {
+                utf8[0] = code;
+                count = 1;
+            }
+            else if (code < 0x800)
+            {
+                utf8[0] = 0xC0 | (code >> 6);
+                utf8[1] = 0x80 | (code & 0x3F);
+                count = 2;
+            }
+            else if (code < 0x10000)
+            {
+                utf8[0] = 0xE0 | (code >> 12);
+                utf8[1] = 0x80 | ((code >> 6) & 0x3F);
+                utf8[2] = 0x80 | (code & 0x3F);
+                count = 3;
+            }
+            else
+            {
+                utf8[0] = 0xF0 | (code >> 18);
+                utf8[1] = 0x80 | ((code >> 12) & 0x3F);
+                utf8[2] = 0x80 | ((code >> 6) & 0x3F);
+                utf8[3] = 0x80 | (code & 0x3F);
+                count = 4;
+            }
+            for (size_t i = 0; i < count && n + 1 < size; ++i)
+            {
+                out[n++] = (char)utf8[i];
+            }
+            break;
+        }
+        default: // '"', '\\', '/'
+            out[n++] = c;
+            break;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// --- Parser ---
+
+bool ScheduleIngest::consume(const Token &token)
+{
+    if (token.type == TOKEN_END)
+    {
+        LOG_ERROR("Upload ends in the middle of the schedule.");
+        return false;
+    }
+    if (token.type == TOKEN_ERROR)
+    {
+        LOG_ERROR("Initial parsing of received string failed at byte %u.", (unsigned)token.start);
+        return false;
+    }
+
+    switch (_state)
+    {
+    case PARSE_SCHEDULE:
+        if (token.type != TOKEN_BEGIN_ARRAY)
+        {
+            LOG_ERROR("Received data string is not a JSON array.");
+            return false;
+        }
+        _state = PARSE_MED_OR_END;
+        return true;
+
+    case PARSE_MED_OR_END:
+    case PARSE_AFTER_MED:
+        if (token.type == TOKEN_END_ARRAY)
+        {
+            _status = INGEST_PARSED; // Anything after the array is ignored
+            return true;
+        }
+        if (_state == PARSE_AFTER_MED)
+        {
+            if (token.type != TOKEN_COMMA)
+            {
+                break;
+            }
+            _state = PARSE_MED;
+            return true;
+        }
+        // The first entry
+        // Fall through
+    case PARSE_MED:
+        if (token.type != TOKEN_BEGIN_OBJECT)
+        {
+            LOG_ERROR("Medication entry is not an object.");
+            return false;
+        }
+        startMed();
+        _state = PARSE_KEY_OR_END;
+        return true;
+
+    case PARSE_KEY_OR_END:
+    case PARSE_AFTER_VALUE:
+        if (token.type == TOKEN_END_OBJECT)
+        {
+            return endMed();
+        }
+        if (_state == PARSE_AFTER_VALUE)
+        {
+            if (token.type != TOKEN_COMMA)
+            {
+                break;
+            }
+            _state = PARSE_KEY;
+            return true;
+        }
+        // The first key
+        // Fall through
+    case PARSE_KEY:
+    {
+        if (token.type != TOKEN_STRING)
+        {
+            break;
+        }
+        char key[8];
+        decodeString(token, key, sizeof(key));
+        _key = (token.len == 6 && strcmp(key, "med_id") == 0) ? KEY_MED_ID
+               : (token.len == 5 && strcmp(key, "times") == 0) ? KEY_TIMES
+                                                               : KEY_OTHER;
+        _state = PARSE_COLON;
+        return true;
+    }
+
+    case PARSE_COLON:
+        if (token.type != TOKEN_COLON)
+        {
+            break;
+        }
+        _state = PARSE_VALUE;
+        return true;
+
+    case PARSE_VALUE:
+        return onValue(token);
+
+    case PARSE_TIME_OR_END:
+    case PARSE_AFTER_TIME:
+        if (token.type == TOKEN_END_ARRAY)
+        {
+            endTimes();
+            return true;
+        }
+        if (_state == PARSE_AFTER_TIME)
+        {
+            if (token.type != TOKEN_COMMA)
+            {
+                break;
+            }
+            _state = PARSE_TIME;
+            return true;
+        }
+        // The first offset
+        // Fall through
+    case PARSE_TIME:
+        return addTime(token);
+
+    case PARSE_SKIP:
+        if (token.type == TOKEN_BEGIN_ARRAY || token.type == TOKEN_BEGIN_OBJECT)
+        {
+            _skipDepth++;
+        }
+        else if ((token.type == TOKEN_END_ARRAY || token.type == TOKEN_END_OBJECT) && --_skipDepth == 0)
+        {
+            _state = _skipNext;
+        }
+        return true;
+    }
+
+    LOG_ERROR("Initial parsing of received string failed at byte %u.", (unsigned)token.start);
+    return false;
+}
+
+bool ScheduleIngest::onValue(const Token &token)
+{
+    if (_key == KEY_MED_ID && token.type == TOKEN_STRING && _med < 0)
+    {
+        decodeString(token, _medId, sizeof(_medId));
+        _hasMedId = true;
+        _state = PARSE_AFTER_VALUE;
+        return true;
+    }
+    if (_key == KEY_TIMES && token.type == TOKEN_BEGIN_ARRAY)
+    {
+        _hasTimes = true;
+        if (!_hasMedId)
+        {
+            // Its slots need the med; read it again at the end of the entry
+            _timesAt = token.start;
+            return skipValue(token, PARSE_AFTER_VALUE);
+        }
+        if (!ensureMed())
+        {
+            return false;
+        }
+        _state = PARSE_TIME_OR_END;
+        return true;
+    }
+    return skipValue(token, PARSE_AFTER_VALUE);
+}
+
+bool ScheduleIngest::skipValue(const Token &token, ParseState next)
+{
+    if (token.type == TOKEN_BEGIN_ARRAY || token.type == TOKEN_BEGIN_OBJECT)
+    {
+        _skipDepth = 1;
+        _skipNext = next;
+        _state = PARSE_SKIP;
+        return true;
+    }
+    if (token.type != TOKEN_STRING && token.type != TOKEN_NUMBER && token.type != TOKEN_LITERAL)
+    {
+        LOG_ERROR("Initial parsing of received string failed at byte %u.", (unsigned)token.start);
+        return false;
+    }
+    _state = next;
+    return true;
+}
+
+// --- Meds and slots ---
+
+void ScheduleIngest::startMed()
+{
+    _medId[0] = '\0';
+    _keptId[0] = '\0';
+    _hasMedId = false;
+    _hasTimes = false;
+    _med = -1;
+    _timesAt = SIZE_MAX;
+    _replaying = false;
+}
+
+// Adds the entry's med to the build the first time a slot (or its end) needs it
+bool ScheduleIngest::ensureMed()
+{
+    if (_med >= 0)
+    {
+        return true;
+    }
+    _med = _store.addMed(_medId);
+    if (_med < 0)
+    {
+        LOG_ERROR("Too many medications (max %d).", SCHEDULE_MAX_MEDS);
+        return false;
+    }
+    // The store keeps truncated ids, so hash what it keeps
+    strncpy(_keptId, _medId, SCHEDULE_MED_ID_LEN - 1);
+    _keptId[SCHEDULE_MED_ID_LEN - 1] = '\0';
+    if (_keptId[0] != '\0')
+    {
+        _hash += ScheduleStore::hashMed(_keptId);
+    }
+    return true;
+}
+
+bool ScheduleIngest::endMed()
+{
+    if (!ensureMed())
+    {
+        return false;
+    }
+    if (_timesAt != SIZE_MAX)
+    {
+        _resumeAt = _pos;
+        _pos = _timesAt + 1;
+        _timesAt = SIZE_MAX;
+        _replaying = true;
+        _state = PARSE_TIME_OR_END;
+        return true;
+    }
+    if (!_hasTimes)
+    {
+        LOG_WARN("Medication entry missing 'times' array or invalid format.");
+    }
+    _state = PARSE_AFTER_MED;
+    return true;
+}
+
+void ScheduleIngest::endTimes()
+{
+    if (_replaying)
+    {
+        _replaying = false;
+        _pos = _resumeAt;
+        _state = PARSE_AFTER_MED;
+        return;
+    }
+    _state = PARSE_AFTER_VALUE;
+}
+
+bool ScheduleIngest::addTime(const Token &token)
+{
+    char text[OFFSET_TEXT_LEN];
+    long offsetSeconds = 0;
+    if (token.type == TOKEN_STRING)
+    {
+        decodeString(token, text, sizeof(text));
+        offsetSeconds = atol(text);
+    }
+    else if (token.type == TOKEN_NUMBER)
+    {
+        size_t n = token.len < sizeof(text) - 1 ? token.len : sizeof(text) - 1;
+        memcpy(text, _data + token.start, n);
+        text[n] = '\0';
+        bool real = strpbrk(text, ".eE") != nullptr;
+        offsetSeconds = real ? (long)strtod(text, nullptr) : strtol(text, nullptr, 10);
+    }
+    // Literals, arrays and objects count as 0, as they always have
+
+    if (!skipValue(token, PARSE_AFTER_TIME))
+    {
+        return false;
+    }
+    if (offsetSeconds < 0)
+    {
+        // Already due: fires on the first scan, as it always has
+        LOG_WARN("Negative reminder offset %ld, due at once.", offsetSeconds);
+        offsetSeconds = 0;
+    }
+    if (!_store.addSlot(_med, (uint32_t)offsetSeconds))
+    {
+        LOG_ERROR("Failed to add reminder slot. Flash full?");
+        return false;
+    }
+    _hash += ScheduleStore::hashSlot(_keptId, (uint32_t)offsetSeconds);
+    return true;
+}
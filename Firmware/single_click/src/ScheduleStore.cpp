@@ -0,0 +1,1031 @@
+#include "ScheduleStore.h"
+#include "Log.h"
+#include "Trace.h"
+
+#include <algorithm> // std::min
+#include <stddef.h>  // offsetof
+
+#define STORE_MAGIC 0x48435350 // "PSCH"
+#define INDEX_MAGIC 0x58495350 // "PSIX"
+#define STORE_VERSION 2 // 2: generation in the header
+
+#define FNV_OFFSET 2166136261UL
+#define FNV_PRIME 16777619UL
+
+#define STORE_TMP SCHEDULE_STORE_FILENAME SCHEDULE_TMP_SUFFIX
+#define INDEX_TMP SCHEDULE_INDEX_FILENAME SCHEDULE_TMP_SUFFIX
+
+// Records read per flash access when scanning the whole store
+#define SCAN_BATCH 16
+
+size_t ScheduleStore::slotPosition(const Header &header, uint16_t slot)
+{
+    return sizeof(Header) + (size_t)header.medCapacity * SCHEDULE_MED_ID_LEN + (size_t)slot * sizeof(SlotRecord);
+}
+
+// --- File helpers ---
+
+bool ScheduleStore::copyFile(const char *fromPath, const char *toPath)
+{
+    File from = _fs.open(fromPath, FILE_READ);
+    if (!from)
+    {
+        return false;
+    }
+    File to = _fs.open(toPath, FILE_WRITE);
+    if (!to)
+    {
+        from.close();
+        return false;
+    }
+    uint8_t buffer[SCAN_BATCH * sizeof(SlotRecord)];
+    size_t copied = 0;
+    size_t n;
+    while ((n = from.read(buffer, sizeof(buffer))) > 0 && to.write(buffer, n) == n)
+    {
+        copied += n;
+    }
+    bool ok = copied == from.size();
+    to.close();
+    from.close();
+    return ok;
+}
+
+bool ScheduleStore::commitFile(const char *tmpPath, const char *path)
+{
+    if (_fs.exists(path) && !_fs.remove(path))
+    {
+        LOG_ERROR("Failed to remove %s before commit", path);
+        return false;
+    }
+    if (!_fs.rename(tmpPath, path))
+    {
+        LOG_ERROR("Failed to rename %s to %s", tmpPath, path);
+        return false;
+    }
+    return true;
+}
+
+void ScheduleStore::recoverFile(const char *tmpPath, const char *path)
+{
+    if (!_fs.exists(tmpPath))
+    {
+        return;
+    }
+    if (!_fs.exists(path))
+    {
+        // Power was lost between remove and rename in commitFile()
+        LOG_INFO("Recovering %s from %s", path, tmpPath);
+        _fs.rename(tmpPath, path);
+    }
+    else
+    {
+        // Leftover from an interrupted build
+        _fs.remove(tmpPath);
+    }
+}
+
+bool ScheduleStore::readSlot(File &file, uint16_t slot, SlotRecord &out)
+{
+    if (!file.seek(slotPosition(_header, slot)))
+    {
+        return false;
+    }
+    return file.read((uint8_t *)&out, sizeof(out)) == sizeof(out);
+}
+
+// --- Loading ---
+
+bool ScheduleStore::load()
+{
+    unload();
+    recoverFile(INDEX_TMP, SCHEDULE_INDEX_FILENAME);
+    recoverFile(STORE_TMP, SCHEDULE_STORE_FILENAME);
+
+    if (!_fs.exists(SCHEDULE_STORE_FILENAME))
+    {
+        return false;
+    }
+
+    File file = _fs.open(SCHEDULE_STORE_FILENAME, FILE_READ);
+    if (!file)
+    {
+        LOG_ERROR("Failed to open schedule store for reading");
+        return false;
+    }
+
+    Header header;
+    if (file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != STORE_MAGIC || header.version != STORE_VERSION ||
+        header.medCapacity > SCHEDULE_MAX_MEDS || header.medCount > header.medCapacity ||
+        file.size() < slotPosition(header, header.slotCount))
+    {
+        LOG_ERROR("Schedule store has an invalid header or is truncated.");
+        file.close();
+        return false;
+    }
+
+    memset(_medIds, 0, sizeof(_medIds));
+    for (uint16_t m = 0; m < header.medCapacity; ++m)
+    {
+        if (file.read((uint8_t *)_medIds[m], SCHEDULE_MED_ID_LEN) != SCHEDULE_MED_ID_LEN)
+        {
+            LOG_ERROR("Failed to read med table.");
+            file.close();
+            return false;
+        }
+        _medIds[m][SCHEDULE_MED_ID_LEN - 1] = '\0';
+    }
+    _header = header;
+
+    // Count pending and missed reminders and hash the content with one sequential pass
+    SlotRecord batch[SCAN_BATCH];
+    _pendingCount = 0;
+    _missedCount = 0;
+    _contentHash = 0;
+    for (uint16_t m = 0; m < header.medCount; ++m)
+    {
+        if (_medIds[m][0] != '\0')
+        {
+            _contentHash += hashMed(_medIds[m]);
+        }
+    }
+    file.seek(slotPosition(_header, 0));
+    for (uint16_t done = 0; done < _header.slotCount;)
+    {
+        uint16_t n = std::min<uint16_t>(SCAN_BATCH, _header.slotCount - done);
+        if (file.read((uint8_t *)batch, n * sizeof(SlotRecord)) != n * sizeof(SlotRecord))
+        {
+            LOG_ERROR("Failed to scan schedule store.");
+            file.close();
+            return false;
+        }
+        for (uint16_t i = 0; i < n; ++i)
+        {
+            if (batch[i].flags & SLOT_FLAG_REMOVED)
+            {
+                continue;
+            }
+            if (batch[i].state == SLOT_PENDING)
+            {
+                _pendingCount++;
+            }
+            else if (batch[i].state == SLOT_MISSED)
+            {
+                _missedCount++;
+            }
+            if (batch[i].med < header.medCount)
+            {
+                _contentHash += hashSlot(_medIds[batch[i].med], batch[i].offsetSec);
+            }
+        }
+        done += n;
+    }
+    file.close();
+
+    if (!indexMatches(_header))
+    {
+        LOG_INFO("Schedule index missing or stale, rebuilding.");
+        if (!rebuildIndex(SCHEDULE_STORE_FILENAME, INDEX_TMP, _header) ||
+            !commitFile(INDEX_TMP, SCHEDULE_INDEX_FILENAME))
+        {
+            LOG_ERROR("Failed to rebuild schedule index.");
+            return false;
+        }
+    }
+
+    _loaded = true;
+    refillWindow();
+    return true;
+}
+
+void ScheduleStore::unload()
+{
+    _loaded = false;
+    _windowCount = 0;
+    _cursor = 0;
+    _pendingCount = 0;
+    _missedCount = 0;
+    _contentHash = 0;
+    _dirtyCount = 0;
+    _header = {};
+}
+
+void ScheduleStore::remove()
+{
+    unload();
+    _fs.remove(SCHEDULE_STORE_FILENAME);
+    _fs.remove(SCHEDULE_INDEX_FILENAME);
+}
+
+static uint32_t fnv1a(uint32_t hash, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// FNV-1a of med_id plus its terminator
+uint32_t ScheduleStore::hashMed(const char *medId)
+{
+    return fnv1a(FNV_OFFSET, (const uint8_t *)medId, strlen(medId) + 1);
+}
+
+// FNV-1a of med_id, its terminator and the offset as 4 little endian bytes
+uint32_t ScheduleStore::hashSlot(const char *medId, uint32_t offsetSec)
+{
+    uint8_t offset[4] = {(uint8_t)offsetSec, (uint8_t)(offsetSec >> 8), (uint8_t)(offsetSec >> 16), (uint8_t)(offsetSec >> 24)};
+    return fnv1a(hashMed(medId), offset, sizeof(offset));
+}
+
+const char *ScheduleStore::medId(uint8_t med) const
+{
+    if (med >= _header.medCount)
+    {
+        return "";
+    }
+    return _medIds[med];
+}
+
+// --- Due-time index ---
+
+bool ScheduleStore::indexMatches(const Header &header)
+{
+    if (!_fs.exists(SCHEDULE_INDEX_FILENAME))
+    {
+        return false;
+    }
+    File file = _fs.open(SCHEDULE_INDEX_FILENAME, FILE_READ);
+    if (!file)
+    {
+        return false;
+    }
+    IndexHeader index;
+    bool ok = file.read((uint8_t *)&index, sizeof(index)) == sizeof(index) &&
+              index.magic == INDEX_MAGIC &&
+              index.slotCount == header.slotCount &&
+              index.buildId == header.buildId &&
+              file.size() == sizeof(IndexHeader) + header.slotCount * sizeof(uint16_t);
+    file.close();
+    return ok;
+}
+
+// Writes the slot numbers of storePath sorted by (offset, slot) to indexPath.
+// RAM use is bounded by SCHEDULE_INDEX_BATCH: each pass streams the whole
+// store and keeps only the next batch of smallest keys.
+bool ScheduleStore::rebuildIndex(const char *storePath, const char *indexPath, const Header &header)
+{
+    IndexBuild build;
+    if (!openIndex(build, storePath, indexPath, header))
+    {
+        return false;
+    }
+    bool ok = true;
+    while (ok && !build.done)
+    {
+        ok = indexPass(build);
+    }
+    closeIndex(build);
+    return ok;
+}
+
+bool ScheduleStore::openIndex(IndexBuild &build, const char *storePath, const char *indexPath, const Header &header)
+{
+    build.store = _fs.open(storePath, FILE_READ);
+    if (!build.store)
+    {
+        return false;
+    }
+    build.index = _fs.open(indexPath, FILE_WRITE);
+    if (!build.index)
+    {
+        build.store.close();
+        return false;
+    }
+    build.header = header;
+    build.lastKey = 0;
+    build.written = 0;
+    build.first = true;
+    build.done = false;
+
+    IndexHeader indexHeader = {INDEX_MAGIC, header.slotCount, 0, header.buildId};
+    if (build.index.write((const uint8_t *)&indexHeader, sizeof(indexHeader)) != sizeof(indexHeader))
+    {
+        closeIndex(build);
+        return false;
+    }
+    return true;
+}
+
+// Appends the next batch of keys. Sets done (and closes both files) once
+// every slot is written; false on a read or write error.
+bool ScheduleStore::indexPass(IndexBuild &build)
+{
+    const Header &header = build.header;
+
+    // Key = offset in the high bits, slot number in the low 16 bits (unique)
+    static uint64_t keys[SCHEDULE_INDEX_BATCH];
+    uint16_t keyCount = 0;
+    SlotRecord batch[SCAN_BATCH];
+    build.store.seek(slotPosition(header, 0));
+    for (uint16_t done = 0; done < header.slotCount;)
+    {
+        uint16_t n = std::min<uint16_t>(SCAN_BATCH, header.slotCount - done);
+        if (build.store.read((uint8_t *)batch, n * sizeof(SlotRecord)) != n * sizeof(SlotRecord))
+        {
+            return false;
+        }
+        for (uint16_t i = 0; i < n; ++i)
+        {
+            uint64_t key = ((uint64_t)batch[i].offsetSec << 16) | (uint16_t)(done + i);
+            if (!build.first && key <= build.lastKey)
+            {
+                continue;
+            }
+            if (keyCount == SCHEDULE_INDEX_BATCH && key >= keys[keyCount - 1])
+            {
+                continue;
+            }
+            // Insertion into the sorted batch, dropping the largest when full
+            int pos = (keyCount < SCHEDULE_INDEX_BATCH) ? keyCount : keyCount - 1;
+            while (pos > 0 && keys[pos - 1] > key)
+            {
+                keys[pos] = keys[pos - 1];
+                pos--;
+            }
+            keys[pos] = key;
+            if (keyCount < SCHEDULE_INDEX_BATCH)
+            {
+                keyCount++;
+            }
+        }
+        done += n;
+    }
+
+    for (uint16_t i = 0; i < keyCount; ++i)
+    {
+        uint16_t slot = (uint16_t)(keys[i] & 0xFFFF);
+        if (build.index.write((const uint8_t *)&slot, sizeof(slot)) != sizeof(slot))
+        {
+            return false;
+        }
+    }
+    build.written += keyCount;
+    if (keyCount > 0)
+    {
+        build.lastKey = keys[keyCount - 1];
+        build.first = false;
+    }
+    if (keyCount == 0 || build.written >= header.slotCount)
+    {
+        build.done = true;
+        closeIndex(build);
+        return build.written == header.slotCount;
+    }
+    return true;
+}
+
+void ScheduleStore::closeIndex(IndexBuild &build)
+{
+    build.store.close();
+    build.index.close();
+}
+
+// --- Window ---
+
+uint8_t ScheduleStore::overlayState(uint16_t slot, uint8_t state) const
+{
+    for (uint8_t i = 0; i < _dirtyCount; ++i)
+    {
+        if (_dirty[i].slot == slot)
+        {
+            return _dirty[i].state;
+        }
+    }
+    return state;
+}
+
+void ScheduleStore::refillWindow()
+{
+    if (!_loaded || _windowCount >= SCHEDULE_WINDOW_SIZE || _cursor >= _header.slotCount)
+    {
+        return;
+    }
+
+    File index = _fs.open(SCHEDULE_INDEX_FILENAME, FILE_READ);
+    File store = _fs.open(SCHEDULE_STORE_FILENAME, FILE_READ);
+    if (!index || !store)
+    {
+        LOG_ERROR("Failed to open schedule files for window refill.");
+        return;
+    }
+
+    index.seek(sizeof(IndexHeader) + _cursor * sizeof(uint16_t));
+    while (_windowCount < SCHEDULE_WINDOW_SIZE && _cursor < _header.slotCount)
+    {
+        uint16_t slot;
+        SlotRecord record;
+        if (index.read((uint8_t *)&slot, sizeof(slot)) != sizeof(slot) ||
+            slot >= _header.slotCount || !readSlot(store, slot, record))
+        {
+            LOG_ERROR("Schedule index read failed during refill.");
+            break;
+        }
+        _cursor++;
+        // readSlot() moved the store position; the index file has its own
+        if (!(record.flags & SLOT_FLAG_REMOVED) && overlayState(slot, record.state) == SLOT_PENDING)
+        {
+            _window[_windowCount++] = {slot, record.offsetSec, record.med, SLOT_PENDING};
+        }
+    }
+
+    index.close();
+    store.close();
+}
+
+bool ScheduleStore::peekNext(ScheduleSlot &out)
+{
+    if (!_loaded)
+    {
+        return false;
+    }
+    if (_windowCount == 0)
+    {
+        refillWindow();
+    }
+    if (_windowCount == 0)
+    {
+        return false;
+    }
+    out = _window[0];
+    return true;
+}
+
+uint8_t ScheduleStore::peekDue(ScheduleSlot *out, uint8_t maxCount, uint32_t untilOffsetSec)
+{
+    if (!_loaded)
+    {
+        return 0;
+    }
+    // Top the window up so reminders just past the current head are visible too
+    refillWindow();
+
+    uint8_t count = 0;
+    while (count < maxCount && count < _windowCount && _window[count].offsetSec <= untilOffsetSec)
+    {
+        out[count] = _window[count];
+        count++;
+    }
+    return count;
+}
+
+bool ScheduleStore::setState(uint16_t slot, uint8_t state)
+{
+    if (!_loaded || slot >= _header.slotCount)
+    {
+        return false;
+    }
+
+    // Find the previous state to keep the pending counter right
+    uint8_t previous = SLOT_PENDING;
+    bool inWindow = false;
+    for (uint8_t i = 0; i < _windowCount; ++i)
+    {
+        if (_window[i].slot == slot)
+        {
+            inWindow = true;
+            if (state != SLOT_PENDING)
+            {
+                memmove(&_window[i], &_window[i + 1], (_windowCount - i - 1) * sizeof(ScheduleSlot));
+                _windowCount--;
+            }
+            break;
+        }
+    }
+    if (!inWindow)
+    {
+        File file = _fs.open(SCHEDULE_STORE_FILENAME, FILE_READ);
+        SlotRecord record;
+        if (!file || !readSlot(file, slot, record) || (record.flags & SLOT_FLAG_REMOVED))
+        {
+            return false;
+        }
+        file.close();
+        previous = overlayState(slot, record.state);
+    }
+
+    if (previous == SLOT_PENDING && state != SLOT_PENDING && _pendingCount > 0)
+    {
+        _pendingCount--;
+    }
+    else if (previous != SLOT_PENDING && state == SLOT_PENDING)
+    {
+        _pendingCount++;
+    }
+    if (previous == SLOT_MISSED && state != SLOT_MISSED && _missedCount > 0)
+    {
+        _missedCount--;
+    }
+    else if (previous != SLOT_MISSED && state == SLOT_MISSED)
+    {
+        _missedCount++;
+    }
+
+    // Record the change for the next flush
+    for (uint8_t i = 0; i < _dirtyCount; ++i)
+    {
+        if (_dirty[i].slot == slot)
+        {
+            _dirty[i].state = state;
+            return true;
+        }
+    }
+    if (_dirtyCount == SCHEDULE_DIRTY_MAX && !flushDirty())
+    {
+        return false;
+    }
+    _dirty[_dirtyCount++] = {slot, state};
+    return true;
+}
+
+// Writes only the state byte of each changed slot
+bool ScheduleStore::flushDirty()
+{
+    if (_dirtyCount == 0)
+    {
+        return true;
+    }
+    if (!_loaded)
+    {
+        _dirtyCount = 0;
+        return true;
+    }
+
+    File file = _fs.open(SCHEDULE_STORE_FILENAME, "r+");
+    if (!file)
+    {
+        LOG_ERROR("Failed to open schedule store for update");
+        return false;
+    }
+    bool ok = true;
+    for (uint8_t i = 0; i < _dirtyCount; ++i)
+    {
+        size_t pos = slotPosition(_header, _dirty[i].slot) + offsetof(SlotRecord, state);
+        if (!file.seek(pos) || file.write(&_dirty[i].state, 1) != 1)
+        {
+            ok = false;
+            break;
+        }
+    }
+    file.close();
+
+    if (ok)
+    {
+        LOG_INFO("Schedule store updated (%u slots)", _dirtyCount);
+        _dirtyCount = 0;
+    }
+    return ok;
+}
+
+// --- Building ---
+
+bool ScheduleStore::beginBuild(uint32_t originalReceiveTime)
+{
+    abortBuild();
+    _buildFile = _fs.open(STORE_TMP, FILE_WRITE);
+    if (!_buildFile)
+    {
+        LOG_ERROR("Failed to open schedule build file");
+        return false;
+    }
+
+    // Generations continue from the schedule being replaced
+    _buildHeader = {STORE_MAGIC, STORE_VERSION, 0, 0, SCHEDULE_MAX_MEDS, originalReceiveTime, 0, _header.generation + 1};
+    memset(_buildMedIds, 0, sizeof(_buildMedIds));
+
+    // Reserve header and med table; both are rewritten on commit
+    bool ok = _buildFile.write((const uint8_t *)&_buildHeader, sizeof(_buildHeader)) == sizeof(_buildHeader);
+    for (uint16_t m = 0; ok && m < SCHEDULE_MAX_MEDS; ++m)
+    {
+        ok = _buildFile.write((const uint8_t *)_buildMedIds[m], SCHEDULE_MED_ID_LEN) == SCHEDULE_MED_ID_LEN;
+    }
+    if (!ok)
+    {
+        abortBuild();
+        return false;
+    }
+    _building = true;
+    return true;
+}
+
+int ScheduleStore::addMed(const char *medId)
+{
+    if (!_building || _buildHeader.medCount >= SCHEDULE_MAX_MEDS)
+    {
+        return -1;
+    }
+    if (strlen(medId) >= SCHEDULE_MED_ID_LEN)
+    {
+        LOG_WARN("med_id '%s' truncated to %d characters.", medId, SCHEDULE_MED_ID_LEN - 1);
+    }
+    strncpy(_buildMedIds[_buildHeader.medCount], medId, SCHEDULE_MED_ID_LEN - 1);
+    return _buildHeader.medCount++;
+}
+
+bool ScheduleStore::addSlot(uint8_t med, uint32_t offsetSec, uint8_t state)
+{
+    if (!_building || med >= _buildHeader.medCount || _buildHeader.slotCount == UINT16_MAX)
+    {
+        return false;
+    }
+    SlotRecord record = {offsetSec, med, state, 0};
+    if (_buildFile.write((const uint8_t *)&record, sizeof(record)) != sizeof(record))
+    {
+        LOG_ERROR("Failed to write slot. Flash full?");
+        return false;
+    }
+    _buildHeader.slotCount++;
+    return true;
+}
+
+// Writes the header and med table; the index is sorted by indexStep()
+bool ScheduleStore::sealBuild()
+{
+    if (!_building)
+    {
+        return false;
+    }
+    _buildHeader.buildId = (uint32_t)micros() ^ ((uint32_t)_buildHeader.slotCount << 16) ^ _buildHeader.originalReceiveTime;
+
+    bool ok = _buildFile.seek(0) &&
+              _buildFile.write((const uint8_t *)&_buildHeader, sizeof(_buildHeader)) == sizeof(_buildHeader) &&
+              _buildFile.write((const uint8_t *)_buildMedIds, sizeof(_buildMedIds)) == sizeof(_buildMedIds);
+    _buildFile.close();
+    _building = false;
+    _sealed = true;
+
+    if (!ok || !openIndex(_indexBuild, STORE_TMP, INDEX_TMP, _buildHeader))
+    {
+        LOG_ERROR("Failed to finalize new schedule.");
+        abortBuild();
+        return false;
+    }
+    return true;
+}
+
+bool ScheduleStore::indexStep()
+{
+    if (!_sealed)
+    {
+        return false;
+    }
+    if (!_indexBuild.done && !indexPass(_indexBuild))
+    {
+        LOG_ERROR("Failed to finalize new schedule.");
+        abortBuild();
+        return false;
+    }
+    return true;
+}
+
+bool ScheduleStore::commitBuild()
+{
+    if (!_building && !_sealed)
+    {
+        return false;
+    }
+    TRACE_SPAN(TRACE_STORE_COMMIT, 0);
+    if (_building && !sealBuild())
+    {
+        return false;
+    }
+    while (!_indexBuild.done)
+    {
+        if (!indexStep())
+        {
+            return false;
+        }
+    }
+    _sealed = false;
+
+    // Any unflushed state belongs to the schedule being replaced
+    _dirtyCount = 0;
+    if (!commitFile(INDEX_TMP, SCHEDULE_INDEX_FILENAME) || !commitFile(STORE_TMP, SCHEDULE_STORE_FILENAME))
+    {
+        return false;
+    }
+    return load();
+}
+
+void ScheduleStore::abortBuild()
+{
+    if (_building)
+    {
+        _buildFile.close();
+        _building = false;
+    }
+    if (_sealed)
+    {
+        closeIndex(_indexBuild);
+        _sealed = false;
+    }
+    if (_fs.exists(STORE_TMP))
+    {
+        _fs.remove(STORE_TMP);
+    }
+    if (_fs.exists(INDEX_TMP))
+    {
+        _fs.remove(INDEX_TMP);
+    }
+}
+
+// --- Patching ---
+
+bool ScheduleStore::beginPatch()
+{
+    if (!_loaded || _building || _patching)
+    {
+        return false;
+    }
+    // Responses recorded so far go to flash first, so the copy carries them
+    if (!flushDirty())
+    {
+        return false;
+    }
+    if (!copyFile(SCHEDULE_STORE_FILENAME, STORE_TMP) || !(_patchFile = _fs.open(STORE_TMP, "r+")))
+    {
+        LOG_ERROR("Failed to copy schedule store for patching");
+        _fs.remove(STORE_TMP);
+        return false;
+    }
+    _patching = true;
+    _patchReorder = false;
+    _patchWrites = 0;
+    return true;
+}
+
+bool ScheduleStore::patchWrite(size_t position, const void *data, size_t len)
+{
+    if (!_patching || !_patchFile.seek(position) || _patchFile.write((const uint8_t *)data, len) != len)
+    {
+        LOG_ERROR("Schedule patch write failed.");
+        return false;
+    }
+    _patchWrites++;
+    return true;
+}
+
+int ScheduleStore::findMed(const char *medId) const
+{
+    for (uint16_t m = 0; m < _header.medCount; ++m)
+    {
+        if (_medIds[m][0] != '\0' && strncmp(_medIds[m], medId, SCHEDULE_MED_ID_LEN - 1) == 0)
+        {
+            return m;
+        }
+    }
+    return -1;
+}
+
+// While patching, searches the copy, so slots added by the patch are found
+int ScheduleStore::findSlot(uint8_t med, uint32_t offsetSec)
+{
+    File file = _patching ? _patchFile : _fs.open(SCHEDULE_STORE_FILENAME, FILE_READ);
+    if (!file)
+    {
+        return -1;
+    }
+    SlotRecord batch[SCAN_BATCH];
+    file.seek(slotPosition(_header, 0));
+    for (uint16_t done = 0; done < _header.slotCount;)
+    {
+        uint16_t n = std::min<uint16_t>(SCAN_BATCH, _header.slotCount - done);
+        if (file.read((uint8_t *)batch, n * sizeof(SlotRecord)) != n * sizeof(SlotRecord))
+        {
+            break;
+        }
+        for (uint16_t i = 0; i < n; ++i)
+        {
+            if (batch[i].med == med && batch[i].offsetSec == offsetSec && !(batch[i].flags & SLOT_FLAG_REMOVED))
+            {
+                if (!_patching)
+                {
+                    file.close();
+                }
+                return done + i;
+            }
+        }
+        done += n;
+    }
+    if (!_patching)
+    {
+        file.close();
+    }
+    return -1;
+}
+
+int ScheduleStore::patchAddMed(const char *medId)
+{
+    if (!_patching || medId[0] == '\0')
+    {
+        return -1;
+    }
+    // Reuse the entry of a removed med (all its slots are tombstones) before growing the table
+    uint16_t med = 0;
+    while (med < _header.medCount && _medIds[med][0] != '\0')
+    {
+        med++;
+    }
+    if (med >= _header.medCapacity)
+    {
+        return -1;
+    }
+
+    char entry[SCHEDULE_MED_ID_LEN] = {};
+    strncpy(entry, medId, SCHEDULE_MED_ID_LEN - 1);
+    if (!patchWrite(sizeof(Header) + med * SCHEDULE_MED_ID_LEN, entry, sizeof(entry)))
+    {
+        return -1;
+    }
+    memcpy(_medIds[med], entry, sizeof(entry));
+    if (med == _header.medCount)
+    {
+        _header.medCount++;
+    }
+    return med;
+}
+
+bool ScheduleStore::patchRemoveMed(uint8_t med)
+{
+    if (!_patching || med >= _header.medCount)
+    {
+        return false;
+    }
+    // Tombstone every live slot of the med in one pass over the store
+    SlotRecord batch[SCAN_BATCH];
+    for (uint16_t done = 0; done < _header.slotCount;)
+    {
+        uint16_t n = std::min<uint16_t>(SCAN_BATCH, _header.slotCount - done);
+        // patchWrite() moves the position, so seek for every batch
+        if (!_patchFile.seek(slotPosition(_header, done)) ||
+            _patchFile.read((uint8_t *)batch, n * sizeof(SlotRecord)) != n * sizeof(SlotRecord))
+        {
+            return false;
+        }
+        for (uint16_t i = 0; i < n; ++i)
+        {
+            if (batch[i].med == med && !(batch[i].flags & SLOT_FLAG_REMOVED) && !patchRemoveSlot(done + i))
+            {
+                return false;
+            }
+        }
+        done += n;
+    }
+
+    char entry[SCHEDULE_MED_ID_LEN] = {};
+    if (!patchWrite(sizeof(Header) + med * SCHEDULE_MED_ID_LEN, entry, sizeof(entry)))
+    {
+        return false;
+    }
+    memset(_medIds[med], 0, SCHEDULE_MED_ID_LEN);
+    return true;
+}
+
+bool ScheduleStore::patchAddSlot(uint8_t med, uint32_t offsetSec)
+{
+    if (!_patching || med >= _header.medCount || _header.slotCount == UINT16_MAX)
+    {
+        return false;
+    }
+    SlotRecord record = {offsetSec, med, SLOT_PENDING, 0};
+    if (!patchWrite(slotPosition(_header, _header.slotCount), &record, sizeof(record)))
+    {
+        return false;
+    }
+    _header.slotCount++;
+    _patchReorder = true;
+    return true;
+}
+
+bool ScheduleStore::patchRemoveSlot(uint16_t slot)
+{
+    if (!_patching || slot >= _header.slotCount)
+    {
+        return false;
+    }
+    uint16_t flags = SLOT_FLAG_REMOVED;
+    return patchWrite(slotPosition(_header, slot) + offsetof(SlotRecord, flags), &flags, sizeof(flags));
+}
+
+bool ScheduleStore::patchSetOffset(uint16_t slot, uint32_t offsetSec)
+{
+    if (!_patching || slot >= _header.slotCount)
+    {
+        return false;
+    }
+    if (!patchWrite(slotPosition(_header, slot) + offsetof(SlotRecord, offsetSec), &offsetSec, sizeof(offsetSec)))
+    {
+        return false;
+    }
+    _patchReorder = true;
+    return true;
+}
+
+// Writes the copy's header, swaps the copy in and reloads. A new buildId
+// makes load() rebuild the index when the due order changed; otherwise the
+// index is kept as is. On failure load() drops the copy (see recoverFile()).
+bool ScheduleStore::commitPatch()
+{
+    if (!_patching)
+    {
+        return false;
+    }
+    TRACE_SPAN(TRACE_STORE_COMMIT, 1);
+    if (_patchReorder)
+    {
+        _header.buildId = (uint32_t)micros() ^ ((uint32_t)_header.slotCount << 16) ^ ~_header.buildId;
+    }
+    _header.generation++;
+    bool ok = patchWrite(0, &_header, sizeof(_header));
+    _patchFile.close();
+    _patching = false;
+    ok = ok && commitFile(STORE_TMP, SCHEDULE_STORE_FILENAME);
+    LOG_INFO("Schedule patch %s (%u writes%s)", ok ? "committed" : "dropped", _patchWrites,
+             ok && _patchReorder ? ", index rebuilt" : "");
+    return load() && ok;
+}
+
+// --- Serialization ---
+
+static size_t printJsonString(Print &out, const char *str)
+{
+    size_t n = out.print('"');
+    for (const char *c = str; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            n += out.print('\\');
+        }
+        n += out.print(*c);
+    }
+    return n + out.print('"');
+}
+
+size_t ScheduleStore::writeJson(Print &out)
+{
+    size_t n = out.print("{\"schedule\":[");
+    File file = _loaded ? _fs.open(SCHEDULE_STORE_FILENAME, FILE_READ) : File();
+
+    bool firstMed = true;
+    for (uint16_t m = 0; file && m < _header.medCount; ++m)
+    {
+        if (_medIds[m][0] == '\0')
+        {
+            continue; // Removed by a patch
+        }
+        n += out.print(firstMed ? "{\"med_id\":" : ",{\"med_id\":");
+        firstMed = false;
+        n += printJsonString(out, _medIds[m]);
+        n += out.print(",\"times\":[");
+
+        // Slots are in upload order, so each med's times come out in the order they arrived
+        bool firstTime = true;
+        SlotRecord batch[SCAN_BATCH];
+        file.seek(slotPosition(_header, 0));
+        for (uint16_t done = 0; done < _header.slotCount;)
+        {
+            uint16_t count = std::min<uint16_t>(SCAN_BATCH, _header.slotCount - done);
+            if (file.read((uint8_t *)batch, count * sizeof(SlotRecord)) != count * sizeof(SlotRecord))
+            {
+                break;
+            }
+            for (uint16_t i = 0; i < count; ++i)
+            {
+                if (batch[i].med != m || (batch[i].flags & SLOT_FLAG_REMOVED))
+                {
+                    continue;
+                }
+                uint8_t state = overlayState(done + i, batch[i].state);
+                n += out.print(firstTime ? "{\"time\":\"" : ",{\"time\":\"");
+                n += out.print(batch[i].offsetSec);
+                n += out.print("\",\"responded\":");
+                n += out.print(state == SLOT_PENDING ? "null" : (state == SLOT_TAKEN ? "true" : "false"));
+                n += out.print('}');
+                firstTime = false;
+            }
+            done += count;
+        }
+        n += out.print("]}");
+    }
+    if (file)
+    {
+        file.close();
+    }
+
+    n += out.print("],\"originalReceiveTime\":");
+    n += out.print(_header.originalReceiveTime);
+    n += out.print('}');
+    return n;
+}
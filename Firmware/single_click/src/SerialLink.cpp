@@ -0,0 +1,178 @@
+#include "SerialLink.h"
+#include "Log.h"
+
+// CRC-16/CCITT-FALSE: poly 0x1021, init 0xFFFF, no reflection
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; ++i)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// --- COBS ---
+// Encodes a frame one byte at a time: _code counts the bytes of the current
+// block, whose length byte is patched in at _codeAt once the block ends.
+struct CobsEncoder
+{
+    explicit CobsEncoder(uint8_t *out) : _out(out) {}
+
+    void put(uint8_t b)
+    {
+        if (b == 0)
+        {
+            endBlock();
+            return;
+        }
+        _out[_length++] = b;
+        if (++_code == 0xFF)
+        {
+            endBlock();
+        }
+    }
+
+    void put(const uint8_t *data, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            put(data[i]);
+        }
+    }
+
+    size_t finish()
+    {
+        _out[_codeAt] = _code;
+        return _length;
+    }
+
+private:
+    void endBlock()
+    {
+        _out[_codeAt] = _code;
+        _codeAt = _length++;
+        _code = 1;
+    }
+
+    uint8_t *_out;
+    size_t _codeAt = 0;
+    size_t _length = 1;
+    uint8_t _code = 1;
+};
+
+// Decodes in place (the output never overtakes the input). Returns the
+// decoded length, or 0 if the block structure is broken.
+static size_t cobsDecode(uint8_t *data, size_t len)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < len)
+    {
+        uint8_t code = data[in++];
+        if (code == 0 || in + code - 1 > len)
+        {
+            return 0;
+        }
+        for (uint8_t i = 1; i < code; ++i)
+        {
+            data[out++] = data[in++];
+        }
+        if (code != 0xFF && in < len)
+        {
+            data[out++] = 0;
+        }
+    }
+    return out;
+}
+
+// --- Link ---
+
+void SerialLink::begin(Stream &port, LinkFrameHandler handler, void *ctx)
+{
+    _port = &port;
+    _handler = handler;
+    _handlerCtx = ctx;
+    _rxLength = 0;
+    _rxOverflow = false;
+}
+
+void SerialLink::poll()
+{
+    if (_port == nullptr)
+    {
+        return;
+    }
+    while (_port->available() > 0)
+    {
+        int c = _port->read();
+        if (c < 0)
+        {
+            break;
+        }
+        if (c == 0)
+        {
+            onDelimiter();
+        }
+        else if (_rxLength < sizeof(_rx))
+        {
+            _rx[_rxLength++] = (uint8_t)c;
+        }
+        else
+        {
+            _rxOverflow = true; // Dropped at the next delimiter
+        }
+    }
+}
+
+void SerialLink::onDelimiter()
+{
+    size_t encoded = _rxLength;
+    bool overflow = _rxOverflow;
+    _rxLength = 0;
+    _rxOverflow = false;
+    if (encoded == 0)
+    {
+        return; // Hosts send a lone delimiter to resynchronise
+    }
+
+    size_t len = overflow ? 0 : cobsDecode(_rx, encoded);
+    if (len < SERIAL_LINK_OVERHEAD ||
+        crc16(0xFFFF, _rx, len - 2) != (uint16_t)(_rx[len - 2] | (_rx[len - 1] << 8)))
+    {
+        _badFrames++;
+        LOG_WARN("Serial link: dropped a bad frame (%u bytes).", (unsigned)encoded);
+        return;
+    }
+    _framesReceived++;
+    if (_handler != nullptr)
+    {
+        _handler(_rx[0], _rx + 1, len - SERIAL_LINK_OVERHEAD, _handlerCtx);
+    }
+}
+
+bool SerialLink::send(uint8_t type, const uint8_t *payload, size_t len)
+{
+    if (_port == nullptr || len > SERIAL_LINK_MAX_PAYLOAD)
+    {
+        return false;
+    }
+    uint16_t crc = crc16(crc16(0xFFFF, &type, 1), payload, len);
+    uint8_t trailer[2] = {(uint8_t)(crc & 0xFF), (uint8_t)(crc >> 8)};
+
+    _tx[0] = 0;
+    CobsEncoder encoder(_tx + 1);
+    encoder.put(type);
+    encoder.put(payload, len);
+    encoder.put(trailer, sizeof(trailer));
+    size_t encoded = 1 + encoder.finish();
+    _tx[encoded++] = 0;
+
+    logger.lockOutput();
+    size_t written = _port->write(_tx, encoded);
+    logger.unlockOutput();
+    return written == encoded;
+}
@@ -0,0 +1,88 @@
+#include "StatusBeacon.h"
+
+#include <string.h>
+
+#define OFFSET_COMPANY 0
+#define OFFSET_VERSION 2
+#define OFFSET_SEQUENCE 3
+#define OFFSET_GENERATION 4
+#define OFFSET_PENDING 6
+#define OFFSET_MISSED 8
+#define OFFSET_RESPONSE_SLOT 10
+#define OFFSET_RESPONSE_STATE 12
+#define OFFSET_BATTERY 13
+#define OFFSET_FLAGS 14
+
+static_assert(OFFSET_FLAGS + 1 == STATUS_BEACON_LEN, "Beacon layout and length disagree");
+
+StatusBeacon::StatusBeacon()
+{
+    memset(_packed, 0, sizeof(_packed));
+    _packed[OFFSET_COMPANY] = STATUS_BEACON_COMPANY_ID & 0xFF;
+    _packed[OFFSET_COMPANY + 1] = STATUS_BEACON_COMPANY_ID >> 8;
+    _packed[OFFSET_VERSION] = STATUS_BEACON_VERSION;
+    _packed[OFFSET_RESPONSE_SLOT] = 0xFF;
+    _packed[OFFSET_RESPONSE_SLOT + 1] = 0xFF;
+    _packed[OFFSET_BATTERY] = 0xFF;
+}
+
+// --- Helpers ---
+
+void StatusBeacon::putU8(size_t offset, uint8_t value)
+{
+    if (_packed[offset] != value)
+    {
+        _packed[offset] = value;
+        _changed = true;
+    }
+}
+
+void StatusBeacon::putU16(size_t offset, uint16_t value)
+{
+    putU8(offset, value & 0xFF);
+    putU8(offset + 1, value >> 8);
+}
+
+// --- Setters ---
+
+void StatusBeacon::setGeneration(uint32_t generation)
+{
+    putU16(OFFSET_GENERATION, (uint16_t)generation);
+}
+
+void StatusBeacon::setPending(uint16_t pending)
+{
+    putU16(OFFSET_PENDING, pending);
+}
+
+void StatusBeacon::setMissed(uint16_t missed)
+{
+    putU16(OFFSET_MISSED, missed);
+}
+
+void StatusBeacon::setLastResponse(uint16_t slot, uint8_t state)
+{
+    putU16(OFFSET_RESPONSE_SLOT, slot);
+    putU8(OFFSET_RESPONSE_STATE, state);
+}
+
+void StatusBeacon::setBattery(uint8_t percent)
+{
+    putU8(OFFSET_BATTERY, percent);
+}
+
+void StatusBeacon::setFlags(uint8_t flags)
+{
+    putU8(OFFSET_FLAGS, flags);
+}
+
+bool StatusBeacon::takeChanged()
+{
+    if (!_changed)
+    {
+        return false;
+    }
+    _changed = false;
+    _packed[OFFSET_SEQUENCE]++;
+    return true;
+}
@@ -0,0 +1,298 @@
+#include "TimerWheel.h"
+#include "Log.h"
+
+#include <string.h>
+
+#define WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_BITS)
+#define LEVEL_SPAN(level) (1UL << LEVEL_SHIFT(level)) // Ticks covered by one slot of a level
+
+static_assert(TIMER_POOL_SIZE <= 127, "Timer links are int8_t");
+
+void TimerWheel::begin(uint32_t nowMs)
+{
+    memset(_timers, 0, sizeof(_timers));
+    memset(_heads, -1, sizeof(_heads));
+    memset(_occupied, 0, sizeof(_occupied));
+    _tick = 0;
+    _tickMs = nowMs;
+    _armed = 0;
+}
+
+int TimerWheel::indexOf(TimerId id) const
+{
+    int index = id & 0xFF;
+    if (id == TIMER_NONE || index >= TIMER_POOL_SIZE)
+    {
+        return -1;
+    }
+    const Timer &t = _timers[index];
+    if (!t.active || t.generation != (id >> 8))
+    {
+        return -1;
+    }
+    return index;
+}
+
+bool TimerWheel::isArmed(TimerId id) const
+{
+    return indexOf(id) >= 0;
+}
+
+// --- Wheel placement ---
+
+void TimerWheel::place(int index)
+{
+    Timer &t = _timers[index];
+    uint32_t delta = t.expires - _tick;
+    if ((int32_t)delta < 0)
+    {
+        // Already late: run on the current tick
+        t.expires = _tick;
+        delta = 0;
+    }
+
+    uint8_t level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(level + 1))
+    {
+        level++;
+    }
+
+    uint8_t slot;
+    if (level == TIMER_WHEEL_LEVELS - 1 && delta >= LEVEL_SPAN(TIMER_WHEEL_LEVELS - 1) * TIMER_WHEEL_SLOTS)
+    {
+        // Beyond the wheel: park in the top slot that cascades last.
+        // It is re-placed with its real expiry when that slot cascades.
+        slot = ((_tick >> LEVEL_SHIFT(level)) - 1) & WHEEL_MASK;
+    }
+    else
+    {
+        slot = (t.expires >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+    }
+
+    t.level = level;
+    t.slot = slot;
+    t.prev = -1;
+    t.next = _heads[level][slot];
+    if (t.next >= 0)
+    {
+        _timers[t.next].prev = index;
+    }
+    _heads[level][slot] = index;
+    _occupied[level] |= (1ULL << slot);
+}
+
+void TimerWheel::unlink(int index)
+{
+    Timer &t = _timers[index];
+    if (t.prev >= 0)
+    {
+        _timers[t.prev].next = t.next;
+    }
+    else
+    {
+        _heads[t.level][t.slot] = t.next;
+    }
+    if (t.next >= 0)
+    {
+        _timers[t.next].prev = t.prev;
+    }
+    if (_heads[t.level][t.slot] < 0)
+    {
+        _occupied[t.level] &= ~(1ULL << t.slot);
+    }
+    t.prev = t.next = -1;
+}
+
+// --- Public API ---
+
+TimerId TimerWheel::schedule(uint32_t delayMs, TimerCallback callback, void *ctx, uint32_t nowMs, uint32_t periodMs)
+{
+    // Catch up first so the delay is measured from nowMs
+    advance(nowMs);
+
+    for (int i = 0; i < TIMER_POOL_SIZE; ++i)
+    {
+        Timer &t = _timers[i];
+        if (t.active)
+        {
+            continue;
+        }
+        // _tick lags nowMs by up to one tick; count the delay from nowMs so timers never fire early
+        uint32_t ticks = ticksFor(delayMs + (nowMs - _tickMs));
+        t.expires = _tick + (ticks > 0 ? ticks : 1);
+        t.periodTicks = ticksFor(periodMs);
+        t.callback = callback;
+        t.ctx = ctx;
+        t.generation = (t.generation == 0xFF) ? 1 : t.generation + 1;
+        t.active = true;
+        place(i);
+        _armed++;
+        return makeId(i, t.generation);
+    }
+    LOG_ERROR("Timer pool exhausted (%u armed).", (unsigned)_armed);
+    return TIMER_NONE;
+}
+
+bool TimerWheel::cancel(TimerId id)
+{
+    int index = indexOf(id);
+    if (index < 0)
+    {
+        return false;
+    }
+    unlink(index);
+    _timers[index].active = false;
+    _armed--;
+    return true;
+}
+
+TimerId TimerWheel::reschedule(TimerId id, uint32_t delayMs, TimerCallback callback, void *ctx, uint32_t nowMs)
+{
+    cancel(id);
+    return schedule(delayMs, callback, ctx, nowMs);
+}
+
+// --- Time keeping ---
+
+void TimerWheel::cascade(uint8_t level)
+{
+    uint8_t slot = (_tick >> LEVEL_SHIFT(level)) & WHEEL_MASK;
+    while (_heads[level][slot] >= 0)
+    {
+        int index = _heads[level][slot];
+        unlink(index);
+        place(index);
+    }
+}
+
+uint16_t TimerWheel::runTick()
+{
+    _tick++;
+
+    // Each time a lower level wraps, pull the next slot of the level above down
+    for (uint8_t level = 0; level < TIMER_WHEEL_LEVELS - 1; ++level)
+    {
+        if (((_tick >> LEVEL_SHIFT(level)) & WHEEL_MASK) != 0)
+        {
+            break;
+        }
+        cascade(level + 1);
+    }
+
+    uint16_t fired = 0;
+    uint8_t slot = _tick & WHEEL_MASK;
+    while (_heads[0][slot] >= 0)
+    {
+        int index = _heads[0][slot];
+        Timer &t = _timers[index];
+        unlink(index);
+
+        if ((int32_t)(t.expires - _tick) > 0)
+        {
+            place(index); // Parked timer that is not due yet
+            continue;
+        }
+
+        TimerCallback callback = t.callback;
+        void *ctx = t.ctx;
+        if (t.periodTicks > 0)
+        {
+            // Re-arm before the callback so it may cancel itself
+            t.expires = _tick + t.periodTicks;
+            place(index);
+        }
+        else
+        {
+            t.active = false;
+            _armed--;
+        }
+        fired++;
+        callback(ctx);
+    }
+    return fired;
+}
+
+uint16_t TimerWheel::advance(uint32_t nowMs)
+{
+    // Unsigned subtraction keeps this correct across millis() rollover
+    uint32_t elapsedTicks = (nowMs - _tickMs) / TIMER_TICK_MS;
+    _tickMs += elapsedTicks * TIMER_TICK_MS;
+    uint32_t target = _tick + elapsedTicks;
+
+    uint16_t fired = 0;
+    while (_tick != target)
+    {
+        if (_armed == 0)
+        {
+            _tick = target;
+            break;
+        }
+
+        // Next tick worth visiting: an occupied level-0 slot in this
+        // revolution, or the wrap where higher levels cascade.
+        uint32_t next = (_tick | WHEEL_MASK) + 1;
+        uint8_t position = _tick & WHEEL_MASK;
+        if (position < WHEEL_MASK)
+        {
+            uint64_t ahead = _occupied[0] & (~0ULL << (position + 1));
+            if (ahead != 0)
+            {
+                next = (_tick & ~(uint32_t)WHEEL_MASK) + __builtin_ctzll(ahead);
+            }
+        }
+
+        if (next - _tick > target - _tick)
+        {
+            _tick = target;
+            break;
+        }
+        _tick = next - 1;
+        fired += runTick();
+    }
+    return fired;
+}
+
+uint32_t TimerWheel::ticksToMs(uint32_t ticks, uint32_t nowMs) const
+{
+    uint32_t sinceTick = nowMs - _tickMs;
+    uint32_t ms = ticks * TIMER_TICK_MS;
+    return ms > sinceTick ? ms - sinceTick : 0;
+}
+
+uint32_t TimerWheel::msUntilNextDeadline(uint32_t nowMs) const
+{
+    if (_armed == 0)
+    {
+        return UINT32_MAX;
+    }
+
+    // The pool is small, so a linear scan is cheaper than tracking the minimum
+    uint32_t best = UINT32_MAX;
+    for (int i = 0; i < TIMER_POOL_SIZE; ++i)
+    {
+        const Timer &t = _timers[i];
+        if (!t.active)
+        {
+            continue;
+        }
+        int32_t ticks = (int32_t)(t.expires - _tick);
+        uint32_t ticksLeft = ticks > 0 ? (uint32_t)ticks : 0;
+        if (ticksLeft < best)
+        {
+            best = ticksLeft;
+        }
+    }
+    return ticksToMs(best, nowMs);
+}
+
+uint32_t TimerWheel::msUntil(TimerId id, uint32_t nowMs) const
+{
+    int index = indexOf(id);
+    if (index < 0)
+    {
+        return UINT32_MAX;
+    }
+    int32_t ticks = (int32_t)(_timers[index].expires - _tick);
+    return ticksToMs(ticks > 0 ? (uint32_t)ticks : 0, nowMs);
+}
@@ -0,0 +1,125 @@
+#include "Trace.h"
+
+#include <esp_timer.h>
+#include <algorithm>
+
+static_assert(sizeof(TraceEvent) == TRACE_EVENT_LEN, "TraceEvent is sent as is");
+static_assert(TRACE_EVENTS <= 0xFFFF, "Ring positions are 16 bit");
+
+Tracer tracer;
+
+// --- Recording ---
+
+// Caller holds _lock
+uint8_t Tracer::taskIndex(TaskHandle_t task)
+{
+    for (uint8_t i = 0; i < _taskCount; ++i)
+    {
+        if (_tasks[i] == task)
+        {
+            return i;
+        }
+    }
+    if (_taskCount == TRACE_MAX_TASKS)
+    {
+        return TRACE_TASK_OTHER;
+    }
+    _tasks[_taskCount] = task;
+    return _taskCount++;
+}
+
+void Tracer::record(uint8_t name, uint8_t phase, uint8_t arg)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    portENTER_CRITICAL(&_lock);
+    if (!_dumping)
+    {
+        TraceEvent &event = _events[(_head + _count) % TRACE_EVENTS];
+        event.us = (uint32_t)esp_timer_get_time();
+        event.name = name;
+        event.phase = phase;
+        event.task = taskIndex(task);
+        event.arg = arg;
+        if (_count < TRACE_EVENTS)
+        {
+            _count++;
+        }
+        else
+        {
+            _head = (_head + 1) % TRACE_EVENTS;
+            _dropped++;
+        }
+    }
+    portEXIT_CRITICAL(&_lock);
+}
+
+// --- Dump ---
+
+bool Tracer::startDump()
+{
+    portENTER_CRITICAL(&_lock);
+    bool started = !_dumping;
+    _dumping = true;
+    portEXIT_CRITICAL(&_lock);
+    if (started)
+    {
+        _tasksSent = 0;
+        _eventsSent = 0;
+    }
+    return started;
+}
+
+// The ring is frozen while _dumping, so it is read without the lock
+size_t Tracer::readFrame(uint8_t *out, size_t room)
+{
+    if (!_dumping || room < 2 + TRACE_TASK_LEN)
+    {
+        return 0;
+    }
+
+    if (_tasksSent < _taskCount)
+    {
+        size_t count = std::min<size_t>((room - 2) / TRACE_TASK_LEN, _taskCount - _tasksSent);
+        out[0] = TRACE_OP_TASKS;
+        out[1] = (uint8_t)count;
+        uint8_t *entry = out + 2;
+        for (size_t i = 0; i < count; ++i, entry += TRACE_TASK_LEN)
+        {
+            uint8_t id = _tasksSent + i;
+            entry[0] = id;
+            memset(entry + 1, 0, TRACE_TASK_NAME_LEN);
+            // The firmware's tasks run forever, so every handle is still valid
+            strncpy((char *)entry + 1, pcTaskGetName(_tasks[id]), TRACE_TASK_NAME_LEN - 1);
+        }
+        _tasksSent += count;
+        return 2 + count * TRACE_TASK_LEN;
+    }
+
+    size_t count = std::min<size_t>((room - 2) / TRACE_EVENT_LEN, _count - _eventsSent);
+    count = std::min<size_t>(count, 0xFF);
+    out[0] = TRACE_OP_EVENTS;
+    out[1] = (uint8_t)count;
+    for (size_t i = 0; i < count; ++i)
+    {
+        // Little endian, like the wire
+        memcpy(out + 2 + i * TRACE_EVENT_LEN, &_events[(_head + _eventsSent + i) % TRACE_EVENTS], TRACE_EVENT_LEN);
+    }
+    _eventsSent += count;
+    if (count == 0)
+    {
+        cancelDump(); // The end marker: start a fresh recording
+    }
+    return 2 + count * TRACE_EVENT_LEN;
+}
+
+void Tracer::cancelDump()
+{
+    portENTER_CRITICAL(&_lock);
+    if (_dumping)
+    {
+        _head = 0;
+        _count = 0;
+        _dumping = false;
+    }
+    portEXIT_CRITICAL(&_lock);
+}
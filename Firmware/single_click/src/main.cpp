@@ -1,11 +1,8 @@
 
 #include <Arduino.h>
 
-// bluetooth related
-#include <BLEDevice.h>
-#include <BLEServer.h>
-#include <BLEUtils.h>
-#include <BLE2902.h>
+// bluetooth related (Bluedroid or NimBLE, see BleTransport.h)
+#include "BleTransport.h"
 
 // srorage related (Optional but recommended for persistence)
 #include "FS.h"
@@ -15,78 +12,297 @@
 #include <ArduinoJson.h>
 
 #include <algorithm> // Needed for std::min
+#include <atomic>
+
+#include <esp_system.h> // esp_reset_reason() for brown-out detection
+
+#include "Persistence.h"
+#include "ScheduleStore.h"
+#include "ScheduleIngest.h"
+#include "ReminderEngine.h"
+#include "Provisioning.h"
+#include "TimerWheel.h"
+#include "Buttons.h"
+#include "BulkTransfer.h"
+#include "Lzss.h"
+#include "DeviceStatus.h"
+#include "StatusBeacon.h"
+#include "EventOutbox.h"
+#include "Log.h"
+#include "SerialLink.h"
+#include "Trace.h"
+#include "RadioPolicy.h"
+#include "BatteryMonitor.h"
+#include "PowerPolicy.h"
+#include "ConnectionStats.h"
+#include "OtaReceiver.h"
+#include "EspOtaTarget.h"
+#include "JsonPool.h"
+#include "StaticQueue.h"
 
 #define FORMAT_LITTLEFS_IF_FAILED true
-#define SCHEDULE_FILENAME "/schedule.json"
-#define MILLIS_COUNTER_FILENAME "/millis_counter.dat" // File to store last millis()
-
-unsigned long lastMillisSaveTime = 0; // Timer for saving millis counter
-
-BLEServer *pServer = NULL;
-BLECharacteristic *pCharacteristic = NULL;
+#define LEGACY_SCHEDULE_FILENAME "/schedule.json" // Pre-store JSON schedule, migrated on boot
+
+// --- Persistence (write-back cache) ---
+// The flush policy settings are in Persistence.h.
+Persistence persistence;
+
+// --- Timer Service ---
+// Every deadline in the firmware (reminders, vibration, response windows,
+// re-reminds, flushes, LED blinks) is a timer in this wheel. The loop sleeps
+// until the earliest one instead of polling each subsystem.
+TimerWheel timers;
+// Every long-lived TimerId handle in this file and the reminder engine may be
+// armed at once. Count new ones here; the build keeps TIMER_HEADROOM entries
+// spare for one-shots.
+#define TIMER_HANDLES (14 + REMINDER_TIMERS)
+#define TIMER_HEADROOM 8
+static_assert(TIMER_POOL_SIZE >= TIMER_HANDLES + TIMER_HEADROOM, "Raise TIMER_POOL_SIZE");
+TimerId ledTimer = TIMER_NONE;          // Ends an LED blink
+TimerId flushTimer = TIMER_NONE;        // Next persistence flush deadline
+TimerId countdownTimer = TIMER_NONE;
+
+// --- Button Input ---
+// Debounced gestures from both buttons arrive on a queue; waiting on it is
+// how the loop sleeps until the next timer deadline.
+Buttons buttons;
+
+BleTransport ble;
+volatile bool splitGattPeer = false; // Peer wrote to the control point or bulk characteristic
 bool deviceConnected = false;
 bool oldDeviceConnected = false;
+volatile uint16_t peerMtu = BLE_DEFAULT_MTU; // ATT MTU of the current connection
+volatile uint8_t sessionCodec = CODEC_NONE; // Negotiated per connection
+
+// --- Radio Policy ---
+// Advertising speed and connection parameters follow what the device is
+// doing (see RadioPolicy.h); a timer wakes the loop when a window ends.
+RadioPolicy radioPolicy(ble);
+TimerId radioTimer = TIMER_NONE;
+
+// --- Power Policy ---
+// The battery tier (see BatteryMonitor.h) sets vibration length and
+// strength, LED blinks, idle advertising and flush batching (PowerPolicy.h).
+BatteryMonitor battery;
+PowerPolicy powerPolicy(radioPolicy, persistence);
+TimerId batteryTimer = TIMER_NONE;
+
+// --- Bonding Settings ---
+// The caregiver's phone bonds once and reconnects encrypted with the stored
+// keys. With BLE_BOND_FILTER only bonded phones can connect outside a
+// pairing window (see BleTransport.h): a PAIR press opens one, a long press
+// forgets every bond first. "CONN_STATS" replies with reconnect timing (see
+// ConnectionStats.h).
+#ifndef PAIRING_WINDOW_MS
+#define PAIRING_WINDOW_MS 120000
+#endif
+#define CONN_STATS_CMD "CONN_STATS"
+ConnectionStats connStats;
+TimerId pairingTimer = TIMER_NONE;
+volatile bool bondsChanged = false; // A new bond: reload the whitelist
 
 // --- BLE Chunking Settings ---
 const size_t BLE_CHUNK_SIZE = 20;
-const int BLE_CHUNK_DELAY_MS = 30; // Delay between sending chunks (adjust as needed)
+const int BLE_CHUNK_DELAY_MS = 30; // SEND_UPDATE sends one chunk per interval
 
 // See the following for generating UUIDs:
 // https://www.uuidgenerator.net/
 
+// --- GATT Layout ---
+// CONTROL_POINT: text commands in, replies notified back
+// BULK_DATA:     schedule uploads and transfer acks in, SEND_UPDATE / XFER frames out
+// STATUS:        DeviceStatus record, read in one ATT read, notified when it changes
+// EVENTS:        EventOutbox events out, their acks in (see EventOutbox.h)
+// CHARACTERISTIC is the original all-in-one characteristic, kept for older
+// apps. Once a peer writes to the control point or bulk characteristic, all
+// replies and streams for that connection go to the new characteristics.
+// The table is built in the same order on every boot, so its handles never
+// change and a bonded phone can keep its discovery cache between
+// connections. New characteristics go after the existing ones.
 #define SERVICE_UUID "4fafc201-1fb5-459e-8fcc-c5c9c331914b"
 #define CHARACTERISTIC_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a8"
-
+#define CONTROL_POINT_UUID "beb5483e-36e1-4688-b7f5-ea07361b26aa"
+#define BULK_DATA_UUID "beb5483e-36e1-4688-b7f5-ea07361b26ab"
+#define STATUS_UUID "beb5483e-36e1-4688-b7f5-ea07361b26ac"
+#define EVENTS_UUID "beb5483e-36e1-4688-b7f5-ea07361b26ad"
+// Read-only: {"hash":"xxxxxxxx","generation":N,"slots":N,"pending":N} of the active schedule
+#define SCHEDULE_INFO_UUID "beb5483e-36e1-4688-b7f5-ea07361b26a9"
+
+// Pins default to the esp32doit-devkit-v1 wiring; other boards set them in platformio.ini
+#ifndef VIBRATION_PIN
 #define VIBRATION_PIN 19
-#define PAIR_PIN 23 // Not used in reminder logic, but kept for consistency
+#endif
+#ifndef PAIR_PIN
+#define PAIR_PIN 23 // Press to open a pairing window, hold to forget bonds first
+#endif
+#ifndef USER_PIN
 #define USER_PIN 34 // Used for responding to reminders
+#endif
+#ifndef LED
 #define LED 2
+#endif
+
+// The motor runs from an LEDC channel so the power policy can lower its duty
+#define VIBRATION_PWM_CHANNEL 0
+#define VIBRATION_PWM_HZ 20000 // Above hearing, so a reduced duty does not whine
+#define VIBRATION_PWM_BITS 8
 
 #define BLINK_DURATION_MS 50 // How long the LED stays on during a blink
 
 // --- Reminder System Settings ---
-#define VIBRATION_DURATION_MS 5000 // How long to vibrate for a reminder
-#define RESPONSE_TIMEOUT_MS 15000  // How long to wait for user input after vibration
+// Timing and coalescing live with the reminder engine (ReminderEngine.h)
+#define COUNTDOWN_PRINT_INTERVAL_MS 1000
+
+// --- Diagnostics ---
+// "LOG_FETCH" streams the binary log history (see Log.h) as
+// LOG_FETCH_OP frames: op u8, count u8, count * LogRecord. A frame with
+// count 0 ends the stream.
+#define LOG_FETCH_CMD "LOG_FETCH"
+#define LOG_FETCH_OP 0xB0
+#define LOG_FETCH_INTERVAL_MS 10
+// "TRACE_DUMP" sends the span trace (see Trace.h) the same way, then starts
+// a fresh one. tools/trace2chrome.py converts it for chrome://tracing / Perfetto.
+#define TRACE_DUMP_CMD "TRACE_DUMP"
+#define TRACE_DUMP_INTERVAL_MS 10
+
+// --- OTA Update Settings ---
+// Firmware images arrive on the bulk characteristic as OtaReceiver frames
+// (0x90-0x93, see OtaReceiver.h; tools/ota_send.py sends them). The BLE task
+// only queues them and the loop writes flash. With the bootloader's rollback
+// enabled a new image boots pending verification and confirms itself after
+// OTA_CONFIRM_AFTER_MS; a reset before that returns to the old image.
+// "OTA_ROLLBACK" boots the previous image on request.
+#define OTA_ROLLBACK_CMD "OTA_ROLLBACK"
+#define OTA_QUEUE_LEN OTA_WINDOW // A whole window of blocks; more are dropped and resent
+#define OTA_FRAME_MAX (OTA_DATA_OVERHEAD + OTA_MAX_BLOCK)
+#define OTA_REBOOT_DELAY_MS 1000 // Lets the last status notification go out
+#ifndef OTA_CONFIRM_AFTER_MS
+#define OTA_CONFIRM_AFTER_MS 60000 // Uptime after which a new image counts as healthy
+#endif
+
+// --- Resumable Transfer Settings ---
+// "XFER_START" snapshots the schedule and sends it as windowed binary frames;
+// "XFER_RESUME <id> <offset>" continues an interrupted transfer. Acks are
+// binary writes (see BulkTransfer.h). SEND_UPDATE keeps the legacy stream.
+#define XFER_START_CMD "XFER_START"
+#define XFER_RESUME_CMD "XFER_RESUME"
+#define XFER_FRAME_INTERVAL_MS 10 // One frame per interval while a transfer runs
+#define XFER_PREFERRED_MTU 247    // Requested ATT MTU; frames follow what the peer negotiates
+#define ATT_NOTIFY_OVERHEAD 3
+#define ADVERTISE_RESTART_DELAY_MS 500 // Let the stack settle after a disconnect
+
+// --- Compression Settings ---
+// "CODEC LZSS" turns on LZSS for the rest of the connection, in both
+// directions: SEND_UPDATE streams and XFER snapshots are compressed, and the
+// app may upload a schedule as COMPRESSED_UPLOAD_MARKER + LZSS stream.
+// "CODEC NONE" turns it off again. The reply names the codec parameters.
+// COMPRESSED_UPLOAD_MARKER and MAX_UPLOAD_BYTES are in Provisioning.h.
+#define CODEC_CMD "CODEC"
+// "LZSS_BENCH" times the codec on this CPU with the stored schedule and
+// replies {"bytes":N,"packed":N,"json_us":N,"encode_us":N,"decode_us":N}.
+// json_us is rendering the JSON alone; encode_us and decode_us are what each
+// codec stage adds to it. It runs from the loop, on either route
+// (tools/provision.py --codec-bench).
+#define LZSS_BENCH_CMD "LZSS_BENCH"
+
+// --- Static Capacity Settings ---
+// Uploads are parsed into a fixed pool instead of the heap, so whether a
+// schedule fits is decided by the build (see JsonPool.h). The values come
+// per env from platformio.ini; the build prints the RAM each subsystem takes.
+#ifndef JSON_POOL_BYTES
+#define JSON_POOL_BYTES 32768 // Parsed upload: about 20 bytes per time sent as a string
+#endif
+
+// --- Event Outbox Settings ---
+// Responses and missed reminders are queued on flash until the app acks
+// them. Subscribing to the events characteristic starts the drain.
+#define OUTBOX_FRAME_INTERVAL_MS 20 // One event per interval while draining
+
+// --- Serial Provisioning ---
+// The settings and the protocol shared with the fleet simulator are in
+// Provisioning.h. CODEC and XFER stay BLE-only.
 
-#define UPDATE_REQUEST_CMD "SEND_UPDATE"
-
-// --- State Machine ---
-enum State
+// -- -Schedule Data-- -
+// The schedule lives on flash; only the next few reminders are held in RAM.
+ScheduleStore scheduleStore(LittleFS);
+JsonPool<JSON_POOL_BYTES> jsonPool; // Every JsonDocument parses into this
+
+// Requests from the BLE task, handled by the loop (timers are loop-only)
+volatile bool blinkRequested = false;   // Blink the LED once
+volatile bool advertiseRequested = false; // Restart advertising after a disconnect
+volatile bool eventsSubscriptionChanged = false; // Peer wrote the events CCCD
+volatile bool logFetchRequested = false;         // Stream the binary log history
+volatile bool traceDumpRequested = false;        // Stream the span trace
+volatile bool otaRebootRequested = false;        // Boot into the other image
+volatile bool lzssBenchRequested = false;        // Time the codec on the schedule
+volatile bool updateRequested = false;           // SEND_UPDATE over BLE
+volatile ReplyRoute lzssBenchRoute = ROUTE_BLE;
+
+enum TransferRequest : uint8_t
 {
-    STATE_IDLE,                // Waiting for a schedule or connection
-    STATE_PROCESSING_SCHEDULE, // Actively checking reminder times
-    STATE_VIBRATING,           // Currently vibrating for a reminder
-    STATE_WAITING_RESPONSE,    // Waiting for user button press after vibration
-    STATE_SENDING_UPDATE       // Preparing/sending updated schedule
+    XFER_REQUEST_NONE,
+    XFER_REQUEST_START,
+    XFER_REQUEST_RESUME,
 };
-State currentState = STATE_IDLE;
-
-// -- -Schedule Data-- -
-// Use JsonDocument for flexibility. Adjust size as needed.
-JsonDocument scheduleDoc; // Increased size for schedule + responses
-bool scheduleLoaded = false;
-unsigned long scheduleReceiveTime = 0; // millis() when schedule was received/loaded
-
-// --- Reminder Tracking ---
-int currentMedIndex = -1;
-int currentTimeIndex = -1;
-unsigned long stateTimer = 0;                // Used for vibration duration and response timeout
-unsigned long nextReminderDueTimeMillis = 0; // Stores the absolute time of the next reminder
-unsigned long lastCountdownPrintMillis = 0;  // Timer for printing countdown
+volatile TransferRequest transferRequest = XFER_REQUEST_NONE;
+volatile uint16_t transferResumeId = 0;
+volatile uint32_t transferResumeOffset = 0;
+
+BulkTransfer transfer(LittleFS);
+DeviceStatus deviceStatus;
+StatusBeacon statusBeacon; // Scan response summary for phones that do not connect
+EventOutbox outbox(LittleFS);
+TimerId outboxTimer = TIMER_NONE;
+TimerId transferTimer = TIMER_NONE;
+TimerId advertiseTimer = TIMER_NONE;
+
+struct OtaFrame
+{
+    uint16_t len;
+    uint8_t data[OTA_FRAME_MAX];
+};
+EspOtaTarget otaTarget(LittleFS);
+OtaReceiver ota(otaTarget);
+StaticQueue<OtaFrame, OTA_QUEUE_LEN> otaQueue; // From the BLE task
+TimerId otaRebootTimer = TIMER_NONE;
+TimerId otaConfirmTimer = TIMER_NONE;
+
+ScheduleIngest ingest(scheduleStore);
+
+// --- Reminders ---
+// The state machine from due reminder to recorded response, the uptime
+// checkpoint and time recovery (see ReminderEngine.h; the fleet simulator
+// runs the same one). The motor, LED, radio and status stay in this file.
+ReminderEngine reminders(LittleFS, scheduleStore, ingest, timers, persistence, outbox);
+
+// --- Upload Inbox and Serial Link ---
+// Every upload goes through the inbox and is ingested by the loop a slice at
+// a time; the serial link speaks the same commands (see Provisioning.h, also
+// run by the fleet simulator). BLE, the codec and patches stay in this file.
+Provisioning provisioning(scheduleStore, ingest, reminders, deviceStatus, outbox, persistence);
 
 // -- -Function Prototypes-- -
 void blinkLed();
 void startVibration();
 void stopVibration();
 bool loadSchedule();
-bool saveSchedule();
-void processSchedule();
+bool migrateLegacySchedule();
+void handleButtonEvent(const ButtonEvent &event);
 void sendUpdate(bool changeStateToIdleOnSuccess = true);
 // void moveToNextReminder(); // No longer needed
-void handleReceivedData(const std::string &data);
-
-bool saveMillisCounter();
-unsigned long loadMillisCounter();
+void handleReceivedData(const char *data, size_t len);
+void updateScheduleInfo();
+void applySchedulePatch(JsonArray ops);
+void handleCodecCommand(const std::string &command);
+void handleCompressedUpload(const std::string &rxValue);
+bool handleCommand(const std::string &rxValue, ReplyRoute route = ROUTE_BLE);
+bool handleBulkWrite(const std::string &rxValue);
+void updateStatus();
+void armOutboxTimer();
+void serviceRadioPolicy();
+void queueOtaFrame(const std::string &rxValue);
+
+void initializePersistence();
 
 // Stream opearator (kept from original)
 template <class T>
@@ -101,758 +317,1524 @@ inline Print &operator<<(Print &obj, float arg)
     obj.print(arg, 4);
     return obj;
 }
-// It preserves the original LED state if it was meant to be ON (connected)
+// Safe to call from any task: the loop toggles the LED and a timer restores
+// it, so nobody blocks for BLINK_DURATION_MS.
 void blinkLed()
 {
-    bool originalState = digitalRead(LED);
-    digitalWrite(LED, !originalState);
-    delay(BLINK_DURATION_MS);
-    digitalWrite(LED, originalState);
+    blinkRequested = true;
+    buttons.wake();
+}
+
+// Restores the LED to its connection state (ON when connected)
+static void onLedRestore(void *)
+{
+    digitalWrite(LED, deviceConnected ? HIGH : LOW);
+}
+
+void serviceBlink()
+{
+    if (!blinkRequested || timers.isArmed(ledTimer))
+    {
+        return;
+    }
+    blinkRequested = false;
+    if (!powerPolicy.profile().blink)
+    {
+        return;
+    }
+    digitalWrite(LED, !digitalRead(LED));
+    ledTimer = timers.schedule(BLINK_DURATION_MS, onLedRestore, nullptr, millis());
 }
 
 void startVibration()
 {
-    Serial.println("Starting Vibration");
-    digitalWrite(VIBRATION_PIN, HIGH);
+    LOG_INFO("Starting Vibration");
+    ledcWrite(VIBRATION_PWM_CHANNEL, powerPolicy.profile().vibrationDuty);
 }
 
 void stopVibration()
 {
-    Serial.println("Stopping Vibration");
-    digitalWrite(VIBRATION_PIN, LOW);
+    LOG_INFO("Stopping Vibration");
+    ledcWrite(VIBRATION_PWM_CHANNEL, 0);
 }
 
-class MyServerCallbacks : public BLEServerCallbacks
+// --- BLE Connection Events (BLE task) ---
+void onBleConnect()
 {
-    void onConnect(BLEServer *pServer)
-    {
-        deviceConnected = true;
-        digitalWrite(LED, HIGH); // LED ON when connected
-        Serial.println("Device Connected");
-        // Optional: Maybe request schedule update on connect?
-        // pCharacteristic->setValue("REQUEST_SCHEDULE");
-        // pCharacteristic->notify();
-    };
+    TRACE_SPAN(TRACE_BLE_CONNECT);
+    deviceConnected = true;
+    digitalWrite(LED, HIGH); // LED ON when connected
+    LOG_INFO("Device Connected");
+    LOG_EVENT(LOG_CODE_CONNECT, 0, 0);
+    connStats.onConnect(millis());
+    // Queued events are pushed as soon as the peer is subscribed
+    eventsSubscriptionChanged = true;
+    buttons.wake();
+}
 
-    void onDisconnect(BLEServer *pServer)
-    {
-        deviceConnected = false;
-        digitalWrite(LED, LOW); // LED OFF when disconnected
-        Serial.println("Device Disconnected - Restarting Advertising");
-        // Reset state if needed when disconnected? Maybe not, allow processing offline.
-        // currentState = STATE_IDLE;
-        // scheduleLoaded = false;
-        delay(500);                  // Give stack time
-        pServer->startAdvertising(); // Restart advertising
-    }
-};
+void onBleDisconnect()
+{
+    TRACE_SPAN(TRACE_BLE_DISCONNECT);
+    deviceConnected = false;
+    peerMtu = BLE_DEFAULT_MTU;
+    sessionCodec = CODEC_NONE;
+    splitGattPeer = false;
+    digitalWrite(LED, LOW); // LED OFF when disconnected
+    LOG_INFO("Device Disconnected - Restarting Advertising");
+    LOG_EVENT(LOG_CODE_DISCONNECT, 0, 0);
+    connStats.onDisconnect(millis());
+    // Reset state if needed when disconnected? Maybe not, allow processing offline.
+    // currentState = STATE_IDLE;
+    // scheduleLoaded = false;
+    // Advertising restarts from a loop timer so the stack callback returns at once
+    advertiseRequested = true;
+    buttons.wake();
+}
 
-class MyCharacteristicCallbacks : public BLECharacteristicCallbacks
+void onBleSecured(bool bonded)
 {
-    void onWrite(BLECharacteristic *pCharacteristic)
+    connStats.onSecured(millis(), bonded);
+    LOG_INFO("Link encrypted (%s)", bonded ? "bonded" : "not bonded");
+    if (bonded)
     {
-        std::string rxValue = pCharacteristic->getValue();
-        if (rxValue.length() > 0)
-        {
-            Serial.println(" ");
-            Serial.print("Received data: ");
-            Serial.println(rxValue.c_str());
-            blinkLed(); // Blink on any receive
-
-            // --- Modification: Check for command first ---
-            if (rxValue == UPDATE_REQUEST_CMD)
-            {
-                Serial.println("Received update request command.");
-                // Attempt to send the update immediately if connected
-                // sendUpdate() already checks for connection and loaded data
-                sendUpdate(false);
-            }
-            else
-            {
-                // If it's not the command, assume it's a new schedule
-                Serial.println("Data is not an update command, treating as new schedule.");
-                handleReceivedData(rxValue);
-            }
-            // --- End Modification ---
-        }
+        bondsChanged = true;
+        buttons.wake();
     }
-};
+}
 
-// --- Function to save the current millis() counter ---
-bool saveMillisCounter()
+void onBleMtuChanged(uint16_t mtu)
 {
-    unsigned long currentMillis = millis();
-    File file = LittleFS.open(MILLIS_COUNTER_FILENAME, FILE_WRITE); // Open for writing (overwrite)
-    if (!file)
-    {
-        Serial.println("Failed to open millis counter file for writing");
-        return false;
-    }
+    TRACE_SPAN(TRACE_BLE_MTU);
+    peerMtu = mtu;
+    LOG_INFO("MTU negotiated: %u", mtu);
+}
 
-    // Write the current millis() value as binary data
-    size_t bytesWritten = file.write((uint8_t *)&currentMillis, sizeof(currentMillis));
-    file.close();
+// Where command replies and bulk streams go for the current peer
+BleChannel replyChannel()
+{
+    return splitGattPeer ? BLE_CHANNEL_CONTROL : BLE_CHANNEL_LEGACY;
+}
 
-    if (bytesWritten == sizeof(currentMillis))
-    {
-        // Serial.printf("Millis counter saved: %lu\n", currentMillis); // Optional: Verbose logging
-        return true;
-    }
-    else
-    {
-        Serial.println("Failed to write millis counter to file.");
-        LittleFS.remove(MILLIS_COUNTER_FILENAME); // Attempt to remove potentially corrupted file
-        return false;
-    }
+BleChannel bulkChannel()
+{
+    return splitGattPeer ? BLE_CHANNEL_BULK : BLE_CHANNEL_LEGACY;
 }
 
-// --- Function to load the last saved millis() counter ---
-unsigned long loadMillisCounter()
+void notifyReply(const char *reply, ReplyRoute route = ROUTE_BLE)
 {
-    if (!LittleFS.exists(MILLIS_COUNTER_FILENAME))
+#if SERIAL_LINK_ENABLED
+    if (route == ROUTE_SERIAL)
     {
-        Serial.println("Millis counter file not found.");
-        return 0; // Return 0 if no previous value exists
+        provisioning.reply(reply);
+        return;
     }
+#endif
+    ble.notify(replyChannel(), (const uint8_t *)reply, strlen(reply));
+}
 
-    File file = LittleFS.open(MILLIS_COUNTER_FILENAME, FILE_READ);
-    if (!file)
+// Handles "CODEC <name>" and tells the app what is now in effect
+void handleCodecCommand(const std::string &command)
+{
+    std::string name = command.size() > strlen(CODEC_CMD) + 1 ? command.substr(strlen(CODEC_CMD) + 1) : "";
+    if (name == "LZSS")
     {
-        Serial.println("Failed to open millis counter file for reading");
-        return 0;
+        sessionCodec = CODEC_LZSS;
     }
-
-    unsigned long loadedMillis = 0;
-    if (file.size() == sizeof(loadedMillis))
+    else if (name == "NONE")
     {
-        size_t bytesRead = file.read((uint8_t *)&loadedMillis, sizeof(loadedMillis));
-        if (bytesRead != sizeof(loadedMillis))
-        {
-            Serial.println("Error reading millis counter file.");
-            loadedMillis = 0; // Treat read error as if file didn't exist
-        }
+        sessionCodec = CODEC_NONE;
     }
     else
     {
-        Serial.println("Millis counter file has incorrect size.");
-        loadedMillis = 0; // Treat size error as if file didn't exist
+        LOG_INFO("Unknown codec '%s', keeping the current one.", name.c_str());
     }
 
-    file.close();
-
-    if (loadedMillis > 0)
+    char reply[32];
+    if (sessionCodec == CODEC_LZSS)
     {
-        Serial.printf("Loaded last known millis: %lu\n", loadedMillis);
+        snprintf(reply, sizeof(reply), "CODEC LZSS %u %u", LZSS_WINDOW_BITS, LZSS_LOOKAHEAD_BITS);
     }
-    return loadedMillis;
+    else
+    {
+        snprintf(reply, sizeof(reply), "CODEC NONE");
+    }
+    LOG_INFO("Session codec: %s", reply);
+    notifyReply(reply);
 }
 
-// --- Schedule Handling Logic ---
-
-void handleReceivedData(const std::string &data)
+// Expands an LZSS schedule upload and hands it to the normal upload path
+void handleCompressedUpload(const std::string &rxValue)
 {
-    Serial.println("Attempting to parse NEW schedule data string...");
-
-    // --- Parse the incoming data string as a temporary array ---
-    JsonDocument tempDoc; // Use a temporary document for the incoming array
-    DeserializationError tempError = deserializeJson(tempDoc, data);
-    if (tempError)
+    if (sessionCodec != CODEC_LZSS)
     {
-        Serial.print(F("Initial parsing of received string failed: "));
-        Serial.println(tempError.f_str());
-        // Don't change state or clear existing valid schedule if parsing fails
+        LOG_ERROR("Compressed upload without a negotiated codec. Ignored.");
         return;
     }
-    if (!tempDoc.is<JsonArray>())
+    if (!provisioning.claimInbox())
     {
-        Serial.println("Error: Received data string is not a JSON array.");
         return;
     }
-    JsonArray receivedArray = tempDoc.as<JsonArray>();
-    // --- End temporary parsing ---
-
-    // --- Prepare the main scheduleDoc with the new structure ---
-    scheduleDoc.clear();                            // Clear previous data
-    JsonObject root = scheduleDoc.to<JsonObject>(); // Make the root an object
-    JsonArray scheduleArray = root.createNestedArray("schedule");
-    if (scheduleArray.isNull())
+    uint32_t startUs = micros();
+    UploadInbox &inbox = provisioning.inbox();
+    LzssDecoder decoder(inbox); // Expands straight into the inbox
+    decoder.write((const uint8_t *)rxValue.data() + 1, rxValue.length() - 1);
+    if (decoder.failed() || inbox.overflowed())
     {
-        Serial.println("Error: Failed to create nested schedule array. Memory full?");
-        scheduleLoaded = false; // Mark as not loaded
-        currentState = STATE_IDLE;
+        LOG_ERROR("Compressed upload is corrupt or too large. Ignored.");
+        provisioning.releaseInbox();
         return;
     }
-    // --- End structure preparation ---
-
-    // --- Populate the new schedule array with structured time objects ---
-    bool structureUpdateSuccess = true;
-    for (JsonObject med_in : receivedArray)
-    { // Iterate the temporary parsed array
-        // Create a corresponding object in the main scheduleDoc's array
-        JsonObject med_out = scheduleArray.createNestedObject();
-        if (med_out.isNull())
-        {
-            Serial.println("Error: Failed to create medication object. Memory full?");
-            structureUpdateSuccess = false;
-            break;
-        }
-        // Copy necessary fields (adjust if you have more fields)
-        med_out["med_id"] = med_in["med_id"]; // Assuming med_id exists
+    LOG_INFO("Compressed upload: %u -> %u bytes in %lu us", (unsigned)(rxValue.length() - 1),
+             (unsigned)inbox.size(), (unsigned long)(micros() - startUs));
+    provisioning.submitInbox(ROUTE_BLE);
+}
 
-        if (med_in.containsKey("times") && med_in["times"].is<JsonArray>())
-        {
-            JsonArray times_in = med_in["times"].as<JsonArray>();
-            JsonArray times_out = med_out.createNestedArray("times");
-            if (times_out.isNull())
-            {
-                Serial.println("Error: Failed to create nested times array. Memory full?");
-                structureUpdateSuccess = false;
-                break;
-            }
+// Counts what a codec stage hands on, so the bench times CPU work only
+class ByteCounter : public Print
+{
+public:
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *buffer, size_t size) override
+    {
+        _bytes += size;
+        return size;
+    }
+    uint32_t bytes() const { return _bytes; }
 
-            for (JsonVariant t_in : times_in)
-            {
-                JsonObject timeObj_out = times_out.createNestedObject();
-                if (timeObj_out.isNull())
-                {
-                    Serial.println("Error: Failed to create nested time object. Memory full?");
-                    structureUpdateSuccess = false;
-                    break;
-                }
-                timeObj_out["time"] = t_in.as<String>(); // Copy time offset
-                timeObj_out["responded"] = nullptr;      // Initialize responded state
-            }
-            if (!structureUpdateSuccess)
-                break;
-        }
-        else
-        {
-            Serial.println("Warning: Medication entry missing 'times' array or invalid format.");
-            // Handle as needed, maybe skip this medication entry
-        }
-    } // --- End populating ---
+private:
+    uint32_t _bytes = 0;
+};
 
-    if (!structureUpdateSuccess)
+// Renders the schedule three times: plain, through the encoder, and through
+// the encoder and decoder, and replies with the difference each stage makes
+void serviceLzssBench()
+{
+    if (!lzssBenchRequested)
     {
-        Serial.println("Failed to build new schedule structure. Aborting.");
-        scheduleLoaded = false;
-        currentState = STATE_IDLE;
-        scheduleDoc.clear(); // Clear potentially corrupted document
+        return;
+    }
+    lzssBenchRequested = false;
+    ReplyRoute route = lzssBenchRoute;
+    if (!reminders.loaded())
+    {
+        notifyReply("LZSS_BENCH NO_SCHEDULE", route);
         return;
     }
 
-    // --- Store the original receive time ---
-    scheduleReceiveTime = millis();                    // Get the current time
-    root["originalReceiveTime"] = scheduleReceiveTime; // Store it in the JSON object
-    // --- End storing time ---
-
-    Serial.println("New schedule processed and structured successfully.");
-    Serial.printf("Original Receive Time recorded: %lu\n", scheduleReceiveTime);
-
-    // --- Debug: Print the modified structure ---
-    Serial.println("--- New Schedule Structure ---");
-    serializeJsonPretty(scheduleDoc, Serial);
-    Serial.println("\n----------------------------");
-
-    scheduleLoaded = true;
-    // Reset indices - processSchedule will find the first one
-    currentMedIndex = -1;
-    currentTimeIndex = -1;
-    currentState = STATE_PROCESSING_SCHEDULE;
-    Serial.println("State changed to STATE_PROCESSING_SCHEDULE");
-
-    // Save the new schedule (with timestamp)
-    if (!saveSchedule())
+    ByteCounter plain;
+    uint32_t startUs = micros();
+    scheduleStore.writeJson(plain);
+    uint32_t jsonUs = micros() - startUs;
+
+    ByteCounter packed;
+    LzssEncoder encoder(packed);
+    startUs = micros();
+    scheduleStore.writeJson(encoder);
+    encoder.finish();
+    uint32_t encodeUs = micros() - startUs;
+
+    ByteCounter unpacked;
+    LzssDecoder decoder(unpacked);
+    LzssEncoder roundTrip(decoder);
+    startUs = micros();
+    scheduleStore.writeJson(roundTrip);
+    roundTrip.finish();
+    uint32_t roundTripUs = micros() - startUs;
+
+    if (decoder.failed() || unpacked.bytes() != plain.bytes())
     {
-        Serial.println("Error saving new schedule!");
-        // Handle error? Maybe revert state?
+        LOG_ERROR("LZSS round trip gave %lu of %lu bytes.", (unsigned long)unpacked.bytes(),
+                  (unsigned long)plain.bytes());
+        notifyReply("LZSS_BENCH FAILED", route);
+        return;
     }
+    char reply[128];
+    snprintf(reply, sizeof(reply), "{\"bytes\":%lu,\"packed\":%lu,\"json_us\":%lu,\"encode_us\":%lu,\"decode_us\":%lu}",
+             (unsigned long)plain.bytes(), (unsigned long)packed.bytes(), (unsigned long)jsonUs,
+             (unsigned long)(encodeUs > jsonUs ? encodeUs - jsonUs : 0),
+             (unsigned long)(roundTripUs > encodeUs ? roundTripUs - encodeUs : 0));
+    LOG_INFO("LZSS bench: %s", reply);
+    notifyReply(reply, route);
 }
 
-// --- MODIFIED processSchedule ---
-// Scans the entire schedule to find the earliest *absolute* time for the next reminder
-void processSchedule()
+// Text commands. Returns false if rxValue is not one. Over the serial link
+// Provisioning answers SEND_UPDATE and SCHEDULE_INFO itself.
+bool handleCommand(const std::string &rxValue, ReplyRoute route)
 {
-    if (!scheduleLoaded || !scheduleDoc.is<JsonObject>() || !scheduleDoc.containsKey("schedule"))
+    if (rxValue == UPDATE_REQUEST_CMD)
     {
-        currentState = STATE_IDLE;
-        return;
+        LOG_INFO("Received update request command.");
+        // The stream reads the store, which only the loop may. sendUpdate()
+        // checks the connection and the loaded data.
+        updateRequested = true;
+        buttons.wake();
     }
-
-    JsonArray scheduleArray = scheduleDoc["schedule"].as<JsonArray>();
-    unsigned long currentTimeMillis = millis();
-
-    // Variables to track the earliest due reminder found in this scan
-    unsigned long earliestDueTimeFound = 0; // Use 0 as initial, check if set later
-    int earliestMedIndexFound = -1;
-    int earliestTimeIndexFound = -1;
-    bool reminderFound = false; // Flag if we found *any* unprocessed reminder
-
-    // Scan ALL medications and ALL times
-    for (int medIdx = 0; medIdx < scheduleArray.size(); ++medIdx)
+    else if (rxValue == SCHEDULE_INFO_CMD)
     {
-        JsonObject currentMed = scheduleArray[medIdx];
-        // Basic validation for the medication entry
-        if (!currentMed || !currentMed.containsKey("times") || !currentMed["times"].is<JsonArray>())
-        {
-            // Serial.printf("Skipping invalid med entry at index %d\n", medIdx); // Optional debug
-            continue; // Skip to next medication
-        }
-
-        JsonArray timesArray = currentMed["times"].as<JsonArray>();
-        for (int timeIdx = 0; timeIdx < timesArray.size(); ++timeIdx)
-        {
-            JsonObject timeObj = timesArray[timeIdx];
-            // Basic validation for the time entry
-            if (!timeObj || !timeObj.containsKey("time") || !timeObj.containsKey("responded"))
-            {
-                // Serial.printf("Skipping invalid time entry at med %d, time %d\n", medIdx, timeIdx); // Optional debug
-                continue; // Skip to next time
-            }
-
-            // Check if this reminder needs processing (responded is null)
-            if (timeObj["responded"].isNull())
-            {
-                // Calculate its absolute due time
-                long reminderOffsetSeconds = timeObj["time"].as<String>().toInt();
-                unsigned long reminderDueTimeMillis = scheduleReceiveTime + (reminderOffsetSeconds * 1000UL);
-
-                // Compare with the earliest found so far
-                if (!reminderFound || reminderDueTimeMillis < earliestDueTimeFound)
-                {
-                    earliestDueTimeFound = reminderDueTimeMillis;
-                    earliestMedIndexFound = medIdx;
-                    earliestTimeIndexFound = timeIdx;
-                    reminderFound = true; // Mark that we found at least one
-                }
-            }
-        } // End loop times
-    } // End loop medications
-
-    // --- After scanning everything ---
-
-    if (reminderFound)
+        char info[96];
+        provisioning.formatScheduleInfo(info, sizeof(info));
+        notifyReply(info, route);
+    }
+    else if (rxValue == CONN_STATS_CMD)
     {
-        // We found at least one unprocessed reminder. Check if the earliest one is due.
-        // Serial.printf("Earliest reminder found: Med %d, Time %d, Due: %lu, Now: %lu\n", // Debug
-        //               earliestMedIndexFound, earliestTimeIndexFound, earliestDueTimeFound, currentTimeMillis);
-
-        if (currentTimeMillis >= earliestDueTimeFound)
+        char stats[192];
+        connStats.format(stats, sizeof(stats), ble.bondCount());
+        notifyReply(stats, route);
+    }
+    else if (rxValue.compare(0, strlen(CODEC_CMD), CODEC_CMD) == 0)
+    {
+        handleCodecCommand(rxValue);
+    }
+    else if (rxValue == LZSS_BENCH_CMD)
+    {
+        lzssBenchRoute = route;
+        lzssBenchRequested = true;
+    }
+    else if (rxValue == LOG_FETCH_CMD)
+    {
+        logFetchRequested = true;
+    }
+    else if (rxValue == TRACE_DUMP_CMD)
+    {
+        traceDumpRequested = true;
+    }
+    else if (rxValue == OTA_ROLLBACK_CMD)
+    {
+        // Refused mid-update; otherwise only the boot selection changes here
+        bool ok = !ota.active() && otaTarget.rollback();
+        notifyReply(ok ? "OTA_ROLLBACK OK" : "OTA_ROLLBACK UNAVAILABLE", route);
+        if (ok)
         {
-            // It's time! Set the global indices for the active reminder
-            currentMedIndex = earliestMedIndexFound;
-            currentTimeIndex = earliestTimeIndexFound;
-
-            // Get details for logging
-            JsonObject med = scheduleArray[currentMedIndex];
-            JsonObject time = med["times"].as<JsonArray>()[currentTimeIndex];
-
-            Serial.printf("Reminder Due! Med ID: %s, Time Offset: %s (Indices: M%d, T%d)\n",
-                          med["med_id"].as<const char *>(),
-                          time["time"].as<const char *>(),
-                          currentMedIndex, currentTimeIndex);
-
-            startVibration();
-            stateTimer = millis(); // Start timer for vibration duration
-            currentState = STATE_VIBRATING;
-            Serial.println("State changed to STATE_VIBRATING");
+            otaRebootRequested = true;
         }
-        // Else: An unprocessed reminder exists, but it's not time yet. Stay in PROCESSING state.
-        nextReminderDueTimeMillis = earliestDueTimeFound; // Store the time for the countdown
     }
-    else
+    else if (rxValue == XFER_START_CMD)
     {
-        nextReminderDueTimeMillis = 0; // Reset when no reminders are pending
-
-        // No unprocessed reminders were found in the entire schedule.
-        Serial.println("All medications processed.");
-        if (deviceConnected)
+        LOG_INFO("Received transfer start command.");
+        transferRequest = XFER_REQUEST_START;
+    }
+    else if (rxValue.compare(0, strlen(XFER_RESUME_CMD), XFER_RESUME_CMD) == 0)
+    {
+        unsigned id = 0;
+        unsigned long offset = 0;
+        if (sscanf(rxValue.c_str() + strlen(XFER_RESUME_CMD), "%u %lu", &id, &offset) == 2)
         {
-            currentState = STATE_SENDING_UPDATE;
-            Serial.println("Processing complete. State changed to STATE_SENDING_UPDATE.");
+            LOG_INFO("Received transfer resume command: id %u at %lu.", id, offset);
+            transferResumeId = id;
+            transferResumeOffset = offset;
+            transferRequest = XFER_REQUEST_RESUME;
         }
         else
         {
-            currentState = STATE_IDLE;
-            Serial.println("Processing complete while disconnected. Update pending. State changed to STATE_IDLE.");
+            LOG_INFO("Malformed resume command, starting a new transfer.");
+            transferRequest = XFER_REQUEST_START;
         }
     }
+    else
+    {
+        return false;
+    }
+    return true;
 }
 
-// --- MODIFIED recordResponse ---
-void recordResponse(bool responded)
+// Binary frames: transfer acks, OTA frames and compressed uploads. Returns false for anything else.
+bool handleBulkWrite(const std::string &rxValue)
 {
-    // Check if indices are valid (should be set by processSchedule before VIBRATING state)
-    if (!scheduleLoaded || !scheduleDoc.is<JsonObject>() || !scheduleDoc.containsKey("schedule") || currentMedIndex < 0 || currentTimeIndex < 0)
+    if (rxValue.length() > 0 && (uint8_t)rxValue[0] == XFER_OP_ACK)
     {
-        Serial.println("Error: Cannot record response, schedule not loaded or indices invalid.");
-        currentState = STATE_IDLE;
-        return;
+        // Transfer acks are frequent and binary: no logging or blinking
+        transfer.onAck((const uint8_t *)rxValue.data(), rxValue.length());
+        return true;
     }
-
-    JsonArray scheduleArray = scheduleDoc["schedule"].as<JsonArray>();
-    // Bounds check just in case
-    if (currentMedIndex >= scheduleArray.size())
+    if (rxValue.length() > 0 && (uint8_t)rxValue[0] >= OTA_OP_BEGIN && (uint8_t)rxValue[0] <= OTA_OP_ABORT)
     {
-        Serial.println("Error: currentMedIndex out of bounds in recordResponse.");
-        currentState = STATE_IDLE;
-        return;
+        queueOtaFrame(rxValue);
+        return true;
     }
-    JsonObject currentMed = scheduleArray[currentMedIndex];
-    if (!currentMed || !currentMed.containsKey("times") || !currentMed["times"].is<JsonArray>())
+    if (rxValue.length() > 1 && (uint8_t)rxValue[0] == COMPRESSED_UPLOAD_MARKER)
     {
-        Serial.println("Error: Invalid med object in recordResponse.");
-        currentState = STATE_IDLE;
-        return;
+        LOG_INFO("Received compressed data (%u bytes)", (unsigned)rxValue.length());
+        blinkLed();
+        handleCompressedUpload(rxValue);
+        buttons.wake();
+        return true;
     }
-    JsonArray timesArray = currentMed["times"].as<JsonArray>();
-    if (currentTimeIndex >= timesArray.size())
+    return false;
+}
+
+// Original all-in-one characteristic: binary frames, commands, or a schedule
+void handleLegacyWrite(const std::string &rxValue)
+{
+    if (handleBulkWrite(rxValue))
     {
-        Serial.println("Error: currentTimeIndex out of bounds in recordResponse.");
-        currentState = STATE_IDLE;
         return;
     }
-    JsonObject timeObj = timesArray[currentTimeIndex];
-    if (!timeObj)
+    if (rxValue.length() > 0)
     {
-        Serial.println("Error: Invalid time object in recordResponse.");
-        currentState = STATE_IDLE;
-        return;
-    }
+        LOG_INFO("Received %u bytes", (unsigned)rxValue.length());
+        LOG_DEBUG("Received data: %s", rxValue.c_str()); // Truncated to LOG_LINE_MAX
+        blinkLed(); // Blink on any receive
 
-    Serial.printf("Recording response for Med %d, Time %d: %s\n", currentMedIndex, currentTimeIndex, responded ? "Yes" : "No");
-    timeObj["responded"] = responded;
-
-    // Save the updated schedule after recording response
-    saveSchedule();
-
-    // *** Save the current millis counter immediately after recording response ***
-    saveMillisCounter();
-
-    // Go back to processing state to find the *next* earliest reminder
-    currentState = STATE_PROCESSING_SCHEDULE;
-    Serial.println("State changed to STATE_PROCESSING_SCHEDULE");
+        // --- Modification: Check for command first ---
+        if (!handleCommand(rxValue))
+        {
+            // If it's not the command, assume it's a new schedule
+            LOG_INFO("Data is not an update command, treating as new schedule.");
+            handleReceivedData(rxValue.data(), rxValue.length());
+        }
+        // --- End Modification ---
+        buttons.wake(); // Let the loop pick up any state change now
+    }
 }
 
-// -- -MODIFIED sendUpdate function signature-- -
-void sendUpdate(bool changeStateToIdleOnSuccess) // Add parameter with default true
+// Control point: commands only
+void handleControlWrite(const std::string &rxValue)
 {
-    // --- Check connection FIRST ---
-    if (!deviceConnected)
+    splitGattPeer = true;
+    LOG_INFO("Control point: %s", rxValue.c_str());
+    blinkLed();
+    if (!handleCommand(rxValue))
     {
-        Serial.println("Cannot send update: Device not connected. Update pending.");
-        // Don't change state here regardless of the parameter, just return.
-        // If called from STATE_SENDING_UPDATE, the state machine loop will handle moving to IDLE.
-        return; // Exit without sending
+        LOG_INFO("Unknown command. Ignored.");
     }
+    buttons.wake();
+}
 
-    // --- Check if data exists ---
-    if (!scheduleLoaded || scheduleDoc.isNull())
+// Bulk data: transfer acks, compressed uploads and plain JSON schedules
+void handleBulkDataWrite(const std::string &rxValue)
+{
+    splitGattPeer = true;
+    if (handleBulkWrite(rxValue) || rxValue.length() == 0)
     {
-        Serial.println("Cannot send update: No schedule data loaded.");
-        // If there's no data, we can safely go idle, regardless of why called.
-        currentState = STATE_IDLE;
         return;
     }
+    LOG_INFO("Received schedule on bulk data (%u bytes)", (unsigned)rxValue.length());
+    blinkLed();
+    handleReceivedData(rxValue.data(), rxValue.length());
+    buttons.wake();
+}
 
-    // --- Proceed with sending ---
-    Serial.println("Serializing updated schedule...");
-    String outputJson;
-    // Use compact serialization for BLE to save space
-    serializeJson(scheduleDoc, outputJson);
-
-    Serial.print("Sending Update (total size ");
-    Serial.print(outputJson.length());
-    Serial.println(" bytes):");
-    // Serial.println(outputJson.c_str()); // Optionally print full JSON for debug
-
-    // --- Chunking Logic ---
-    size_t totalLength = outputJson.length();
-    for (size_t i = 0; i < totalLength; i += BLE_CHUNK_SIZE)
-    {
-        size_t chunkLen = std::min((size_t)BLE_CHUNK_SIZE, totalLength - i);
-        // Use Arduino String's substring method
-        String chunkStr = outputJson.substring(i, i + chunkLen);
-
-        Serial.printf("  Sending chunk %d/%d (%d bytes)\n", //: %s\n", // Optionally print chunk content
-                      (i / BLE_CHUNK_SIZE) + 1,
-                      (totalLength + BLE_CHUNK_SIZE - 1) / BLE_CHUNK_SIZE,
-                      chunkLen
-                      //,chunkStr.c_str() // Uncomment to see chunk content
-        );
-
-        // Set value using uint8_t pointer and length
-        pCharacteristic->setValue((uint8_t *)chunkStr.c_str(), chunkLen);
-        pCharacteristic->notify();
-
-        // IMPORTANT: Delay between chunks
-        delay(BLE_CHUNK_DELAY_MS);
-    }
-    // --- End Chunking Logic ---
-
-    blinkLed(); // Blink once after all chunks are sent
-
-    Serial.println("Update sending process complete.");
-
-    // --- MODIFIED State Change Logic ---
-    if (changeStateToIdleOnSuccess)
+void onBleWrite(BleChannel channel, const std::string &rxValue)
+{
+    TRACE_SPAN(TRACE_BLE_WRITE, channel);
+    radioPolicy.noteBulk(millis()); // The app is exchanging data: keep the interval short
+    if (connStats.onWrite(millis()))
     {
-        currentState = STATE_IDLE;
-        Serial.println("State changed to STATE_IDLE after sending final update.");
+        bool bonded = connStats.bonded();
+        LOG_INFO("First write %lu ms after connecting (%s)", (unsigned long)connStats.lastFirstWriteMs(),
+                 bonded ? "bonded" : "new");
+        LOG_EVENT(LOG_CODE_FIRST_WRITE, bonded ? 1 : 0, connStats.lastFirstWriteMs());
     }
-    else
+    switch (channel)
     {
-        // If called for an intermediate update, just log it and DO NOT change state.
-        Serial.println("Intermediate update sent. State remains unchanged.");
-        // The caller (e.g., the onWrite callback) is responsible for managing the state.
+    case BLE_CHANNEL_LEGACY:
+        handleLegacyWrite(rxValue);
+        break;
+    case BLE_CHANNEL_CONTROL:
+        handleControlWrite(rxValue);
+        break;
+    case BLE_CHANNEL_BULK:
+        handleBulkDataWrite(rxValue);
+        break;
+    case BLE_CHANNEL_EVENTS:
+        // Acks for drained events
+        if (outbox.onAck((const uint8_t *)rxValue.data(), rxValue.length()))
+        {
+            buttons.wake(); // Let the drain move on without waiting for its tick
+        }
+        break;
+    default:
+        break;
     }
-    // --- End MODIFIED State Change Logic ---
 }
 
-// --- LittleFS Functions (Optional but Recommended) ---
-bool initializeFS()
+// Status: times are rendered at read time, everything else is already packed
+void onBleRead(BleChannel channel)
 {
-    if (!LittleFS.begin(FORMAT_LITTLEFS_IF_FAILED))
+    TRACE_SPAN(TRACE_BLE_READ, channel);
+    if (channel == BLE_CHANNEL_STATUS)
     {
-        Serial.println("LittleFS Mount Failed");
-        return false;
+        uint8_t record[DEVICE_STATUS_LEN];
+        deviceStatus.refresh(millis());
+        deviceStatus.copy(record);
+        ble.setValue(BLE_CHANNEL_STATUS, record, sizeof(record));
     }
-    Serial.println("LittleFS Mounted.");
-    return true;
 }
 
-bool saveSchedule()
+// Events: the drain follows the peer's subscription
+void onBleSubscribe(BleChannel channel, bool notifications)
 {
-    // --- Check if data is loaded and is the correct object type ---
-    if (!scheduleLoaded || !scheduleDoc.is<JsonObject>())
+    TRACE_SPAN(TRACE_BLE_SUBSCRIBE, channel);
+    if (channel == BLE_CHANNEL_EVENTS)
     {
-        Serial.println("No valid schedule data (object) to save.");
-        return false;
+        eventsSubscriptionChanged = true;
+        buttons.wake();
     }
-    // --- End check ---
+}
 
-    File file = LittleFS.open(SCHEDULE_FILENAME, FILE_WRITE);
-    if (!file)
+// --- Schedule Identity ---
+// The info characteristic holds Provisioning::formatScheduleInfo()
+void updateScheduleInfo()
+{
+    // Before setup() adds the channel this is a no-op; setup() fills it in
+    char info[96];
+    provisioning.formatScheduleInfo(info, sizeof(info));
+    ble.setValue(BLE_CHANNEL_INFO, (const uint8_t *)info, strlen(info));
+}
+
+// Offsets arrive as strings or numbers. Parsed like String::toInt(), without
+// the heap copy as<String>() makes.
+long jsonOffset(JsonVariantConst value)
+{
+    long offset = 0;
+    if (value.is<const char *>())
     {
-        Serial.println("Failed to open schedule file for writing");
-        return false;
+        offset = atol(value.as<const char *>());
     }
-
-    // Use compact JSON for saving to save space on flash
-    size_t bytesWritten = serializeJson(scheduleDoc, file); // Serialize the whole object
-    file.close();
-
-    if (bytesWritten > 0)
+    else if (value.is<long>())
     {
-        Serial.printf("Schedule saved to %s (%d bytes)\n", SCHEDULE_FILENAME, bytesWritten);
-        return true;
+        offset = value.as<long>();
     }
-    else
+    else if (value.is<float>())
     {
-        Serial.println("Failed to write schedule to file.");
-        // Attempt to delete potentially corrupted file
-        LittleFS.remove(SCHEDULE_FILENAME);
-        return false;
+        offset = (long)value.as<float>();
     }
+    // A negative offset is already due, like a full upload's (see ScheduleIngest::addTime)
+    return offset < 0 ? 0 : offset;
 }
 
-bool loadSchedule()
+// --- Schedule Handling Logic ---
+
+// Queues a schedule or patch upload for the loop (BLE task)
+void handleReceivedData(const char *data, size_t len)
 {
-    if (!LittleFS.exists(SCHEDULE_FILENAME))
+    if (!provisioning.claimInbox())
     {
-        Serial.println("Schedule file not found.");
-        scheduleLoaded = false; // Ensure flag is false
-        return false;
+        return;
     }
-
-    File file = LittleFS.open(SCHEDULE_FILENAME, FILE_READ);
-    if (!file)
+    if (!provisioning.inbox().append((const uint8_t *)data, len))
     {
-        Serial.println("Failed to open schedule file for reading");
-        scheduleLoaded = false; // Ensure flag is false
-        return false;
+        LOG_ERROR("Upload larger than %u bytes. Ignored.", MAX_UPLOAD_BYTES);
+        provisioning.releaseInbox();
+        return;
     }
+    provisioning.submitInbox(ROUTE_BLE);
+}
 
-    scheduleDoc.clear();
-    DeserializationError error = deserializeJson(scheduleDoc, file);
-    file.close();
-
-    if (error)
+// Patches are small: parsed and applied in one step (Provisioning hook)
+static void applyPatchUpload(const char *data, size_t len, void *)
+{
+    JsonDocument tempDoc(&jsonPool);
+    DeserializationError tempError = deserializeJson(tempDoc, data, len);
+    if (tempError.code() == DeserializationError::NoMemory)
     {
-        Serial.print(F("Failed to parse schedule file: "));
-        Serial.println(error.f_str());
-        scheduleLoaded = false; // Ensure flag is false
-        return false;
+        LOG_ERROR("Upload does not fit the %u byte JSON pool. Ignored.", (unsigned)JSON_POOL_BYTES);
+        return;
     }
-
-    // --- Check for new object structure ---
-    if (!scheduleDoc.is<JsonObject>() || !scheduleDoc.containsKey("schedule") || !scheduleDoc["schedule"].is<JsonArray>() || !scheduleDoc.containsKey("originalReceiveTime"))
+    if (tempError)
     {
-        Serial.println("Error: Loaded schedule file has incorrect structure or missing keys (originalReceiveTime).");
-        scheduleDoc.clear();    // Clear invalid data
-        scheduleLoaded = false; // Ensure flag is false
-        return false;
+        LOG_ERROR("Initial parsing of received string failed: %s", tempError.c_str());
+        return;
     }
-    // --- End structure check ---
-
-    // --- Load the original timestamp INTO THE GLOBAL VARIABLE ---
-    // This is the millis() value from the boot *when the schedule was received*
-    scheduleReceiveTime = scheduleDoc["originalReceiveTime"].as<unsigned long>();
-    // --- End loading timestamp ---
-
-    Serial.println("Schedule loaded successfully from LittleFS.");
-    Serial.printf("Original Receive Time (from previous boot): %lu\n", scheduleReceiveTime);
-
-    // --- Debug: Print the loaded structure ---
-    // Serial.println("--- Loaded Schedule Structure ---");
-    // serializeJsonPretty(scheduleDoc, Serial);
-    // Serial.println("\n-----------------------------");
-
-    scheduleLoaded = true;
-    // DO NOT reset scheduleReceiveTime = millis(); here!
-
-    // Reset indices - processSchedule will find the first one
-    currentMedIndex = -1;
-    currentTimeIndex = -1;
-    // State will be set in setup() after potential time adjustment
-    // currentState = STATE_PROCESSING_SCHEDULE;
-    // Serial.println("State changed to STATE_PROCESSING_SCHEDULE");
-    return true;
+    if (!tempDoc["patch"].is<JsonArray>())
+    {
+        LOG_ERROR("Received data string is not a JSON array.");
+        return;
+    }
+    // Small edits go in place and keep every response and the time origin
+    applySchedulePatch(tempDoc["patch"].as<JsonArray>());
 }
 
-//==================== SETUP ====================//
-void setup()
+// The store has swapped in the schedule ingested from the inbox; the
+// reminder engine has taken over its origin and rescans it next pass
+static void onScheduleCommitted(void *)
 {
-    Serial.begin(115200);
-    Serial.println("\nStarting Pipli Reminder Device...");
+    LOG_INFO("New schedule processed and structured successfully.");
+    LOG_INFO("Original Receive Time recorded: %lu", (unsigned long)reminders.receiveTime());
+    LOG_INFO("Slots: %u, Meds: %u, Hash: %08lx, Generation: %lu", scheduleStore.slotCount(), scheduleStore.medCount(),
+             (unsigned long)scheduleStore.contentHash(), (unsigned long)scheduleStore.generation());
+    LOG_EVENT(LOG_CODE_SCHEDULE_UPLOAD, scheduleStore.slotCount(), scheduleStore.contentHash());
+    updateScheduleInfo();
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+    // --- Debug: Print the modified structure ---
+    // Writes the whole schedule straight to the UART, so debug builds only
+    logger.lockOutput();
+    Serial.println("--- New Schedule Structure ---");
+    scheduleStore.writeJson(Serial);
+    Serial.println("\n----------------------------");
+    logger.unlockOutput();
+#endif
+}
 
-    // Initialize LittleFS
-    if (!initializeFS())
+// Applies {"patch":[...]} to the loaded schedule. Each op names a med by
+// med_id; times use the same offsets (string or number) as a full upload:
+//   {"op":"add_med","med_id":"X","times":["3600",...]}
+//   {"op":"remove_med","med_id":"X"}
+//   {"op":"add_time","med_id":"X","time":"7200"}
+//   {"op":"remove_time","med_id":"X","time":"7200"}
+//   {"op":"set_time","med_id":"X","time":"7200","new_time":"9000"}
+// Ops are applied in order; one that fails is skipped and logged.
+void applySchedulePatch(JsonArray ops)
+{
+    if (!reminders.loaded() || !scheduleStore.beginPatch())
     {
-        // Handle FS failure (e.g., loop forever, indicate error)
-        Serial.println("CRITICAL: File System Failed. Halting.");
-        while (1)
-            delay(1000);
+        LOG_ERROR("No schedule loaded to patch. Send a full schedule first.");
+        return;
     }
 
-    pinMode(VIBRATION_PIN, OUTPUT);
-    pinMode(PAIR_PIN, INPUT_PULLDOWN); // Use pulldown/pullup as appropriate
-    pinMode(USER_PIN, INPUT_PULLDOWN); // Use pulldown for response button
-    pinMode(LED, OUTPUT);
-
-    digitalWrite(VIBRATION_PIN, LOW); // Ensure vibration is off
-    digitalWrite(LED, LOW);           // Ensure LED is off
-
-    // --- Load existing schedule AND Adjust Time ---
-    unsigned long originalScheduleReceiveTime = 0;
-    bool scheduleIsValid = loadSchedule(); // Loads schedule, sets scheduleLoaded, sets global scheduleReceiveTime
-
-    if (scheduleIsValid)
+    uint16_t applied = 0;
+    uint16_t index = 0;
+    for (JsonObject op : ops)
     {
-        originalScheduleReceiveTime = scheduleReceiveTime; // Keep the original value loaded from file
-
-        unsigned long lastKnownMillis = loadMillisCounter(); // Load millis() saved just before last shutdown
-        unsigned long timePassedBeforeShutdown = 0;
+        const char *name = op["op"] | "";
+        const char *medId = op["med_id"] | "";
+        long time = jsonOffset(op["time"]);
+        int med = scheduleStore.findMed(medId);
+        bool ok = false;
 
-        // --- Sanity Checks for Time Adjustment ---
-        // Only adjust if both the original time and the last counter seem valid (non-zero)
-        if (lastKnownMillis > 0 && originalScheduleReceiveTime > 0)
+        if (strcmp(name, "add_med") == 0)
         {
-            // Calculate time elapsed *relative to the schedule's origin* before shutdown
-            if (lastKnownMillis >= originalScheduleReceiveTime)
+            if (med < 0)
             {
-                // Normal case or rollover where lastKnownMillis wrapped PAST originalReceiveTime
-                timePassedBeforeShutdown = lastKnownMillis - originalScheduleReceiveTime;
+                med = scheduleStore.patchAddMed(medId);
             }
-            else
+            ok = med >= 0;
+            for (JsonVariant t_in : op["times"].as<JsonArray>())
             {
-                // Potential rollover case OR stale counter file from a previous schedule.
-                // The rollover calculation is complex to verify without more state.
-                // A very simple heuristic: if lastKnownMillis is "small" and original is "large",
-                // assume it's a stale counter file from before the current schedule was received.
-                // Let's treat this cautiously and assume NO time passed relative to *this* schedule yet.
-                // A more advanced check could compare against ULONG_MAX, but this is safer for now.
-                Serial.println("Warning: lastKnownMillis < originalScheduleReceiveTime. Assuming stale counter or recent schedule receipt. Resetting elapsed time.");
-                timePassedBeforeShutdown = 0;
-                // // If you are SURE the device runs long enough for rollover (>49 days):
-                // timePassedBeforeShutdown = (ULONG_MAX - originalScheduleReceiveTime) + 1 + lastKnownMillis;
+                long offsetSeconds = jsonOffset(t_in);
+                ok = ok && scheduleStore.patchAddSlot(med, (uint32_t)offsetSeconds);
             }
-            Serial.printf("Time passed before shutdown (relative to schedule): %lu ms\n", timePassedBeforeShutdown);
+        }
+        else if (strcmp(name, "remove_med") == 0)
+        {
+            ok = med >= 0 && scheduleStore.patchRemoveMed(med);
+        }
+        else if (strcmp(name, "add_time") == 0)
+        {
+            ok = med >= 0 && scheduleStore.patchAddSlot(med, (uint32_t)time);
+        }
+        else if (strcmp(name, "remove_time") == 0)
+        {
+            int slot = med >= 0 ? scheduleStore.findSlot(med, (uint32_t)time) : -1;
+            ok = slot >= 0 && scheduleStore.patchRemoveSlot(slot);
+        }
+        else if (strcmp(name, "set_time") == 0)
+        {
+            long newTime = jsonOffset(op["new_time"]);
+            int slot = med >= 0 ? scheduleStore.findSlot(med, (uint32_t)time) : -1;
+            ok = slot >= 0 && scheduleStore.patchSetOffset(slot, (uint32_t)newTime);
+        }
+
+        if (ok)
+        {
+            applied++;
         }
         else
         {
-            Serial.println("Could not determine time passed before shutdown (invalid counter or schedule time).");
-            timePassedBeforeShutdown = 0; // Default to no time passed if data is missing/invalid
+            LOG_WARN("Patch op %u (%s %s) failed, skipped.", index, name, medId);
+        }
+        index++;
+    }
+
+    if (!scheduleStore.commitPatch())
+    {
+        LOG_ERROR("Failed to reload schedule after patch.");
+        reminders.unload();
+        return;
+    }
+    LOG_INFO("Applied %u of %u patch ops. Slots: %u, pending: %u",
+             applied, index, scheduleStore.slotCount(), scheduleStore.pendingCount());
+    updateScheduleInfo();
+
+    // The active reminder may have moved or gone; rescan (responses and origin are unchanged)
+    reminders.reschedule();
+}
+
+// --- Timer Callbacks ---
+static void onCountdown(void *)
+{
+    reminders.countdown();
+}
+
+// Samples the cell between alerts (the motor drags it down) and moves the
+// power policy with the tier. Dropping a tier tells the app; reaching
+// critical writes everything pending now, before the longer flush delays.
+static void onBatterySample(void *)
+{
+    if (reminders.state() == STATE_VIBRATING)
+    {
+        return;
+    }
+    BatteryTier previous = battery.tier();
+    if (battery.sample())
+    {
+        powerPolicy.apply(battery.tier());
+        LOG_EVENT(LOG_CODE_BATTERY_TIER, battery.tier(), battery.millivolts());
+        if (battery.tier() > previous)
+        {
+            reminders.queueEvent(EVENT_LOW_BATTERY, battery.percent(), 0, 0);
+            persistence.markDirty(PERSIST_OUTBOX, millis());
+        }
+        if (battery.tier() == BATTERY_CRITICAL)
+        {
+            persistence.onPowerWarning();
+        }
+    }
+    deviceStatus.setBattery(battery.percent());
+    statusBeacon.setBattery(battery.percent());
+}
+
+static void onFlushDue(void *)
+{
+    persistence.flushIfDue(millis());
+}
+
+// Keeps flushTimer on the persistence policy's deadline. Marks can come
+// from the BLE task, so the loop re-checks this every iteration.
+void armFlushTimer()
+{
+    unsigned long now = millis();
+    uint32_t wait = persistence.msUntilFlush(now);
+    if (wait == UINT32_MAX)
+    {
+        return; // Nothing dirty
+    }
+    if (!timers.isArmed(flushTimer) || timers.msUntil(flushTimer, now) > wait)
+    {
+        flushTimer = timers.reschedule(flushTimer, wait, onFlushDue, nullptr, now);
+    }
+}
+
+// --- Reminder Hooks ---
+// What the reminder engine does to this device
+
+// Vibrates for the battery tier's on-time
+static uint32_t onReminderAlert(bool, void *)
+{
+    radioPolicy.boost(millis()); // The user may reach for the phone now
+    startVibration();
+    return powerPolicy.profile().vibrationMs;
+}
+
+static void onReminderSilence(void *)
+{
+    stopVibration();
+}
+
+static void onReminderAnswered(const ScheduleSlot &last, uint8_t, bool taken, void *)
+{
+    deviceStatus.setLastResponse(last.slot, taken ? SLOT_TAKEN : SLOT_MISSED, millis());
+    statusBeacon.setLastResponse(last.slot, taken ? SLOT_TAKEN : SLOT_MISSED);
+    updateScheduleInfo(); // Pending count changed
+}
+
+// Responses, missed reminders and low battery alike wait in the outbox
+static void onEventQueued(void *)
+{
+    armOutboxTimer();
+    radioPolicy.boost(millis()); // Let the app find the device and collect it
+}
+
+// A finished schedule goes straight to a connected app
+static bool isPeerConnected(void *)
+{
+    return deviceConnected;
+}
+// --- Update Stream ---
+// SEND_UPDATE over BLE is loop-only: the schedule (compressed when the
+// session negotiated LZSS) is rendered into a flash snapshot in one go, then
+// a timer notifies one BLE_CHUNK_SIZE chunk every BLE_CHUNK_DELAY_MS. The
+// store is never read from the BLE task, and nobody waits between chunks.
+#define UPDATE_SNAPSHOT_FILENAME "/update.bin"
+File updateFile;
+TimerId updateTimer = TIMER_NONE;
+uint32_t updateBytes = 0;
+uint32_t updateChunks = 0;
+
+static void stopUpdateStream()
+{
+    timers.cancel(updateTimer);
+    updateTimer = TIMER_NONE;
+    updateFile.close();
+    LittleFS.remove(UPDATE_SNAPSHOT_FILENAME);
+}
+
+static void onUpdateTick(void *)
+{
+    TRACE_SPAN(TRACE_SEND_CHUNK);
+    uint8_t chunk[BLE_CHUNK_SIZE];
+    size_t len = deviceConnected ? updateFile.read(chunk, sizeof(chunk)) : 0;
+    if (len > 0)
+    {
+        LOG_DEBUG("Sending chunk %u (%u bytes)", (unsigned)(updateChunks + 1), (unsigned)len);
+        ble.notify(bulkChannel(), chunk, len);
+        updateChunks++;
+        updateBytes += len;
+        radioPolicy.noteBulk(millis());
+        return;
+    }
+    stopUpdateStream();
+    LOG_INFO("Sent %lu bytes in %lu chunks.", (unsigned long)updateBytes, (unsigned long)updateChunks);
+    blinkLed(); // Blink once after all chunks are sent
+}
+
+// Renders the snapshot and starts the chunk timer. False if it could not.
+static bool startUpdateStream()
+{
+    stopUpdateStream(); // A new request restarts the stream from the current schedule
+    File file = LittleFS.open(UPDATE_SNAPSHOT_FILENAME, FILE_WRITE);
+    if (!file)
+    {
+        LOG_ERROR("Failed to open the update snapshot.");
+        return false;
+    }
+    uint32_t startUs = micros();
+    size_t rendered;
+    if (sessionCodec == CODEC_LZSS)
+    {
+        LzssEncoder encoder(file);
+        scheduleStore.writeJson(encoder);
+        encoder.finish();
+        rendered = encoder.bytesOut();
+        LOG_INFO("Compressed %lu -> %lu bytes in %lu us.", (unsigned long)encoder.bytesIn(),
+                 (unsigned long)encoder.bytesOut(), (unsigned long)(micros() - startUs));
+    }
+    else
+    {
+        rendered = scheduleStore.writeJson(file);
+    }
+    bool ok = file.size() == rendered;
+    file.close();
+    updateFile = LittleFS.open(UPDATE_SNAPSHOT_FILENAME, FILE_READ);
+    if (!ok || !updateFile)
+    {
+        LOG_ERROR("Failed to write the update snapshot. Flash full?");
+        stopUpdateStream();
+        return false;
+    }
+    updateBytes = 0;
+    updateChunks = 0;
+    updateTimer = timers.schedule(BLE_CHUNK_DELAY_MS, onUpdateTick, nullptr, millis(), BLE_CHUNK_DELAY_MS);
+    radioPolicy.noteBulk(millis());
+    return updateTimer != TIMER_NONE;
+}
+
+// Loop only: a BLE request sets updateRequested (see handleCommand)
+void sendUpdate(bool changeStateToIdleOnSuccess)
+{
+    // --- Check connection FIRST ---
+    if (!deviceConnected)
+    {
+        LOG_INFO("Cannot send update: Device not connected. Update pending.");
+        // Don't change state here regardless of the parameter, just return.
+        // If called from STATE_SENDING_UPDATE, the state machine loop will handle moving to IDLE.
+        return; // Exit without sending
+    }
+
+    // --- Check if data exists ---
+    if (!reminders.loaded())
+    {
+        LOG_INFO("Cannot send update: No schedule data loaded.");
+        // If there's no data, we can safely go idle, regardless of why called.
+        reminders.setState(STATE_IDLE);
+        return;
+    }
+
+    // --- Proceed with sending ---
+    TRACE_SPAN(TRACE_SEND_UPDATE, ROUTE_BLE);
+    LOG_INFO("Sending Update:");
+    if (!startUpdateStream())
+    {
+        return;
+    }
+
+    LOG_INFO("Update sending process started.");
+
+    // --- MODIFIED State Change Logic ---
+    if (changeStateToIdleOnSuccess)
+    {
+        reminders.setState(STATE_IDLE);
+        LOG_DEBUG("State changed to STATE_IDLE after starting the final update.");
+    }
+    else
+    {
+        // If called for an intermediate update, just log it and DO NOT change state.
+        LOG_INFO("Intermediate update started. State remains unchanged.");
+        // The caller (e.g., the onWrite callback) is responsible for managing the state.
+    }
+    // --- End MODIFIED State Change Logic ---
+}
+
+// --- LittleFS Functions (Optional but Recommended) ---
+bool initializeFS()
+{
+    if (!LittleFS.begin(FORMAT_LITTLEFS_IF_FAILED))
+    {
+        LOG_ERROR("LittleFS Mount Failed");
+        return false;
+    }
+    LOG_INFO("LittleFS Mounted.");
+    return true;
+}
+
+// --- Persistence Regions ---
+// The reminder engine registers the schedule and the uptime checkpoint
+static bool writeOutboxRegion(void *)
+{
+    return outbox.save();
+}
+
+void initializePersistence()
+{
+    FlushPolicy policy = {FLUSH_MAX_LATENCY_MS, FLUSH_MAX_DIRTY_COUNT, true};
+
+    // After a brown-out reset the supply is marginal: write every change
+    // straight away instead of holding it in RAM.
+    if (esp_reset_reason() == ESP_RST_BROWNOUT)
+    {
+        LOG_WARN("Last reset was a brown-out. Flushing every change immediately.");
+        policy.maxDirtyCount = 1;
+    }
+
+    persistence.begin(policy);
+    persistence.registerRegion(PERSIST_OUTBOX, writeOutboxRegion);
+}
+
+// Opens the stored schedule; the reminder engine recovers its clock
+bool loadSchedule()
+{
+    if (!scheduleStore.load())
+    {
+        // Older firmware kept the whole schedule as one JSON file
+        if (!LittleFS.exists(LEGACY_SCHEDULE_FILENAME) || !migrateLegacySchedule())
+        {
+            LOG_INFO("Schedule store not found.");
+            return false;
+        }
+    }
+
+    LOG_INFO("Schedule loaded successfully from LittleFS.");
+    LOG_INFO("Slots: %u, Pending: %u", scheduleStore.slotCount(), scheduleStore.pendingCount());
+    LOG_EVENT(LOG_CODE_SCHEDULE_LOADED, scheduleStore.slotCount(), scheduleStore.contentHash());
+    return true;
+}
+
+// Converts a /schedule.json written by older firmware into the store,
+// keeping recorded responses, then removes the JSON file.
+bool migrateLegacySchedule()
+{
+    LOG_INFO("Migrating legacy JSON schedule to schedule store...");
+
+    File file = LittleFS.open(LEGACY_SCHEDULE_FILENAME, FILE_READ);
+    if (!file)
+    {
+        LOG_ERROR("Failed to open legacy schedule file for reading");
+        return false;
+    }
+    JsonDocument legacyDoc(&jsonPool);
+    DeserializationError error = deserializeJson(legacyDoc, file);
+    file.close();
+
+    if (error || !legacyDoc["schedule"].is<JsonArray>() || !legacyDoc.containsKey("originalReceiveTime"))
+    {
+        LOG_ERROR("Legacy schedule file is invalid, removing it.");
+        LittleFS.remove(LEGACY_SCHEDULE_FILENAME);
+        return false;
+    }
+
+    bool ok = scheduleStore.beginBuild(legacyDoc["originalReceiveTime"].as<unsigned long>());
+    for (JsonObject medObj : legacyDoc["schedule"].as<JsonArray>())
+    {
+        if (!ok)
+            break;
+        int med = scheduleStore.addMed(medObj["med_id"] | "");
+        ok = med >= 0;
+        for (JsonObject timeObj : medObj["times"].as<JsonArray>())
+        {
+            if (!ok)
+                break;
+            uint8_t state = timeObj["responded"].isNull() ? SLOT_PENDING : (timeObj["responded"].as<bool>() ? SLOT_TAKEN : SLOT_MISSED);
+            ok = scheduleStore.addSlot(med, (uint32_t)jsonOffset(timeObj["time"]), state);
+        }
+    }
+
+    if (!ok || !scheduleStore.commitBuild())
+    {
+        LOG_ERROR("Failed to migrate legacy schedule.");
+        scheduleStore.abortBuild();
+        return false;
+    }
+    LittleFS.remove(LEGACY_SCHEDULE_FILENAME);
+    LOG_INFO("Legacy schedule migrated.");
+    return true;
+}
+
+// --- Resumable Transfer ---
+static bool sendTransferFrame(const uint8_t *data, size_t len, void *)
+{
+    return deviceConnected && ble.notify(bulkChannel(), data, len);
+}
+
+static size_t writeScheduleSnapshot(Print &out, void *)
+{
+    return scheduleStore.writeJson(out);
+}
+
+static void onTransferTick(void *)
+{
+    transfer.service(millis());
+    if (!transfer.active())
+    {
+        timers.cancel(transferTimer);
+        transferTimer = TIMER_NONE;
+    }
+    if (transfer.takeCompleted())
+    {
+        blinkLed(); // Same cue as a finished legacy update
+    }
+}
+
+static void onAdvertiseRestart(void *)
+{
+    if (!deviceConnected)
+    {
+        ble.startAdvertising();
+    }
+}
+
+// --- Pairing ---
+// Without a bond pairing stays open, so closing the window only takes
+// effect once a phone has bonded.
+static void onPairingWindowEnd(void *)
+{
+    pairingTimer = TIMER_NONE;
+    ble.setPairing(false);
+    LOG_INFO("Pairing window closed (%u bonds)", ble.bondCount());
+}
+
+void openPairingWindow()
+{
+    ble.setPairing(true);
+    pairingTimer = timers.reschedule(pairingTimer, PAIRING_WINDOW_MS, onPairingWindowEnd, nullptr, millis());
+    LOG_INFO("Pairing window open for %lu s", (unsigned long)(PAIRING_WINDOW_MS / 1000));
+}
+
+// A new bond goes into the whitelist unless a pairing window still runs
+void serviceBonds()
+{
+    if (!bondsChanged)
+    {
+        return;
+    }
+    bondsChanged = false;
+    if (!timers.isArmed(pairingTimer))
+    {
+        ble.setPairing(false);
+    }
+}
+
+// Starts or resumes a transfer requested over BLE. Chunks fill one
+// notification at the negotiated MTU.
+void serviceTransferRequest()
+{
+    TransferRequest request = transferRequest;
+    if (request == XFER_REQUEST_NONE)
+    {
+        return;
+    }
+    transferRequest = XFER_REQUEST_NONE;
+
+    uint16_t mtu = peerMtu;
+    uint16_t chunkSize = mtu > ATT_NOTIFY_OVERHEAD + XFER_DATA_OVERHEAD ? mtu - ATT_NOTIFY_OVERHEAD - XFER_DATA_OVERHEAD : 1;
+    bool started = false;
+    if (request == XFER_REQUEST_RESUME)
+    {
+        started = transfer.resume(transferResumeId, transferResumeOffset, chunkSize);
+        if (!started)
+        {
+            LOG_INFO("Transfer to resume is gone, starting a new one.");
+        }
+    }
+    if (!started)
+    {
+        if (!reminders.loaded())
+        {
+            LOG_INFO("No schedule loaded, nothing to transfer.");
+            return;
+        }
+        started = transfer.start(writeScheduleSnapshot, nullptr, chunkSize, sessionCodec);
+    }
+    if (started && !timers.isArmed(transferTimer))
+    {
+        transferTimer = timers.schedule(XFER_FRAME_INTERVAL_MS, onTransferTick, nullptr, millis(), XFER_FRAME_INTERVAL_MS);
+    }
+}
+
+// --- Event Outbox ---
+static bool sendEventFrame(const uint8_t *data, size_t len, void *)
+{
+    return deviceConnected && ble.notify(BLE_CHANNEL_EVENTS, data, len);
+}
+
+static void onOutboxTick(void *)
+{
+    if (outbox.service(millis()))
+    {
+        persistence.markDirty(PERSIST_OUTBOX, millis());
+    }
+    if (!outbox.draining() || outbox.count() == 0)
+    {
+        timers.cancel(outboxTimer);
+        outboxTimer = TIMER_NONE;
+    }
+}
+
+void armOutboxTimer()
+{
+    if (outbox.draining() && outbox.count() > 0 && !timers.isArmed(outboxTimer))
+    {
+        outboxTimer = timers.schedule(OUTBOX_FRAME_INTERVAL_MS, onOutboxTick, nullptr, millis(), OUTBOX_FRAME_INTERVAL_MS);
+    }
+}
+
+// Starts draining when the peer subscribes to events, stops when it unsubscribes
+void serviceEventsSubscription()
+{
+    if (!eventsSubscriptionChanged)
+    {
+        return;
+    }
+    eventsSubscriptionChanged = false;
+    if (deviceConnected && ble.subscribed(BLE_CHANNEL_EVENTS))
+    {
+        outbox.startDrain(millis());
+        armOutboxTimer();
+    }
+    else
+    {
+        outbox.stopDrain();
+    }
+}
+
+// --- Log Fetch ---
+// Snapshot of the binary log taken when LOG_FETCH arrives, sent one frame per tick
+LogRecord logFetchRecords[LOG_HISTORY_RECORDS];
+size_t logFetchCount = 0;
+size_t logFetchSent = 0;
+TimerId logFetchTimer = TIMER_NONE;
+
+static void onLogFetchTick(void *)
+{
+    uint8_t frame[2 + XFER_MAX_CHUNK];
+    uint16_t mtu = peerMtu;
+    size_t room = std::min<size_t>(sizeof(frame), mtu > ATT_NOTIFY_OVERHEAD ? mtu - ATT_NOTIFY_OVERHEAD : 0);
+    size_t perFrame = room > 2 + LOG_RECORD_LEN ? (room - 2) / LOG_RECORD_LEN : 1;
+    size_t count = std::min(perFrame, logFetchCount - logFetchSent);
+
+    frame[0] = LOG_FETCH_OP;
+    frame[1] = (uint8_t)count;
+    memcpy(frame + 2, logFetchRecords + logFetchSent, count * LOG_RECORD_LEN); // Little endian, like the wire
+    if (!deviceConnected || !ble.notify(bulkChannel(), frame, 2 + count * LOG_RECORD_LEN) || count == 0)
+    {
+        timers.cancel(logFetchTimer); // Done (count 0 was the end marker) or peer gone
+        logFetchTimer = TIMER_NONE;
+        return;
+    }
+    logFetchSent += count;
+}
+
+void serviceLogFetchRequest()
+{
+    if (!logFetchRequested)
+    {
+        return;
+    }
+    logFetchRequested = false;
+    logFetchCount = logger.copyRecords(logFetchRecords, LOG_HISTORY_RECORDS);
+    logFetchSent = 0;
+    LOG_INFO("Sending %u log records.", (unsigned)logFetchCount);
+    timers.cancel(logFetchTimer);
+    logFetchTimer = timers.schedule(LOG_FETCH_INTERVAL_MS, onLogFetchTick, nullptr, millis(), LOG_FETCH_INTERVAL_MS);
+}
+
+// --- Trace Dump ---
+// The tracer stops recording while it hands out its frames, one per tick
+TimerId traceDumpTimer = TIMER_NONE;
+
+static void stopTraceDump()
+{
+    tracer.cancelDump();
+    timers.cancel(traceDumpTimer);
+    traceDumpTimer = TIMER_NONE;
+}
+
+static void onTraceDumpTick(void *)
+{
+    uint8_t frame[2 + XFER_MAX_CHUNK];
+    uint16_t mtu = peerMtu;
+    size_t room = std::min<size_t>(sizeof(frame), mtu > ATT_NOTIFY_OVERHEAD ? mtu - ATT_NOTIFY_OVERHEAD : 0);
+    size_t len = deviceConnected ? tracer.readFrame(frame, room) : 0;
+    if (len == 0 || !ble.notify(bulkChannel(), frame, len) || !tracer.dumping())
+    {
+        stopTraceDump(); // Done (the end marker went out) or peer gone
+    }
+}
+
+void serviceTraceDumpRequest()
+{
+    if (!traceDumpRequested)
+    {
+        return;
+    }
+    traceDumpRequested = false;
+    if (!tracer.startDump())
+    {
+        LOG_INFO("Trace dump already running.");
+        return;
+    }
+    LOG_INFO("Sending span trace (%lu events overwritten).", (unsigned long)tracer.dropped());
+    timers.cancel(traceDumpTimer);
+    traceDumpTimer = timers.schedule(TRACE_DUMP_INTERVAL_MS, onTraceDumpTick, nullptr, millis(), TRACE_DUMP_INTERVAL_MS);
+}
+
+// --- OTA Update ---
+// A full queue drops the frame; the receiver answers the gap with a NAK
+void queueOtaFrame(const std::string &rxValue) // BLE task
+{
+    OtaFrame frame;
+    frame.len = std::min<size_t>(rxValue.length(), OTA_FRAME_MAX);
+    memcpy(frame.data, rxValue.data(), frame.len);
+    if (otaQueue.send(frame))
+    {
+        buttons.wake();
+    }
+}
+
+static bool sendOtaStatus(const uint8_t *data, size_t len, void *)
+{
+    return deviceConnected && ble.notify(bulkChannel(), data, len);
+}
+
+static void onOtaReboot(void *)
+{
+    LOG_INFO("Rebooting into the other image.");
+    reminders.checkpoint(); // The schedule clock goes on from here after the reboot
+    persistence.flush(millis());
+    ESP.restart();
+}
+
+// The Arduino core marks a new image valid at boot unless this asks it to
+// wait; the image confirms itself from onOtaConfirm() instead
+extern "C" bool verifyRollbackLater()
+{
+    return true;
+}
+
+static void onOtaConfirm(void *)
+{
+    otaTarget.confirm();
+    otaConfirmTimer = TIMER_NONE;
+}
+
+void serviceOta()
+{
+    OtaFrame frame;
+    while (otaQueue.receive(frame, 0))
+    {
+        TRACE_SPAN(TRACE_OTA, frame.data[0]);
+        // Blocks follow the MTU in effect when the session (re)starts
+        uint16_t mtu = peerMtu;
+        ota.setMaxBlock(mtu > ATT_NOTIFY_OVERHEAD + OTA_DATA_OVERHEAD ? mtu - ATT_NOTIFY_OVERHEAD - OTA_DATA_OVERHEAD : 1);
+        ota.handle(frame.data, frame.len);
+    }
+    if ((ota.done() || otaRebootRequested) && !timers.isArmed(otaRebootTimer))
+    {
+        otaRebootRequested = false;
+        persistence.flush(millis()); // Nothing pending is lost to the reboot
+        otaRebootTimer = timers.schedule(OTA_REBOOT_DELAY_MS, onOtaReboot, nullptr, millis());
+    }
+}
+
+// --- Radio Policy ---
+static void onRadioDeadline(void *)
+{
+    // Nothing to do here: the loop pass this timer ends runs serviceRadioPolicy()
+}
+
+// Streams running on the loop count as bulk traffic
+void serviceRadioPolicy()
+{
+    uint32_t now = millis();
+    if (transfer.active() || outbox.draining() || timers.isArmed(logFetchTimer) || timers.isArmed(traceDumpTimer) ||
+        timers.isArmed(updateTimer))
+    {
+        radioPolicy.noteBulk(now);
+    }
+    uint32_t wait = radioPolicy.update(now, deviceConnected);
+    if (wait == RADIO_NO_DEADLINE)
+    {
+        timers.cancel(radioTimer);
+        radioTimer = TIMER_NONE;
+    }
+    else
+    {
+        radioTimer = timers.reschedule(radioTimer, wait, onRadioDeadline, nullptr, now);
+    }
+}
+
+#if SERIAL_LINK_ENABLED
+// --- Serial Provisioning ---
+// Frames are decoded and handled in the loop; the UART driver only wakes it.
+static_assert(LOG_HISTORY_RECORDS * LOG_RECORD_LEN <= SERIAL_LINK_MAX_PAYLOAD, "LOG_FETCH answers in one frame");
+
+void onSerialReceive() // UART event task
+{
+    buttons.wake();
+}
+
+// Serial commands Provisioning does not answer itself
+static bool handleSerialCommand(const std::string &command, void *)
+{
+    if (command == LOG_FETCH_CMD)
+    {
+        LogRecord records[LOG_HISTORY_RECORDS];
+        size_t count = logger.copyRecords(records, LOG_HISTORY_RECORDS);
+        provisioning.link().send(LINK_LOG_RECORDS, (const uint8_t *)records, count * LOG_RECORD_LEN);
+        return true;
+    }
+    if (command == TRACE_DUMP_CMD)
+    {
+        // The whole dump in one go: a few dozen frames at link speed
+        if (!tracer.startDump())
+        {
+            notifyReply("BUSY", ROUTE_SERIAL);
+            return true;
+        }
+        uint8_t *frame = provisioning.streamBuffer();
+        size_t len;
+        while ((len = tracer.readFrame(frame, SERIAL_STREAM_CHUNK)) > 0)
+        {
+            provisioning.link().send(LINK_TRACE, frame, len);
         }
-        // --- End Sanity Checks ---
+        return true;
+    }
+    if (command.compare(0, strlen(CODEC_CMD), CODEC_CMD) == 0 || command == XFER_START_CMD ||
+        command.compare(0, strlen(XFER_RESUME_CMD), XFER_RESUME_CMD) == 0)
+    {
+        // Codecs and windowed transfers are per BLE connection; the link needs neither
+        notifyReply("UNSUPPORTED", ROUTE_SERIAL);
+        return true;
+    }
+    return handleCommand(command, ROUTE_SERIAL);
+}
 
-        // Adjust the global scheduleReceiveTime for the current boot session
-        scheduleReceiveTime = millis() - timePassedBeforeShutdown;
+static void onSerialStreamed(uint32_t, void *)
+{
+    blinkLed();
+}
+#endif
 
-        Serial.printf("Adjusted scheduleReceiveTime for current session: %lu\n", scheduleReceiveTime);
-        Serial.println("Existing schedule loaded. Will start processing.");
-        currentState = STATE_PROCESSING_SCHEDULE; // Now set the state
+// --- Upload Inbox ---
+// An upload waits in the inbox (BLE task or loop)
+static void onUploadSubmitted(ReplyRoute route, void *)
+{
+    if (route == ROUTE_SERIAL)
+    {
+        blinkLed(); // BLE writes blink when they arrive
     }
-    else // loadSchedule() failed
+    buttons.wake();
+}
+
+//==================== SETUP ====================//
+void setup()
+{
+#if SERIAL_LINK_ENABLED
+    Serial.setRxBufferSize(SERIAL_LINK_RX_BUFFER); // Must precede Serial.begin()
+    logger.begin(SERIAL_LINK_BAUD);
+    provisioning.beginSerial(Serial);
+    Serial.onReceive(onSerialReceive);
+#else
+    logger.begin();
+#endif
+    LOG_INFO("Starting Pipli Reminder Device...");
+    LOG_EVENT(LOG_CODE_BOOT, esp_reset_reason(), 0);
+    timers.begin(millis());
+
+    // Initialize LittleFS
+    if (!initializeFS())
     {
-        Serial.println("No existing schedule found or load failed. Waiting for BLE connection.");
-        currentState = STATE_IDLE;
-        scheduleReceiveTime = 0; // Ensure it's zero if no schedule loaded
-        // Attempt to delete potentially corrupt counter file if schedule load failed
-        if (LittleFS.exists(MILLIS_COUNTER_FILENAME))
+        // Handle FS failure (e.g., loop forever, indicate error)
+        LOG_ERROR("CRITICAL: File System Failed. Halting.");
+        LOG_EVENT(LOG_CODE_FS_FAILED, 0, 0);
+        if (otaTarget.pendingVerify() && otaTarget.rollback())
         {
-            Serial.println("Deleting potentially stale millis counter file.");
-            LittleFS.remove(MILLIS_COUNTER_FILENAME);
+            ESP.restart(); // A new image that cannot mount the FS is not healthy
         }
+        while (1)
+            delay(1000);
+    }
+    initializePersistence();
+    outbox.load();
+    if (otaTarget.pendingVerify())
+    {
+        LOG_INFO("New image, confirming it in %lu s.", (unsigned long)(OTA_CONFIRM_AFTER_MS / 1000));
+        otaConfirmTimer = timers.schedule(OTA_CONFIRM_AFTER_MS, onOtaConfirm, nullptr, millis());
     }
+
+    ledcSetup(VIBRATION_PWM_CHANNEL, VIBRATION_PWM_HZ, VIBRATION_PWM_BITS);
+    ledcAttachPin(VIBRATION_PIN, VIBRATION_PWM_CHANNEL);
+    pinMode(PAIR_PIN, INPUT_PULLDOWN); // Use pulldown/pullup as appropriate
+    pinMode(USER_PIN, INPUT_PULLDOWN); // Use pulldown for response button
+    pinMode(LED, OUTPUT);
+    if (!buttons.begin(USER_PIN, PAIR_PIN))
+    {
+        LOG_WARN("Button input unavailable.");
+    }
+
+    ledcWrite(VIBRATION_PWM_CHANNEL, 0); // Ensure vibration is off
+    digitalWrite(LED, LOW);           // Ensure LED is off
+
+    // --- Load existing schedule AND Adjust Time ---
+    ReminderHooks reminderHooks = {onReminderAlert, onReminderSilence, nullptr, onReminderAnswered, onEventQueued, isPeerConnected, nullptr};
+    reminders.begin(reminderHooks);
+    reminders.restore(loadSchedule());
     // --- End Load and Adjust ---
+    ProvisioningHooks provisioningHooks = {nullptr, applyPatchUpload, onUploadSubmitted, onScheduleCommitted, nullptr, nullptr};
+#if SERIAL_LINK_ENABLED
+    provisioningHooks.command = handleSerialCommand;
+    provisioningHooks.streamed = onSerialStreamed;
+#endif
+    provisioning.begin(provisioningHooks);
 
     // --- Initialize BLE ---
-    BLEDevice::init("Pipli");
-    pServer = BLEDevice::createServer();
-    pServer->setCallbacks(new MyServerCallbacks());
-    BLEService *pService = pServer->createService(SERVICE_UUID);
-    pCharacteristic = pService->createCharacteristic(
-        CHARACTERISTIC_UUID,
-        BLECharacteristic::PROPERTY_READ |
-            BLECharacteristic::PROPERTY_WRITE | // Crucial for receiving schedule
-            BLECharacteristic::PROPERTY_NOTIFY |
-            BLECharacteristic::PROPERTY_INDICATE);
-    pCharacteristic->setCallbacks(new MyCharacteristicCallbacks()); // Handle writes
-    pCharacteristic->addDescriptor(new BLE2902());                  // Needed for notifications
+    BleTransportHandlers bleHandlers = {onBleConnect, onBleDisconnect, onBleMtuChanged, onBleWrite, onBleRead, onBleSubscribe, onBleSecured};
+    ble.begin("Pipli", SERVICE_UUID, XFER_PREFERRED_MTU, bleHandlers);
+    transfer.setSender(sendTransferFrame, nullptr);
+    outbox.setSender(sendEventFrame, nullptr);
+    ota.setSender(sendOtaStatus, nullptr);
+    otaQueue.begin();
+    ble.addChannel(BLE_CHANNEL_LEGACY, CHARACTERISTIC_UUID,
+                   BLE_PROP_READ | BLE_PROP_WRITE | BLE_PROP_NOTIFY | BLE_PROP_INDICATE); // WRITE is crucial for receiving schedule
+    ble.addChannel(BLE_CHANNEL_INFO, SCHEDULE_INFO_UUID, BLE_PROP_READ);
+    ble.addChannel(BLE_CHANNEL_CONTROL, CONTROL_POINT_UUID, BLE_PROP_WRITE | BLE_PROP_NOTIFY);
+    // Acks and upload chunks need no response
+    ble.addChannel(BLE_CHANNEL_BULK, BULK_DATA_UUID, BLE_PROP_WRITE | BLE_PROP_WRITE_NR | BLE_PROP_NOTIFY);
+    ble.addChannel(BLE_CHANNEL_STATUS, STATUS_UUID, BLE_PROP_READ | BLE_PROP_NOTIFY);
+    ble.addChannel(BLE_CHANNEL_EVENTS, EVENTS_UUID, BLE_PROP_WRITE | BLE_PROP_WRITE_NR | BLE_PROP_NOTIFY);
+    updateScheduleInfo();
 
     // Set initial characteristic value (optional)
-    pCharacteristic->setValue("Ready");
+    ble.setValue(BLE_CHANNEL_LEGACY, (const uint8_t *)"Ready", 5);
+
+    ble.setPairing(false); // Bonded phones only (BLE_BOND_FILTER), unless there is no bond yet
+    ble.start(); // Start advertising initially
+    radioPolicy.boost(millis()); // Fast at boot, so a phone waiting for the device finds it
+    LOG_INFO("BLE stack: %s, %u bonds", ble.stackName(), ble.bondCount());
+    // The stacks allocate most of their RAM at init, so static RAM alone does not compare them
+    LOG_INFO("Heap after BLE init: %lu free of %lu bytes", (unsigned long)ESP.getFreeHeap(),
+             (unsigned long)ESP.getHeapSize());
+    LOG_INFO("BLE Initialized. Waiting for connection or processing schedule...");
+
+    // --- Battery ---
+    // Seeded before the first alert so a weak cell starts in its tier
+    powerPolicy.begin(VIBRATION_DURATION_MS, persistence.policy());
+    if (battery.begin(BATTERY_PIN))
+    {
+        onBatterySample(nullptr);
+        batteryTimer = timers.schedule(BATTERY_SAMPLE_INTERVAL_MS, onBatterySample, nullptr, millis(), BATTERY_SAMPLE_INTERVAL_MS);
+    }
 
-    pService->start();
-    BLEAdvertising *pAdvertising = BLEDevice::getAdvertising();
-    pAdvertising->addServiceUUID(SERVICE_UUID);
-    pAdvertising->setScanResponse(true);
-    pAdvertising->setMinPreferred(0x06);
-    pAdvertising->setMaxPreferred(0x12);
-    BLEDevice::startAdvertising(); // Start advertising initially
-    Serial.println("BLE Initialized. Waiting for connection or processing schedule...");
+    // --- Periodic timers ---
+    countdownTimer = timers.schedule(COUNTDOWN_PRINT_INTERVAL_MS, onCountdown, nullptr, millis(), COUNTDOWN_PRINT_INTERVAL_MS);
 }
 
-//==================== LOOP ====================//
-void loop()
+// --- Status ---
+// Feeds the loop's view of the device into the status record and the beacon.
+// Setters ignore unchanged values, so this is cheap to run every pass; a
+// changed record is notified to a subscribed peer, a changed beacon goes into
+// the scan response.
+void updateStatus()
+{
+    bool loaded = reminders.loaded();
+    uint8_t flags = provisioning.updateStatus(transfer.active() || ota.active() ? DEVICE_STATUS_FLAG_TRANSFER : 0);
+
+    if (deviceStatus.takeChanged() && deviceConnected)
+    {
+        uint8_t record[DEVICE_STATUS_LEN];
+        deviceStatus.refresh(millis());
+        deviceStatus.copy(record);
+        ble.notify(BLE_CHANNEL_STATUS, record, sizeof(record));
+    }
+
+    statusBeacon.setGeneration(loaded ? scheduleStore.generation() : 0);
+    statusBeacon.setPending(loaded ? scheduleStore.pendingCount() : 0);
+    statusBeacon.setMissed(loaded ? scheduleStore.missedCount() : 0);
+    statusBeacon.setFlags(flags);
+    if (statusBeacon.takeChanged())
+    {
+        ble.setManufacturerData(statusBeacon.data(), STATUS_BEACON_LEN);
+    }
+}
+
+// --- Button Events ---
+void handleButtonEvent(const ButtonEvent &event)
 {
+    radioPolicy.boost(millis());
+
+    static const char *const gestureNames[] = {"press", "long press", "double press"};
+    LOG_INFO("%s button: %s", event.button == BUTTON_USER ? "User" : "Pair", gestureNames[event.gesture]);
 
-    // --- Periodically save millis counter ---
-    // Only save if a schedule is loaded, otherwise, the counter isn't very useful
-    if (scheduleLoaded && (millis() - lastMillisSaveTime >= 5000))
+    if (event.button == BUTTON_USER)
     {
-        lastMillisSaveTime = millis();
-        saveMillisCounter(); // Attempt to save the current millis() value
+        if (event.gesture == BUTTON_PRESS)
+        {
+            reminders.press(); // Only counts while a reminder waits for it
+        }
     }
-    // --- End periodic save ---
+    else if (event.button == BUTTON_PAIR)
+    {
+        if (event.gesture == BUTTON_LONG_PRESS)
+        {
+            LOG_INFO("Pair button held - Forgetting %u bonds", ble.bondCount());
+            ble.clearBonds();
+        }
+        if (event.gesture == BUTTON_PRESS || event.gesture == BUTTON_LONG_PRESS)
+        {
+            openPairingWindow();
+            if (!deviceConnected)
+            {
+                LOG_INFO("Pair button pressed - Restarting Advertising");
+                ble.startAdvertising();
+            }
+            blinkLed();
+        }
+    }
+}
 
+//==================== LOOP ====================//
+void loop()
+{
     // --- Handle Connection State Changes (Advertising) ---
     // This logic is mostly handled by callbacks now, but keep advertising restart logic
     if (!deviceConnected && oldDeviceConnected)
     {
         // onDisconnect callback handles LED and prints message
-        // It also restarts advertising
+        // Keep the transfer snapshot; the app resumes it on the next connection
+        transfer.pause();
+        timers.cancel(transferTimer);
+        transferTimer = TIMER_NONE;
+        // A SEND_UPDATE stream is not resumable; the app asks again
+        stopUpdateStream();
+        // Unacked events stay queued for the next subscription
+        outbox.stopDrain();
+        timers.cancel(outboxTimer);
+        outboxTimer = TIMER_NONE;
+        if (timers.isArmed(traceDumpTimer))
+        {
+            stopTraceDump();
+        }
+        radioPolicy.boost(millis()); // The app often reconnects right away
         oldDeviceConnected = deviceConnected;
     }
     if (deviceConnected && !oldDeviceConnected)
@@ -861,8 +1843,40 @@ void loop()
         oldDeviceConnected = deviceConnected;
     }
 
+    if (advertiseRequested)
+    {
+        advertiseRequested = false;
+        advertiseTimer = timers.reschedule(advertiseTimer, ADVERTISE_RESTART_DELAY_MS, onAdvertiseRestart, nullptr, millis());
+    }
+    serviceBonds();
+    serviceTransferRequest();
+    serviceEventsSubscription();
+    serviceLogFetchRequest();
+    serviceLzssBench();
+    if (updateRequested)
+    {
+        updateRequested = false;
+        sendUpdate(false);
+    }
+    serviceTraceDumpRequest();
+    serviceOta();
+#if SERIAL_LINK_ENABLED
+    provisioning.pollSerial();
+#endif
+    provisioning.serviceIngest();
+
+    // --- Run every expired deadline ---
+    {
+        TRACE_SPAN(TRACE_TIMERS);
+        timers.advance(millis());
+    }
+    serviceBlink();
+    armFlushTimer();
+
     // --- Main State Machine ---
-    switch (currentState)
+    // The reminder engine drops a replaced schedule's alert and looks for the next reminder
+    reminders.service();
+    switch (reminders.state())
     {
     case STATE_IDLE:
         // Waiting for connection or schedule via BLE write
@@ -871,65 +1885,10 @@ void loop()
         break;
 
     case STATE_PROCESSING_SCHEDULE:
-        // Check the schedule for due reminders
-        processSchedule();
-
-        // --- Add Countdown Logic ---
-        if (millis() - lastCountdownPrintMillis >= 1000)
-        {
-            lastCountdownPrintMillis = millis();
-            if (nextReminderDueTimeMillis > 0)
-            {
-                unsigned long now = millis();
-                // nextReminderDueTimeMillis is calculated based on the adjusted scheduleReceiveTime
-                if (nextReminderDueTimeMillis > now)
-                {
-                    unsigned long remainingMillis = nextReminderDueTimeMillis - now;
-                    unsigned long remainingSeconds = remainingMillis / 1000;
-                    Serial.printf("Next reminder in: %lu seconds\n", remainingSeconds);
-                }
-                else
-                {
-                    // Serial.println("Next reminder is due now or very soon.");
-                }
-            }
-            else
-            {
-                if (scheduleLoaded)
-                {
-                    Serial.println("No pending reminders.");
-                }
-            }
-        }
-        // --- End Countdown Logic ---
-        break;
-
     case STATE_VIBRATING:
-        // Check if vibration duration has passed
-        if (millis() - stateTimer >= VIBRATION_DURATION_MS)
-        {
-            stopVibration();
-            stateTimer = millis(); // Start timer for response timeout
-            currentState = STATE_WAITING_RESPONSE;
-            Serial.println("State changed to STATE_WAITING_RESPONSE");
-        }
-        break;
-
     case STATE_WAITING_RESPONSE:
-        // Check for user button press
-        if (digitalRead(USER_PIN) == HIGH)
-        {
-            Serial.println("User button pressed - Responded YES");
-            recordResponse(true); // Records response, saves, moves to next, sets state back
-            // Debounce delay might be needed if button is bouncy
-            delay(200);
-        }
-        // Check for response timeout
-        else if (millis() - stateTimer >= RESPONSE_TIMEOUT_MS)
-        {
-            Serial.println("Response timeout - Responded NO");
-            recordResponse(false); // Records response, saves, moves to next, sets state back
-        }
+    case STATE_SNOOZED:
+        // Driven by the reminder engine's timers; a press arrives through handleButtonEvent()
         break;
 
     case STATE_SENDING_UPDATE:
@@ -940,14 +1899,35 @@ void loop()
         // back to IDLE here, as the "sending attempt" is done for this cycle.
         // The data remains loaded for a future request.
         // If sendUpdate *did* send successfully, it already set the state to IDLE.
-        if (currentState == STATE_SENDING_UPDATE)
+        if (reminders.state() == STATE_SENDING_UPDATE)
         { // Check if sendUpdate didn't already change state
-            Serial.println("Send attempt finished (or skipped if disconnected). Returning to IDLE.");
-            currentState = STATE_IDLE;
+            LOG_INFO("Send attempt finished (or skipped if disconnected). Returning to IDLE.");
+            reminders.setState(STATE_IDLE);
         }
         break;
     }
 
-    // Small delay to prevent watchdog issues if loop is very fast
-    delay(10);
+    updateStatus();
+    serviceRadioPolicy();
+
+    // --- Sleep until the next deadline or button event ---
+    // One query covers every subsystem; a button press or a BLE write ends the wait early.
+    uint32_t idleMillis = timers.msUntilNextDeadline(millis());
+    if (reminders.pending() || blinkRequested || advertiseRequested || bondsChanged || transferRequest != XFER_REQUEST_NONE ||
+        eventsSubscriptionChanged || logFetchRequested || traceDumpRequested || otaRebootRequested || lzssBenchRequested || updateRequested ||
+        provisioning.inboxReady() || ingest.active())
+    {
+        idleMillis = 0;
+    }
+    ButtonEvent event;
+    bool pressed;
+    {
+        TRACE_SPAN(TRACE_LOOP_WAIT);
+        pressed = buttons.waitEvent(event, idleMillis);
+    }
+    while (pressed)
+    {
+        handleButtonEvent(event);
+        pressed = buttons.waitEvent(event, 0); // Drain whatever else is queued, then run the loop again
+    }
 } // End loop
\ No newline at end of file
@@ -0,0 +1,341 @@
+#!/usr/bin/env python3
+"""Send a firmware image to a Pipli device with the resumable OTA protocol.
+
+Speaks the frames of include/OtaReceiver.h: begin with the image size, block
+size and SHA-256, then windowed data blocks each with its CRC-32, then finish.
+The device acks every half window; a NAK or a silent link rewinds to the last
+acked offset. A dropped link (or a device reset) is answered with begin again,
+which resumes where the device's flash left off.
+
+Two links:
+    tools/ota_send.py firmware.bin --ble AA:BB:CC:DD:EE:FF   # needs `pip install bleak`
+    tools/ota_send.py firmware.bin --sim .pio/build/native/program
+
+--sim runs the native receiver (src/OtaSim.cpp, `pio run -e native`) against a
+simulated partition file and restarts it whenever it exits, so --drop,
+--corrupt and the receiver's own --crash-after exercise resume end to end.
+"""
+
+import argparse
+import asyncio
+import hashlib
+import os
+import queue
+import random
+import select
+import struct
+import subprocess
+import sys
+import threading
+import time
+import zlib
+
+# --- Frames (OtaReceiver.h) ---
+OTA_OP_BEGIN = 0x90
+OTA_OP_DATA = 0x91
+OTA_OP_FINISH = 0x92
+OTA_OP_ABORT = 0x93
+OTA_OP_STATUS = 0x98
+OTA_DATA_OVERHEAD = 9
+OTA_MAX_BLOCK = 235
+
+OTA_OK, OTA_DONE, OTA_NAK = 0, 1, 2
+STATUS_NAMES = ["ok", "done", "nak", "aborted", "bad frame", "image too large", "wrong state",
+                "flash error", "hash mismatch", "image rejected"]
+
+BULK_DATA_UUID = "beb5483e-36e1-4688-b7f5-ea07361b26ab"
+ATT_WRITE_OVERHEAD = 3
+ACK_TIMEOUT_S = 2.0
+MAX_RECONNECTS = 20
+
+
+class LinkLost(Exception):
+    pass
+
+
+class OtaError(Exception):
+    pass
+
+
+def begin_frame(size, block, digest):
+    return struct.pack("<BIH", OTA_OP_BEGIN, size, block) + digest
+
+
+def data_frame(offset, payload):
+    return struct.pack("<BII", OTA_OP_DATA, offset, zlib.crc32(payload)) + payload
+
+
+def parse_status(frame):
+    if len(frame) < 9 or frame[0] != OTA_OP_STATUS:
+        return None
+    code, offset, block, window = struct.unpack_from("<BIHB", frame, 1)
+    return code, offset, block, window
+
+
+def status_name(code):
+    return STATUS_NAMES[code] if code < len(STATUS_NAMES) else "status %d" % code
+
+
+# --- Links ---
+
+class SimLink:
+    """The native receiver as a child process, u16-LE length-prefixed frames on its stdio."""
+
+    def __init__(self, argv):
+        self.argv = argv
+        self.proc = None
+        self.rx = bytearray()
+        self.max_block = OTA_MAX_BLOCK
+
+    def connect(self):
+        self.close()
+        self.proc = subprocess.Popen(self.argv, stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.rx = bytearray()
+
+    def close(self):
+        if self.proc is not None:
+            try:
+                self.proc.stdin.close()
+            except OSError:
+                pass
+            self.proc.wait()
+            self.proc = None
+
+    def send(self, frame):
+        try:
+            self.proc.stdin.write(struct.pack("<H", len(frame)) + frame)
+            self.proc.stdin.flush()
+        except (BrokenPipeError, OSError):
+            raise LinkLost("receiver exited")
+
+    def receive(self, timeout):
+        deadline = time.monotonic() + timeout
+        fd = self.proc.stdout.fileno()
+        while True:
+            if len(self.rx) >= 2:
+                (length,) = struct.unpack_from("<H", self.rx)
+                if len(self.rx) >= 2 + length:
+                    frame = bytes(self.rx[2:2 + length])
+                    del self.rx[:2 + length]
+                    return frame
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return None
+            readable, _, _ = select.select([fd], [], [], remaining)
+            if readable:
+                data = os.read(fd, 4096)
+                if not data:
+                    raise LinkLost("receiver exited")
+                self.rx += data
+
+
+class BleLink:
+    """Write-without-response on the bulk characteristic, status frames as notifications."""
+
+    def __init__(self, address):
+        try:
+            import bleak
+        except ImportError:
+            sys.exit("--ble needs bleak: pip install bleak")
+        self.bleak = bleak
+        self.address = address
+        self.loop = asyncio.new_event_loop()
+        threading.Thread(target=self.loop.run_forever, daemon=True).start()
+        self.client = None
+        self.frames = queue.Queue()
+        self.max_block = OTA_MAX_BLOCK
+
+    def _run(self, coroutine, timeout=30):
+        return asyncio.run_coroutine_threadsafe(coroutine, self.loop).result(timeout)
+
+    def _on_notify(self, _, data):
+        self.frames.put(bytes(data))
+
+    def _on_disconnect(self, _):
+        self.frames.put(None)
+
+    async def _connect(self):
+        self.client = self.bleak.BleakClient(self.address, disconnected_callback=self._on_disconnect)
+        await self.client.connect()
+        await self.client.start_notify(BULK_DATA_UUID, self._on_notify)
+
+    def connect(self):
+        self.close()
+        self.frames = queue.Queue()
+        try:
+            self._run(self._connect())
+        except Exception as e:
+            raise LinkLost(str(e))
+        # The largest block one write carries at the negotiated MTU
+        mtu = self.client.mtu_size
+        self.max_block = max(1, min(OTA_MAX_BLOCK, mtu - ATT_WRITE_OVERHEAD - OTA_DATA_OVERHEAD))
+
+    def close(self):
+        if self.client is not None:
+            try:
+                self._run(self.client.disconnect())
+            except Exception:
+                pass
+            self.client = None
+
+    def send(self, frame):
+        try:
+            self._run(self.client.write_gatt_char(BULK_DATA_UUID, frame, response=False))
+        except Exception as e:
+            raise LinkLost(str(e))
+
+    def receive(self, timeout):
+        try:
+            frame = self.frames.get(timeout=timeout)
+        except queue.Empty:
+            return None
+        if frame is None:
+            raise LinkLost("disconnected")
+        return frame
+
+
+# --- Sender ---
+
+class Sender:
+    def __init__(self, link, image, block, drop=0.0, corrupt=0.0, verbose=False):
+        self.link = link
+        self.image = image
+        self.digest = hashlib.sha256(image).digest()
+        self.block = block
+        self.drop = drop
+        self.corrupt = corrupt
+        self.verbose = verbose
+        self.stats = {"blocks": 0, "resent": 0, "naks": 0, "timeouts": 0, "reconnects": 0}
+
+    def log(self, text):
+        if self.verbose:
+            print(text, file=sys.stderr)
+
+    def status(self, timeout=ACK_TIMEOUT_S):
+        frame = self.link.receive(timeout)
+        while frame is not None and parse_status(frame) is None:
+            frame = self.link.receive(timeout)  # Not ours
+        return None if frame is None else parse_status(frame)
+
+    def put(self, frame):
+        """A data frame over the simulated lossy link."""
+        if random.random() < self.drop:
+            return
+        if random.random() < self.corrupt:
+            frame = bytearray(frame)
+            frame[random.randrange(OTA_DATA_OVERHEAD, len(frame))] ^= 0x40
+            frame = bytes(frame)
+        self.link.send(frame)
+
+    def begin(self):
+        block = min(self.block, self.link.max_block)
+        self.link.send(begin_frame(len(self.image), block, self.digest))
+        reply = self.status()
+        if reply is None:
+            raise LinkLost("no answer to begin")
+        code, offset, block, window = reply
+        if code != OTA_OK:
+            raise OtaError("begin refused: " + status_name(code))
+        return offset, block, window
+
+    def session(self):
+        """One connection's worth of transfer. Returns True once the device activated the image."""
+        size = len(self.image)
+        acked, block, window = self.begin()
+        self.log("session at %d, block %d, window %d" % (acked, block, window))
+        sent = acked
+        high = acked  # Furthest offset ever sent, to count resends
+        while True:
+            while sent < size and sent - acked < window * block:
+                payload = self.image[sent:sent + block]
+                self.put(data_frame(sent, payload))
+                self.stats["blocks"] += 1
+                if sent < high:
+                    self.stats["resent"] += 1
+                sent += len(payload)
+                high = max(high, sent)
+                # Pick up acks as they come so the window keeps moving
+                reply = self.status(0)
+                if reply is not None:
+                    acked, sent = self.on_status(reply, acked, sent)
+            if acked == size:
+                self.link.send(bytes([OTA_OP_FINISH]))
+                reply = self.status(ACK_TIMEOUT_S * 5)  # Finish hashes the whole image
+                if reply is None:
+                    raise LinkLost("no answer to finish")
+                if reply[0] == OTA_DONE:
+                    return True
+                acked, sent = self.on_status(reply, acked, sent)
+                continue
+            reply = self.status()
+            if reply is None:
+                self.stats["timeouts"] += 1
+                sent = acked  # Go back to the last ack
+                continue
+            acked, sent = self.on_status(reply, acked, sent)
+
+    def on_status(self, reply, acked, sent):
+        code, offset, _, _ = reply
+        if code == OTA_OK:
+            return max(acked, offset), max(sent, offset)
+        if code == OTA_NAK:
+            self.stats["naks"] += 1
+            self.log("nak at %d" % offset)
+            return offset, offset
+        raise OtaError(status_name(code) + " at %d" % offset)
+
+    def run(self):
+        for attempt in range(MAX_RECONNECTS + 1):
+            try:
+                self.link.connect()
+                if self.session():
+                    return
+            except LinkLost as e:
+                self.stats["reconnects"] += 1
+                self.log("link lost (%s), reconnecting" % e)
+            finally:
+                self.link.close()
+        raise OtaError("gave up after %d reconnects" % MAX_RECONNECTS)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("image", help="firmware image (.pio/build/<env>/firmware.bin)")
+    link = parser.add_mutually_exclusive_group(required=True)
+    link.add_argument("--ble", metavar="ADDRESS", help="device address")
+    link.add_argument("--sim", metavar="PROGRAM", help="native receiver; the partition file is --sim-file")
+    parser.add_argument("--sim-file", default="ota_sim.part", help="simulated partition (default: %(default)s)")
+    parser.add_argument("--sim-args", default="", help="extra receiver arguments, e.g. \"--crash-after 100000\"")
+    parser.add_argument("--block", type=int, default=OTA_MAX_BLOCK, help="block size (capped by the MTU)")
+    parser.add_argument("--drop", type=float, default=0.0, help="fraction of data blocks to drop")
+    parser.add_argument("--corrupt", type=float, default=0.0, help="fraction of data blocks to damage")
+    parser.add_argument("--seed", type=int, help="random seed for --drop/--corrupt")
+    parser.add_argument("-v", "--verbose", action="store_true")
+    args = parser.parse_args()
+
+    with open(args.image, "rb") as f:
+        image = f.read()
+    if args.seed is not None:
+        random.seed(args.seed)
+    if args.sim:
+        link = SimLink([args.sim] + args.sim_args.split() + [args.sim_file])
+    else:
+        link = BleLink(args.ble)
+
+    sender = Sender(link, image, args.block, args.drop, args.corrupt, args.verbose)
+    start = time.monotonic()
+    try:
+        sender.run()
+    except OtaError as e:
+        print("OTA failed: %s" % e, file=sys.stderr)
+        return 1
+    seconds = time.monotonic() - start
+    s = sender.stats
+    print("%d bytes in %.2f s (%.1f KB/s): %d blocks, %d resent, %d naks, %d timeouts, %d reconnects" %
+          (len(image), seconds, len(image) / seconds / 1024, s["blocks"], s["resent"], s["naks"],
+           s["timeouts"], s["reconnects"]))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+"""Report the static RAM of a Pipli build per subsystem.
+
+Buffers in the firmware are globals sized at compile time (the capacities
+in platformio.ini), so .bss and .data hold the budget; the heap is left to
+the BLE stack and the framework. The symbols of each object file under src/
+are summed per module. main.cpp's globals are split by name, so the JSON
+pool, upload buffers and OTA queue each show up as their own line. Whatever
+the ELF holds beyond that belongs to the framework and libraries.
+
+Runs after every firmware link as a PlatformIO extra script, and by hand:
+    tools/ram_budget.py .pio/build/esp32doit-devkit-v1
+"""
+
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+RAM_TYPES = set("bBdD")  # .bss and .data, local and global
+
+# main.cpp globals by subsystem; the first match wins
+MAIN_GROUPS = [
+    (r"^jsonPool$", "JSON pool"),
+    (r"^provisioning$", "Provisioning"),  # Upload inbox and serial link
+    (r"^ingest$", "ScheduleIngest"),
+    (r"^ota", "OTA"),
+    (r"^scheduleStore$", "ScheduleStore"),
+    (r"^reminders$", "ReminderEngine"),
+    (r"^(timers|.*Timer)$", "TimerWheel"),
+    (r"^buttons$", "Buttons"),
+    (r"^transfer", "BulkTransfer"),
+    (r"^outbox", "EventOutbox"),
+    (r"^(serial|logFetch)", "SerialLink"),
+    (r"^persistence$", "Persistence"),
+    (r"^deviceStatus$", "DeviceStatus"),
+    (r"^statusBeacon$", "StatusBeacon"),
+    (r"^radioPolicy$", "RadioPolicy"),
+    (r"^(connStats|bondsChanged)$", "Bonding"),
+    (r"^(battery|powerPolicy)", "PowerPolicy"),
+    (r"^ble$", "BleTransport"),
+]
+
+# Object files whose module goes by another name
+OBJECT_GROUPS = {
+    "BluedroidTransport": "BleTransport",
+    "NimbleTransport": "BleTransport",
+    "Trace": "Trace",
+    "Log": "Log",
+}
+
+
+def find_nm():
+    for name in ("xtensa-esp32-elf-nm", "xtensa-esp32s3-elf-nm", "riscv32-esp-elf-nm"):
+        path = shutil.which(name)
+        if path:
+            return path
+    packages = os.path.expanduser("~/.platformio/packages")
+    found = sorted(glob.glob(os.path.join(packages, "toolchain-*", "bin", "*-elf-nm")))
+    return found[0] if found else "nm"
+
+
+def ram_symbols(nm, path, env=None):
+    """[(name, size)] of the .bss/.data symbols defined in path."""
+    out = subprocess.run([nm, "-S", "-C", "--defined-only", path], capture_output=True, text=True,
+                         check=True, env=env).stdout
+    symbols = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        if len(parts) == 4 and parts[2] in RAM_TYPES:
+            symbols.append((parts[3], int(parts[1], 16)))
+    return symbols
+
+
+def main_group(name):
+    base = name.split("::")[0]  # Function statics are named function()::variable
+    base = re.sub(r"\(.*$", "", base)
+    for pattern, group in MAIN_GROUPS:
+        if re.search(pattern, base):
+            return group
+    return "main (other)"
+
+
+def budget(build_dir, nm, env=None):
+    """({subsystem: bytes}, bytes of the whole ELF or None)."""
+    groups = {}
+    objects = glob.glob(os.path.join(build_dir, "src", "**", "*.o"), recursive=True)
+    for obj in objects:
+        module = os.path.basename(obj).split(".")[0]
+        for name, size in ram_symbols(nm, obj, env):
+            if module == "main":
+                group = main_group(name)
+            else:
+                group = OBJECT_GROUPS.get(module, module)
+            groups[group] = groups.get(group, 0) + size
+    elf = os.path.join(build_dir, "firmware.elf")
+    total = sum(size for _, size in ram_symbols(nm, elf, env)) if os.path.exists(elf) else None
+    return groups, total
+
+
+def report(build_dir, nm, env=None, out=sys.stdout):
+    groups, total = budget(build_dir, nm, env)
+    if not groups:
+        print("ram_budget: no objects under %s/src" % build_dir, file=out)
+        return
+    ours = sum(groups.values())
+    print("Static RAM by subsystem (%s):" % os.path.basename(os.path.normpath(build_dir)), file=out)
+    for group, size in sorted(groups.items(), key=lambda item: -item[1]):
+        print("  %-20s %8d B" % (group, size), file=out)
+    print("  %-20s %8d B" % ("firmware total", ours), file=out)
+    if total is not None:
+        print("  %-20s %8d B" % ("framework + libs", total - ours), file=out)
+        print("  %-20s %8d B" % ("image total", total), file=out)
+
+
+def main():
+    if len(sys.argv) != 2 or sys.argv[1].startswith("-"):
+        sys.exit("usage: ram_budget.py BUILD_DIR  (e.g. .pio/build/esp32doit-devkit-v1)")
+    report(sys.argv[1], find_nm())
+
+
+# --- PlatformIO hook (extra_scripts = post:tools/ram_budget.py) ---
+try:
+    Import("env")  # noqa: F821 - defined when SCons runs this file
+except NameError:
+    if __name__ == "__main__":
+        main()
+else:
+    def _after_link(target, source, env):
+        nm = re.sub(r"gcc$", "nm", env.subst("$CC"))
+        report(env.subst("$BUILD_DIR"), nm, dict(os.environ, PATH=env["ENV"]["PATH"]))
+
+    env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", _after_link)  # noqa: F821
@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""Convert a Pipli span trace dump into Chrome trace JSON.
+
+A dump is the TRACE_DUMP frames (include/Trace.h) concatenated as received,
+over BLE notifications or LINK_TRACE serial frames; every frame carries its
+own length, so nothing else is needed. provision.py --trace writes the JSON
+directly. Open the output in https://ui.perfetto.dev or chrome://tracing:
+each firmware task is a track, so blocking and overlap between the loop and
+the BLE task show up side by side.
+
+    tools/trace2chrome.py dump.bin -o trace.json
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_OP_EVENTS = 0xB1
+TRACE_OP_TASKS = 0xB2
+TRACE_EVENT_LEN = 8
+TRACE_TASK_NAME_LEN = 16
+TRACE_TASK_LEN = 1 + TRACE_TASK_NAME_LEN
+TRACE_TASK_OTHER = 0xFF
+
+# TraceName in Trace.h
+SPAN_NAMES = {
+    1: "loop wait",
+    2: "timers",
+    3: "processSchedule",
+    4: "ingest step",
+    5: "saveSchedule",
+    6: "saveMillisCounter",
+    7: "persistence flush",
+    8: "store commit",
+    9: "sendUpdate",
+    10: "sendUpdate chunk",
+    11: "ble connect",
+    12: "ble disconnect",
+    13: "ble write",
+    14: "ble read",
+    15: "ble subscribe",
+    16: "ble mtu",
+    17: "serial frame",
+    18: "outbox save",
+    19: "ota frame",
+}
+
+# Spans whose arg is worth showing, and what it means
+SPAN_ARGS = {
+    4: "status",
+    7: "regions",
+    8: "patch",
+    9: "route",
+    13: "channel",
+    14: "channel",
+    15: "channel",
+    17: "type",
+    19: "op",
+}
+
+
+def parse_dump(data):
+    """Returns ({task id: name}, [(us, name, phase, task, arg)]) from concatenated frames."""
+    tasks = {}
+    events = []
+    pos = 0
+    while pos + 2 <= len(data):
+        op, count = data[pos], data[pos + 1]
+        pos += 2
+        if op == TRACE_OP_TASKS:
+            for _ in range(count):
+                entry = data[pos:pos + TRACE_TASK_LEN]
+                tasks[entry[0]] = entry[1:].split(b"\0", 1)[0].decode("ascii", "replace")
+                pos += TRACE_TASK_LEN
+        elif op == TRACE_OP_EVENTS:
+            if count == 0:
+                break  # End marker
+            for _ in range(count):
+                events.append(struct.unpack_from("<IBBBB", data, pos))
+                pos += TRACE_EVENT_LEN
+        else:
+            raise ValueError("unknown frame 0x%02x at byte %d" % (op, pos - 2))
+    if pos > len(data):
+        raise ValueError("dump is truncated")
+    return tasks, events
+
+
+def to_chrome(tasks, events, pid=1, process_name="pipli"):
+    """Chrome trace events, balanced per task so every viewer accepts them."""
+    out = [{"name": "process_name", "ph": "M", "pid": pid, "args": {"name": process_name}}]
+    for task_id in sorted(set(tasks) | {e[3] for e in events}):
+        name = tasks.get(task_id, "other" if task_id == TRACE_TASK_OTHER else "task %d" % task_id)
+        out.append({"name": "thread_name", "ph": "M", "pid": pid, "tid": task_id, "args": {"name": name}})
+
+    # Timestamps are 32-bit microseconds; the ring is in time order, so unwrap
+    base = 0
+    previous = None
+    open_spans = {}  # tid -> stack of names
+    last_ts = 0
+    for us, name, phase, task, arg in events:
+        if previous is not None and us < previous and previous - us > 0x80000000:
+            base += 1 << 32
+        previous = us
+        ts = base + us
+        last_ts = ts
+        label = SPAN_NAMES.get(name, "span %d" % name)
+        stack = open_spans.setdefault(task, [])
+        if phase == ord("B"):
+            stack.append(label)
+            event = {"name": label, "ph": "B", "ts": ts, "pid": pid, "tid": task}
+            if name in SPAN_ARGS:
+                event["args"] = {SPAN_ARGS[name]: arg}
+            out.append(event)
+        elif phase == ord("E"):
+            if not stack:
+                continue  # Its begin was overwritten or recorded before the last dump
+            stack.pop()
+            out.append({"name": label, "ph": "E", "ts": ts, "pid": pid, "tid": task})
+
+    # Spans still running when the dump started end with the trace
+    for task, stack in open_spans.items():
+        for label in reversed(stack):
+            out.append({"name": label, "ph": "E", "ts": last_ts, "pid": pid, "tid": task})
+    return out
+
+
+def convert(data, process_name="pipli"):
+    tasks, events = parse_dump(data)
+    return {"traceEvents": to_chrome(tasks, events, process_name=process_name), "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("dump", help="binary dump (concatenated TRACE_DUMP frames)")
+    parser.add_argument("-o", "--output", help="output file (default: stdout)")
+    parser.add_argument("--name", default="pipli", help="process name shown in the viewer")
+    args = parser.parse_args()
+
+    with open(args.dump, "rb") as f:
+        trace = convert(f.read(), args.name)
+    text = json.dumps(trace, indent=1)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text)
+    else:
+        sys.stdout.write(text + "\n")
+    spans = sum(1 for e in trace["traceEvents"] if e["ph"] == "B")
+    print("%d spans" % spans, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()